@@ -11,8 +11,8 @@
 // with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
 //==================================================================================================
 
-#include "random.h"
-#include "ray.h"
+#include "../common/random.h"
+#include "../common/ray.h"
 
 
 vec3 random_in_unit_disk() {
@@ -11,7 +11,8 @@
 // with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
 //==================================================================================================
 
-#include "ray.h"
+#include "../common/ray.h"
+#include "../common/ray_offset.h"
 
 
 class material;
@@ -20,12 +21,19 @@ struct hit_record
 {
     float t;
     vec3 p;
+    float p_error;     // bound on the rounding error in each coordinate of p
     vec3 normal;
     material *mat_ptr;
 };
 
+// A ray from the surface point of rec in direction dir.
+inline ray spawn_ray(const hit_record& rec, const vec3& dir) {
+    return ray(offset_ray_origin(rec.p, rec.p_error, rec.normal, dir), dir);
+}
+
 class hittable  {
     public:
+        virtual ~hittable() {}
         virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const = 0;
 };
 
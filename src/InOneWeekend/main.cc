@@ -9,23 +9,43 @@
 // with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
 //==================================================================================================
 
+#include "../common/arena.h"
+#include "../common/framebuffer.h"
+#include "../common/random.h"
+#include "../common/roulette.h"
+#include "../common/tile_scheduler.h"
 #include "camera.h"
 #include "hittable_list.h"
 #include "material.h"
-#include "random.h"
 #include "sphere.h"
+#include "sphere_set.h"
 
 #include <float.h>
 #include <iostream>
+#include <stdlib.h>
+#include <string.h>
 
 
-vec3 color(const ray& r, hittable *world, int depth) {
+// Past this many bounces paths go through Russian roulette; -1 turns it off.
+int roulette_depth = 3;
+
+// throughput is what the radiance r brings back will be scaled by, roulette included.
+vec3 color(const ray& r, hittable *world, int depth, const vec3& throughput) {
     hit_record rec;
-    if (world->hit(r, 0.001, MAXFLOAT, rec)) {
+    random_begin_bounce(depth+1);
+    if (world->hit(r, 0, MAXFLOAT, rec)) {
         ray scattered;
         vec3 attenuation;
         if (depth < 50 && rec.mat_ptr->scatter(r, rec, attenuation, scattered)) {
-             return attenuation*color(scattered, world, depth+1);
+             vec3 next = throughput*attenuation;
+             float q = roulette_survival(depth, roulette_depth, next[0], next[1], next[2]);
+             if (q < 1) {
+                 if (random_double() >= q)
+                     return vec3(0,0,0);
+                 attenuation /= q;
+                 next /= q;
+             }
+             return attenuation*color(scattered, world, depth+1, next);
         }
         else {
             return vec3(0,0,0);
@@ -39,10 +59,10 @@ vec3 color(const ray& r, hittable *world, int depth) {
 }
 
 
-hittable *random_scene() {
+hittable_list *random_scene(arena& scene) {
     int n = 500;
-    hittable **list = new hittable*[n+1];
-    list[0] =  new sphere(vec3(0,-1000,0), 1000, new lambertian(vec3(0.5, 0.5, 0.5)));
+    hittable **list = scene.make_array<hittable*>(n+1);
+    list[0] =  scene.make<sphere>(vec3(0,-1000,0), 1000, scene.make<lambertian>(vec3(0.5, 0.5, 0.5)));
     int i = 1;
     for (int a = -11; a < 11; a++) {
         for (int b = -11; b < 11; b++) {
@@ -50,43 +70,85 @@ hittable *random_scene() {
             vec3 center(a+0.9*random_double(),0.2,b+0.9*random_double());
             if ((center-vec3(4,0.2,0)).length() > 0.9) {
                 if (choose_mat < 0.8) {  // diffuse
-                    list[i++] = new sphere(
+                    list[i++] = scene.make<sphere>(
                         center, 0.2,
-                        new lambertian(vec3(random_double()*random_double(),
+                        scene.make<lambertian>(vec3(random_double()*random_double(),
                                             random_double()*random_double(),
                                             random_double()*random_double()))
                     );
                 }
                 else if (choose_mat < 0.95) { // metal
-                    list[i++] = new sphere(
+                    list[i++] = scene.make<sphere>(
                         center, 0.2,
-                        new metal(vec3(0.5*(1 + random_double()),
+                        scene.make<metal>(vec3(0.5*(1 + random_double()),
                                        0.5*(1 + random_double()),
                                        0.5*(1 + random_double())),
                                   0.5*random_double())
                     );
                 }
                 else {  // glass
-                    list[i++] = new sphere(center, 0.2, new dielectric(1.5));
+                    list[i++] = scene.make<sphere>(center, 0.2, scene.make<dielectric>(1.5));
                 }
             }
         }
     }
 
-    list[i++] = new sphere(vec3(0, 1, 0), 1.0, new dielectric(1.5));
-    list[i++] = new sphere(vec3(-4, 1, 0), 1.0, new lambertian(vec3(0.4, 0.2, 0.1)));
-    list[i++] = new sphere(vec3(4, 1, 0), 1.0, new metal(vec3(0.7, 0.6, 0.5), 0.0));
+    list[i++] = scene.make<sphere>(vec3(0, 1, 0), 1.0, scene.make<dielectric>(1.5));
+    list[i++] = scene.make<sphere>(vec3(-4, 1, 0), 1.0, scene.make<lambertian>(vec3(0.4, 0.2, 0.1)));
+    list[i++] = scene.make<sphere>(vec3(4, 1, 0), 1.0, scene.make<metal>(vec3(0.7, 0.6, 0.5), 0.0));
 
-    return new hittable_list(list,i);
+    return scene.make<hittable_list>(list,i);
 }
 
+// The same spheres, in the same order, as one sphere_set.
+hittable *pack_spheres(arena& scene, const hittable_list *spheres) {
+    sphere_set *packed = scene.make<sphere_set>();
+    for (int i = 0; i < spheres->list_size; i++) {
+        const sphere *s = static_cast<const sphere*>(spheres->list[i]);
+        packed->add(s->center, s->radius, s->mat_ptr);
+    }
+    return packed;
+}
 
-int main() {
+
+int main(int argc, char **argv) {
     int nx = 1200;
     int ny = 800;
     int ns = 10;
-    std::cout << "P3\n" << nx << " " << ny << "\n255\n";
-    hittable *world = random_scene();
+    int nthreads = default_thread_count();
+    int tile_size = 16;
+    unsigned int seed = 0;
+    const char *out_path = 0;
+    bool packed = true;
+    for (int a = 1; a < argc; a++) {
+        if (!strcmp(argv[a], "-t") && a+1 < argc)
+            nthreads = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "-tile") && a+1 < argc)
+            tile_size = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "-seed") && a+1 < argc)
+            seed = strtoul(argv[++a], 0, 10);
+        else if (!strcmp(argv[a], "-o") && a+1 < argc)
+            out_path = argv[++a];
+        else if (!strcmp(argv[a], "-spheres") && a+1 < argc)
+            packed = strcmp(argv[++a], "list") != 0;
+        else if (!strcmp(argv[a], "-roulette") && a+1 < argc) {
+            a++;
+            roulette_depth = strcmp(argv[a], "off") ? atoi(argv[a]) : -1;
+        }
+        else {
+            std::cerr << "usage: " << argv[0] << " [-t threads] [-tile size] [-seed n] [-o image.ppm|pfm|exr]\n"
+                      << "    [-roulette off|min-depth] [-spheres set|list]\n";
+            return 1;
+        }
+    }
+    // Check the output format up front rather than after the render.
+    if (out_path && (image_format_for_path(out_path) == image_unknown || image_format_for_path(out_path) == image_png)) {
+        std::cerr << "unsupported image format: " << out_path << "\n";
+        return 1;
+    }
+    arena scene_arena;
+    hittable_list *spheres = random_scene(scene_arena);
+    hittable *world = packed ? pack_spheres(scene_arena, spheres) : spheres;
 
     vec3 lookfrom(13,2,3);
     vec3 lookat(0,0,0);
@@ -95,21 +157,28 @@ int main() {
 
     camera cam(lookfrom, lookat, vec3(0,1,0), 20, float(nx)/float(ny), aperture, dist_to_focus);
 
-    for (int j = ny-1; j >= 0; j--) {
-        for (int i = 0; i < nx; i++) {
-            vec3 col(0, 0, 0);
-            for (int s=0; s < ns; s++) {
-                float u = float(i + random_double()) / float(nx);
-                float v = float(j + random_double()) / float(ny);
-                ray r = cam.get_ray(u, v);
-                col += color(r, world,0);
+    framebuffer fb(nx, ny);
+    tile_scheduler scheduler(nx, ny, tile_size, nthreads);
+    scheduler.run([&](const tile& t) {
+        for (int j = t.y1-1; j >= t.y0; j--) {
+            for (int i = t.x0; i < t.x1; i++) {
+                vec3 col(0, 0, 0);
+                for (int s=0; s < ns; s++) {
+                    random_begin_sample(seed, j*nx + i, s);
+                    float u = float(i+random_double())/ float(nx);
+                    float v = float(j+random_double())/ float(ny);
+                    ray r = cam.get_ray(u, v);
+                    col += color(r, world, 0, vec3(1,1,1));
+                }
+                col /= float(ns);
+                fb.set(i, j, col[0], col[1], col[2]);
             }
-            col /= float(ns);
-            col = vec3( sqrt(col[0]), sqrt(col[1]), sqrt(col[2]) );
-            int ir = int(255.99*col[0]);
-            int ig = int(255.99*col[1]);
-            int ib = int(255.99*col[2]);
-            std::cout << ir << " " << ig << " " << ib << "\n";
         }
+    });
+    if (!out_path)
+        write_ppm_p3(std::cout, fb);
+    else if (!write_image(out_path, image_format_for_path(out_path), fb)) {
+        std::cerr << "could not write " << out_path << "\n";
+        return 1;
     }
 }
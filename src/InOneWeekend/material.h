@@ -11,9 +11,9 @@
 // with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
 //==================================================================================================
 
+#include "../common/random.h"
+#include "../common/ray.h"
 #include "hittable.h"
-#include "random.h"
-#include "ray.h"
 
 
 struct hit_record;
@@ -55,6 +55,7 @@ vec3 random_in_unit_sphere() {
 
 class material  {
     public:
+        virtual ~material() {}
         virtual bool scatter(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered) const = 0;
 };
 
@@ -64,7 +65,7 @@ class lambertian : public material {
         lambertian(const vec3& a) : albedo(a) {}
         virtual bool scatter(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered) const  {
              vec3 target = rec.p + rec.normal + random_in_unit_sphere();
-             scattered = ray(rec.p, target-rec.p);
+             scattered = spawn_ray(rec, target-rec.p);
              attenuation = albedo;
              return true;
         }
@@ -78,7 +79,7 @@ class metal : public material {
         metal(const vec3& a, float f) : albedo(a) { if (f < 1) fuzz = f; else fuzz = 1; }
         virtual bool scatter(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered) const  {
             vec3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);
-            scattered = ray(rec.p, reflected + fuzz*random_in_unit_sphere());
+            scattered = spawn_ray(rec, reflected + fuzz*random_in_unit_sphere());
             attenuation = albedo;
             return (dot(scattered.direction(), rec.normal) > 0);
         }
@@ -115,9 +116,9 @@ class dielectric : public material {
              else
                 reflect_prob = 1.0;
              if (random_double() < reflect_prob)
-                scattered = ray(rec.p, reflected);
+                scattered = spawn_ray(rec, reflected);
              else
-                scattered = ray(rec.p, refracted);
+                scattered = spawn_ray(rec, refracted);
              return true;
         }
 
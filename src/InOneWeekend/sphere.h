@@ -36,6 +36,7 @@ bool sphere::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
         if (temp < t_max && temp > t_min) {
             rec.t = temp;
             rec.p = r.point_at_parameter(rec.t);
+            rec.p_error = reproject_to_sphere(rec.p, center, radius);
             rec.normal = (rec.p - center) / radius;
             rec.mat_ptr = mat_ptr;
             return true;
@@ -44,6 +45,7 @@ bool sphere::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
         if (temp < t_max && temp > t_min) {
             rec.t = temp;
             rec.p = r.point_at_parameter(rec.t);
+            rec.p_error = reproject_to_sphere(rec.p, center, radius);
             rec.normal = (rec.p - center) / radius;
             rec.mat_ptr = mat_ptr;
             return true;
@@ -11,17 +11,45 @@
 // with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
 //==================================================================================================
 
-#include "hittable.h"
+#include "../common/hittable.h"
 
 
+// Hit test shared by the three rect orientations: the plane is at coordinate k along axis k_axis,
+// and the rect spans [a0,a1] x [b0,b1] along the other two. t is where r crosses the plane, and
+// is only set when the rect is hit.
+inline bool aarect_crossing(const ray& r, float t0, float t1, int a_axis, int b_axis, int k_axis,
+                            float a0, float a1, float b0, float b1, float k, float& t) {
+    float s = (k-r.origin()[k_axis]) / r.direction()[k_axis];
+    if (s < t0 || s > t1)
+        return false;
+    float a = r.origin()[a_axis] + s*r.direction()[a_axis];
+    float b = r.origin()[b_axis] + s*r.direction()[b_axis];
+    if (a < a0 || a > a1 || b < b0 || b > b1)
+        return false;
+    t = s;
+    return true;
+}
+
 class xy_rect: public hittable  {
     public:
         xy_rect() {}
         xy_rect(float _x0, float _x1, float _y0, float _y1, float _k, material *mat) : x0(_x0), x1(_x1), y0(_y0), y1(_y1), k(_k), mp(mat) {};
         virtual bool hit(const ray& r, float t0, float t1, hit_record& rec) const;
         virtual bool bounding_box(float t0, float t1, aabb& box) const {
-               box =  aabb(vec3(x0,y0, k-0.0001), vec3(x1, y1, k+0.0001));
+               float pad = flat_box_pad(k, x1 - x0, y1 - y0);
+               box = aabb(vec3(x0,y0, k - pad), vec3(x1, y1, k + pad));
                return true; }
+        virtual bool occluded(const ray& r, float t0, float t1) const {
+            float t;
+            return aarect_crossing(r, t0, t1, 0, 1, 2, x0, x1, y0, y1, k, t);
+        }
+        virtual bool intersect(const ray& r, float t0, float t1, hit_record& rec) const {
+            if (!aarect_crossing(r, t0, t1, 0, 1, 2, x0, x1, y0, y1, k, rec.t))
+                return false;
+            rec.prim = this;
+            return true;
+        }
+        virtual void finalize(const ray& r, hit_record& rec) const;
         material  *mp;
         float x0, x1, y0, y1, k;
 };
@@ -32,8 +60,20 @@ class xz_rect: public hittable  {
         xz_rect(float _x0, float _x1, float _z0, float _z1, float _k, material *mat) : x0(_x0), x1(_x1), z0(_z0), z1(_z1), k(_k), mp(mat) {};
         virtual bool hit(const ray& r, float t0, float t1, hit_record& rec) const;
         virtual bool bounding_box(float t0, float t1, aabb& box) const {
-               box =  aabb(vec3(x0,k-0.0001,z0), vec3(x1, k+0.0001, z1));
+               float pad = flat_box_pad(k, x1 - x0, z1 - z0);
+               box = aabb(vec3(x0,k - pad,z0), vec3(x1, k + pad, z1));
                return true; }
+        virtual bool occluded(const ray& r, float t0, float t1) const {
+            float t;
+            return aarect_crossing(r, t0, t1, 0, 2, 1, x0, x1, z0, z1, k, t);
+        }
+        virtual bool intersect(const ray& r, float t0, float t1, hit_record& rec) const {
+            if (!aarect_crossing(r, t0, t1, 0, 2, 1, x0, x1, z0, z1, k, rec.t))
+                return false;
+            rec.prim = this;
+            return true;
+        }
+        virtual void finalize(const ray& r, hit_record& rec) const;
         material  *mp;
         float x0, x1, z0, z1, k;
 };
@@ -44,8 +84,20 @@ class yz_rect: public hittable  {
         yz_rect(float _y0, float _y1, float _z0, float _z1, float _k, material *mat) : y0(_y0), y1(_y1), z0(_z0), z1(_z1), k(_k), mp(mat) {};
         virtual bool hit(const ray& r, float t0, float t1, hit_record& rec) const;
         virtual bool bounding_box(float t0, float t1, aabb& box) const {
-               box =  aabb(vec3(k-0.0001, y0, z0), vec3(k+0.0001, y1, z1));
+               float pad = flat_box_pad(k, y1 - y0, z1 - z0);
+               box = aabb(vec3(k - pad, y0, z0), vec3(k + pad, y1, z1));
                return true; }
+        virtual bool occluded(const ray& r, float t0, float t1) const {
+            float t;
+            return aarect_crossing(r, t0, t1, 1, 2, 0, y0, y1, z0, z1, k, t);
+        }
+        virtual bool intersect(const ray& r, float t0, float t1, hit_record& rec) const {
+            if (!aarect_crossing(r, t0, t1, 1, 2, 0, y0, y1, z0, z1, k, rec.t))
+                return false;
+            rec.prim = this;
+            return true;
+        }
+        virtual void finalize(const ray& r, hit_record& rec) const;
         material  *mp;
         float y0, y1, z0, z1, k;
 };
@@ -53,55 +105,60 @@ class yz_rect: public hittable  {
 
 
 
-bool xy_rect::hit(const ray& r, float t0, float t1, hit_record& rec) const {
-    float t = (k-r.origin().z()) / r.direction().z();
-    if (t < t0 || t > t1)
-        return false;
-    float x = r.origin().x() + t*r.direction().x();
-    float y = r.origin().y() + t*r.direction().y();
-    if (x < x0 || x > x1 || y < y0 || y > y1) 
-        return false;
+void xy_rect::finalize(const ray& r, hit_record& rec) const {
+    float x = r.origin().x() + rec.t*r.direction().x();
+    float y = r.origin().y() + rec.t*r.direction().y();
     rec.u = (x-x0)/(x1-x0);
-    rec.v = (y-y0)/(y1-y0); 
-    rec.t = t;
+    rec.v = (y-y0)/(y1-y0);
     rec.mat_ptr = mp;
-    rec.p = r.point_at_parameter(t);
+    // The point goes on the plane exactly rather than where the rounded ray puts it, so that
+    // its error is all along the plane.
+    rec.p = vec3(x, y, k);
+    rec.p_error = point_error(max_abs(rec.p));
     rec.normal = vec3(0, 0, 1);
+}
+
+bool xy_rect::hit(const ray& r, float t0, float t1, hit_record& rec) const {
+    if (!intersect(r, t0, t1, rec))
+        return false;
+    finalize(r, rec);
     return true;
 }
 
 
-bool xz_rect::hit(const ray& r, float t0, float t1, hit_record& rec) const {
-    float t = (k-r.origin().y()) / r.direction().y();
-    if (t < t0 || t > t1)
-        return false;
-    float x = r.origin().x() + t*r.direction().x();
-    float z = r.origin().z() + t*r.direction().z();
-    if (x < x0 || x > x1 || z < z0 || z > z1) 
-        return false;
+void xz_rect::finalize(const ray& r, hit_record& rec) const {
+    float x = r.origin().x() + rec.t*r.direction().x();
+    float z = r.origin().z() + rec.t*r.direction().z();
     rec.u = (x-x0)/(x1-x0);
-    rec.v = (z-z0)/(z1-z0); 
-    rec.t = t;
+    rec.v = (z-z0)/(z1-z0);
     rec.mat_ptr = mp;
-    rec.p = r.point_at_parameter(t);
+    rec.p = vec3(x, k, z);
+    rec.p_error = point_error(max_abs(rec.p));
     rec.normal = vec3(0, 1, 0);
-    return true;
 }
 
-bool yz_rect::hit(const ray& r, float t0, float t1, hit_record& rec) const {
-    float t = (k-r.origin().x()) / r.direction().x();
-    if (t < t0 || t > t1)
-        return false;
-    float y = r.origin().y() + t*r.direction().y();
-    float z = r.origin().z() + t*r.direction().z();
-    if (y < y0 || y > y1 || z < z0 || z > z1) 
+bool xz_rect::hit(const ray& r, float t0, float t1, hit_record& rec) const {
+    if (!intersect(r, t0, t1, rec))
         return false;
+    finalize(r, rec);
+    return true;
+}
+
+void yz_rect::finalize(const ray& r, hit_record& rec) const {
+    float y = r.origin().y() + rec.t*r.direction().y();
+    float z = r.origin().z() + rec.t*r.direction().z();
     rec.u = (y-y0)/(y1-y0);
-    rec.v = (z-z0)/(z1-z0); 
-    rec.t = t;
+    rec.v = (z-z0)/(z1-z0);
     rec.mat_ptr = mp;
-    rec.p = r.point_at_parameter(t);
+    rec.p = vec3(k, y, z);
+    rec.p_error = point_error(max_abs(rec.p));
     rec.normal = vec3(1, 0, 0);
+}
+
+bool yz_rect::hit(const ray& r, float t0, float t1, hit_record& rec) const {
+    if (!intersect(r, t0, t1, rec))
+        return false;
+    finalize(r, rec);
     return true;
 }
 
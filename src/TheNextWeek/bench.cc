@@ -0,0 +1,364 @@
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include "../common/bench.h"
+#include "../common/ray_sort.h"
+#include "scenes.h"
+#define STB_IMAGE_IMPLEMENTATION
+#include "../common/stb_image.h"
+
+#include <iostream>
+#include <mutex>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+
+// Benchmarks of the renderer: the intersection and shading kernels one call at a time, a second
+// bounce's rays in the order they were made and sorted, and full frames of every built-in scene.
+// Run it from the images directory, so that earth finds its texture. -filter name runs only the
+// benchmarks whose names contain name.
+
+// Inputs are drawn once, up front, and cycled through, so the timings leave out making them.
+const int bench_inputs = 4096;
+
+// Rays from points a distance spread from the origin towards points within aim of it.
+std::vector<ray> bench_rays(float spread, float aim) {
+    std::vector<ray> rays;
+    for (int i = 0; i < bench_inputs; i++) {
+        vec3 from = spread * unit_vector(random_in_unit_sphere());
+        vec3 to = aim * random_in_unit_sphere();
+        rays.push_back(ray(from, to - from, random_double()));
+    }
+    return rays;
+}
+
+std::vector<vec3> bench_points(float size) {
+    std::vector<vec3> points;
+    for (int i = 0; i < bench_inputs; i++)
+        points.push_back(size * random_in_unit_sphere());
+    return points;
+}
+
+template <typename T> double bench_hit(const T& shape, const std::vector<ray>& rays, long long i) {
+    hit_record rec;
+    bench_keep(shape.hit(rays[i % bench_inputs], 0.001, FLT_MAX, rec));
+    return 1;
+}
+
+
+// Rays traced through a world, counted per thread and folded into the total when the thread
+// exits, as render_stats.h counts under RT_STATS.
+inline long long& bench_ray_total() {
+    static long long total = 0;
+    return total;
+}
+
+struct bench_thread_rays {
+    long long count;
+    bench_thread_rays() : count(0) {}
+    ~bench_thread_rays() { flush(); }
+    void flush() {
+        static std::mutex m;
+        std::lock_guard<std::mutex> lock(m);
+        bench_ray_total() += count;
+        count = 0;
+    }
+};
+
+inline bench_thread_rays& bench_rays_traced() {
+    static thread_local bench_thread_rays c;
+    return c;
+}
+
+// Counts the rays traced through world; color() traces each one with a single hit().
+class counted_world : public hittable {
+    public:
+        counted_world(hittable *w) : world(w) {}
+        virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+            bench_rays_traced().count++;
+            return world->hit(r, t_min, t_max, rec);
+        }
+        virtual bool bounding_box(float t0, float t1, aabb& box) const {
+            return world->bounding_box(t0, t1, box);
+        }
+        hittable *world;
+};
+
+
+void bench_kernels(bench_runner& runner) {
+    material *m = new lambertian(new constant_texture(vec3(0.5, 0.5, 0.5)));
+
+    std::vector<ray> rays = bench_rays(4, 1.5);
+    sphere s(vec3(0, 0, 0), 1, m);
+    runner.run("sphere::hit", [&](long long i) { return bench_hit(s, rays, i); });
+
+    aabb unit_box(vec3(-1, -1, -1), vec3(1, 1, 1));
+    runner.run("aabb::hit", [&](long long i) {
+        bench_keep(unit_box.hit(rays[i % bench_inputs], 0.001, FLT_MAX));
+        return 1.0;
+    });
+
+    xz_rect rect(-1, 1, -1, 1, 0, m);
+    runner.run("xz_rect::hit", [&](long long i) { return bench_hit(rect, rays, i); });
+
+    box b(vec3(-1, -1, -1), vec3(1, 1, 1), m);
+    runner.run("box::hit", [&](long long i) { return bench_hit(b, rays, i); });
+
+    // Ten thousand small spheres filling a ball, hit by rays from well outside it.
+    int n = 10000;
+    std::vector<hittable*> spheres;
+    for (int k = 0; k < n; k++)
+        spheres.push_back(new sphere(10 * random_in_unit_sphere(), 0.2, m));
+    std::vector<ray> far_rays = bench_rays(30, 10);
+    if (runner.selected("bvh_node::hit")) {
+        bvh_node tree(&spheres[0], n, 0, 1, bvh_split_sah);
+        runner.run("bvh_node::hit", [&](long long i) { return bench_hit(tree, far_rays, i); });
+    }
+    if (runner.selected("bvh4::hit")) {
+        bvh4 tree(&spheres[0], n, 0, 1);
+        runner.run("bvh4::hit", [&](long long i) { return bench_hit(tree, far_rays, i); });
+    }
+    if (runner.selected("compressed_bvh::hit")) {
+        compressed_bvh tree(&spheres[0], n, 0, 1);
+        runner.run("compressed_bvh::hit", [&](long long i) { return bench_hit(tree, far_rays, i); });
+    }
+    for (int k = 0; k < n; k++)
+        delete spheres[k];
+
+    // A ball of 320000 triangles paged within a budget of about a tenth of it, hit by the same
+    // rays one at a time and then all of them in one batch.
+    if (runner.selected("paged_mesh::hit") || runner.selected("paged_mesh::hit_batch")) {
+        mesh_data ball;
+        int rings = 400, segments = 400;
+        for (int j = 0; j <= rings; j++) {
+            for (int k = 0; k < segments; k++) {
+                float theta = M_PI * j / rings, phi = 2 * M_PI * k / segments;
+                ball.positions.push_back(10 * sin(theta) * cos(phi));
+                ball.positions.push_back(10 * cos(theta));
+                ball.positions.push_back(10 * sin(theta) * sin(phi));
+            }
+        }
+        for (int j = 0; j < rings; j++) {
+            for (int k = 0; k < segments; k++) {
+                uint32_t a = j*segments + k, b = j*segments + (k+1) % segments;
+                uint32_t quad[6] = { a, b, a + segments, b, b + segments, a + segments };
+                ball.indices.insert(ball.indices.end(), quad, quad + 6);
+            }
+        }
+        paged_mesh paged(std::move(ball), m, size_t(1) << 20);
+        runner.run("paged_mesh::hit", [&](long long i) { return bench_hit(paged, far_rays, i); });
+        std::vector<float> t_max(bench_inputs);
+        std::vector<hit_record> recs(bench_inputs);
+        bool hits[bench_inputs];
+        runner.run("paged_mesh::hit_batch", [&](long long i) {
+            for (int k = 0; k < bench_inputs; k++)
+                t_max[k] = FLT_MAX;
+            bench_keep(paged.hit_batch(&far_rays[0], bench_inputs, 0.001, &t_max[0], &recs[0],
+                                       hits));
+            return double(bench_inputs);
+        });
+    }
+
+    std::vector<vec3> points = bench_points(10);
+    perlin noise;
+    runner.run("perlin::turb", [&](long long i) {
+        bench_keep(noise.turb(points[i % bench_inputs]));
+        return 0.0;
+    });
+
+    // A generated 1024x512 image, so the benchmark does not depend on a file.
+    int tx = 1024, ty = 512;
+    std::vector<unsigned char> texels(3*tx*ty);
+    for (size_t k = 0; k < texels.size(); k++)
+        texels[k] = (unsigned char)(256 * random_double());
+    image_texture image(&texels[0], tx, ty, float(M_PI));
+    runner.run("image_texture::value", [&](long long i) {
+        const vec3& p = points[i % bench_inputs];
+        bench_keep(image.value(0.5f + 0.05f*p.x(), 0.5f + 0.05f*p.y(), p)[0]);
+        return 0.0;
+    });
+    runner.run("image_texture::value/footprint", [&](long long i) {
+        const vec3& p = points[i % bench_inputs];
+        bench_keep(image.value(0.5f + 0.05f*p.x(), 0.5f + 0.05f*p.y(), p, 0.01f)[0]);
+        return 0.0;
+    });
+
+    delete m;
+}
+
+// A second bounce as a wavefront traces it: a camera ray for each sample of each pixel, scattered
+// once off whatever it hits. One iteration traces all of those rays, one at a time and then as
+// packets, first in the order they were made and then sorted by ray_sort.h in runs of sort_batch.
+// The sort itself is timed on its own. The cache misses of one pass in each order follow, where
+// the machine can count them. The rays stay on one thread, so that the misses are all theirs.
+void bench_secondary(bench_runner& runner, int nx, int ny, int ns, int sort_batch) {
+    const char *names[2] = { "cornell_smoke", "final" };
+    const char *labels[2] = { "smoke", "final" };
+    for (int n = 0; n < 2; n++) {
+        int k = 0;
+        while (k < nscenes && strcmp(scenes[k].name, names[n]))
+            k++;
+        std::string name = std::string("secondary/") + labels[n];
+        if (k == nscenes || !runner.selected(name.c_str()))
+            continue;
+        arena scene_arena;
+        hittable *world = scenes[k].build(scene_arena);
+        camera cam = scene_camera(scenes[k], nx, ny);
+        std::vector<ray> rays;
+        for (int j = 0; j < ny; j++) {
+            for (int i = 0; i < nx; i++) {
+                for (int s = 0; s < ns; s++) {
+                    ray r = cam.get_ray(float(i + random_double()) / nx,
+                                        float(j + random_double()) / ny);
+                    hit_record rec;
+                    vec3 attenuation;
+                    ray scattered;
+                    if (world->hit(r, 0, FLT_MAX, rec)
+                        && rec.mat_ptr->scatter(r, rec, attenuation, scattered))
+                        rays.push_back(scattered);
+                }
+            }
+        }
+        aabb bounds;
+        world->bounding_box(0, 1, bounds);
+        std::vector<int> order(rays.size()), in_order(rays.size()), in_sorted_order;
+        std::vector<std::pair<uint64_t, int> > keys;
+        for (size_t r = 0; r < rays.size(); r++)
+            in_order[r] = int(r);
+        auto sort = [&]() {
+            order = in_order;
+            sort_ray_batches(order, sort_batch, bounds,
+                             [&rays](int r) -> const ray& { return rays[r]; }, keys);
+        };
+        sort();
+        in_sorted_order = order;
+        std::vector<float> t_max(ray_packet_size);
+        hit_record recs[ray_packet_size];
+        auto trace = [&](bool packets) {
+            if (!packets) {
+                for (size_t r = 0; r < order.size(); r++) {
+                    hit_record rec;
+                    bench_keep(world->hit(rays[order[r]], 0, FLT_MAX, rec));
+                }
+                return double(order.size());
+            }
+            for (size_t b = 0; b < order.size(); b += ray_packet_size) {
+                ray_packet packet;
+                packet.count = int(order.size() - b < size_t(ray_packet_size) ? order.size() - b
+                                                                               : ray_packet_size);
+                for (int r = 0; r < packet.count; r++) {
+                    packet.set(r, rays[order[b+r]]);
+                    t_max[r] = FLT_MAX;
+                }
+                packet.pad(&t_max[0]);
+                bench_keep(world->hit_packet(packet, (1 << packet.count) - 1, 0, &t_max[0],
+                                             recs));
+            }
+            return double(order.size());
+        };
+        for (int packets = 0; packets < 2; packets++) {
+            std::string kind = name + (packets ? " packets" : "");
+            order = in_order;
+            runner.run(kind.c_str(), [&](long long) { return trace(packets != 0); });
+            order = in_sorted_order;
+            runner.run((kind + " sorted").c_str(), [&](long long) { return trace(packets != 0); });
+        }
+        runner.run((name + " sort").c_str(), [&](long long) {
+            sort();
+            return double(rays.size());
+        });
+        cache_miss_counter misses;
+        if (misses.available()) {
+            long long counted[2];
+            for (int sorted = 0; sorted < 2; sorted++) {
+                order = sorted ? in_sorted_order : in_order;
+                misses.start();
+                trace(false);
+                counted[sorted] = misses.stop();
+            }
+            std::cout << name << ": cache misses per ray " << double(counted[0]) / rays.size()
+                      << " in order, " << double(counted[1]) / rays.size() << " sorted\n";
+        }
+        scene_bvhs.clear();
+        scene_paged_meshes.clear();
+    }
+}
+
+// One iteration renders the whole frame, and counts every ray it traced.
+void bench_scenes(bench_runner& runner, int nx, int ny, int ns, int tile_size) {
+    for (int k = 0; k < nscenes; k++) {
+        std::string name = std::string("render/") + scenes[k].name;
+        if (!runner.selected(name.c_str()) || (scenes[k].build == cornell_mesh && !mesh_path))
+            continue;
+        arena scene_arena;
+        hittable *world = scenes[k].build(scene_arena);
+        if (!world)
+            continue;
+        counted_world counted(world);
+        camera cam = scene_camera(scenes[k], nx, ny);
+        framebuffer fb(nx, ny);
+        tile_scheduler scheduler(nx, ny, tile_size, runner.threads);
+        runner.run(name.c_str(), [&](long long i) {
+            render(&counted, cam, ns, (unsigned int)i, scheduler, fb);
+            bench_rays_traced().flush();
+            long long rays = bench_ray_total();
+            bench_ray_total() = 0;
+            return double(rays);
+        });
+        scene_bvhs.clear();
+        scene_paged_meshes.clear();
+    }
+}
+
+int main(int argc, char **argv) {
+    int nx = 100;
+    int ny = 100;
+    int ns = 4;
+    int tile_size = 16;
+    int sort_batch = 4096;
+    double min_time = 0.5;
+    const char *filter = 0;
+    int nthreads = default_thread_count();
+    for (int a = 1; a < argc; a++) {
+        if (!strcmp(argv[a], "-t") && a+1 < argc)
+            nthreads = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "-filter") && a+1 < argc)
+            filter = argv[++a];
+        else if (!strcmp(argv[a], "-min-time") && a+1 < argc)
+            min_time = atof(argv[++a]);
+        else if (!strcmp(argv[a], "-nx") && a+1 < argc)
+            nx = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "-ny") && a+1 < argc)
+            ny = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "-ns") && a+1 < argc)
+            ns = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "-ray-sort") && a+1 < argc)
+            sort_batch = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "-mesh") && a+1 < argc)
+            mesh_path = argv[++a];
+        else if (!strcmp(argv[a], "-mesh-cache") && a+1 < argc)
+            mesh_cache_bytes = size_t(atof(argv[++a]) * (1 << 20));
+        else {
+            std::cerr << "usage: " << argv[0] << " [-filter name] [-min-time seconds] [-t threads]"
+                      << " [-nx width] [-ny height] [-ns samples] [-ray-sort batch]"
+                      << " [-mesh file.obj|ply [-mesh-cache MB]]\n";
+            return 1;
+        }
+    }
+    random_seed(1, 0);
+    // The kernels run on one thread; the renders on all of them.
+    bench_runner runner(min_time, filter, 1);
+    bench_kernels(runner);
+    bench_secondary(runner, nx, ny, ns, sort_batch);
+    runner.threads = nthreads;
+    bench_scenes(runner, nx, ny, ns, tile_size);
+}
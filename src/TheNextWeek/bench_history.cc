@@ -0,0 +1,389 @@
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include "../common/framebuffer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <ctype.h>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <math.h>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+#ifndef _WIN32
+#include <spawn.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+extern char **environ;
+#endif
+
+
+// Tracks the renderer's speed from one version to the next. Each run renders the canonical scenes
+// with a build of main.cc that has RT_STATS defined, at a fixed size, sample count and seed, and
+// appends a line of JSON for each scene to a history file: the rays traced, the wall time of the
+// whole run, scene build and output included, rays per second over that time, the renderer's peak
+// resident memory, and the RMSE of the image against a reference render of the same settings.
+// The RMSE is taken on the gamma-2 values clamped to [0,1] that the 8-bit outputs hold; renders
+// are deterministic for a given seed, so it is 0 until a change alters the image. Each scene is
+// rendered a few times and the fastest kept, as the least disturbed by the rest of the machine.
+//
+// A scene has regressed when its rays per second fall more than the threshold below the median of
+// its last few runs with the same settings; then the run exits with status 1, so a build or CI
+// step that runs it fails. Regressed runs are kept in the history but left out of later medians.
+// Run it from the images directory, so that the scenes find their textures. The CMake target
+// bench does this.
+//
+// Usage: bench_history -renderer path [-history file] [-references dir] [-threshold fraction]
+//                      [-window runs] [-repeat n] [-scenes a,b,...] [-nx width] [-ny height]
+//                      [-ns samples] [-seed n] [-t threads] [-label text] [-update-references]
+
+// The settings a run's numbers depend on; runs are only compared with others that share them.
+struct bench_settings {
+    int nx, ny, ns;
+    unsigned int seed;
+    int threads;
+};
+
+struct scene_result {
+    std::string scene;
+    long long rays;
+    double wall_seconds;
+    long long peak_rss_kb;
+    double rmse;            // negative when there was no reference to compare with
+    bool regressed;
+};
+
+
+// The number after "key": in a line of JSON, or fallback if the key is not there.
+double json_number(const std::string& line, const char *key, double fallback = 0) {
+    std::string k = std::string("\"") + key + "\":";
+    size_t at = line.find(k);
+    if (at == std::string::npos)
+        return fallback;
+    const char *p = line.c_str() + at + k.size();
+    char *end;
+    double v = strtod(p, &end);
+    return end == p ? fallback : v;
+}
+
+// The string after "key": in a line of JSON, without escapes, or "" if the key is not there.
+std::string json_string(const std::string& line, const char *key) {
+    std::string k = std::string("\"") + key + "\":";
+    size_t at = line.find(k);
+    if (at == std::string::npos)
+        return "";
+    size_t open = line.find('"', at + k.size());
+    size_t close = open == std::string::npos ? open : line.find('"', open + 1);
+    return close == std::string::npos ? "" : line.substr(open + 1, close - open - 1);
+}
+
+// Quotes s for JSON.
+std::string json_quote(const std::string& s) {
+    std::string q = "\"";
+    for (size_t i = 0; i < s.size(); i++) {
+        if (s[i] == '"' || s[i] == '\\')
+            q += '\\';
+        if ((unsigned char)s[i] >= 0x20)
+            q += s[i];
+    }
+    return q + "\"";
+}
+
+// The median rays per second of the last window runs of scene with settings s that did not
+// regress, or 0 if there are none.
+double history_baseline(const char *history_path, const std::string& scene,
+                        const bench_settings& s, int window) {
+    std::ifstream in(history_path);
+    std::vector<double> rates;
+    std::string line;
+    while (std::getline(in, line)) {
+        if (json_string(line, "scene") != scene || line.find("\"regressed\": true") != line.npos)
+            continue;
+        if (json_number(line, "nx") != s.nx || json_number(line, "ny") != s.ny
+                || json_number(line, "ns") != s.ns || json_number(line, "seed") != s.seed
+                || json_number(line, "threads") != s.threads)
+            continue;
+        rates.push_back(json_number(line, "rays_per_s"));
+    }
+    if (rates.empty())
+        return 0;
+    if (int(rates.size()) > window)
+        rates.erase(rates.begin(), rates.end() - window);
+    std::sort(rates.begin(), rates.end());
+    size_t n = rates.size();
+    return n % 2 ? rates[n/2] : 0.5 * (rates[n/2 - 1] + rates[n/2]);
+}
+
+// Root mean square difference of two images of the same size, on the display values.
+double display_rmse(const framebuffer& a, const framebuffer& b) {
+    double sum = 0;
+    for (size_t k = 0; k < a.pixels.size(); k++) {
+        float va = a.pixels[k] > 0 ? sqrtf(a.pixels[k]) : 0;
+        float vb = b.pixels[k] > 0 ? sqrtf(b.pixels[k]) : 0;
+        double d = double(va < 1 ? va : 1) - double(vb < 1 ? vb : 1);
+        sum += d * d;
+    }
+    return sqrt(sum / a.pixels.size());
+}
+
+bool copy_file(const std::string& from, const std::string& to) {
+    std::ifstream in(from.c_str(), std::ios::binary);
+    std::ofstream out(to.c_str(), std::ios::binary);
+    out << in.rdbuf();
+    return bool(in) && bool(out);
+}
+
+// The current commit, if the working directory is in a git checkout.
+std::string git_label() {
+#ifdef _WIN32
+    return "";
+#else
+    FILE *p = popen("git rev-parse --short HEAD 2>/dev/null", "r");
+    if (!p)
+        return "";
+    char buf[64] = { 0 };
+    if (!fgets(buf, sizeof(buf), p))
+        buf[0] = 0;
+    pclose(p);
+    std::string label(buf);
+    while (!label.empty() && isspace((unsigned char)label[label.size()-1]))
+        label.erase(label.size()-1);
+    return label;
+#endif
+}
+
+// Runs the command in args and waits for it. Gives its wall time and peak resident set in
+// kilobytes, and returns whether it exited with status 0.
+bool run_timed(const std::vector<std::string>& args, double& seconds, long long& peak_rss_kb) {
+#ifdef _WIN32
+    std::cerr << "bench_history is not supported on this platform\n";
+    return false;
+#else
+    std::vector<char*> argv;
+    for (size_t i = 0; i < args.size(); i++)
+        argv.push_back(const_cast<char*>(args[i].c_str()));
+    argv.push_back(0);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    pid_t pid;
+    if (posix_spawn(&pid, argv[0], 0, 0, &argv[0], environ) != 0) {
+        std::cerr << "could not run " << args[0] << "\n";
+        return false;
+    }
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) != pid)
+        return false;
+    seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+#ifdef __APPLE__
+    peak_rss_kb = usage.ru_maxrss / 1024;
+#else
+    peak_rss_kb = usage.ru_maxrss;
+#endif
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+#endif
+}
+
+// Renders scene with the renderer repeat times, keeping the fastest, and compares it with its
+// reference, making the render the reference if there is none yet or update is set.
+bool bench_scene(const char *renderer, const std::string& scene, const bench_settings& s,
+                 int repeat, const std::string& references, bool update, scene_result& result) {
+    std::ostringstream stem;
+    stem << references << "/" << scene << "_" << s.nx << "x" << s.ny << "_" << s.ns << "spp_seed"
+         << s.seed;
+    std::string image = stem.str() + ".last.pfm", stats = stem.str() + ".last.json";
+    std::string reference = stem.str() + ".pfm";
+    std::vector<std::string> args;
+    args.push_back(renderer);
+    args.push_back("-scene"); args.push_back(scene);
+    args.push_back("-nx"); args.push_back(std::to_string(s.nx));
+    args.push_back("-ny"); args.push_back(std::to_string(s.ny));
+    args.push_back("-ns"); args.push_back(std::to_string(s.ns));
+    args.push_back("-seed"); args.push_back(std::to_string(s.seed));
+    args.push_back("-t"); args.push_back(std::to_string(s.threads));
+    args.push_back("-o"); args.push_back(image);
+    args.push_back("-stats-json"); args.push_back(stats);
+
+    result.scene = scene;
+    for (int i = 0; i < repeat; i++) {
+        double seconds;
+        long long rss_kb;
+        if (!run_timed(args, seconds, rss_kb)) {
+            std::cerr << scene << ": the renderer failed\n";
+            return false;
+        }
+        if (i == 0 || seconds < result.wall_seconds)
+            result.wall_seconds = seconds;
+        if (i == 0 || rss_kb > result.peak_rss_kb)
+            result.peak_rss_kb = rss_kb;
+    }
+    std::ifstream in(stats.c_str());
+    std::string json((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    result.rays = (long long)json_number(json, "rays", -1);
+    if (result.rays < 0) {
+        std::cerr << scene << ": no ray count in " << stats << "\n";
+        return false;
+    }
+
+    framebuffer rendered(1, 1), expected(1, 1);
+    if (!read_pfm(image.c_str(), rendered)) {
+        std::cerr << scene << ": could not read " << image << "\n";
+        return false;
+    }
+    result.rmse = -1;
+    if (!update && read_pfm(reference.c_str(), expected)) {
+        if (expected.nx == rendered.nx && expected.ny == rendered.ny)
+            result.rmse = display_rmse(rendered, expected);
+        else
+            std::cerr << scene << ": " << reference << " is not " << s.nx << "x" << s.ny << "\n";
+    }
+    else if (!copy_file(image, reference))
+        std::cerr << scene << ": could not write " << reference << "\n";
+    return true;
+}
+
+// Splits a comma-separated list.
+std::vector<std::string> split_list(const char *s) {
+    std::vector<std::string> items;
+    std::stringstream in(s);
+    std::string item;
+    while (std::getline(in, item, ','))
+        if (!item.empty())
+            items.push_back(item);
+    return items;
+}
+
+int main(int argc, char **argv) {
+    const char *renderer = 0;
+    const char *history_path = "bench_history.jsonl";
+    std::string references = ".";
+    double threshold = 0.1;
+    int window = 5;
+    int repeat = 3;
+    std::vector<std::string> scenes;
+    scenes.push_back("random_scene");
+    scenes.push_back("cornell_box");
+    scenes.push_back("cornell_smoke");
+    scenes.push_back("final");
+    bench_settings s = { 200, 200, 64, 1, int(std::thread::hardware_concurrency()) };
+    std::string label;
+    bool update = false;
+    bool usage = false;
+    for (int a = 1; a < argc && !usage; a++) {
+        if (!strcmp(argv[a], "-renderer") && a+1 < argc)
+            renderer = argv[++a];
+        else if (!strcmp(argv[a], "-history") && a+1 < argc)
+            history_path = argv[++a];
+        else if (!strcmp(argv[a], "-references") && a+1 < argc)
+            references = argv[++a];
+        else if (!strcmp(argv[a], "-threshold") && a+1 < argc)
+            threshold = atof(argv[++a]);
+        else if (!strcmp(argv[a], "-window") && a+1 < argc)
+            window = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "-repeat") && a+1 < argc)
+            repeat = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "-scenes") && a+1 < argc)
+            scenes = split_list(argv[++a]);
+        else if (!strcmp(argv[a], "-nx") && a+1 < argc)
+            s.nx = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "-ny") && a+1 < argc)
+            s.ny = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "-ns") && a+1 < argc)
+            s.ns = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "-seed") && a+1 < argc)
+            s.seed = strtoul(argv[++a], 0, 10);
+        else if (!strcmp(argv[a], "-t") && a+1 < argc)
+            s.threads = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "-label") && a+1 < argc)
+            label = argv[++a];
+        else if (!strcmp(argv[a], "-update-references"))
+            update = true;
+        else
+            usage = true;
+    }
+    if (s.threads < 1)
+        s.threads = 1;
+    if (usage || !renderer || scenes.empty() || window < 1 || repeat < 1
+            || s.nx < 1 || s.ny < 1 || s.ns < 1) {
+        std::cerr << "usage: " << argv[0] << " -renderer path [-history file] [-references dir]"
+                  << " [-threshold fraction] [-window runs] [-repeat n] [-scenes a,b,...]"
+                  << " [-nx width] [-ny height] [-ns samples] [-seed n] [-t threads] [-label text]"
+                  << " [-update-references]\n";
+        return 1;
+    }
+    if (label.empty())
+        label = git_label();
+
+    char date[32];
+    time_t now = time(0);
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+
+    std::ofstream history(history_path, std::ios::app);
+    if (!history) {
+        std::cerr << "could not open " << history_path << "\n";
+        return 1;
+    }
+    history << std::setprecision(9);
+    std::cout << std::left << std::setw(16) << "scene" << std::right << std::setw(12) << "Mrays/s"
+              << std::setw(12) << "baseline" << std::setw(10) << "wall s" << std::setw(12)
+              << "peak MB" << std::setw(12) << "RMSE" << "\n";
+    bool failed = false;
+    for (size_t i = 0; i < scenes.size(); i++) {
+        scene_result r;
+        double baseline = history_baseline(history_path, scenes[i], s, window);
+        if (!bench_scene(renderer, scenes[i], s, repeat, references, update, r)) {
+            failed = true;
+            continue;
+        }
+        double rate = r.rays / r.wall_seconds;
+        r.regressed = baseline > 0 && rate < (1 - threshold) * baseline;
+        failed = failed || r.regressed;
+
+        history << "{\"date\": \"" << date << "\", \"label\": " << json_quote(label)
+                << ", \"scene\": " << json_quote(r.scene) << ", \"nx\": " << s.nx
+                << ", \"ny\": " << s.ny << ", \"ns\": " << s.ns << ", \"seed\": " << s.seed
+                << ", \"threads\": " << s.threads << ", \"rays\": " << r.rays
+                << ", \"wall_s\": " << r.wall_seconds << ", \"rays_per_s\": " << rate
+                << ", \"peak_rss_kb\": " << r.peak_rss_kb << ", \"rmse\": ";
+        if (r.rmse < 0)
+            history << "null";
+        else
+            history << r.rmse;
+        history << ", \"regressed\": " << (r.regressed ? "true" : "false") << "}" << std::endl;
+
+        std::cout << std::left << std::setw(16) << r.scene << std::right << std::fixed
+                  << std::setprecision(3) << std::setw(12) << rate * 1e-6 << std::setw(12);
+        if (baseline > 0)
+            std::cout << baseline * 1e-6;
+        else
+            std::cout << "-";
+        std::cout << std::setw(10) << r.wall_seconds << std::setw(12) << std::setprecision(1)
+                  << r.peak_rss_kb / 1024.0 << std::setw(12);
+        if (r.rmse < 0)
+            std::cout << "new ref";
+        else
+            std::cout << std::scientific << std::setprecision(2) << r.rmse;
+        std::cout << std::defaultfloat << (r.regressed ? "  REGRESSED" : "") << "\n";
+    }
+    if (!history) {
+        std::cerr << "could not write " << history_path << "\n";
+        return 1;
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,207 @@
+#ifndef GRIDMEDIUMH
+#define GRIDMEDIUMH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include "../common/box.h"
+#include "../common/fast_math.h"
+#include "../common/hittable.h"
+#include "../common/random.h"
+#include "material.h"
+#include "texture.h"
+
+#include <float.h>
+#include <math.h>
+#include <vector>
+
+
+// A medium whose density varies over a box, given as samples on a grid and blended trilinearly
+// between them. There is no closed form for how far light gets through it, so hit() uses delta
+// tracking: it steps exponential distances as if the medium were as dense as a majorant
+// everywhere, and at each step scatters with the odds of the real density to the majorant.
+// The majorant comes from a coarse grid of the largest density in each block of cells, so
+// thin regions take long steps and empty blocks are skipped without a single lookup.
+class grid_medium : public hittable {
+    public:
+        // Blocks of the coarse majorant grid are this many density cells across.
+        static const int block = 8;
+
+        // density holds nx*ny*nz samples, x fastest and z slowest, at the centres of the cells
+        // [pmin,pmax] is split into.
+        grid_medium(const float *density, int nx, int ny, int nz, const vec3& p0, const vec3& p1,
+                    texture *a);
+        ~grid_medium() { delete phase_function; }
+        virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+        virtual bool bounding_box(float t0, float t1, aabb& box) const {
+            box = aabb(pmin, pmax);
+            return true;
+        }
+        float density(const vec3& p) const;
+
+        std::vector<float> grid;
+        int n[3];
+        std::vector<float> majorant;
+        int nblocks[3];
+        vec3 pmin, pmax;
+        material *phase_function;
+
+    private:
+        // Calls step(t_a, t_b, majorant) for the blocks r passes through between t0 and t1, in
+        // order, until it returns true. Returns whether one did.
+        template <class F> bool march(const ray& r, float t0, float t1, F& step) const;
+};
+
+
+grid_medium::grid_medium(const float *density, int nx, int ny, int nz, const vec3& p0,
+                         const vec3& p1, texture *a)
+    : grid(density, density + size_t(nx)*ny*nz), pmin(p0), pmax(p1) {
+    phase_function = new isotropic(a);
+    n[0] = nx;
+    n[1] = ny;
+    n[2] = nz;
+    for (int i = 0; i < 3; i++)
+        nblocks[i] = (n[i] + block - 1) / block;
+    majorant.resize(size_t(nblocks[0])*nblocks[1]*nblocks[2]);
+    // A lookup inside a block blends the samples of its cells and of the cells next to them.
+    for (int bz = 0; bz < nblocks[2]; bz++) {
+        for (int by = 0; by < nblocks[1]; by++) {
+            for (int bx = 0; bx < nblocks[0]; bx++) {
+                int lo[3] = { bx*block - 1, by*block - 1, bz*block - 1 };
+                int hi[3] = { (bx+1)*block, (by+1)*block, (bz+1)*block };
+                for (int i = 0; i < 3; i++) {
+                    if (lo[i] < 0) lo[i] = 0;
+                    if (hi[i] > n[i]-1) hi[i] = n[i]-1;
+                }
+                float m = 0;
+                for (int z = lo[2]; z <= hi[2]; z++)
+                    for (int y = lo[1]; y <= hi[1]; y++)
+                        for (int x = lo[0]; x <= hi[0]; x++)
+                            m = ffmax(m, grid[(size_t(z)*n[1] + y)*n[0] + x]);
+                majorant[(size_t(bz)*nblocks[1] + by)*nblocks[0] + bx] = m;
+            }
+        }
+    }
+}
+
+float grid_medium::density(const vec3& p) const {
+    int i0[3], i1[3];
+    float w[3];
+    for (int a = 0; a < 3; a++) {
+        float g = (p[a] - pmin[a]) / (pmax[a] - pmin[a]) * n[a] - 0.5f;
+        float f = floorf(g);
+        i0[a] = int(f);
+        w[a] = g - f;
+        i1[a] = i0[a] + 1;
+        if (i0[a] < 0) i0[a] = 0;
+        if (i0[a] > n[a]-1) i0[a] = n[a]-1;
+        if (i1[a] < 0) i1[a] = 0;
+        if (i1[a] > n[a]-1) i1[a] = n[a]-1;
+    }
+    float sum = 0;
+    for (int c = 0; c < 8; c++) {
+        int x = c & 1 ? i1[0] : i0[0];
+        int y = c & 2 ? i1[1] : i0[1];
+        int z = c & 4 ? i1[2] : i0[2];
+        float weight = (c & 1 ? w[0] : 1-w[0]) * (c & 2 ? w[1] : 1-w[1])
+                     * (c & 4 ? w[2] : 1-w[2]);
+        sum += weight * grid[(size_t(z)*n[1] + y)*n[0] + x];
+    }
+    return sum;
+}
+
+// Steps from block to block along the ray, as a 3D DDA over the majorant grid.
+template <class F> bool grid_medium::march(const ray& r, float t0, float t1, F& step) const {
+    vec3 origin = r.origin(), direction = r.direction();
+    vec3 start = r.point_at_parameter(t0);
+    int cell[3], dir[3];
+    float t_next[3], t_delta[3];
+    for (int a = 0; a < 3; a++) {
+        float size = (pmax[a] - pmin[a]) / n[a] * block;
+        int c = int(floorf((start[a] - pmin[a]) / size));
+        cell[a] = c < 0 ? 0 : c > nblocks[a]-1 ? nblocks[a]-1 : c;
+        if (direction[a] > 0) {
+            dir[a] = 1;
+            t_next[a] = (pmin[a] + (cell[a]+1)*size - origin[a]) / direction[a];
+            t_delta[a] = size / direction[a];
+        }
+        else if (direction[a] < 0) {
+            dir[a] = -1;
+            t_next[a] = (pmin[a] + cell[a]*size - origin[a]) / direction[a];
+            t_delta[a] = -size / direction[a];
+        }
+        else {
+            dir[a] = 0;
+            t_next[a] = FLT_MAX;
+            t_delta[a] = FLT_MAX;
+        }
+    }
+    float t = t0;
+    for (;;) {
+        int a = t_next[0] < t_next[1] ? (t_next[0] < t_next[2] ? 0 : 2)
+                                      : (t_next[1] < t_next[2] ? 1 : 2);
+        float t_end = ffmin(t_next[a], t1);
+        float m = majorant[(size_t(cell[2])*nblocks[1] + cell[1])*nblocks[0] + cell[0]];
+        if (t_end > t && step(t, t_end, m))
+            return true;
+        if (t_end >= t1)
+            return false;
+        t = t_end;
+        cell[a] += dir[a];
+        if (cell[a] < 0 || cell[a] >= nblocks[a])
+            return false;
+        t_next[a] += t_delta[a];
+    }
+}
+
+// Draws the steps of delta tracking through one block, restarting at each block boundary; the
+// exponential distribution forgets how far it has already gone, so that changes nothing.
+struct grid_medium_delta_step {
+    const grid_medium *medium;
+    const ray *r;
+    float length;
+    float t;
+    bool operator()(float t_a, float t_b, float m) {
+        if (m <= 0)
+            return false;
+        t = t_a;
+        for (;;) {
+            t += -rt_log(1 - random_double()) / (m * length);
+            if (t >= t_b)
+                return false;
+            if (random_double() * m < medium->density(r->point_at_parameter(t)))
+                return true;
+        }
+    }
+};
+
+bool grid_medium::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+    float t_enter, t_exit;
+    const float o[3] = { r.origin()[0], r.origin()[1], r.origin()[2] };
+    const float d[3] = { r.direction()[0], r.direction()[1], r.direction()[2] };
+    int near_face, far_face;
+    if (!box_span(o, d, pmin, pmax, t_enter, t_exit, near_face, far_face))
+        return false;
+    if (t_enter < t_min) t_enter = t_min;
+    if (t_exit > t_max) t_exit = t_max;
+    if (t_enter >= t_exit)
+        return false;
+    grid_medium_delta_step step = { this, &r, r.direction().length(), 0 };
+    if (!march(r, t_enter, t_exit, step))
+        return false;
+    rec.t = step.t;
+    rec.p = r.point_at_parameter(rec.t);
+    rec.p_error = 0;  // inside the medium rather than on a surface; rays leave from p itself
+    rec.normal = vec3(1,0,0);  // arbitrary
+    rec.mat_ptr = phase_function;
+    return true;
+}
+
+#endif
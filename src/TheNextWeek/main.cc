@@ -9,297 +9,452 @@
 // with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
 //==================================================================================================
 
-#include "aarect.h"
-#include "box.h"
-#include "bvh.h"
-#include "camera.h"
-#include "constant_medium.h"
-#include "hittable_list.h"
-#include "material.h"
-#include "moving_sphere.h"
-#include "random.h"
-#include "sphere.h"
+#include "../common/distributed.h"
+#include "../common/framebuffer.h"
+#include "../common/render_server.h"
+#include "../common/render_stats.h"
+#include "../common/tile_scheduler.h"
+#include "../common/trace.h"
+#include "scene_file.h"
+#include "scenes.h"
 #define STB_IMAGE_IMPLEMENTATION
-#include "stb_image.h"
-#include "surface_texture.h"
-#include "texture.h"
+#include "../common/stb_image.h"
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "../common/stb_image_write.h"
 
-#include <float.h>
+#include <chrono>
+#include <fstream>
 #include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
 
 
-vec3 color(const ray& r, hittable *world, int depth) {
-    hit_record rec;
-    if (world->hit(r, 0.001, MAXFLOAT, rec)) { 
-        ray scattered;
-        vec3 attenuation;
-        vec3 emitted = rec.mat_ptr->emitted(rec.u, rec.v, rec.p);
-        if (depth < 50 && rec.mat_ptr->scatter(r, rec, attenuation, scattered)) 
-             return emitted + attenuation*color(scattered, world, depth+1);
-        else 
-            return emitted;
-    }
-    else 
-        return vec3(0,0,0);
-}
-
-hittable *earth() {
-    int nx, ny, nn;
-    //unsigned char *tex_data = stbi_load("tiled.jpg", &nx, &ny, &nn, 0);
-    unsigned char *tex_data = stbi_load("earthmap.jpg", &nx, &ny, &nn, 0);
-    material *mat =  new lambertian(new image_texture(tex_data, nx, ny));
-    return new sphere(vec3(0,0, 0), 2, mat);
+// Writes the image to path, in the format its extension names. PNG goes through stb_image_write.
+bool write_output(const char *path, const framebuffer& fb) {
+    image_format format = image_format_for_path(path);
+    if (format != image_png)
+        return write_image(path, format, fb);
+    std::vector<unsigned char> rgb = framebuffer_to_rgb8(fb);
+    return stbi_write_png(path, fb.nx, fb.ny, 3, &rgb[0], 3*fb.nx) != 0;
 }
 
-hittable *two_spheres() {
-    texture *checker = new checker_texture( new constant_texture(vec3(0.2,0.3, 0.1)), new constant_texture(vec3(0.9, 0.9, 0.9)));
-    int n = 50;
-    hittable **list = new hittable*[n+1];
-    list[0] =  new sphere(vec3(0,-10, 0), 10, new lambertian( checker));
-    list[1] =  new sphere(vec3(0, 10, 0), 10, new lambertian( checker));
-
-    return new hittable_list(list,2);
+// PNG bytes for fb, made in memory by stb_image_write.
+bool encode_png(const framebuffer& fb, std::string& bytes) {
+    std::vector<unsigned char> rgb = framebuffer_to_rgb8(fb);
+    int n = 0;
+    unsigned char *png = stbi_write_png_to_mem(&rgb[0], 3*fb.nx, fb.nx, fb.ny, 3, &n);
+    if (!png)
+        return false;
+    bytes.assign((const char*)png, n);
+    STBIW_FREE(png);
+    return true;
 }
 
-hittable *final() {
-    int nb = 20;
-    hittable **list = new hittable*[30];
-    hittable **boxlist = new hittable*[10000];
-    hittable **boxlist2 = new hittable*[10000];
-    material *white = new lambertian( new constant_texture(vec3(0.73, 0.73, 0.73)) );
-    material *ground = new lambertian( new constant_texture(vec3(0.48, 0.83, 0.53)) );
-    int b = 0;
-    for (int i = 0; i < nb; i++) {
-        for (int j = 0; j < nb; j++) {
-            float w = 100;
-            float x0 = -1000 + i*w;
-            float z0 = -1000 + j*w;
-            float y0 = 0;
-            float x1 = x0 + w;
-            float y1 = 100*(random_double()+0.01);
-            float z1 = z0 + w;
-            boxlist[b++] = new box(vec3(x0,y0,z0), vec3(x1,y1,z1), ground);
-        }
-    }
-    int l = 0;
-    list[l++] = new bvh_node(boxlist, b, 0, 1);
-    material *light = new diffuse_light( new constant_texture(vec3(7, 7, 7)) );
-    list[l++] = new xz_rect(123, 423, 147, 412, 554, light);
-    vec3 center(400, 400, 200);
-    list[l++] = new moving_sphere(center, center+vec3(30, 0, 0), 0, 1, 50, new lambertian(new constant_texture(vec3(0.7, 0.3, 0.1))));
-    list[l++] = new sphere(vec3(260, 150, 45), 50, new dielectric(1.5));
-    list[l++] = new sphere(vec3(0, 150, 145), 50, new metal(vec3(0.8, 0.8, 0.9), 10.0));
-    hittable *boundary = new sphere(vec3(360, 150, 145), 70, new dielectric(1.5));
-    list[l++] = boundary;
-    list[l++] = new constant_medium(boundary, 0.2, new constant_texture(vec3(0.2, 0.4, 0.9)));
-    boundary = new sphere(vec3(0, 0, 0), 5000, new dielectric(1.5));
-    list[l++] = new constant_medium(boundary, 0.0001, new constant_texture(vec3(1.0, 1.0, 1.0)));
-    int nx, ny, nn;
-    unsigned char *tex_data = stbi_load("earthmap.jpg", &nx, &ny, &nn, 0);
-    material *emat =  new lambertian(new image_texture(tex_data, nx, ny));
-    list[l++] = new sphere(vec3(400,200, 400), 100, emat);
-    texture *pertext = new noise_texture(0.1);
-    list[l++] =  new sphere(vec3(220,280, 300), 80, new lambertian( pertext ));
-    int ns = 1000;
-    for (int j = 0; j < ns; j++) {
-        boxlist2[j] = new sphere(vec3(165*random_double(), 165*random_double(), 165*random_double()), 10, white);
-    }
-    list[l++] =   new translate(new rotate_y(new bvh_node(boxlist2,ns, 0.0, 1.0), 15), vec3(-100,270,395));
-    return new hittable_list(list,l);
+// out_path with its "%d" replaced by the frame number, for -frames.
+std::string frame_path(const char *out_path, int frame) {
+    std::string path(out_path);
+    size_t at = path.find("%d");
+    return path.replace(at, 2, std::to_string(frame));
 }
 
-hittable *cornell_final() {
-    hittable **list = new hittable*[30];
-    hittable **boxlist = new hittable*[10000];
-    texture *pertext = new noise_texture(0.1);
-    int nx, ny, nn;
-    unsigned char *tex_data = stbi_load("earthmap.jpg", &nx, &ny, &nn, 0);
-    material *mat =  new lambertian(new image_texture(tex_data, nx, ny));
-    int i = 0;
-    material *red = new lambertian( new constant_texture(vec3(0.65, 0.05, 0.05)) );
-    material *white = new lambertian( new constant_texture(vec3(0.73, 0.73, 0.73)) );
-    material *green = new lambertian( new constant_texture(vec3(0.12, 0.45, 0.15)) );
-    material *light = new diffuse_light( new constant_texture(vec3(7, 7, 7)) );
-    //list[i++] = new sphere(vec3(260, 50, 145), 50,mat);
-    list[i++] = new flip_normals(new yz_rect(0, 555, 0, 555, 555, green));
-    list[i++] = new yz_rect(0, 555, 0, 555, 0, red);
-    list[i++] = new xz_rect(123, 423, 147, 412, 554, light);
-    list[i++] = new flip_normals(new xz_rect(0, 555, 0, 555, 555, white));
-    list[i++] = new xz_rect(0, 555, 0, 555, 0, white);
-    list[i++] = new flip_normals(new xy_rect(0, 555, 0, 555, 555, white));
-    /*
-    hittable *boundary = new sphere(vec3(160, 50, 345), 50, new dielectric(1.5));
-    list[i++] = boundary;
-    list[i++] = new constant_medium(boundary, 0.2, new constant_texture(vec3(0.2, 0.4, 0.9)));
-    list[i++] = new sphere(vec3(460, 50, 105), 50, new dielectric(1.5));
-    list[i++] = new sphere(vec3(120, 50, 205), 50, new lambertian(pertext));
-    int ns = 10000;
-    for (int j = 0; j < ns; j++) {
-        boxlist[j] = new sphere(vec3(165*random_double(), 330*random_double(), 165*random_double()), 10, white);
+// Writes fb to out_path, or as text PPM to standard output if there is none.
+bool write_frame(const char *out_path, const framebuffer& fb) {
+    if (!out_path)
+        write_ppm_p3(std::cout, fb);
+    else if (!write_output(out_path, fb)) {
+        std::cerr << "could not write " << out_path << "\n";
+        return false;
     }
-    list[i++] =   new translate(new rotate_y(new bvh_node(boxlist,ns, 0.0, 1.0), 15), vec3(265,0,295));
-    */
-    hittable *boundary2 = new translate(new rotate_y(new box(vec3(0, 0, 0), vec3(165, 165, 165), new dielectric(1.5)), -18), vec3(130,0,65));
-    list[i++] = boundary2;
-    list[i++] = new constant_medium(boundary2, 0.2, new constant_texture(vec3(0.9, 0.9, 0.9)));
-    return new hittable_list(list,i);
+    return true;
 }
 
-hittable *cornell_balls() {
-    hittable **list = new hittable*[9];
-    int i = 0;
-    material *red = new lambertian( new constant_texture(vec3(0.65, 0.05, 0.05)) );
-    material *white = new lambertian( new constant_texture(vec3(0.73, 0.73, 0.73)) );
-    material *green = new lambertian( new constant_texture(vec3(0.12, 0.45, 0.15)) );
-    material *light = new diffuse_light( new constant_texture(vec3(5, 5, 5)) );
-    list[i++] = new flip_normals(new yz_rect(0, 555, 0, 555, 555, green));
-    list[i++] = new yz_rect(0, 555, 0, 555, 0, red);
-    list[i++] = new xz_rect(113, 443, 127, 432, 554, light);
-    list[i++] = new flip_normals(new xz_rect(0, 555, 0, 555, 555, white));
-    list[i++] = new xz_rect(0, 555, 0, 555, 0, white);
-    list[i++] = new flip_normals(new xy_rect(0, 555, 0, 555, 555, white));
-    hittable *boundary = new sphere(vec3(160, 100, 145), 100, new dielectric(1.5));
-    list[i++] = boundary;
-    list[i++] = new constant_medium(boundary, 0.1, new constant_texture(vec3(1.0, 1.0, 1.0)));
-    list[i++] = new translate(new rotate_y(new box(vec3(0, 0, 0), vec3(165, 330, 165), white),  15), vec3(265,0,295));
-    return new hittable_list(list,i);
+// Reads a whole file into a string. Returns false if it cannot be read.
+bool read_file(const char *path, std::string& data) {
+    mapped_file f;
+    if (!f.open(path))
+        return false;
+    data.assign(f.data(), f.size());
+    return true;
 }
 
-hittable *cornell_smoke() {
-    hittable **list = new hittable*[8];
-    int i = 0;
-    material *red = new lambertian( new constant_texture(vec3(0.65, 0.05, 0.05)) );
-    material *white = new lambertian( new constant_texture(vec3(0.73, 0.73, 0.73)) );
-    material *green = new lambertian( new constant_texture(vec3(0.12, 0.45, 0.15)) );
-    material *light = new diffuse_light( new constant_texture(vec3(7, 7, 7)) );
-    list[i++] = new flip_normals(new yz_rect(0, 555, 0, 555, 555, green));
-    list[i++] = new yz_rect(0, 555, 0, 555, 0, red);
-    list[i++] = new xz_rect(113, 443, 127, 432, 554, light);
-    list[i++] = new flip_normals(new xz_rect(0, 555, 0, 555, 555, white));
-    list[i++] = new xz_rect(0, 555, 0, 555, 0, white);
-    list[i++] = new flip_normals(new xy_rect(0, 555, 0, 555, 555, white));
-    hittable *b1 = new translate(new rotate_y(new box(vec3(0, 0, 0), vec3(165, 165, 165), white), -18), vec3(130,0,65));
-    hittable *b2 = new translate(new rotate_y(new box(vec3(0, 0, 0), vec3(165, 330, 165), white),  15), vec3(265,0,295));
-    list[i++] = new constant_medium(b1, 0.01, new constant_texture(vec3(1.0, 1.0, 1.0)));
-    list[i++] = new constant_medium(b2, 0.01, new constant_texture(vec3(0.0, 0.0, 0.0)));
-    return new hittable_list(list,i);
+// Splits a comma-separated list.
+std::vector<std::string> split_list(const char *s) {
+    std::vector<std::string> items;
+    for (const char *p = s; ; p++) {
+        const char *q = strchr(p, ',');
+        items.push_back(q ? std::string(p, q) : std::string(p));
+        if (!q)
+            break;
+        p = q;
+    }
+    return items;
 }
 
-hittable *cornell_box() {
-    hittable **list = new hittable*[8];
-    int i = 0;
-    material *red = new lambertian( new constant_texture(vec3(0.65, 0.05, 0.05)) );
-    material *white = new lambertian( new constant_texture(vec3(0.73, 0.73, 0.73)) );
-    material *green = new lambertian( new constant_texture(vec3(0.12, 0.45, 0.15)) );
-    material *light = new diffuse_light( new constant_texture(vec3(15, 15, 15)) );
-    list[i++] = new flip_normals(new yz_rect(0, 555, 0, 555, 555, green));
-    list[i++] = new yz_rect(0, 555, 0, 555, 0, red);
-    list[i++] = new xz_rect(213, 343, 227, 332, 554, light);
-    list[i++] = new flip_normals(new xz_rect(0, 555, 0, 555, 555, white));
-    list[i++] = new xz_rect(0, 555, 0, 555, 0, white);
-    list[i++] = new flip_normals(new xy_rect(0, 555, 0, 555, 555, white));
-    list[i++] = new translate(new rotate_y(new box(vec3(0, 0, 0), vec3(165, 165, 165), white), -18), vec3(130,0,65));
-    list[i++] = new translate(new rotate_y(new box(vec3(0, 0, 0), vec3(165, 330, 165), white),  15), vec3(265,0,295));
-    return new hittable_list(list,i);
-}
+int main(int argc, char **argv) {
+    int scene = 5;
 
-hittable *two_perlin_spheres() {
-    texture *pertext = new noise_texture(4);
-    hittable **list = new hittable*[2];
-    list[0] =  new sphere(vec3(0,-1000, 0), 1000, new lambertian( pertext ));
-    list[1] =  new sphere(vec3(0, 2, 0), 2, new lambertian( pertext ));
-    return new hittable_list(list,2);
-}
+    int nx = 800;
+    int ny = 800;
+    int ns = 100;
+    int nthreads = default_thread_count();
+    int tile_size = 16;
+    unsigned int seed = 0;
+    const char *out_path = 0;
+    const char *stats_json_path = 0;
+    const char *trace_path = 0;
+    const char *scene_path = 0;
+    const char *scene_cache_path = 0;
+    bool print_stats = false;
+    // Consecutive slices of the shutter rendered as frames of their own.
+    int frames = 1;
+    // A piece of a frame rendered for a coordinator, which sends its part to part_path.
+    render_piece piece = { 0, -1, 0, -1 };
+    const char *part_path = 0;
+    // A coordinator: the same renderer on other machines renders the pieces.
+    const char *worker_command = 0;
+    std::vector<std::string> hosts;
+    int row_bands = 0;
+    int sample_ranges = 1;
+    std::vector<const char*> merge_paths;
+    // A server: requests come on standard input, or over TCP from listen_address:listen_port.
+    bool serve = false;
+    std::string listen_address = "127.0.0.1";
+    int listen_port = 0;
+    render_limits limits = render_default_limits;
+    bool usage = false;
+    for (int a = 1; a < argc && !usage; a++) {
+        if (!strcmp(argv[a], "-t") && a+1 < argc)
+            nthreads = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "-tile") && a+1 < argc)
+            tile_size = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "-seed") && a+1 < argc)
+            seed = strtoul(argv[++a], 0, 10);
+        else if (!strcmp(argv[a], "-o") && a+1 < argc)
+            out_path = argv[++a];
+        else if (!strcmp(argv[a], "-nx") && a+1 < argc)
+            nx = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "-ny") && a+1 < argc)
+            ny = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "-ns") && a+1 < argc)
+            ns = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "-mesh") && a+1 < argc)
+            mesh_path = argv[++a];
+        else if (!strcmp(argv[a], "-mesh-cache") && a+1 < argc)
+            mesh_cache_bytes = size_t(atof(argv[++a]) * (1 << 20));
+        else if (!strcmp(argv[a], "-stats"))
+            print_stats = true;
+        else if (!strcmp(argv[a], "-stats-json") && a+1 < argc)
+            stats_json_path = argv[++a];
+        else if (!strcmp(argv[a], "-trace") && a+1 < argc)
+            trace_path = argv[++a];
+        else if (!strcmp(argv[a], "-roulette") && a+1 < argc) {
+            a++;
+            roulette_depth = strcmp(argv[a], "off") ? atoi(argv[a]) : -1;
+        }
+        else if (!strcmp(argv[a], "-noise-volume") && a+1 < argc)
+            noise_volume_size = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "-texture-cache") && a+1 < argc)
+            image_texture_cache().set_budget(size_t(atof(argv[++a]) * (1 << 20)));
+        else if (!strcmp(argv[a], "-bvh") && a+1 < argc) {
+            a++;
+            if (!strcmp(argv[a], "linear")) scene_accel = accel_linear;
+            else if (!strcmp(argv[a], "sah")) scene_accel = accel_sah;
+            else if (!strcmp(argv[a], "median")) scene_accel = accel_median;
+            else if (!strcmp(argv[a], "bvh4")) scene_accel = accel_bvh4;
+            else if (!strcmp(argv[a], "compressed")) scene_accel = accel_compressed;
+            else if (!strcmp(argv[a], "motion")) scene_accel = accel_motion;
+            else usage = true;
+        }
+        else if (!strcmp(argv[a], "-motion-segments") && a+1 < argc)
+            motion_segments = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "-frames") && a+1 < argc) {
+            frames = atoi(argv[++a]);
+            usage = frames < 1;
+        }
+        else if (!strcmp(argv[a], "-bvh-update") && a+1 < argc) {
+            a++;
+            if (!strcmp(argv[a], "refit")) scene_bvh_update = bvh_update_refit;
+            else if (!strcmp(argv[a], "rotate")) scene_bvh_update = bvh_update_rotate;
+            else if (!strcmp(argv[a], "rebuild")) scene_bvh_update = bvh_update_rebuild;
+            else usage = true;
+        }
+        else if (!strcmp(argv[a], "-rows") && a+1 < argc)
+            usage = sscanf(argv[++a], "%d:%d", &piece.y0, &piece.y1) != 2;
+        else if (!strcmp(argv[a], "-samples") && a+1 < argc)
+            usage = sscanf(argv[++a], "%d:%d", &piece.first_sample, &piece.samples) != 2;
+        else if (!strcmp(argv[a], "-part") && a+1 < argc)
+            part_path = argv[++a];
+        else if (!strcmp(argv[a], "-distribute") && a+1 < argc)
+            worker_command = argv[++a];
+        else if (!strcmp(argv[a], "-hosts") && a+1 < argc)
+            hosts = split_list(argv[++a]);
+        else if (!strcmp(argv[a], "-bands") && a+1 < argc)
+            row_bands = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "-sample-ranges") && a+1 < argc)
+            sample_ranges = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "-merge") && a+1 < argc)
+            merge_paths.push_back(argv[++a]);
+        else if (!strcmp(argv[a], "-serve"))
+            serve = true;
+        else if (!strcmp(argv[a], "-listen") && a+1 < argc) {
+            const char *colon = strrchr(argv[++a], ':');
+            if (colon)
+                listen_address.assign((const char*)argv[a], colon);
+            listen_port = atoi(colon ? colon+1 : argv[a]);
+            usage = listen_port <= 0 || listen_port > 65535;
+            serve = true;
+        }
+        else if (!strcmp(argv[a], "-serve-limits") && a+1 < argc) {
+            char end;
+            usage = sscanf(argv[++a], "%d,%d,%d,%lld,%lld%c", &limits.max_nx, &limits.max_ny,
+                           &limits.max_ns, &limits.max_pixels, &limits.max_samples, &end) != 5
+                    || limits.max_nx < 1 || limits.max_ny < 1 || limits.max_ns < 1
+                    || limits.max_pixels < 1 || limits.max_samples < 1;
+        }
+        else if (!strcmp(argv[a], "-scene-file") && a+1 < argc)
+            scene_path = argv[++a];
+        else if (!strcmp(argv[a], "-scene-cache") && a+1 < argc)
+            scene_cache_path = argv[++a];
+        else if (!strcmp(argv[a], "-scene") && a+1 < argc) {
+            a++;
+            for (scene = 0; scene < nscenes && strcmp(argv[a], scenes[scene].name); scene++) {}
+            usage = scene == nscenes;
+        }
+        else
+            usage = true;
+    }
+    if (!usage && !scene_path && scenes[scene].build == cornell_mesh && !mesh_path) {
+        std::cerr << "cornell_mesh needs -mesh\n";
+        return 1;
+    }
+    if (usage) {
+        std::cerr << "usage: " << argv[0] << " [-t threads] [-tile size] [-seed n]"
+                  << " [-nx width] [-ny height] [-ns samples]"
+                  << " [-scene name | -scene-file file [-scene-cache file]]"
+                  << " [-mesh file.obj|ply [-mesh-cache MB]]"
+                  << " [-bvh linear|sah|median|bvh4|compressed|motion]"
+                  << " [-motion-segments n] [-frames n [-bvh-update refit|rotate|rebuild]]"
+                  << " [-stats] [-stats-json file] [-trace file.json]"
+                  << " [-texture-cache MB] [-noise-volume n] [-roulette off|min-depth]"
+                  << " [-o image.ppm|png|pfm|exr]"
+                  << " [-rows y0:y1] [-samples first:count] [-part file|-]"
+                  << " [-distribute command [-hosts a,b,...] [-bands n] [-sample-ranges n]]"
+                  << " [-merge part]... [-serve | -listen [address:]port]"
+                  << " [-serve-limits max-nx,max-ny,max-ns,max-pixels,max-samples]\n"
+                  << "scenes:";
+        for (int i = 0; i < nscenes; i++)
+            std::cerr << " " << scenes[i].name;
+        std::cerr << "\n";
+        return 1;
+    }
 
-hittable *simple_light() {
-    texture *pertext = new noise_texture(4);
-    hittable **list = new hittable*[4];
-    list[0] =  new sphere(vec3(0,-1000, 0), 1000, new lambertian( pertext ));
-    list[1] =  new sphere(vec3(0, 2, 0), 2, new lambertian( pertext ));
-    list[2] =  new sphere(vec3(0, 7, 0), 2, new diffuse_light( new constant_texture(vec3(4,4,4))));
-    list[3] =  new xy_rect(3, 5, 1, 3, -2, new diffuse_light(new constant_texture(vec3(4,4,4))));
-    return new hittable_list(list,4);
-}
+    // Check the output format up front rather than after the render.
+    if (out_path && (image_format_for_path(out_path) == image_unknown)) {
+        std::cerr << "unsupported image format: " << out_path << "\n";
+        return 1;
+    }
+    if (frames > 1 && (!out_path || !strstr(out_path, "%d"))) {
+        std::cerr << "-frames needs -o with %d in the name, for the frame number\n";
+        return 1;
+    }
+    if (frames > 1 && (serve || part_path || worker_command || !merge_paths.empty())) {
+        std::cerr << "-frames renders whole frames here, not with -serve, -part, -distribute"
+                  << " or -merge\n";
+        return 1;
+    }
+#ifndef RT_STATS
+    if (stats_json_path) {
+        std::cerr << "-stats-json needs a build with RT_STATS defined\n";
+        return 1;
+    }
+#endif
 
-hittable *random_scene() {
-    int n = 50000;
-    hittable **list = new hittable*[n+1];
-    texture *checker = new checker_texture( new constant_texture(vec3(0.2,0.3, 0.1)), new constant_texture(vec3(0.9, 0.9, 0.9)));
-    list[0] =  new sphere(vec3(0,-1000,0), 1000, new lambertian( checker));
-    int i = 1;
-    for (int a = -10; a < 10; a++) {
-        for (int b = -10; b < 10; b++) {
-            float choose_mat = random_double();
-            vec3 center(a+0.9*random_double(),0.2,b+0.9*random_double()); 
-            if ((center-vec3(4,0.2,0)).length() > 0.9) { 
-                if (choose_mat < 0.8) {  // diffuse
-                    list[i++] = new moving_sphere(center, center+vec3(0,0.5*random_double(), 0), 0.0, 1.0, 0.2, new lambertian(new constant_texture(vec3(random_double()*random_double(), random_double()*random_double(), random_double()*random_double()))));
-                }
-                else if (choose_mat < 0.95) { // metal
-                    list[i++] = new sphere(center, 0.2,
-                            new metal(vec3(0.5*(1 + random_double()), 0.5*(1 + random_double()), 0.5*(1 + random_double())),  0.5*random_double()));
-                }
-                else {  // glass
-                    list[i++] = new sphere(center, 0.2, new dielectric(1.5));
-                }
+    // Frames made from parts need no scene here.
+    if (!merge_paths.empty()) {
+        std::vector<std::string> parts(merge_paths.size()), names(merge_paths.begin(),
+                                                                 merge_paths.end());
+        for (size_t i = 0; i < merge_paths.size(); i++) {
+            if (!read_file(merge_paths[i], parts[i])) {
+                std::cerr << "could not open " << merge_paths[i] << "\n";
+                return 1;
             }
         }
+        framebuffer fb(1, 1);
+        return merge_render_parts(parts, names, fb) && write_frame(out_path, fb) ? 0 : 1;
+    }
+    if (worker_command) {
+        if (hosts.empty())
+            hosts.push_back("localhost");
+        framebuffer fb(nx, ny);
+        if (!render_distributed(worker_command, hosts, row_bands > 0 ? row_bands : int(hosts.size()),
+                                sample_ranges, ny, ns, fb))
+            return 1;
+        return write_frame(out_path, fb) ? 0 : 1;
+    }
+    if (piece.y1 < 0)
+        piece.y1 = ny;
+    if (piece.samples < 0)
+        piece.samples = ns - piece.first_sample;
+    if (piece.y0 < 0 || piece.y1 > ny || piece.y0 >= piece.y1 || piece.first_sample < 0
+            || piece.samples < 1) {
+        std::cerr << "-rows and -samples must pick out part of the frame\n";
+        return 1;
     }
 
-    list[i++] = new sphere(vec3(0, 1, 0), 1.0, new dielectric(1.5));
-    list[i++] = new sphere(vec3(-4, 1, 0), 1.0, new lambertian(new constant_texture(vec3(0.4, 0.2, 0.1))));
-    list[i++] = new sphere(vec3(4, 1, 0), 1.0, new metal(vec3(0.7, 0.6, 0.5), 0.0));
-
-    //return new hittable_list(list,i);
-    return new bvh_node(list,i, 0.0, 1.0);
-}
-
-int main() {
-    int nx = 800;
-    int ny = 800;
-    int ns = 100;
-    std::cout << "P3\n" << nx << " " << ny << "\n255\n";
-    hittable *list[5];
-    float R = cos(M_PI/4);
-    //hittable *world = random_scene();
-    //hittable *world = two_spheres();
-    //hittable *world = two_perlin_spheres();
-    //hittable *world = earth();
-    //hittable *world = simple_light();
-    hittable *world = cornell_box();
-    //hittable *world = cornell_balls();
-    //hittable *world = cornell_smoke();
-    //hittable *world = cornell_final();
-    //hittable *world = final();
-
-    vec3 lookfrom(278, 278, -800);
-    //vec3 lookfrom(478, 278, -600);
-    vec3 lookat(278,278,0);
-    //vec3 lookfrom(0, 0, 6);
-    //vec3 lookat(0,0,0);
-    float dist_to_focus = 10.0;
-    float aperture = 0.0;
-    float vfov = 40.0;
-
-    camera cam(lookfrom, lookat, vec3(0,1,0), vfov, float(nx)/float(ny), aperture, dist_to_focus, 0.0, 1.0);
+    if (trace_path)
+        trace_start();
+    trace_zone build_zone("scene build");
+    std::chrono::steady_clock::time_point build_start = std::chrono::steady_clock::now();
+    arena scene_arena;
+    scene_file file;
+    if (scene_path && !load_scene_file(scene_path, scene_cache_path, file))
+        return 1;
+    hittable *world = scene_path ? build_scene(scene_arena, file)
+                                 : scenes[scene].build(scene_arena);
+    if (!world)
+        return 1;
+    double build_ms = std::chrono::duration<double, std::milli>(
+                          std::chrono::steady_clock::now() - build_start).count();
+    build_zone.end();
 
-    for (int j = ny-1; j >= 0; j--) {
-        for (int i = 0; i < nx; i++) {
-            vec3 col(0, 0, 0);
-            for (int s=0; s < ns; s++) {
-                float u = float(i+random_double())/ float(nx);
-                float v = float(j+random_double())/ float(ny);
-                ray r = cam.get_ray(u, v);
-                vec3 p = r.point_at_parameter(2.0);
-                col += color(r, world,0);
+    camera cam = scene_path ? scene_view_camera(file.view, nx, ny)
+                            : scene_camera(scenes[scene], nx, ny);
+    if (serve) {
+        // Requests fall back to the options this was started with and the scene's own camera.
+        scene_camera_record view = { { 0, 0, 0 }, { 0, 0, 0 }, 0, 0, 10 };
+        if (scene_path)
+            view = file.view.camera;
+        else {
+            for (int k = 0; k < 3; k++) {
+                view.lookfrom[k] = scenes[scene].lookfrom[k];
+                view.lookat[k] = scenes[scene].lookat[k];
             }
-            col /= float(ns);
-            col = vec3( sqrt(col[0]), sqrt(col[1]), sqrt(col[2]) );
-            int ir = int(255.99*col[0]); 
-            int ig = int(255.99*col[1]); 
-            int ib = int(255.99*col[2]); 
-            std::cout << ir << " " << ig << " " << ib << "\n";
+            view.vfov = scenes[scene].vfov;
         }
+        render_request defaults = { nx, ny, ns, seed, image_p6, { 0, 0, 0 }, { 0, 0, 0 },
+                                    0, 0, 0, 0 };
+        render_handler handler = [&](const render_request& req, framebuffer& fb,
+                                     std::string&) {
+            scene_camera_record c = view;
+            for (int k = 0; k < 3; k++) {
+                if (req.view_fields & render_view_lookfrom) c.lookfrom[k] = req.lookfrom[k];
+                if (req.view_fields & render_view_lookat) c.lookat[k] = req.lookat[k];
+            }
+            if (req.view_fields & render_view_vfov) c.vfov = req.vfov;
+            if (req.view_fields & render_view_aperture) c.aperture = req.aperture;
+            if (req.view_fields & render_view_focus) c.focus_dist = req.focus_dist;
+            tile_scheduler scheduler(req.nx, req.ny, tile_size, nthreads);
+            render(world, record_camera(c, req.nx, req.ny), req.ns, req.seed, scheduler, fb);
+            return true;
+        };
+        if (!listen_port)
+            return serve_requests(stdin, stdout, defaults, limits, handler, encode_png) ? 0 : 1;
+#ifdef _WIN32
+        std::cerr << "-listen is not supported on this platform; use -serve\n";
+#else
+        serve_tcp(listen_address.c_str(), listen_port, defaults, limits, handler, encode_png);
+        std::cerr << "could not listen on " << listen_address << ":" << listen_port << "\n";
+#endif
+        return 1;
+    }
+    if (part_path) {
+        render_part part(nx, piece, ny, seed);
+        tile_scheduler scheduler(nx, piece.y1 - piece.y0, tile_size, nthreads);
+        render_samples(world, cam, ny, piece.y0, piece.first_sample, piece.samples, seed,
+                       scheduler, part.sum);
+        trace_zone output_zone("output");
+        if (!strcmp(part_path, "-"))
+            write_render_part(std::cout, part);
+        else {
+            std::ofstream out(part_path, std::ios::binary);
+            write_render_part(out, part);
+            if (!out) {
+                std::cerr << "could not write " << part_path << "\n";
+                return 1;
+            }
+        }
+    }
+    else if (frames > 1) {
+        // The trees were built over the whole shutter; each frame's are refit to its own slice.
+        framebuffer fb(nx, ny);
+        tile_scheduler scheduler(nx, ny, tile_size, nthreads);
+        for (int f = 0; f < frames; f++) {
+            float time0 = float(f) / frames, time1 = float(f+1) / frames;
+            trace_zone frame_zone("frame", "frame", f);
+            std::chrono::steady_clock::time_point update_start = std::chrono::steady_clock::now();
+            trace_zone update_zone("bvh update");
+            int rebuilt = update_scene_bvhs(time0, time1);
+            update_zone.end();
+            double update_ms = std::chrono::duration<double, std::milli>(
+                                   std::chrono::steady_clock::now() - update_start).count();
+            camera frame_cam = scene_path ? scene_view_camera(file.view, nx, ny, time0, time1)
+                                          : scene_camera(scenes[scene], nx, ny, time0, time1);
+            std::chrono::steady_clock::time_point render_start = std::chrono::steady_clock::now();
+            trace_zone render_zone("render");
+            render(world, frame_cam, ns, seed, scheduler, fb);
+            render_zone.end();
+            double render_ms = std::chrono::duration<double, std::milli>(
+                                   std::chrono::steady_clock::now() - render_start).count();
+            trace_zone output_zone("output");
+            if (!write_frame(frame_path(out_path, f).c_str(), fb))
+                return 1;
+            output_zone.end();
+            if (print_stats)
+                std::cerr << "frame " << f << ": trees updated in " << update_ms << " ms, "
+                          << rebuilt << " of " << scene_bvhs.size() << " built again, rendered in "
+                          << render_ms << " ms\n";
+        }
+    }
+    else {
+        framebuffer fb(nx, ny);
+        tile_scheduler scheduler(nx, ny, tile_size, nthreads);
+        trace_zone render_zone("render");
+        render(world, cam, ns, seed, scheduler, fb);
+        render_zone.end();
+        trace_zone output_zone("output");
+        if (!write_frame(out_path, fb))
+            return 1;
     }
-}
 
+    if (print_stats) {
+        std::cerr << "scene build: " << build_ms << " ms, "
+                  << scene_arena.bytes_allocated() << " bytes in the scene arena\n";
+        for (size_t i = 0; i < scene_bvhs.size(); i++) {
+            bvh_build_stats bs = scene_bvhs[i]->build_stats();
+            std::cerr << "bvh " << i << ": " << bs.primitives << " primitives, "
+                      << bs.interior_nodes << " interior nodes, " << bs.leaves << " leaves, "
+                      << "depth " << bs.max_depth << ", SAH cost " << bs.sah_cost
+                      << ", built in " << bs.build_ms << " ms\n";
+        }
+        texture_cache& tc = image_texture_cache();
+        if (tc.lookups() > 0)
+            std::cerr << "texture cache: " << tc.lookups() << " lookups, " << tc.tiles_read()
+                      << " tiles read, " << tc.resident_bytes() << " bytes resident\n";
+        for (size_t i = 0; i < scene_paged_meshes.size(); i++) {
+            const paged_mesh *pm = scene_paged_meshes[i];
+            std::cerr << "paged mesh " << i << ": " << pm->triangle_count() << " triangles in "
+                      << pm->chunk_count() << " chunks, " << pm->chunks_read() << " chunks read, "
+                      << pm->resident_bytes() << " bytes resident\n";
+        }
+#ifdef RT_STATS
+        render_stats_print(std::cerr, render_stats_collect(), (long long)(nx) * ny * ns);
+#endif
+    }
+#ifdef RT_STATS
+    if (stats_json_path) {
+        std::ofstream out(stats_json_path);
+        render_stats_write_json(out, render_stats_collect(), (long long)(nx) * ny * ns);
+        if (!out) {
+            std::cerr << "could not write " << stats_json_path << "\n";
+            return 1;
+        }
+    }
+#endif
+    if (trace_path && !trace_write(trace_path)) {
+        std::cerr << "could not write " << trace_path << "\n";
+        return 1;
+    }
+}
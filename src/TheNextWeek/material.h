@@ -11,16 +11,18 @@
 // with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
 //==================================================================================================
 
-#include "hittable.h"
-#include "ray.h"
+#include "../common/fast_math.h"
+#include "../common/hittable.h"
+#include "../common/random.h"
+#include "../common/ray.h"
+#include "../common/render_stats.h"
 #include "texture.h"
-#include "random.h"
 
 
 float schlick(float cosine, float ref_idx) {
     float r0 = (1-ref_idx) / (1+ref_idx);
     r0 = r0*r0;
-    return r0 + (1-r0)*pow((1 - cosine),5);
+    return r0 + (1-r0)*rt_pow5(1 - cosine);
 }
 
 bool refract(const vec3& v, const vec3& n, float ni_over_nt, vec3& refracted) {
@@ -52,6 +54,7 @@ vec3 random_in_unit_sphere() {
 
 class material  {
     public:
+        virtual ~material() {}
         virtual bool scatter(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered) const = 0;
         virtual vec3 emitted(float u, float v, const vec3& p) const {
             return vec3(0,0,0); }
@@ -70,8 +73,9 @@ class isotropic : public material {
     public:
         isotropic(texture *a) : albedo(a) {}
         virtual bool scatter(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered) const  {
+             RT_COUNT_SCATTER("isotropic");
              scattered = ray(rec.p, random_in_unit_sphere(), r_in.time());
-             attenuation = albedo->value(rec.u, rec.v, rec.p);
+             attenuation = albedo->value(rec.u, rec.v, rec.p, rec.footprint);
              return true;
         }
         texture *albedo;
@@ -81,9 +85,10 @@ class lambertian : public material {
     public:
         lambertian(texture *a) : albedo(a) {}
         virtual bool scatter(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered) const  {
+             RT_COUNT_SCATTER("lambertian");
              vec3 target = rec.p + rec.normal + random_in_unit_sphere();
-             scattered = ray(rec.p, target-rec.p, r_in.time());
-             attenuation = albedo->value(rec.u, rec.v, rec.p);
+             scattered = spawn_ray(rec, target-rec.p, r_in.time());
+             attenuation = albedo->value(rec.u, rec.v, rec.p, rec.footprint);
              return true;
         }
 
@@ -94,8 +99,9 @@ class metal : public material {
     public:
         metal(const vec3& a, float f) : albedo(a) { if (f < 1) fuzz = f; else fuzz = 1; }
         virtual bool scatter(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered) const  {
+            RT_COUNT_SCATTER("metal");
             vec3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);
-            scattered = ray(rec.p, reflected + fuzz*random_in_unit_sphere(), r_in.time());
+            scattered = spawn_ray(rec, reflected + fuzz*random_in_unit_sphere(), r_in.time());
             attenuation = albedo;
             return (dot(scattered.direction(), rec.normal) > 0);
         }
@@ -107,6 +113,7 @@ class dielectric : public material {
     public:
         dielectric(float ri) : ref_idx(ri) {}
         virtual bool scatter(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered) const  {
+             RT_COUNT_SCATTER("dielectric");
              vec3 outward_normal;
              vec3 reflected = reflect(r_in.direction(), rec.normal);
              float ni_over_nt;
@@ -128,14 +135,14 @@ class dielectric : public material {
                 reflect_prob = schlick(cosine, ref_idx);
              }
              else {
-                scattered = ray(rec.p, reflected, r_in.time());
+                scattered = spawn_ray(rec, reflected, r_in.time());
                 reflect_prob = 1.0;
              }
              if (random_double() < reflect_prob) {
-                scattered = ray(rec.p, reflected, r_in.time());
+                scattered = spawn_ray(rec, reflected, r_in.time());
              }
              else {
-                scattered = ray(rec.p, refracted, r_in.time());
+                scattered = spawn_ray(rec, refracted, r_in.time());
              }
              return true;
         }
@@ -0,0 +1,356 @@
+#ifndef MOTIONBVHH
+#define MOTIONBVHH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include "../common/hittable.h"
+#include "../common/render_stats.h"
+#include "../common/trace.h"
+
+#include <algorithm>
+#include <float.h>
+#include <iostream>
+#include <math.h>
+#include <stdint.h>
+#include <vector>
+
+
+// A flattened node of a motion_bvh. The bounds live apart from the nodes, one box per key.
+struct motion_bvh_node {
+    int32_t offset;   // leaf: first primitive, interior: index of the second child
+    uint16_t count;   // number of primitives in a leaf, 0 for interior nodes
+    uint8_t axis;     // split axis of an interior node
+    uint8_t pad;
+};
+
+
+// A BVH for scenes that move during the shutter. Ordinary trees take each primitive's bounds over
+// the whole of [time0,time1], so a fast mover's box covers its whole path and overlaps everything
+// along it. This one keeps every node's bounds at segments+1 evenly spaced keys instead, and a ray
+// is tested against the bounds blended between the two keys either side of its time.
+//
+// The blend is exact for shapes that move in a straight line between keys: moving_sphere for any
+// number of segments, and a keyframe_translate whose segments the keys include. Rays are expected
+// to carry times within [time0,time1], as the camera's do; others are tested at the nearest end.
+class motion_bvh : public hittable {
+    public:
+        motion_bvh() : segments(1), time0(0), time1(0) {}
+        motion_bvh(hittable **l, int n, float time0, float time1, int segments = 1,
+                   int max_leaf_size = 2);
+        virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+        virtual bool bounding_box(float t0, float t1, aabb& box) const;
+        virtual bool occluded(const ray& r, float t_min, float t_max) const;
+        virtual bool intersect(const ray& r, float t_min, float t_max, hit_record& rec) const;
+
+        int segments;
+        float time0, time1;
+        std::vector<motion_bvh_node> nodes;
+        // Per node, segments+1 boxes of six floats: the min corner, then the max corner.
+        std::vector<float> keys;
+        std::vector<hittable*> prims;
+
+    private:
+        // Splits are chosen by the surface area heuristic over this many bins of centroids. Past
+        // sah_depth levels they fall back to the median, so a 64-entry stack always suffices.
+        static const int bins = 12;
+        static const int sah_depth = 32;
+
+        struct build_prim {
+            vec3 centroid;   // averaged over the keys
+            int first_box;   // the first of its segments+1 boxes in the build's box array
+            hittable *ptr;
+        };
+
+        int build(std::vector<build_prim>& info, const std::vector<aabb>& boxes, int begin,
+                  int end, int depth, int max_leaf_size);
+        void key_of(float time, int& k, float& s) const;
+        bool node_hit(int node, const ray& r, int k, float s,
+                      float tmin, float tmax) const;
+};
+
+
+motion_bvh::motion_bvh(hittable **l, int n, float t0, float t1, int segs, int max_leaf_size)
+    : segments(segs < 1 ? 1 : segs), time0(t0), time1(t1) {
+    trace_zone zone("motion bvh build", "primitives", n);
+    if (max_leaf_size < 1) max_leaf_size = 1;
+    if (max_leaf_size > 0xffff) max_leaf_size = 0xffff;
+
+    int nkeys = segments + 1;
+    std::vector<aabb> boxes(size_t(n) * nkeys);
+    std::vector<build_prim> info(n);
+    for (int i = 0; i < n; i++) {
+        vec3 sum(0, 0, 0);
+        for (int k = 0; k < nkeys; k++) {
+            float time = time0 + (time1 - time0) * k / segments;
+            aabb& b = boxes[size_t(i)*nkeys + k];
+            if (!l[i]->bounding_box(time, time, b))
+                std::cerr << "no bounding box in motion_bvh constructor\n";
+            sum += 0.5*(b.min() + b.max());
+        }
+        info[i].centroid = sum / float(nkeys);
+        info[i].first_box = i*nkeys;
+        info[i].ptr = l[i];
+    }
+
+    prims.reserve(n);
+    nodes.reserve(n > 0 ? 2*n - 1 : 0);
+    keys.reserve(n > 0 ? (2*size_t(n) - 1) * nkeys * 6 : 0);
+    if (n > 0)
+        build(info, boxes, 0, n, 0, max_leaf_size);
+}
+
+int motion_bvh::build(std::vector<build_prim>& info, const std::vector<aabb>& boxes, int begin,
+                      int end, int depth, int max_leaf_size) {
+    int nkeys = segments + 1;
+    int index = int(nodes.size());
+    nodes.push_back(motion_bvh_node());
+    // Padded a little, so rounding in the blend can't cull a ray that grazes a shape.
+    for (int k = 0; k < nkeys; k++) {
+        aabb b = boxes[info[begin].first_box + k];
+        for (int i = begin+1; i < end; i++)
+            b = surrounding_box(b, boxes[info[i].first_box + k]);
+        for (int c = 0; c < 6; c++) {
+            float v = c < 3 ? b.min()[c] : b.max()[c-3];
+            float pad = 1e-6f*fabs(v) + 1e-7f;
+            keys.push_back(c < 3 ? v - pad : v + pad);
+        }
+    }
+
+    vec3 cmin = info[begin].centroid;
+    vec3 cmax = info[begin].centroid;
+    for (int i = begin+1; i < end; i++) {
+        for (int a = 0; a < 3; a++) {
+            cmin[a] = ffmin(cmin[a], info[i].centroid[a]);
+            cmax[a] = ffmax(cmax[a], info[i].centroid[a]);
+        }
+    }
+
+    motion_bvh_node node;
+    node.pad = 0;
+    int n = end - begin;
+    int axis = aabb(cmin, cmax).longest_axis();
+    if (n <= max_leaf_size || (cmax[axis] - cmin[axis] <= 0 && n <= 0xffff)) {
+        node.offset = int32_t(prims.size());
+        node.count = uint16_t(n);
+        node.axis = 0;
+        for (int i = begin; i < end; i++)
+            prims.push_back(info[i].ptr);
+        nodes[index] = node;
+        return index;
+    }
+
+    // The cost of a split weighs each side's count by its surface area summed over the keys, so
+    // a tree that is tight on average over the shutter wins.
+    int mid = -1;
+    if (cmax[axis] - cmin[axis] > 0 && depth < sah_depth) {
+        float scale = bins / (cmax[axis] - cmin[axis]);
+        int count[bins] = { 0 };
+        std::vector<aabb> bin_box(size_t(bins) * nkeys);
+        std::vector<bool> bin_used(bins, false);
+        for (int i = begin; i < end; i++) {
+            int b = int((info[i].centroid[axis] - cmin[axis]) * scale);
+            b = b < 0 ? 0 : (b >= bins ? bins - 1 : b);
+            count[b]++;
+            for (int k = 0; k < nkeys; k++) {
+                const aabb& pb = boxes[info[i].first_box + k];
+                aabb& bb = bin_box[size_t(b)*nkeys + k];
+                bb = bin_used[b] ? surrounding_box(bb, pb) : pb;
+            }
+            bin_used[b] = true;
+        }
+        float left_cost[bins];
+        std::vector<aabb> acc(nkeys);
+        int left_n = 0;
+        for (int b = 0; b < bins - 1; b++) {
+            if (count[b] > 0) {
+                for (int k = 0; k < nkeys; k++)
+                    acc[k] = left_n > 0 ? surrounding_box(acc[k], bin_box[size_t(b)*nkeys + k])
+                                        : bin_box[size_t(b)*nkeys + k];
+                left_n += count[b];
+            }
+            float area = 0;
+            for (int k = 0; k < nkeys && left_n > 0; k++)
+                area += acc[k].area();
+            left_cost[b] = area * left_n;
+        }
+        float best_cost = FLT_MAX;
+        int best = -1;
+        int right_n = 0;
+        for (int b = bins - 1; b > 0; b--) {
+            if (count[b] > 0) {
+                for (int k = 0; k < nkeys; k++)
+                    acc[k] = right_n > 0 ? surrounding_box(acc[k], bin_box[size_t(b)*nkeys + k])
+                                         : bin_box[size_t(b)*nkeys + k];
+                right_n += count[b];
+            }
+            float area = 0;
+            for (int k = 0; k < nkeys && right_n > 0; k++)
+                area += acc[k].area();
+            float cost = left_cost[b-1] + area * right_n;
+            if (right_n > 0 && right_n < n && cost < best_cost) {
+                best_cost = cost;
+                best = b;
+            }
+        }
+        if (best > 0) {
+            build_prim *split = std::partition(&info[0] + begin, &info[0] + end,
+                [&](const build_prim& p) {
+                    int b = int((p.centroid[axis] - cmin[axis]) * scale);
+                    b = b < 0 ? 0 : (b >= bins ? bins - 1 : b);
+                    return b < best;
+                });
+            mid = int(split - &info[0]);
+        }
+    }
+    if (mid <= begin || mid >= end) {
+        mid = begin + n/2;
+        std::nth_element(info.begin() + begin, info.begin() + mid, info.begin() + end,
+                         [axis](const build_prim& a, const build_prim& b) {
+                             return a.centroid[axis] < b.centroid[axis];
+                         });
+    }
+    build(info, boxes, begin, mid, depth + 1, max_leaf_size);
+    node.offset = build(info, boxes, mid, end, depth + 1, max_leaf_size);
+    node.count = 0;
+    node.axis = uint8_t(axis);
+    nodes[index] = node;
+    return index;
+}
+
+// Every key of the root, which holds for any time in [time0,time1].
+bool motion_bvh::bounding_box(float t0, float t1, aabb& b) const {
+    if (nodes.empty())
+        return false;
+    vec3 lo(keys[0], keys[1], keys[2]), hi(keys[3], keys[4], keys[5]);
+    for (int k = 1; k <= segments; k++) {
+        const float *key = &keys[size_t(k)*6];
+        for (int a = 0; a < 3; a++) {
+            lo[a] = ffmin(lo[a], key[a]);
+            hi[a] = ffmax(hi[a], key[3+a]);
+        }
+    }
+    b = aabb(lo, hi);
+    return true;
+}
+
+// The segment k a time falls in, and how far along it, s, it is.
+void motion_bvh::key_of(float time, int& k, float& s) const {
+    float f = time1 > time0 ? (time - time0) / (time1 - time0) * segments : 0;
+    if (!(f > 0)) f = 0;
+    if (f > segments) f = float(segments);
+    k = int(f);
+    if (k > segments - 1) k = segments - 1;
+    s = f - k;
+}
+
+bool motion_bvh::node_hit(int node, const ray& r, int k, float s,
+                          float tmin, float tmax) const {
+    const float *a = &keys[(size_t(node)*(segments + 1) + k) * 6];
+    const float *b = a + 6;
+    float lo[3], hi[3];
+    for (int c = 0; c < 3; c++) {
+        lo[c] = a[c] + s*(b[c] - a[c]);
+        hi[c] = a[3+c] + s*(b[3+c] - a[3+c]);
+    }
+    return slab_hit(lo, hi, r, tmin, tmax);
+}
+
+bool motion_bvh::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+    if (!intersect(r, t_min, t_max, rec))
+        return false;
+    finalize_hit(r, rec);
+    return true;
+}
+
+bool motion_bvh::intersect(const ray& r, float t_min, float t_max, hit_record& rec) const {
+    if (nodes.empty())
+        return false;
+
+    int k;
+    float s;
+    key_of(r.time(), k, s);
+
+    int stack[64];
+    int stack_size = 0;
+    int current = 0;
+    bool hit_anything = false;
+    for (;;) {
+        const motion_bvh_node& node = nodes[current];
+        RT_COUNT(node_visits, 1);
+        if (node_hit(current, r, k, s, t_min, t_max)) {
+            if (node.count > 0) {
+                RT_COUNT(primitive_tests, node.count);
+                for (int i = 0; i < node.count; i++) {
+                    if (prims[node.offset + i]->intersect(r, t_min, t_max, rec)) {
+                        hit_anything = true;
+                        t_max = rec.t;
+                    }
+                }
+                if (stack_size == 0)
+                    break;
+                current = stack[--stack_size];
+            }
+            else if (r.sign(node.axis)) {
+                stack[stack_size++] = current + 1;
+                current = node.offset;
+            }
+            else {
+                stack[stack_size++] = node.offset;
+                current = current + 1;
+            }
+        }
+        else {
+            if (stack_size == 0)
+                break;
+            current = stack[--stack_size];
+        }
+    }
+    return hit_anything;
+}
+
+bool motion_bvh::occluded(const ray& r, float t_min, float t_max) const {
+    if (nodes.empty())
+        return false;
+
+    int k;
+    float s;
+    key_of(r.time(), k, s);
+    int stack[64];
+    int stack_size = 0;
+    int current = 0;
+    for (;;) {
+        const motion_bvh_node& node = nodes[current];
+        RT_COUNT(node_visits, 1);
+        if (node_hit(current, r, k, s, t_min, t_max)) {
+            if (node.count > 0) {
+                RT_COUNT(primitive_tests, node.count);
+                for (int i = 0; i < node.count; i++)
+                    if (prims[node.offset + i]->occluded(r, t_min, t_max))
+                        return true;
+                if (stack_size == 0)
+                    break;
+                current = stack[--stack_size];
+            }
+            else {
+                stack[stack_size++] = node.offset;
+                current = current + 1;
+            }
+        }
+        else {
+            if (stack_size == 0)
+                break;
+            current = stack[--stack_size];
+        }
+    }
+    return false;
+}
+
+#endif
@@ -0,0 +1,812 @@
+#ifndef SCENEFILEH
+#define SCENEFILEH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include "../common/mapped_file.h"
+#include "../common/mesh_io.h"
+#include "scenes.h"
+
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <sys/stat.h>
+#include <unordered_map>
+#include <vector>
+
+
+// Scenes described in a text file rather than built in C++, one statement per line, # to the end
+// of a line a comment:
+//
+//   camera fx fy fz  ax ay az  vfov [aperture focus_dist]
+//   world list|bvh
+//   texture name constant r g b | checker odd even | noise scale | image file world_height
+//   material name lambertian tex | metal r g b fuzz | dielectric ri | diffuse_light tex
+//                 | isotropic tex
+//   sphere cx cy cz radius mat
+//   moving_sphere x0 y0 z0  x1 y1 z1  t0 t1 radius mat
+//   xy_rect x0 x1 y0 y1 k mat   (and xz_rect x0 x1 z0 z1 k, yz_rect y0 y1 z0 z1 k)
+//   box x0 y0 z0  x1 y1 z1 mat
+//   mesh file.obj|ply mat
+//   medium object density tex
+//   group list|bvh ... end
+//
+// Textures and materials are referred to by name, and defined before they are used. A shape, a
+// medium or a group's end may be followed by modifiers:
+//
+//   flip                       turn the normals around, as flip_normals does
+//   scale s, rotate_y degrees, translate x y z
+//                              place it, scaling first and translating last, whatever the order
+//   as name                    name it, so that a medium can fill it
+//   hidden                     leave it out of the scene, for a boundary only a medium uses
+//
+// The world, and each group, is a hittable_list or a BVH of what is in it. Files named in a scene
+// are found relative to the scene file.
+//
+// A parsed scene is a handful of flat arrays of plain records, which is also the layout of its
+// binary cache: a header followed by the arrays, one after the other, and then the linear_bvh of
+// every BVH group, nodes and primitive order as they were built. A cache is used in place from a
+// memory mapping, with nothing to parse: the trees' nodes are traversed right where they are
+// mapped, so processes rendering the same scene share their pages, and only the primitive
+// pointers are made anew.
+
+enum scene_texture_kind { scene_constant, scene_checker, scene_noise, scene_image };
+enum scene_material_kind { scene_lambertian, scene_metal, scene_dielectric, scene_diffuse_light,
+                           scene_isotropic };
+enum scene_object_kind { scene_sphere, scene_moving_sphere, scene_xy_rect, scene_xz_rect,
+                         scene_yz_rect, scene_box, scene_mesh, scene_medium, scene_group };
+
+// Object flags.
+const int32_t scene_flip = 1;
+const int32_t scene_hidden = 2;
+const int32_t scene_placed = 4;
+const int32_t scene_bvh = 8;
+
+struct scene_texture_record {
+    int32_t kind;
+    int32_t arg[2];     // checker: the odd and even textures; image: the file, in the strings
+    float value[3];     // constant: the color; noise: the scale; image: the world height
+};
+
+struct scene_material_record {
+    int32_t kind;
+    int32_t texture;    // lambertian, diffuse_light, isotropic
+    float value[4];     // metal: albedo and fuzz; dielectric: refractive index
+};
+
+// Objects come in file order, so a group's contents follow it, down to the object before end.
+struct scene_object_record {
+    int32_t kind;
+    int32_t flags;
+    int32_t material;   // the texture, for a medium
+    int32_t parent;     // the enclosing group, or -1
+    int32_t ref;        // medium: the boundary; mesh: the file; group: one past its last object
+    float param[9];     // the numbers of the statement, in order
+    float angle;        // placement, if flags has scene_placed
+    float scale;
+    float offset[3];
+};
+
+struct scene_camera_record {
+    float lookfrom[3];
+    float lookat[3];
+    float vfov;
+    float aperture;
+    float focus_dist;
+};
+
+// A scene's records wherever they are, in a parsed scene_description or a mapped cache.
+struct scene_view {
+    scene_camera_record camera;
+    int32_t world_flags;
+    const scene_texture_record *textures;
+    int texture_count;
+    const scene_material_record *materials;
+    int material_count;
+    const scene_object_record *objects;
+    int object_count;
+    const char *strings;
+    int string_bytes;
+    const char *trees;      // prebuilt linear_bvh trees, from a cache
+    int tree_count;
+    size_t tree_bytes;
+};
+
+struct scene_description {
+    scene_description() : world_flags(0) {
+        scene_camera_record c = { { 13, 2, 3 }, { 0, 0, 0 }, 20, 0, 10 };
+        camera = c;
+    }
+
+    scene_view view() const {
+        scene_view v;
+        v.camera = camera;
+        v.world_flags = world_flags;
+        v.textures = textures.empty() ? 0 : &textures[0];
+        v.texture_count = int(textures.size());
+        v.materials = materials.empty() ? 0 : &materials[0];
+        v.material_count = int(materials.size());
+        v.objects = objects.empty() ? 0 : &objects[0];
+        v.object_count = int(objects.size());
+        v.strings = strings.empty() ? 0 : &strings[0];
+        v.string_bytes = int(strings.size());
+        v.trees = 0;
+        v.tree_count = 0;
+        v.tree_bytes = 0;
+        return v;
+    }
+
+    // Adds s to the strings and returns its offset.
+    int32_t add_string(const std::string& s) {
+        int32_t offset = int32_t(strings.size());
+        strings.insert(strings.end(), s.begin(), s.end());
+        strings.push_back(0);
+        return offset;
+    }
+
+    scene_camera_record camera;
+    int32_t world_flags;
+    std::vector<scene_texture_record> textures;
+    std::vector<scene_material_record> materials;
+    std::vector<scene_object_record> objects;
+    std::vector<char> strings;
+};
+
+
+// 64-bit FNV-1a, continuing from h, which is what a cache records of the text it was made from.
+inline uint64_t scene_text_hash(const char *p, size_t n, uint64_t h = 14695981039346656037ULL) {
+    for (size_t i = 0; i < n; i++)
+        h = (h ^ (unsigned char)p[i]) * 1099511628211ULL;
+    return h;
+}
+
+// The text's hash with the path, size and modification time of each mesh file v loads folded in,
+// since the prebuilt trees hold the meshes' bounds: replacing a mesh puts a cache out of date just
+// as editing the text does.
+inline uint64_t scene_source_hash(uint64_t text_hash, const scene_view& v) {
+    uint64_t h = text_hash;
+    for (int i = 0; i < v.object_count; i++) {
+        if (v.objects[i].kind != scene_mesh)
+            continue;
+        const char *path = v.strings + v.objects[i].ref;
+        h = scene_text_hash(path, strlen(path) + 1, h);
+        struct stat st;
+        int64_t stamp[2] = { -1, -1 };
+        if (stat(path, &st) == 0) {
+            stamp[0] = int64_t(st.st_size);
+            stamp[1] = int64_t(st.st_mtime);
+        }
+        h = scene_text_hash((const char*)stamp, sizeof(stamp), h);
+    }
+    return h;
+}
+
+// The directory part of path, with its trailing slash, or nothing if it has none.
+inline std::string scene_directory(const char *path) {
+    const char *slash = strrchr(path, '/');
+    return slash ? std::string(path, slash + 1) : std::string();
+}
+
+
+// Parses the text of a scene file. Errors are reported as path:line and leave desc part-filled.
+class scene_parser {
+    public:
+        scene_parser(const char *file_path, scene_description& d)
+            : path(file_path), dir(scene_directory(file_path)), desc(d), line(1) {}
+
+        bool parse(const char *begin, const char *end);
+
+    private:
+        bool error(const std::string& message) {
+            std::cerr << path << ":" << line << ": " << message << "\n";
+            return false;
+        }
+        bool numbers(mesh_reader& in, float *v, int n) {
+            for (int i = 0; i < n; i++) {
+                double d;
+                if (in.at_line_end() || !in.number(d))
+                    return false;
+                v[i] = float(d);
+            }
+            return true;
+        }
+        bool lookup(const std::unordered_map<std::string, int>& names, const std::string& name,
+                    const char *what, int32_t& index) {
+            std::unordered_map<std::string, int>::const_iterator it = names.find(name);
+            if (it == names.end())
+                return error(std::string("unknown ") + what + " " + name);
+            index = it->second;
+            return true;
+        }
+        bool texture_statement(mesh_reader& in);
+        bool material_statement(mesh_reader& in);
+        bool object_statement(mesh_reader& in, const std::string& kind);
+        bool modifiers(mesh_reader& in, scene_object_record& o, int index);
+
+        const char *path;
+        std::string dir;
+        scene_description& desc;
+        int line;
+        std::unordered_map<std::string, int> textures, materials, objects;
+        std::vector<int> open_groups;
+};
+
+bool scene_parser::parse(const char *begin, const char *end) {
+    mesh_reader in(begin, end);
+    for (; !in.at_end(); in.skip_line(), line++) {
+        if (in.at_line_end())
+            continue;
+        std::string kind = in.token();
+        bool ok;
+        if (kind == "camera") {
+            scene_camera_record& c = desc.camera;
+            ok = numbers(in, c.lookfrom, 3) && numbers(in, c.lookat, 3) && numbers(in, &c.vfov, 1);
+            if (ok && !in.at_line_end())
+                ok = numbers(in, &c.aperture, 1) && numbers(in, &c.focus_dist, 1);
+            if (!ok)
+                return error("bad camera");
+        }
+        else if (kind == "world") {
+            std::string accel = in.token();
+            if (accel != "list" && accel != "bvh")
+                return error("world is list or bvh");
+            desc.world_flags = accel == "bvh" ? scene_bvh : 0;
+            ok = true;
+        }
+        else if (kind == "texture")
+            ok = texture_statement(in);
+        else if (kind == "material")
+            ok = material_statement(in);
+        else if (kind == "end") {
+            if (open_groups.empty())
+                return error("end without group");
+            int g = open_groups.back();
+            open_groups.pop_back();
+            desc.objects[g].ref = int32_t(desc.objects.size());
+            ok = modifiers(in, desc.objects[g], g);
+        }
+        else
+            ok = object_statement(in, kind);
+        if (!ok)
+            return false;
+        if (!in.at_line_end())
+            return error("unexpected " + in.token());
+    }
+    if (!open_groups.empty())
+        return error("group without end");
+    return true;
+}
+
+bool scene_parser::texture_statement(mesh_reader& in) {
+    std::string name = in.token();
+    std::string kind = in.token();
+    scene_texture_record t;
+    memset(&t, 0, sizeof(t));
+    if (kind == "constant") {
+        t.kind = scene_constant;
+        if (!numbers(in, t.value, 3))
+            return error("bad constant texture");
+    }
+    else if (kind == "checker") {
+        t.kind = scene_checker;
+        if (!lookup(textures, in.token(), "texture", t.arg[0])
+                || !lookup(textures, in.token(), "texture", t.arg[1]))
+            return false;
+    }
+    else if (kind == "noise") {
+        t.kind = scene_noise;
+        if (!numbers(in, t.value, 1))
+            return error("bad noise texture");
+    }
+    else if (kind == "image") {
+        t.kind = scene_image;
+        std::string file = in.token();
+        if (file.empty() || !numbers(in, t.value, 1))
+            return error("bad image texture");
+        t.arg[0] = desc.add_string(file[0] == '/' ? file : dir + file);
+    }
+    else
+        return error("unknown texture kind " + kind);
+    textures[name] = int(desc.textures.size());
+    desc.textures.push_back(t);
+    return true;
+}
+
+bool scene_parser::material_statement(mesh_reader& in) {
+    std::string name = in.token();
+    std::string kind = in.token();
+    scene_material_record m;
+    memset(&m, 0, sizeof(m));
+    m.texture = -1;
+    if (kind == "lambertian" || kind == "diffuse_light" || kind == "isotropic") {
+        m.kind = kind == "lambertian" ? scene_lambertian
+               : kind == "diffuse_light" ? scene_diffuse_light : scene_isotropic;
+        if (!lookup(textures, in.token(), "texture", m.texture))
+            return false;
+    }
+    else if (kind == "metal") {
+        m.kind = scene_metal;
+        if (!numbers(in, m.value, 4))
+            return error("bad metal");
+    }
+    else if (kind == "dielectric") {
+        m.kind = scene_dielectric;
+        if (!numbers(in, m.value, 1))
+            return error("bad dielectric");
+    }
+    else
+        return error("unknown material kind " + kind);
+    materials[name] = int(desc.materials.size());
+    desc.materials.push_back(m);
+    return true;
+}
+
+bool scene_parser::object_statement(mesh_reader& in, const std::string& kind) {
+    scene_object_record o;
+    memset(&o, 0, sizeof(o));
+    o.parent = open_groups.empty() ? -1 : open_groups.back();
+    o.ref = -1;
+    o.scale = 1;
+    int n;
+    if (kind == "sphere") { o.kind = scene_sphere; n = 4; }
+    else if (kind == "moving_sphere") { o.kind = scene_moving_sphere; n = 9; }
+    else if (kind == "xy_rect") { o.kind = scene_xy_rect; n = 5; }
+    else if (kind == "xz_rect") { o.kind = scene_xz_rect; n = 5; }
+    else if (kind == "yz_rect") { o.kind = scene_yz_rect; n = 5; }
+    else if (kind == "box") { o.kind = scene_box; n = 6; }
+    else if (kind == "mesh") { o.kind = scene_mesh; n = 0; }
+    else if (kind == "medium") { o.kind = scene_medium; n = 0; }
+    else if (kind == "group") { o.kind = scene_group; n = 0; }
+    else
+        return error("unknown statement " + kind);
+
+    if (o.kind == scene_mesh) {
+        std::string file = in.token();
+        if (file.empty())
+            return error("bad mesh");
+        o.ref = desc.add_string(file[0] == '/' ? file : dir + file);
+    }
+    if (o.kind == scene_medium) {
+        if (!lookup(objects, in.token(), "object", o.ref))
+            return false;
+        if (!numbers(in, o.param, 1))
+            return error("bad medium");
+        return lookup(textures, in.token(), "texture", o.material)
+               && modifiers(in, o, int(desc.objects.size()));
+    }
+    if (o.kind == scene_group) {
+        std::string accel = in.token();
+        if (accel != "list" && accel != "bvh")
+            return error("group is list or bvh");
+        o.flags = accel == "bvh" ? scene_bvh : 0;
+        open_groups.push_back(int(desc.objects.size()));
+        desc.objects.push_back(o);
+        return true;
+    }
+    if (!numbers(in, o.param, n))
+        return error("bad " + kind);
+    return lookup(materials, in.token(), "material", o.material)
+           && modifiers(in, o, int(desc.objects.size()));
+}
+
+// Reads the modifiers after an object and stores it as object index. Groups are stored when they
+// open, so theirs are written back in place.
+bool scene_parser::modifiers(mesh_reader& in, scene_object_record& o, int index) {
+    while (!in.at_line_end()) {
+        std::string m = in.token();
+        if (m == "flip")
+            o.flags |= scene_flip;
+        else if (m == "hidden")
+            o.flags |= scene_hidden;
+        else if (m == "scale" || m == "rotate_y" || m == "translate") {
+            float *v = m == "scale" ? &o.scale : m == "rotate_y" ? &o.angle : o.offset;
+            if (!numbers(in, v, m == "translate" ? 3 : 1))
+                return error("bad " + m);
+            o.flags |= scene_placed;
+        }
+        else if (m == "as") {
+            std::string name = in.token();
+            if (name.empty())
+                return error("as needs a name");
+            objects[name] = index;
+        }
+        else
+            return error("unknown modifier " + m);
+    }
+    if (index == int(desc.objects.size()))
+        desc.objects.push_back(o);
+    return true;
+}
+
+
+// A BVH the builder made over list, kept so that it can be written to the cache.
+struct scene_tree {
+    const linear_bvh *tree;
+    hittable **list;
+    int n;
+};
+
+// Turns scene records into hittables in the arena, in file order, so that the objects and what
+// the random stream draws while making them come out as they would from the C++ builders. With
+// -bvh linear, the view's prebuilt trees, if it has any, stand in for building each BVH group.
+// Every mesh is parsed by a task in scene_loads() from the start, so the meshes parse at once, and
+// alongside the objects before them and the BVHs over those.
+class scene_builder {
+    public:
+        scene_builder(arena& a, const scene_view& v)
+            : trees_built(0), scene(a), view(v), textures(v.texture_count),
+              materials(v.material_count), objects(v.object_count), meshes(v.object_count),
+              mesh_loaded(v.object_count, 0), mesh_parsed(v.object_count), next_tree(v.trees),
+              tree_bytes_left(v.tree_bytes), trees_left(v.tree_count) {}
+        // The parse tasks write into the builder, so it outlives them.
+        ~scene_builder() {
+            for (size_t i = 0; i < mesh_parsed.size(); i++)
+                if (mesh_parsed[i].valid())
+                    mesh_parsed[i].wait();
+        }
+
+        hittable *build();
+
+        std::vector<scene_tree> trees;  // every linear_bvh made, in the order they were made
+        int trees_built;                // how many of them there was no prebuilt tree for
+
+    private:
+        bool build_range(int first, int end, int parent, std::vector<hittable*>& list);
+        hittable *build_object(const scene_object_record& o);
+        hittable *collection(std::vector<hittable*>& list, int32_t flags);
+        linear_bvh *prebuilt_tree(hittable **l, int n);
+
+        arena& scene;
+        const scene_view& view;
+        std::vector<texture*> textures;
+        std::vector<material*> materials;
+        std::vector<hittable*> objects;
+        // Indexed like objects; only the entries for meshes are used.
+        std::vector<mesh_data> meshes;
+        std::vector<char> mesh_loaded;
+        std::vector<std::future<void> > mesh_parsed;
+        const char *next_tree;
+        size_t tree_bytes_left;
+        int trees_left;
+};
+
+hittable *scene_builder::build() {
+    for (int i = 0; i < view.object_count; i++) {
+        if (view.objects[i].kind == scene_mesh) {
+            const char *path = view.strings + view.objects[i].ref;
+            mesh_parsed[i] = scene_loads().run([this, i, path]() {
+                mesh_loaded[i] = load_mesh(path, meshes[i]);
+            });
+        }
+    }
+    for (int i = 0; i < view.texture_count; i++) {
+        const scene_texture_record& t = view.textures[i];
+        if (t.kind == scene_constant)
+            textures[i] = scene.make<constant_texture>(vec3(t.value[0], t.value[1], t.value[2]));
+        else if (t.kind == scene_checker)
+            textures[i] = scene.make<checker_texture>(textures[t.arg[1]], textures[t.arg[0]]);
+        else if (t.kind == scene_noise)
+            textures[i] = scene.make<noise_texture>(t.value[0]);
+        else
+            textures[i] = load_image_texture(scene, view.strings + t.arg[0], t.value[0]);
+    }
+    for (int i = 0; i < view.material_count; i++) {
+        const scene_material_record& m = view.materials[i];
+        if (m.kind == scene_lambertian)
+            materials[i] = scene.make<lambertian>(textures[m.texture]);
+        else if (m.kind == scene_metal)
+            materials[i] = scene.make<metal>(vec3(m.value[0], m.value[1], m.value[2]), m.value[3]);
+        else if (m.kind == scene_dielectric)
+            materials[i] = scene.make<dielectric>(m.value[0]);
+        else if (m.kind == scene_diffuse_light)
+            materials[i] = scene.make<diffuse_light>(textures[m.texture]);
+        else
+            materials[i] = scene.make<isotropic>(textures[m.texture]);
+    }
+    std::vector<hittable*> list;
+    if (!build_range(0, view.object_count, -1, list))
+        return 0;
+    return collection(list, view.world_flags);
+}
+
+bool scene_builder::build_range(int first, int end, int parent, std::vector<hittable*>& list) {
+    for (int i = first; i < end; ) {
+        const scene_object_record& o = view.objects[i];
+        hittable *h;
+        int next = i + 1;
+        if (o.kind == scene_group) {
+            std::vector<hittable*> members;
+            if (!build_range(i + 1, o.ref, i, members))
+                return false;
+            h = collection(members, o.flags);
+            next = o.ref;
+        }
+        else if (!(h = build_object(o)))
+            return false;
+        if (o.flags & scene_flip)
+            h = scene.make<flip_normals>(h);
+        if (o.flags & scene_placed) {
+            affine_transform placement = affine_transform::translation(
+                                             vec3(o.offset[0], o.offset[1], o.offset[2]));
+            if (o.angle != 0)
+                placement = placement * affine_transform::rotation_y(o.angle);
+            if (o.scale != 1)
+                placement = placement * affine_transform::scaling(o.scale);
+            h = scene.make<instance>(h, placement);
+        }
+        objects[i] = h;
+        if (!(o.flags & scene_hidden) && o.parent == parent)
+            list.push_back(h);
+        i = next;
+    }
+    return true;
+}
+
+hittable *scene_builder::build_object(const scene_object_record& o) {
+    const float *p = o.param;
+    material *m = o.kind == scene_medium ? 0 : materials[o.material];
+    switch (o.kind) {
+        case scene_sphere:
+            return scene.make<sphere>(vec3(p[0], p[1], p[2]), p[3], m);
+        case scene_moving_sphere:
+            return scene.make<moving_sphere>(vec3(p[0], p[1], p[2]), vec3(p[3], p[4], p[5]),
+                                             p[6], p[7], p[8], m);
+        case scene_xy_rect:
+            return scene.make<xy_rect>(p[0], p[1], p[2], p[3], p[4], m);
+        case scene_xz_rect:
+            return scene.make<xz_rect>(p[0], p[1], p[2], p[3], p[4], m);
+        case scene_yz_rect:
+            return scene.make<yz_rect>(p[0], p[1], p[2], p[3], p[4], m);
+        case scene_box:
+            return scene.make<box>(vec3(p[0], p[1], p[2]), vec3(p[3], p[4], p[5]), m);
+        case scene_medium:
+            return medium(scene, objects[o.ref], p[0], textures[o.material]);
+        default: {
+            size_t i = &o - view.objects;
+            mesh_parsed[i].wait();
+            if (!mesh_loaded[i])
+                return 0;
+            return scene.make<triangle_mesh>(std::move(meshes[i]), m);
+        }
+    }
+}
+
+hittable *scene_builder::collection(std::vector<hittable*>& list, int32_t flags) {
+    int n = int(list.size());
+    hittable **l = scene.make_array<hittable*>(n > 0 ? n : 1);
+    for (int i = 0; i < n; i++)
+        l[i] = list[i];
+    if (!(flags & scene_bvh) || n == 0)
+        return scene.make<hittable_list>(l, n);
+    if (scene_accel != accel_linear)
+        return make_bvh(scene, l, n, 0.0, 1.0);
+    linear_bvh *tree = prebuilt_tree(l, n);
+    if (!tree) {
+        tree = scene.make<linear_bvh>(l, n, 0.0, 1.0);
+        trees_built++;
+    }
+    scene_tree t = { tree, l, n };
+    trees.push_back(t);
+    return tree;
+}
+
+// Each prebuilt tree is two counts, the nodes and the primitive order. They are taken in turn,
+// until one does not fit the group it should belong to or is not a tree that can be adopted over
+// it; that one and the rest are built instead.
+linear_bvh *scene_builder::prebuilt_tree(hittable **l, int n) {
+    int32_t counts[2];
+    if (trees_left == 0 || tree_bytes_left < sizeof(counts))
+        return 0;
+    memcpy(counts, next_tree, sizeof(counts));
+    size_t bytes = sizeof(counts) + size_t(uint32_t(counts[1]))*sizeof(linear_bvh_node)
+                 + size_t(uint32_t(n))*sizeof(uint32_t);
+    if (counts[0] != n || counts[1] < 0 || bytes > tree_bytes_left) {
+        trees_left = 0;
+        return 0;
+    }
+    const linear_bvh_node *nodes = (const linear_bvh_node*)(next_tree + sizeof(counts));
+    const uint32_t *order = (const uint32_t*)(nodes + counts[1]);
+    if (!linear_bvh_adoptable(l, n, nodes, int(counts[1]), order, n, 0.0, 1.0)) {
+        trees_left = 0;
+        return 0;
+    }
+    next_tree += bytes;
+    tree_bytes_left -= bytes;
+    trees_left--;
+    return scene.make<linear_bvh>(l, nodes, int(counts[1]), order, n);
+}
+
+
+const uint32_t scene_cache_magic = 0x32535452;   // "RTS2"
+
+struct scene_cache_header {
+    uint32_t magic;
+    uint32_t record_bytes;      // the sizes of the three records, packed, to catch layout changes
+    uint64_t source_hash;       // of the text and mesh files the cache was made from
+    scene_camera_record camera;
+    int32_t world_flags;
+    int32_t texture_count;
+    int32_t material_count;
+    int32_t object_count;
+    int32_t string_bytes;       // a multiple of 4, so that the trees after them stay aligned
+    int32_t tree_count;
+    uint64_t tree_bytes;
+};
+
+inline uint32_t scene_cache_record_bytes() {
+    return uint32_t(sizeof(scene_texture_record)) | uint32_t(sizeof(scene_material_record)) << 8
+           | uint32_t(sizeof(scene_object_record)) << 16 | uint32_t(sizeof(linear_bvh_node)) << 24;
+}
+
+// Writes the records of v and the trees after them. The file is written to a temporary and
+// renamed over path, so that a half-written cache is never seen, and a process that has the old
+// one mapped keeps it.
+bool save_scene_cache(const char *path, const scene_view& v, uint64_t source_hash,
+                      const std::vector<scene_tree>& trees) {
+    std::vector<char> tree_data;
+    for (size_t t = 0; t < trees.size(); t++) {
+        const linear_bvh& tree = *trees[t].tree;
+        std::vector<uint32_t> order = tree.primitive_order(trees[t].list, trees[t].n);
+        int32_t counts[2] = { int32_t(order.size()), int32_t(tree.node_count) };
+        const char *parts[3] = { (const char*)counts, (const char*)tree.nodes,
+                                 order.empty() ? 0 : (const char*)&order[0] };
+        size_t sizes[3] = { sizeof(counts), tree.node_count*sizeof(linear_bvh_node),
+                            order.size()*sizeof(uint32_t) };
+        for (int k = 0; k < 3; k++)
+            tree_data.insert(tree_data.end(), parts[k], parts[k] + sizes[k]);
+    }
+
+    scene_cache_header h;
+    memset(&h, 0, sizeof(h));
+    h.magic = scene_cache_magic;
+    h.record_bytes = scene_cache_record_bytes();
+    h.source_hash = source_hash;
+    h.camera = v.camera;
+    h.world_flags = v.world_flags;
+    h.texture_count = v.texture_count;
+    h.material_count = v.material_count;
+    h.object_count = v.object_count;
+    h.string_bytes = (v.string_bytes + 3) & ~3;
+    h.tree_count = int32_t(trees.size());
+    h.tree_bytes = tree_data.size();
+    std::string tmp = std::string(path) + ".tmp";
+    {
+        std::ofstream out(tmp.c_str(), std::ios::binary);
+        if (!out)
+            return false;
+        const char padding[4] = { 0, 0, 0, 0 };
+        out.write((const char*)&h, sizeof(h));
+        out.write((const char*)v.textures, v.texture_count*sizeof(scene_texture_record));
+        out.write((const char*)v.materials, v.material_count*sizeof(scene_material_record));
+        out.write((const char*)v.objects, v.object_count*sizeof(scene_object_record));
+        out.write(v.strings, v.string_bytes);
+        out.write(padding, h.string_bytes - v.string_bytes);
+        if (!tree_data.empty())
+            out.write(&tree_data[0], tree_data.size());
+        if (!out)
+            return false;
+    }
+    return rename(tmp.c_str(), path) == 0;
+}
+
+// Points v into a mapped cache. Returns false if it is not a cache of text with text_hash, or
+// the mesh files it loads have changed since it was made.
+bool view_scene_cache(const mapped_file& f, uint64_t text_hash, scene_view& v) {
+    scene_cache_header h;
+    if (f.size() < sizeof(h))
+        return false;
+    memcpy(&h, f.data(), sizeof(h));
+    if (h.magic != scene_cache_magic || h.record_bytes != scene_cache_record_bytes()
+            || h.texture_count < 0 || h.material_count < 0 || h.object_count < 0
+            || h.string_bytes < 0 || h.tree_count < 0 || h.tree_bytes > f.size())
+        return false;
+    size_t size = sizeof(h) + size_t(h.texture_count)*sizeof(scene_texture_record)
+                + size_t(h.material_count)*sizeof(scene_material_record)
+                + size_t(h.object_count)*sizeof(scene_object_record) + size_t(h.string_bytes)
+                + size_t(h.tree_bytes);
+    if (f.size() != size)
+        return false;
+    const char *p = f.data() + sizeof(h);
+    v.camera = h.camera;
+    v.world_flags = h.world_flags;
+    v.textures = (const scene_texture_record*)p;
+    v.texture_count = h.texture_count;
+    p += h.texture_count*sizeof(scene_texture_record);
+    v.materials = (const scene_material_record*)p;
+    v.material_count = h.material_count;
+    p += h.material_count*sizeof(scene_material_record);
+    v.objects = (const scene_object_record*)p;
+    v.object_count = h.object_count;
+    p += h.object_count*sizeof(scene_object_record);
+    v.strings = p;
+    v.string_bytes = h.string_bytes;
+    p += h.string_bytes;
+    v.trees = p;
+    v.tree_count = h.tree_count;
+    v.tree_bytes = size_t(h.tree_bytes);
+    // The mesh paths are read before anything else is, so they have to be strings in the cache.
+    for (int i = 0; i < v.object_count; i++) {
+        int32_t ref = v.objects[i].ref;
+        if (v.objects[i].kind == scene_mesh
+                && (ref < 0 || ref >= v.string_bytes || !memchr(v.strings + ref, 0,
+                                                                v.string_bytes - ref)))
+            return false;
+    }
+    return h.source_hash == scene_source_hash(text_hash, v);
+}
+
+
+// A scene loaded from a file, the mapping its records and trees may live in, and the cache it
+// should be written to.
+struct scene_file {
+    scene_file() : cache_path(0), source_hash(0), from_cache(false) {}
+
+    scene_view view;
+    scene_description desc;
+    mapped_file cache;
+    const char *cache_path;
+    uint64_t source_hash;
+    bool from_cache;
+};
+
+// Loads the scene in path. With a cache_path, a cache made from the same text and mesh files is
+// used instead of parsing it.
+bool load_scene_file(const char *path, const char *cache_path, scene_file& s) {
+    mapped_file text;
+    if (!text.open(path)) {
+        std::cerr << "could not open " << path << "\n";
+        return false;
+    }
+    s.cache_path = cache_path;
+    uint64_t text_hash = scene_text_hash(text.data(), text.size());
+    s.from_cache = cache_path && s.cache.open(cache_path)
+                   && view_scene_cache(s.cache, text_hash, s.view);
+    if (s.from_cache) {
+        s.source_hash = scene_source_hash(text_hash, s.view);
+        return true;
+    }
+    s.cache.close();
+    scene_parser parser(path, s.desc);
+    if (!parser.parse(text.data(), text.data() + text.size()))
+        return false;
+    s.view = s.desc.view();
+    s.source_hash = scene_source_hash(text_hash, s.view);
+    return true;
+}
+
+// Builds the scene loaded in s. Its cache, if it has one, is written when it was missing or out of
+// date, or has fewer prebuilt trees than there were BVHs to build. The scene's BVHs may use the
+// mapped cache, so s must outlive the render.
+hittable *build_scene(arena& scene, scene_file& s) {
+    scene_builder builder(scene, s.view);
+    hittable *world = builder.build();
+    if (world && s.cache_path && (!s.from_cache || builder.trees_built > 0)
+            && !save_scene_cache(s.cache_path, s.view, s.source_hash, builder.trees))
+        std::cerr << "could not write " << s.cache_path << "\n";
+    return world;
+}
+
+camera record_camera(const scene_camera_record& c, int nx, int ny, float time0 = 0,
+                     float time1 = 1) {
+    return camera(vec3(c.lookfrom[0], c.lookfrom[1], c.lookfrom[2]),
+                  vec3(c.lookat[0], c.lookat[1], c.lookat[2]), vec3(0,1,0), c.vfov,
+                  float(nx)/float(ny), c.aperture, c.focus_dist, time0, time1);
+}
+
+camera scene_view_camera(const scene_view& v, int nx, int ny, float time0 = 0, float time1 = 1) {
+    return record_camera(v.camera, nx, ny, time0, time1);
+}
+
+#endif
@@ -0,0 +1,616 @@
+#ifndef SCENESH
+#define SCENESH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include "../common/arena.h"
+#include "../common/box.h"
+#include "../common/bvh.h"
+#include "../common/bvh4.h"
+#include "../common/camera.h"
+#include "../common/compressed_bvh.h"
+#include "../common/constant_medium.h"
+#include "../common/framebuffer.h"
+#include "../common/hittable_list.h"
+#include "../common/instance.h"
+#include "../common/linear_bvh.h"
+#include "../common/moving_sphere.h"
+#include "../common/paged_mesh.h"
+#include "../common/random.h"
+#include "../common/render_stats.h"
+#include "../common/roulette.h"
+#include "../common/stb_image.h"
+#include "../common/surface_texture.h"
+#include "../common/task_group.h"
+#include "../common/tile_scheduler.h"
+#include "../common/trace.h"
+#include "../common/triangle_mesh.h"
+#include "aarect.h"
+#include "grid_medium.h"
+#include "material.h"
+#include "motion_bvh.h"
+#include "sphere.h"
+#include "texture.h"
+
+#include <float.h>
+#include <iostream>
+#include <string>
+#include <vector>
+
+
+// The built-in scenes and the path tracer that renders them, shared by main.cc and bench.cc.
+
+// Past this many bounces paths go through Russian roulette; -1 turns it off.
+int roulette_depth = 3;
+
+// The ray is the axis of a cone that is width across at its origin and widens by spread per unit
+// of distance; rec.footprint is the cone's width where it hits. Bounces carry the cone on as if
+// off a mirror, which keeps the footprints of scattered rays small enough not to blur textures.
+// throughput is what the radiance r brings back will be scaled by, roulette included.
+vec3 color(const ray& r, hittable *world, int depth, float width, float spread,
+           const vec3& throughput) {
+    hit_record rec;
+    random_begin_bounce(depth+1);
+    RT_COUNT(rays, 1);
+    RT_COUNT_DEPTH(depth, 1);
+    if (world->hit(r, 0, MAXFLOAT, rec)) { 
+        rec.footprint = width + spread * rec.t * r.direction().length();
+        ray scattered;
+        vec3 attenuation;
+        vec3 emitted = rec.mat_ptr->emitted(rec.u, rec.v, rec.p);
+        if (depth < 50 && rec.mat_ptr->scatter(r, rec, attenuation, scattered)) {
+             vec3 next = throughput*attenuation;
+             float q = roulette_survival(depth, roulette_depth, next[0], next[1], next[2]);
+             if (q < 1) {
+                 if (random_double() >= q)
+                     return emitted;
+                 attenuation /= q;
+                 next /= q;
+             }
+             return emitted + attenuation*color(scattered, world, depth+1, rec.footprint, spread,
+                                                next);
+        }
+        else 
+            return emitted;
+    }
+    else 
+        return vec3(0,0,0);
+}
+
+// Acceleration structure the scene builders wrap around large groups of objects, chosen with
+// -bvh. The bvh_node trees are remembered so that -stats can report on them.
+enum accel_kind { accel_linear, accel_sah, accel_median, accel_bvh4, accel_compressed, accel_motion };
+accel_kind scene_accel = accel_linear;
+std::vector<bvh_node*> scene_bvhs;
+// Keys of bounds over the shutter for -bvh motion, set with -motion-segments.
+int motion_segments = 4;
+
+// How -frames brings the bvh_node trees to each frame's shutter, set with -bvh-update: refit
+// them, refit and rotate them, or build them again every frame. The first two still build again
+// once a tree has grown too costly.
+enum bvh_update_kind { bvh_update_refit, bvh_update_rotate, bvh_update_rebuild };
+bvh_update_kind scene_bvh_update = bvh_update_rotate;
+
+hittable *make_bvh(arena& scene, hittable **l, int n, float time0, float time1) {
+    if (scene_accel == accel_linear)
+        return scene.make<linear_bvh>(l, n, time0, time1);
+    if (scene_accel == accel_motion)
+        return scene.make<motion_bvh>(l, n, time0, time1, motion_segments);
+    if (scene_accel == accel_bvh4)
+        return scene.make<bvh4>(l, n, time0, time1);
+    if (scene_accel == accel_compressed)
+        return scene.make<compressed_bvh>(l, n, time0, time1);
+    bvh_node *node = scene.make<bvh_node>(l, n, time0, time1,
+                                          scene_accel == accel_sah ? bvh_split_sah : bvh_split_median);
+    scene_bvhs.push_back(node);
+    return node;
+}
+
+// Brings every tree in scene_bvhs to the shutter [time0, time1]. A tree made inside another was
+// made first, so it is up to date by the time the outer one asks for its box. Returns how many
+// trees were built again.
+int update_scene_bvhs(float time0, float time1) {
+    bvh_split_method method = scene_accel == accel_median ? bvh_split_median : bvh_split_sah;
+    int rebuilt = 0;
+    for (size_t i = 0; i < scene_bvhs.size(); i++) {
+        if (scene_bvh_update == bvh_update_rebuild) {
+            scene_bvhs[i]->rebuild(time0, time1, method);
+            rebuilt++;
+        }
+        else if (scene_bvhs[i]->update(time0, time1, scene_bvh_update == bvh_update_rotate,
+                                       method))
+            rebuilt++;
+    }
+    return rebuilt;
+}
+
+// An instance of p turned by angle degrees about y and then moved by offset, in place of the
+// book's translate(rotate_y(p)): one transform instead of two wrappers.
+hittable *place(arena& scene, hittable *p, float angle, const vec3& offset) {
+    return scene.make<instance>(p, affine_transform::translation(offset)
+                                   * affine_transform::rotation_y(angle));
+}
+
+// A constant_medium of the given density filling boundary, scattering isotropically with albedo.
+hittable *medium(arena& scene, hittable *boundary, float density, texture *albedo) {
+    return scene.make<constant_medium>(boundary, density, scene.make<isotropic>(albedo));
+}
+
+// Grid points per side of the volumes that noise textures on static spheres are baked into, set
+// with -noise-volume. 0 evaluates the noise in full at every lookup.
+int noise_volume_size = 0;
+
+void bake_noise(noise_texture *t, const vec3& center, float radius) {
+    if (noise_volume_size > 0)
+        t->bake(center - vec3(radius, radius, radius), center + vec3(radius, radius, radius),
+                noise_volume_size);
+}
+
+// Decoding images and parsing meshes, which go on while the scene builders carry on with BVHs.
+task_group& scene_loads() {
+    // Made first so that it is destroyed last: decodes still going at exit fill it.
+    image_texture_cache();
+    static task_group loads;
+    return loads;
+}
+
+// An image_texture from an image file, for a surface world_height across in v. Only the file's
+// header is read here; the image is decoded and its mip pyramid built by a task in scene_loads(),
+// and lookups that come before the task is done wait for it. The texture cache keeps its own
+// copy of the texels, so the decoded image is freed straight away.
+texture *load_image_texture(arena& scene, const char *path, float world_height) {
+    int nx, ny, nn;
+    if (!stbi_info(path, &nx, &ny, &nn)) {
+        std::cerr << "could not load " << path << "\n";
+        return scene.make<constant_texture>(vec3(0.5, 0.5, 0.5));
+    }
+    int id = image_texture_cache().reserve();
+    std::string file(path);
+    scene_loads().run([file, id]() {
+        trace_zone zone("texture load");
+        int w, h, n;
+        unsigned char *tex_data = stbi_load(file.c_str(), &w, &h, &n, 3);
+        if (!tex_data) {
+            // A file that is cut short, say: it stays the grey a missing one gets.
+            std::cerr << "could not load " << file << "\n";
+            unsigned char grey[3] = { 128, 128, 128 };
+            image_texture_cache().fill(id, grey, 1, 1);
+            return;
+        }
+        image_texture_cache().fill(id, tex_data, w, h);
+        stbi_image_free(tex_data);
+    });
+    return scene.make<image_texture>(id, nx, ny, world_height);
+}
+
+hittable *earth(arena& scene) {
+    //texture *tex = load_image_texture(scene, "tiled.jpg", 2*M_PI);
+    texture *tex = load_image_texture(scene, "earthmap.jpg", 2*M_PI);
+    material *mat =  scene.make<lambertian>(tex);
+    return scene.make<sphere>(vec3(0,0, 0), 2, mat);
+}
+
+hittable *two_spheres(arena& scene) {
+    texture *checker = scene.make<checker_texture>( scene.make<constant_texture>(vec3(0.2,0.3, 0.1)), scene.make<constant_texture>(vec3(0.9, 0.9, 0.9)));
+    int n = 50;
+    hittable **list = scene.make_array<hittable*>(n+1);
+    list[0] =  scene.make<sphere>(vec3(0,-10, 0), 10, scene.make<lambertian>( checker));
+    list[1] =  scene.make<sphere>(vec3(0, 10, 0), 10, scene.make<lambertian>( checker));
+
+    return scene.make<hittable_list>(list,2);
+}
+
+hittable *final(arena& scene) {
+    int nb = 20;
+    hittable **list = scene.make_array<hittable*>(30);
+    hittable **boxlist = scene.make_array<hittable*>(10000);
+    hittable **boxlist2 = scene.make_array<hittable*>(10000);
+    material *white = scene.make<lambertian>( scene.make<constant_texture>(vec3(0.73, 0.73, 0.73)) );
+    material *ground = scene.make<lambertian>( scene.make<constant_texture>(vec3(0.48, 0.83, 0.53)) );
+    int b = 0;
+    for (int i = 0; i < nb; i++) {
+        for (int j = 0; j < nb; j++) {
+            float w = 100;
+            float x0 = -1000 + i*w;
+            float z0 = -1000 + j*w;
+            float y0 = 0;
+            float x1 = x0 + w;
+            float y1 = 100*(random_double()+0.01);
+            float z1 = z0 + w;
+            boxlist[b++] = scene.make<box>(vec3(x0,y0,z0), vec3(x1,y1,z1), ground);
+        }
+    }
+    int l = 0;
+    list[l++] = make_bvh(scene, boxlist, b, 0, 1);
+    material *light = scene.make<diffuse_light>( scene.make<constant_texture>(vec3(7, 7, 7)) );
+    list[l++] = scene.make<xz_rect>(123, 423, 147, 412, 554, light);
+    vec3 center(400, 400, 200);
+    list[l++] = scene.make<moving_sphere>(center, center+vec3(30, 0, 0), 0, 1, 50, scene.make<lambertian>(scene.make<constant_texture>(vec3(0.7, 0.3, 0.1))));
+    list[l++] = scene.make<sphere>(vec3(260, 150, 45), 50, scene.make<dielectric>(1.5));
+    list[l++] = scene.make<sphere>(vec3(0, 150, 145), 50, scene.make<metal>(vec3(0.8, 0.8, 0.9), 10.0));
+    hittable *boundary = scene.make<sphere>(vec3(360, 150, 145), 70, scene.make<dielectric>(1.5));
+    list[l++] = boundary;
+    list[l++] = medium(scene, boundary, 0.2, scene.make<constant_texture>(vec3(0.2, 0.4, 0.9)));
+    boundary = scene.make<sphere>(vec3(0, 0, 0), 5000, scene.make<dielectric>(1.5));
+    list[l++] = medium(scene, boundary, 0.0001, scene.make<constant_texture>(vec3(1.0, 1.0, 1.0)));
+    material *emat =  scene.make<lambertian>(load_image_texture(scene, "earthmap.jpg", 100*M_PI));
+    list[l++] = scene.make<sphere>(vec3(400,200, 400), 100, emat);
+    noise_texture *pertext = scene.make<noise_texture>(0.1);
+    bake_noise(pertext, vec3(220,280, 300), 80);
+    list[l++] =  scene.make<sphere>(vec3(220,280, 300), 80, scene.make<lambertian>( pertext ));
+    int ns = 1000;
+    for (int j = 0; j < ns; j++) {
+        boxlist2[j] = scene.make<sphere>(vec3(165*random_double(), 165*random_double(), 165*random_double()), 10, white);
+    }
+    list[l++] =   place(scene, make_bvh(scene, boxlist2,ns, 0.0, 1.0), 15, vec3(-100,270,395));
+    return make_bvh(scene, list,l, 0.0, 1.0);
+}
+
+hittable *cornell_final(arena& scene) {
+    hittable **list = scene.make_array<hittable*>(30);
+    hittable **boxlist = scene.make_array<hittable*>(10000);
+    texture *pertext = scene.make<noise_texture>(0.1);
+    material *mat =  scene.make<lambertian>(load_image_texture(scene, "earthmap.jpg", 50*M_PI));
+    int i = 0;
+    material *red = scene.make<lambertian>( scene.make<constant_texture>(vec3(0.65, 0.05, 0.05)) );
+    material *white = scene.make<lambertian>( scene.make<constant_texture>(vec3(0.73, 0.73, 0.73)) );
+    material *green = scene.make<lambertian>( scene.make<constant_texture>(vec3(0.12, 0.45, 0.15)) );
+    material *light = scene.make<diffuse_light>( scene.make<constant_texture>(vec3(7, 7, 7)) );
+    //list[i++] = scene.make<sphere>(vec3(260, 50, 145), 50,mat);
+    list[i++] = scene.make<flip_normals>(scene.make<yz_rect>(0, 555, 0, 555, 555, green));
+    list[i++] = scene.make<yz_rect>(0, 555, 0, 555, 0, red);
+    list[i++] = scene.make<xz_rect>(123, 423, 147, 412, 554, light);
+    list[i++] = scene.make<flip_normals>(scene.make<xz_rect>(0, 555, 0, 555, 555, white));
+    list[i++] = scene.make<xz_rect>(0, 555, 0, 555, 0, white);
+    list[i++] = scene.make<flip_normals>(scene.make<xy_rect>(0, 555, 0, 555, 555, white));
+    /*
+    hittable *boundary = scene.make<sphere>(vec3(160, 50, 345), 50, scene.make<dielectric>(1.5));
+    list[i++] = boundary;
+    list[i++] = medium(scene, boundary, 0.2, scene.make<constant_texture>(vec3(0.2, 0.4, 0.9)));
+    list[i++] = scene.make<sphere>(vec3(460, 50, 105), 50, scene.make<dielectric>(1.5));
+    list[i++] = scene.make<sphere>(vec3(120, 50, 205), 50, scene.make<lambertian>(pertext));
+    int ns = 10000;
+    for (int j = 0; j < ns; j++) {
+        boxlist[j] = scene.make<sphere>(vec3(165*random_double(), 330*random_double(), 165*random_double()), 10, white);
+    }
+    list[i++] =   place(scene, make_bvh(scene, boxlist,ns, 0.0, 1.0), 15, vec3(265,0,295));
+    */
+    hittable *boundary2 = place(scene, scene.make<box>(vec3(0, 0, 0), vec3(165, 165, 165), scene.make<dielectric>(1.5)), -18, vec3(130,0,65));
+    list[i++] = boundary2;
+    list[i++] = medium(scene, boundary2, 0.2, scene.make<constant_texture>(vec3(0.9, 0.9, 0.9)));
+    return scene.make<hittable_list>(list,i);
+}
+
+hittable *cornell_balls(arena& scene) {
+    hittable **list = scene.make_array<hittable*>(9);
+    int i = 0;
+    material *red = scene.make<lambertian>( scene.make<constant_texture>(vec3(0.65, 0.05, 0.05)) );
+    material *white = scene.make<lambertian>( scene.make<constant_texture>(vec3(0.73, 0.73, 0.73)) );
+    material *green = scene.make<lambertian>( scene.make<constant_texture>(vec3(0.12, 0.45, 0.15)) );
+    material *light = scene.make<diffuse_light>( scene.make<constant_texture>(vec3(5, 5, 5)) );
+    list[i++] = scene.make<flip_normals>(scene.make<yz_rect>(0, 555, 0, 555, 555, green));
+    list[i++] = scene.make<yz_rect>(0, 555, 0, 555, 0, red);
+    list[i++] = scene.make<xz_rect>(113, 443, 127, 432, 554, light);
+    list[i++] = scene.make<flip_normals>(scene.make<xz_rect>(0, 555, 0, 555, 555, white));
+    list[i++] = scene.make<xz_rect>(0, 555, 0, 555, 0, white);
+    list[i++] = scene.make<flip_normals>(scene.make<xy_rect>(0, 555, 0, 555, 555, white));
+    hittable *boundary = scene.make<sphere>(vec3(160, 100, 145), 100, scene.make<dielectric>(1.5));
+    list[i++] = boundary;
+    list[i++] = medium(scene, boundary, 0.1, scene.make<constant_texture>(vec3(1.0, 1.0, 1.0)));
+    list[i++] = place(scene, scene.make<box>(vec3(0, 0, 0), vec3(165, 330, 165), white), 15, vec3(265,0,295));
+    return scene.make<hittable_list>(list,i);
+}
+
+hittable *cornell_smoke(arena& scene) {
+    hittable **list = scene.make_array<hittable*>(8);
+    int i = 0;
+    material *red = scene.make<lambertian>( scene.make<constant_texture>(vec3(0.65, 0.05, 0.05)) );
+    material *white = scene.make<lambertian>( scene.make<constant_texture>(vec3(0.73, 0.73, 0.73)) );
+    material *green = scene.make<lambertian>( scene.make<constant_texture>(vec3(0.12, 0.45, 0.15)) );
+    material *light = scene.make<diffuse_light>( scene.make<constant_texture>(vec3(7, 7, 7)) );
+    list[i++] = scene.make<flip_normals>(scene.make<yz_rect>(0, 555, 0, 555, 555, green));
+    list[i++] = scene.make<yz_rect>(0, 555, 0, 555, 0, red);
+    list[i++] = scene.make<xz_rect>(113, 443, 127, 432, 554, light);
+    list[i++] = scene.make<flip_normals>(scene.make<xz_rect>(0, 555, 0, 555, 555, white));
+    list[i++] = scene.make<xz_rect>(0, 555, 0, 555, 0, white);
+    list[i++] = scene.make<flip_normals>(scene.make<xy_rect>(0, 555, 0, 555, 555, white));
+    hittable *b1 = place(scene, scene.make<box>(vec3(0, 0, 0), vec3(165, 165, 165), white), -18, vec3(130,0,65));
+    hittable *b2 = place(scene, scene.make<box>(vec3(0, 0, 0), vec3(165, 330, 165), white), 15, vec3(265,0,295));
+    list[i++] = medium(scene, b1, 0.01, scene.make<constant_texture>(vec3(1.0, 1.0, 1.0)));
+    list[i++] = medium(scene, b2, 0.01, scene.make<constant_texture>(vec3(0.0, 0.0, 0.0)));
+    return scene.make<hittable_list>(list,i);
+}
+
+// The Cornell box around a cloud: a 64^3 grid of turbulent density inside a ball, which thins out
+// towards the ball's edge and is empty beyond it.
+hittable *cornell_cloud(arena& scene) {
+    hittable **list = scene.make_array<hittable*>(8);
+    int i = 0;
+    material *red = scene.make<lambertian>( scene.make<constant_texture>(vec3(0.65, 0.05, 0.05)) );
+    material *white = scene.make<lambertian>( scene.make<constant_texture>(vec3(0.73, 0.73, 0.73)) );
+    material *green = scene.make<lambertian>( scene.make<constant_texture>(vec3(0.12, 0.45, 0.15)) );
+    material *light = scene.make<diffuse_light>( scene.make<constant_texture>(vec3(7, 7, 7)) );
+    list[i++] = scene.make<flip_normals>(scene.make<yz_rect>(0, 555, 0, 555, 555, green));
+    list[i++] = scene.make<yz_rect>(0, 555, 0, 555, 0, red);
+    list[i++] = scene.make<xz_rect>(113, 443, 127, 432, 554, light);
+    list[i++] = scene.make<flip_normals>(scene.make<xz_rect>(0, 555, 0, 555, 555, white));
+    list[i++] = scene.make<xz_rect>(0, 555, 0, 555, 0, white);
+    list[i++] = scene.make<flip_normals>(scene.make<xy_rect>(0, 555, 0, 555, 555, white));
+    const int n = 64;
+    std::vector<float> density(n*n*n);
+    perlin noise;
+    for (int z = 0; z < n; z++) {
+        for (int y = 0; y < n; y++) {
+            for (int x = 0; x < n; x++) {
+                vec3 p(2*(x+0.5f)/n - 1, 2*(y+0.5f)/n - 1, 2*(z+0.5f)/n - 1);
+                float falloff = 1 - p.length();
+                density[(size_t(z)*n + y)*n + x] =
+                    falloff > 0 ? 0.5f * falloff * noise.turb(4*p) : 0;
+            }
+        }
+    }
+    list[i++] = scene.make<grid_medium>(&density[0], n, n, n, vec3(128, 80, 128),
+                                        vec3(428, 380, 428),
+                                        scene.make<constant_texture>(vec3(0.9, 0.9, 0.9)));
+    return scene.make<hittable_list>(list,i);
+}
+
+hittable *cornell_box(arena& scene) {
+    hittable **list = scene.make_array<hittable*>(8);
+    int i = 0;
+    material *red = scene.make<lambertian>( scene.make<constant_texture>(vec3(0.65, 0.05, 0.05)) );
+    material *white = scene.make<lambertian>( scene.make<constant_texture>(vec3(0.73, 0.73, 0.73)) );
+    material *green = scene.make<lambertian>( scene.make<constant_texture>(vec3(0.12, 0.45, 0.15)) );
+    material *light = scene.make<diffuse_light>( scene.make<constant_texture>(vec3(15, 15, 15)) );
+    list[i++] = scene.make<flip_normals>(scene.make<yz_rect>(0, 555, 0, 555, 555, green));
+    list[i++] = scene.make<yz_rect>(0, 555, 0, 555, 0, red);
+    list[i++] = scene.make<xz_rect>(213, 343, 227, 332, 554, light);
+    list[i++] = scene.make<flip_normals>(scene.make<xz_rect>(0, 555, 0, 555, 555, white));
+    list[i++] = scene.make<xz_rect>(0, 555, 0, 555, 0, white);
+    list[i++] = scene.make<flip_normals>(scene.make<xy_rect>(0, 555, 0, 555, 555, white));
+    list[i++] = place(scene, scene.make<box>(vec3(0, 0, 0), vec3(165, 165, 165), white), -18, vec3(130,0,65));
+    list[i++] = place(scene, scene.make<box>(vec3(0, 0, 0), vec3(165, 330, 165), white), 15, vec3(265,0,295));
+    return scene.make<hittable_list>(list,i);
+}
+
+// Ten thousand copies of one cluster of spheres, each turned and scaled at random. The cluster's
+// BVH is stored once and every copy is an instance of it; a BVH over the instances is the top level.
+hittable *instances(arena& scene) {
+    int nb = 100;
+    hittable **cluster = scene.make_array<hittable*>(nb);
+    material *white = scene.make<lambertian>( scene.make<constant_texture>(vec3(0.73, 0.73, 0.73)) );
+    for (int j = 0; j < nb; j++) {
+        vec3 center(2*random_double() - 1, 2*random_double(), 2*random_double() - 1);
+        cluster[j] = scene.make<sphere>(center, 0.15, white);
+    }
+    hittable *cluster_bvh = make_bvh(scene, cluster, nb, 0, 1);
+
+    int n = 100;
+    hittable **copies = scene.make_array<hittable*>(n*n);
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) {
+            affine_transform placement = affine_transform::translation(vec3(3*(i - n/2), 0, 3*(j - n/2)))
+                                       * affine_transform::rotation_y(360*random_double())
+                                       * affine_transform::scaling(0.5 + 0.5*random_double());
+            copies[i*n + j] = scene.make<instance>(cluster_bvh, placement);
+        }
+    }
+    hittable **list = scene.make_array<hittable*>(3);
+    texture *checker = scene.make<checker_texture>( scene.make<constant_texture>(vec3(0.2,0.3, 0.1)), scene.make<constant_texture>(vec3(0.9, 0.9, 0.9)));
+    list[0] = make_bvh(scene, copies, n*n, 0, 1);
+    list[1] = scene.make<sphere>(vec3(0,-1000,0), 1000, scene.make<lambertian>( checker));
+    list[2] = scene.make<sphere>(vec3(0, 400, 0), 200, scene.make<diffuse_light>( scene.make<constant_texture>(vec3(4, 4, 4))));
+    return scene.make<hittable_list>(list,3);
+}
+
+// The mesh given with -mesh, scaled to stand 330 units tall (or as wide, if that is smaller) on
+// the floor of the Cornell box. With -mesh-cache it is paged in from disk, keeping at most
+// mesh_cache_bytes of it in memory; the paged meshes are remembered so that -stats can report on
+// them.
+const char *mesh_path = 0;
+size_t mesh_cache_bytes = 0;
+std::vector<paged_mesh*> scene_paged_meshes;
+
+hittable *cornell_mesh(arena& scene) {
+    mesh_data mesh;
+    if (!load_mesh(mesh_path, mesh))
+        return 0;
+    float lo[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, hi[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+    for (size_t v = 0; v < mesh.positions.size(); v++) {
+        lo[v%3] = ffmin(lo[v%3], mesh.positions[v]);
+        hi[v%3] = ffmax(hi[v%3], mesh.positions[v]);
+    }
+    float size = ffmax(hi[1] - lo[1], ffmax(hi[0] - lo[0], hi[2] - lo[2]) * 330.0f / 400.0f);
+    float scale = size > 0 ? 330.0f / size : 1.0f;
+    vec3 offset(278 - scale*0.5f*(lo[0] + hi[0]), -scale*lo[1], 278 - scale*0.5f*(lo[2] + hi[2]));
+    for (size_t v = 0; v < mesh.positions.size(); v++)
+        mesh.positions[v] = scale*mesh.positions[v] + offset[v%3];
+
+    hittable **list = scene.make_array<hittable*>(7);
+    int i = 0;
+    material *red = scene.make<lambertian>( scene.make<constant_texture>(vec3(0.65, 0.05, 0.05)) );
+    material *white = scene.make<lambertian>( scene.make<constant_texture>(vec3(0.73, 0.73, 0.73)) );
+    material *green = scene.make<lambertian>( scene.make<constant_texture>(vec3(0.12, 0.45, 0.15)) );
+    material *light = scene.make<diffuse_light>( scene.make<constant_texture>(vec3(15, 15, 15)) );
+    list[i++] = scene.make<flip_normals>(scene.make<yz_rect>(0, 555, 0, 555, 555, green));
+    list[i++] = scene.make<yz_rect>(0, 555, 0, 555, 0, red);
+    list[i++] = scene.make<xz_rect>(213, 343, 227, 332, 554, light);
+    list[i++] = scene.make<flip_normals>(scene.make<xz_rect>(0, 555, 0, 555, 555, white));
+    list[i++] = scene.make<xz_rect>(0, 555, 0, 555, 0, white);
+    list[i++] = scene.make<flip_normals>(scene.make<xy_rect>(0, 555, 0, 555, 555, white));
+    if (mesh_cache_bytes > 0) {
+        paged_mesh *paged = scene.make<paged_mesh>(std::move(mesh), white, mesh_cache_bytes);
+        scene_paged_meshes.push_back(paged);
+        list[i++] = paged;
+    }
+    else
+        list[i++] = scene.make<triangle_mesh>(std::move(mesh), white);
+    return scene.make<hittable_list>(list,i);
+}
+
+hittable *two_perlin_spheres(arena& scene) {
+    noise_texture *pertext = scene.make<noise_texture>(4);
+    bake_noise(pertext, vec3(0, 2, 0), 2);
+    hittable **list = scene.make_array<hittable*>(2);
+    list[0] =  scene.make<sphere>(vec3(0,-1000, 0), 1000, scene.make<lambertian>( pertext ));
+    list[1] =  scene.make<sphere>(vec3(0, 2, 0), 2, scene.make<lambertian>( pertext ));
+    return scene.make<hittable_list>(list,2);
+}
+
+hittable *simple_light(arena& scene) {
+    noise_texture *pertext = scene.make<noise_texture>(4);
+    bake_noise(pertext, vec3(0, 2, 0), 2);
+    hittable **list = scene.make_array<hittable*>(4);
+    list[0] =  scene.make<sphere>(vec3(0,-1000, 0), 1000, scene.make<lambertian>( pertext ));
+    list[1] =  scene.make<sphere>(vec3(0, 2, 0), 2, scene.make<lambertian>( pertext ));
+    list[2] =  scene.make<sphere>(vec3(0, 7, 0), 2, scene.make<diffuse_light>( scene.make<constant_texture>(vec3(4,4,4))));
+    list[3] =  scene.make<xy_rect>(3, 5, 1, 3, -2, scene.make<diffuse_light>(scene.make<constant_texture>(vec3(4,4,4))));
+    return scene.make<hittable_list>(list,4);
+}
+
+// A crowd of balls sweeping several of their own widths across the floor during the shutter,
+// bouncing as they go along paths of four straight segments. Trees that bound each ball's whole
+// path overlap all along the sweep; -bvh motion bounds them where they are at the ray's time.
+hittable *bouncing_balls(arena& scene) {
+    int n = 4000;
+    hittable **balls = scene.make_array<hittable*>(n);
+    for (int i = 0; i < n; i++) {
+        vec3 center(40*random_double() - 20, 0.2, 40*random_double() - 20);
+        float height = 0.5*random_double();
+        float phase = random_double();
+        vec3 drift(6*(1 + 0.2*random_double()), 0, 0.5*(random_double() - 0.5));
+        vec3 path[5];
+        for (int k = 0; k < 5; k++) {
+            float t = k / 4.0f;
+            path[k] = vec3(0, height*fabs(sin(M_PI*(phase + t))), 0) + t*drift;
+        }
+        material *m = scene.make<lambertian>(scene.make<constant_texture>(
+            vec3(random_double(), random_double(), random_double())));
+        balls[i] = scene.make<keyframe_translate>(scene.make<sphere>(center, 0.2, m), path, 5,
+                                                  0.0, 1.0);
+    }
+    hittable **list = scene.make_array<hittable*>(3);
+    texture *checker = scene.make<checker_texture>( scene.make<constant_texture>(vec3(0.2,0.3, 0.1)), scene.make<constant_texture>(vec3(0.9, 0.9, 0.9)));
+    list[0] = make_bvh(scene, balls, n, 0.0, 1.0);
+    list[1] = scene.make<sphere>(vec3(0,-1000,0), 1000, scene.make<lambertian>( checker));
+    list[2] = scene.make<sphere>(vec3(0, 400, 0), 200, scene.make<diffuse_light>( scene.make<constant_texture>(vec3(4, 4, 4))));
+    return scene.make<hittable_list>(list, 3);
+}
+
+hittable *random_scene(arena& scene) {
+    int n = 50000;
+    hittable **list = scene.make_array<hittable*>(n+1);
+    texture *checker = scene.make<checker_texture>( scene.make<constant_texture>(vec3(0.2,0.3, 0.1)), scene.make<constant_texture>(vec3(0.9, 0.9, 0.9)));
+    list[0] =  scene.make<sphere>(vec3(0,-1000,0), 1000, scene.make<lambertian>( checker));
+    int i = 1;
+    for (int a = -10; a < 10; a++) {
+        for (int b = -10; b < 10; b++) {
+            float choose_mat = random_double();
+            vec3 center(a+0.9*random_double(),0.2,b+0.9*random_double()); 
+            if ((center-vec3(4,0.2,0)).length() > 0.9) { 
+                if (choose_mat < 0.8) {  // diffuse
+                    list[i++] = scene.make<moving_sphere>(center, center+vec3(0,0.5*random_double(), 0), 0.0, 1.0, 0.2, scene.make<lambertian>(scene.make<constant_texture>(vec3(random_double()*random_double(), random_double()*random_double(), random_double()*random_double()))));
+                }
+                else if (choose_mat < 0.95) { // metal
+                    list[i++] = scene.make<sphere>(center, 0.2,
+                            scene.make<metal>(vec3(0.5*(1 + random_double()), 0.5*(1 + random_double()), 0.5*(1 + random_double())),  0.5*random_double()));
+                }
+                else {  // glass
+                    list[i++] = scene.make<sphere>(center, 0.2, scene.make<dielectric>(1.5));
+                }
+            }
+        }
+    }
+
+    list[i++] = scene.make<sphere>(vec3(0, 1, 0), 1.0, scene.make<dielectric>(1.5));
+    list[i++] = scene.make<sphere>(vec3(-4, 1, 0), 1.0, scene.make<lambertian>(scene.make<constant_texture>(vec3(0.4, 0.2, 0.1))));
+    list[i++] = scene.make<sphere>(vec3(4, 1, 0), 1.0, scene.make<metal>(vec3(0.7, 0.6, 0.5), 0.0));
+
+    //return scene.make<hittable_list>(list,i);
+    return make_bvh(scene, list,i, 0.0, 1.0);
+}
+
+struct scene_entry {
+    const char *name;
+    hittable *(*build)(arena& scene);
+    vec3 lookfrom;
+    vec3 lookat;
+    float vfov;
+};
+
+scene_entry scenes[] = {
+    { "random_scene",       random_scene,       vec3(13,2,3),       vec3(0,0,0),     20 },
+    { "two_spheres",        two_spheres,        vec3(13,2,3),       vec3(0,0,0),     20 },
+    { "two_perlin_spheres", two_perlin_spheres, vec3(13,2,3),       vec3(0,0,0),     20 },
+    { "earth",              earth,              vec3(13,2,3),       vec3(0,0,0),     20 },
+    { "simple_light",       simple_light,       vec3(26,3,6),       vec3(0,2,0),     20 },
+    { "cornell_box",        cornell_box,        vec3(278,278,-800), vec3(278,278,0), 40 },
+    { "cornell_balls",      cornell_balls,      vec3(278,278,-800), vec3(278,278,0), 40 },
+    { "cornell_smoke",      cornell_smoke,      vec3(278,278,-800), vec3(278,278,0), 40 },
+    { "cornell_final",      cornell_final,      vec3(278,278,-800), vec3(278,278,0), 40 },
+    { "cornell_cloud",      cornell_cloud,      vec3(278,278,-800), vec3(278,278,0), 40 },
+    { "final",              final,              vec3(478,278,-600), vec3(278,278,0), 40 },
+    { "cornell_mesh",       cornell_mesh,       vec3(278,278,-800), vec3(278,278,0), 40 },
+    { "instances",          instances,          vec3(30,10,30),     vec3(0,0,0),     40 },
+    { "bouncing_balls",     bouncing_balls,     vec3(0,8,30),       vec3(0,1,0),     40 },
+};
+const int nscenes = sizeof(scenes) / sizeof(scenes[0]);
+
+camera scene_camera(const scene_entry& s, int nx, int ny, float time0 = 0, float time1 = 1) {
+    float dist_to_focus = 10.0;
+    float aperture = 0.0;
+    return camera(s.lookfrom, s.lookat, vec3(0,1,0), s.vfov, float(nx)/float(ny), aperture,
+                  dist_to_focus, time0, time1);
+}
+
+// Camera rays are made a block at a time, for about this many samples.
+const int camera_batch_samples = 4096;
+
+// Traces samples [first_sample, first_sample + samples) of every pixel in rows [y0, y0 + sum.ny)
+// of a frame sum.nx by ny, and stores their sums in sum, whose row 0 is row y0 of the frame. The
+// scheduler's tiles cover just those rows.
+void render_samples(hittable *world, const camera& cam, int ny, int y0, int first_sample,
+                    int samples, unsigned int seed, tile_scheduler& scheduler, framebuffer& sum) {
+    int nx = sum.nx;
+    scheduler.run([&](const tile& t) {
+        tile frame_tile = { t.x0, y0 + t.y0, t.x1, y0 + t.y1, t.index };
+        int pixels = (t.x1 - t.x0) * (t.y1 - t.y0);
+        int batch = camera_batch_samples / pixels > 1 ? camera_batch_samples / pixels : 1;
+        // Each pixel adds up its samples in order, batch after batch.
+        std::vector<vec3> cols(pixels, vec3(0, 0, 0));
+        camera_rays rays;
+        for (int s0 = first_sample; s0 < first_sample + samples; s0 += batch) {
+            int n = first_sample + samples - s0 < batch ? first_sample + samples - s0 : batch;
+            cam.generate_rays(frame_tile, nx, ny, s0, n, seed, rays);
+            for (size_t k = 0; k < rays.size(); k++) {
+                random_resume_sample(rays.sample_key(k), 0);
+                cols[k / n] += color(rays.get(k), world, 0, 0, cam.pixel_spread(ny),
+                                     vec3(1,1,1));
+            }
+        }
+        int k = 0;
+        for (int j = t.y1-1; j >= t.y0; j--)
+            for (int i = t.x0; i < t.x1; i++, k++)
+                sum.set(i, j, cols[k][0], cols[k][1], cols[k][2]);
+    });
+}
+
+// Traces ns samples for every pixel of fb, tile by tile on the scheduler's threads.
+void render(hittable *world, const camera& cam, int ns, unsigned int seed,
+            tile_scheduler& scheduler, framebuffer& fb) {
+    render_samples(world, cam, fb.ny, 0, 0, ns, seed, scheduler, fb);
+    // Scaled the way vec3::operator/= does it.
+    float scale = 1.0f / float(ns);
+    for (size_t k = 0; k < fb.pixels.size(); k++)
+        fb.pixels[k] *= scale;
+}
+
+#endif
@@ -0,0 +1,104 @@
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include "../common/hittable.h"
+#include "../common/random.h"
+
+#include <chrono>
+#include <iostream>
+#include <stdlib.h>
+#include <vector>
+
+
+// Times slab_hit() against the box test it replaced, which divides by the direction four times
+// per axis and returns as soon as one axis misses, on random boxes and rays, and checks that the
+// two agree. Usage: slab_bench [boxes] [rays]
+
+// The old aabb::hit().
+bool divide_slab_hit(const aabb& box, const ray& r, float tmin, float tmax) {
+    for (int a = 0; a < 3; a++) {
+        float t0 = ffmin((box.min()[a] - r.origin()[a]) / r.direction()[a],
+                         (box.max()[a] - r.origin()[a]) / r.direction()[a]);
+        float t1 = ffmax((box.min()[a] - r.origin()[a]) / r.direction()[a],
+                         (box.max()[a] - r.origin()[a]) / r.direction()[a]);
+        tmin = ffmax(t0, tmin);
+        tmax = ffmin(t1, tmax);
+        if (tmax <= tmin)
+            return false;
+    }
+    return true;
+}
+
+vec3 random_in_cube(float size) {
+    return vec3(size*(2*random_double() - 1), size*(2*random_double() - 1),
+                size*(2*random_double() - 1));
+}
+
+template <class F> double time_tests(const std::vector<aabb>& boxes, const std::vector<ray>& rays,
+                                     F test, int& hits) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    hits = 0;
+    for (size_t i = 0; i < rays.size(); i++)
+        for (size_t j = 0; j < boxes.size(); j++)
+            hits += test(boxes[j], rays[i]);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() * 1e9 / (double(rays.size()) * boxes.size());
+}
+
+struct divide_test {
+    bool operator()(const aabb& box, const ray& r) const {
+        return divide_slab_hit(box, r, 0.001, FLT_MAX);
+    }
+};
+
+struct slab_test {
+    bool operator()(const aabb& box, const ray& r) const { return box.hit(r, 0.001, FLT_MAX); }
+};
+
+int main(int argc, char **argv) {
+    int nboxes = argc > 1 ? atoi(argv[1]) : 1000;
+    int nrays = argc > 2 ? atoi(argv[2]) : 20000;
+    random_seed(1, 0);
+
+    std::vector<aabb> boxes;
+    for (int i = 0; i < nboxes; i++) {
+        vec3 c = random_in_cube(10);
+        vec3 half(random_double(), random_double(), random_double());
+        boxes.push_back(aabb(c - half, c + half));
+    }
+    // One ray in eight runs along an axis, so the tests also meet infinite inverse directions.
+    std::vector<ray> rays;
+    for (int i = 0; i < nrays; i++) {
+        vec3 d = random_in_cube(1);
+        if (i % 8 == 0) {
+            int a = i / 8 % 3;
+            d = vec3(0, 0, 0);
+            d[a] = random_double() < 0.5 ? -1 : 1;
+        }
+        rays.push_back(ray(random_in_cube(12), d));
+    }
+
+    int divide_hits, slab_hits;
+    double divide_ns = time_tests(boxes, rays, divide_test(), divide_hits);
+    double slab_ns = time_tests(boxes, rays, slab_test(), slab_hits);
+
+    int disagree = 0;
+    for (size_t i = 0; i < rays.size(); i++)
+        for (size_t j = 0; j < boxes.size(); j++)
+            disagree += divide_test()(boxes[j], rays[i]) != slab_test()(boxes[j], rays[i]);
+
+    std::cout << boxes.size() << " boxes x " << rays.size() << " rays, "
+              << divide_hits << " hits\n";
+    std::cout << "divide:   " << divide_ns << " ns per test\n";
+    std::cout << "slab_hit: " << slab_ns << " ns per test (" << slab_hits << " hits)\n";
+    std::cout << disagree << " tests disagree\n";
+    return disagree != 0;
+}
@@ -11,7 +11,7 @@
 // with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
 //==================================================================================================
 
-#include "hittable.h"
+#include "../common/hittable.h"
 
 
 class sphere: public hittable  {
@@ -20,6 +20,10 @@ class sphere: public hittable  {
         sphere(vec3 cen, float r, material *m) : center(cen), radius(r), mat_ptr(m)  {};
         virtual bool hit(const ray& r, float tmin, float tmax, hit_record& rec) const;
         virtual bool bounding_box(float t0, float t1, aabb& box) const;
+        virtual bool hit_interval(const ray& r, float& t_enter, float& t_exit) const;
+        virtual bool occluded(const ray& r, float t_min, float t_max) const;
+        virtual bool intersect(const ray& r, float t_min, float t_max, hit_record& rec) const;
+        virtual void finalize(const ray& r, hit_record& rec) const;
         vec3 center;
         float radius;
         material *mat_ptr;
@@ -31,7 +35,37 @@ bool sphere::bounding_box(float t0, float t1, aabb& box) const {
     return true;
 }
 
-bool sphere::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+// Both roots at once, computed as hit() computes them.
+bool sphere::hit_interval(const ray& r, float& t_enter, float& t_exit) const {
+    vec3 oc = r.origin() - center;
+    float a = dot(r.direction(), r.direction());
+    float b = dot(oc, r.direction());
+    float c = dot(oc, oc) - radius*radius;
+    float discriminant = b*b - a*c;
+    if (discriminant <= 0)
+        return false;
+    t_enter = (-b - sqrt(b*b-a*c))/a;
+    t_exit = (-b + sqrt(b*b-a*c))/a;
+    return t_exit > t_enter;
+}
+
+// The roots as hit() finds them, without the point, normal and uv.
+bool sphere::occluded(const ray& r, float t_min, float t_max) const {
+    vec3 oc = r.origin() - center;
+    float a = dot(r.direction(), r.direction());
+    float b = dot(oc, r.direction());
+    float c = dot(oc, oc) - radius*radius;
+    float discriminant = b*b - a*c;
+    if (discriminant <= 0)
+        return false;
+    float temp = (-b - sqrt(b*b-a*c))/a;
+    if (temp < t_max && temp > t_min)
+        return true;
+    temp = (-b + sqrt(b*b-a*c))/a;
+    return temp < t_max && temp > t_min;
+}
+
+bool sphere::intersect(const ray& r, float t_min, float t_max, hit_record& rec) const {
     vec3 oc = r.origin() - center;
     float a = dot(r.direction(), r.direction());
     float b = dot(oc, r.direction());
@@ -41,25 +75,34 @@ bool sphere::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
         float temp = (-b - sqrt(b*b-a*c))/a;
         if (temp < t_max && temp > t_min) {
             rec.t = temp;
-            rec.p = r.point_at_parameter(rec.t);
-            get_sphere_uv((rec.p-center)/radius, rec.u, rec.v);
-            rec.normal = (rec.p - center) / radius;
-            rec.mat_ptr = mat_ptr;
+            rec.prim = this;
             return true;
         }
         temp = (-b + sqrt(b*b-a*c))/a;
         if (temp < t_max && temp > t_min) {
             rec.t = temp;
-            rec.p = r.point_at_parameter(rec.t);
-            get_sphere_uv((rec.p-center)/radius, rec.u, rec.v);
-            rec.normal = (rec.p - center) / radius;
-            rec.mat_ptr = mat_ptr;
+            rec.prim = this;
             return true;
         }
     }
     return false;
 }
 
+void sphere::finalize(const ray& r, hit_record& rec) const {
+    rec.p = r.point_at_parameter(rec.t);
+    rec.p_error = reproject_to_sphere(rec.p, center, radius);
+    get_sphere_uv((rec.p-center)/radius, rec.u, rec.v);
+    rec.normal = (rec.p - center) / radius;
+    rec.mat_ptr = mat_ptr;
+}
+
+bool sphere::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+    if (!intersect(r, t_min, t_max, rec))
+        return false;
+    finalize(r, rec);
+    return true;
+}
+
 
 #endif
 
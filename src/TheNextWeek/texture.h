@@ -11,14 +11,11 @@
 // with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
 //==================================================================================================
 
-#include "perlin.h"
+#include "../common/fast_math.h"
+#include "../common/perlin.h"
+#include "../common/texture_base.h"
 
 
-class texture  {
-    public:
-        virtual vec3 value(float u, float v, const vec3& p) const = 0;
-};
-
 class constant_texture : public texture {
     public:
         constant_texture() { }
@@ -34,7 +31,7 @@ class checker_texture : public texture {
         checker_texture() { }
         checker_texture(texture *t0, texture *t1): even(t0), odd(t1) { }
         virtual vec3 value(float u, float v, const vec3& p) const {
-            float sines = sin(10*p.x())*sin(10*p.y())*sin(10*p.z());
+            float sines = rt_sin(10*p.x())*rt_sin(10*p.y())*rt_sin(10*p.z());
             if (sines < 0)
                 return odd->value(u, v, p);
             else
@@ -52,9 +49,21 @@ class noise_texture : public texture {
         virtual vec3 value(float u, float v, const vec3& p) const {
 //            return vec3(1,1,1)*0.5*(1 + noise.turb(scale * p));
 //            return vec3(1,1,1)*noise.turb(scale * p);
-              return vec3(1,1,1)*0.5*(1 + sin(scale*p.x() + 5*noise.turb(scale*p))) ;
+              return vec3(1,1,1)*0.5*(1 + rt_sin(scale*p.x() + 5*turb(scale*p))) ;
+        }
+        // Bakes the turbulence over a world-space box, for a texture whose objects stay inside it.
+        // Points outside the box are still evaluated in full.
+        void bake(const vec3& lo, const vec3& hi, int n) {
+            vec3 a = scale*lo, b = scale*hi;
+            baked.bake(noise, vec3(fminf(a[0], b[0]), fminf(a[1], b[1]), fminf(a[2], b[2])),
+                       vec3(fmaxf(a[0], b[0]), fmaxf(a[1], b[1]), fmaxf(a[2], b[2])), n);
+        }
+        float turb(const vec3& p) const {
+            float t;
+            return baked.lookup(p, t) ? t : noise.turb(p);
         }
         perlin noise;
+        perlin_volume baked;
         float scale;
 };
 
@@ -11,18 +11,214 @@
 // with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
 //==================================================================================================
 
-#include "hittable.h"
-#include "random.h"
+#include "../common/hittable.h"
+#include "../common/random.h"
 
 
+// Hit test shared by the three rect orientations: the plane is at coordinate k along axis k_axis,
+// and the rect spans [a0,a1] x [b0,b1] along the other two. t is where r crosses the plane, and
+// is only set when the rect is hit.
+inline bool aarect_crossing(const ray& r, float t0, float t1, int a_axis, int b_axis, int k_axis,
+                            float a0, float a1, float b0, float b1, float k, float& t) {
+    float s = (k-r.origin()[k_axis]) / r.direction()[k_axis];
+    if (s < t0 || s > t1)
+        return false;
+    float a = r.origin()[a_axis] + s*r.direction()[a_axis];
+    float b = r.origin()[b_axis] + s*r.direction()[b_axis];
+    if (a < a0 || a > a1 || b < b0 || b > b1)
+        return false;
+    t = s;
+    return true;
+}
+
+enum rect_sampling_mode { rect_sampling_area, rect_sampling_solid_angle };
+
+// How the rects pick directions towards themselves when they are sampled as lights. Area sampling
+// is the book's; it is noisy close to the light, where a uniform point on the rect is far from a
+// uniform direction.
+rect_sampling_mode rect_sampling = rect_sampling_solid_angle;
+
+// Below this many steradians the spherical rectangle's angles lose too much precision, and the
+// rect is sampled by area instead. Whether that happens depends only on the shading point, so
+// random() and pdf_value() always agree.
+const double min_rect_solid_angle = 1e-5;
+
+// Urena, Fajardo and King's uniform sampling of the solid angle an axis-aligned rect subtends
+// from o, set up in the frame of the rect's own axes with o at the origin and the rect on the
+// negative side of the third axis.
+struct spherical_rect {
+    spherical_rect(const vec3& o, int a_axis, int b_axis, int k_axis,
+                   float a0, float a1, float b0, float b1, float k) {
+        x0 = a0 - o[a_axis]; x1 = a1 - o[a_axis];
+        y0 = b0 - o[b_axis]; y1 = b1 - o[b_axis];
+        z0 = -fabs(double(k) - o[k_axis]);
+        double z0sq = z0*z0;
+        // The inward normals of the four planes through o and an edge, as (x, y, z).
+        double n0[3] = { 0, z0, -y0 }, n1[3] = { -z0, 0, x1 };
+        double n2[3] = { 0, -z0, y1 }, n3[3] = { z0, 0, -x0 };
+        double l0 = sqrt(z0sq + y0*y0), l1 = sqrt(z0sq + x1*x1);
+        double l2 = sqrt(z0sq + y1*y1), l3 = sqrt(z0sq + x0*x0);
+        solid_angle = 0;
+        if (!(l0 > 0 && l1 > 0 && l2 > 0 && l3 > 0))
+            return;
+        double g0 = acos(clamp(-(n0[1]*n1[1] + n0[2]*n1[2] + n0[0]*n1[0]) / (l0*l1)));
+        double g1 = acos(clamp(-(n1[0]*n2[0] + n1[1]*n2[1] + n1[2]*n2[2]) / (l1*l2)));
+        double g2 = acos(clamp(-(n2[0]*n3[0] + n2[1]*n3[1] + n2[2]*n3[2]) / (l2*l3)));
+        double g3 = acos(clamp(-(n3[0]*n0[0] + n3[1]*n0[1] + n3[2]*n0[2]) / (l3*l0)));
+        beta0 = n0[2] / l0;
+        beta1 = n2[2] / l2;
+        k_angle = 2*M_PI - g2 - g3;
+        solid_angle = g0 + g1 - k_angle;
+    }
+
+    // The point on the rect, as offsets from o along its first two axes, for (u, v) in [0,1)^2.
+    void sample(double u, double v, double& xu, double& yv) const {
+        double au = u*solid_angle + k_angle;
+        double fu = (cos(au)*beta0 - beta1) / sin(au);
+        double cu = clamp((fu > 0 ? 1 : -1) / sqrt(fu*fu + beta0*beta0));
+        xu = -(cu*z0) / sqrt(1 - cu*cu);
+        xu = xu < x0 ? x0 : xu > x1 ? x1 : xu;
+        double d = sqrt(xu*xu + z0*z0);
+        double h0 = y0 / sqrt(d*d + y0*y0);
+        double h1 = y1 / sqrt(d*d + y1*y1);
+        double hv = h0 + v*(h1 - h0), hv2 = hv*hv;
+        yv = hv2 < 1 - 1e-9 ? (hv*d) / sqrt(1 - hv2) : y1;
+    }
+
+    static double clamp(double c) { return c < -1 ? -1 : c > 1 ? 1 : c; }
+
+    double x0, x1, y0, y1, z0;
+    double beta0, beta1, k_angle;
+    double solid_angle;
+};
+
+// hittable::pdf_value for the rect at k along k_axis spanning [a0,a1] x [b0,b1].
+inline float aarect_pdf_value(const vec3& o, const vec3& v, int a_axis, int b_axis, int k_axis,
+                              float a0, float a1, float b0, float b1, float k) {
+    float t;
+    if (!aarect_crossing(ray(o, v), 0.001, FLT_MAX, a_axis, b_axis, k_axis, a0, a1, b0, b1, k, t))
+        return 0;
+    if (rect_sampling == rect_sampling_solid_angle) {
+        spherical_rect sr(o, a_axis, b_axis, k_axis, a0, a1, b0, b1, k);
+        if (sr.solid_angle > min_rect_solid_angle)
+            return float(1 / sr.solid_angle);
+    }
+    float area = (a1-a0)*(b1-b0);
+    float distance_squared = t * t * v.squared_length();
+    float cosine = fabs(v[k_axis] / v.length());
+    return distance_squared / (cosine * area);
+}
+
+// hittable::random for the same rect: the direction from o to a point on it.
+inline vec3 aarect_random(const vec3& o, int a_axis, int b_axis, int k_axis,
+                          float a0, float a1, float b0, float b1, float k) {
+    vec3 direction;
+    direction[k_axis] = k - o[k_axis];
+    if (rect_sampling == rect_sampling_solid_angle) {
+        spherical_rect sr(o, a_axis, b_axis, k_axis, a0, a1, b0, b1, k);
+        if (sr.solid_angle > min_rect_solid_angle) {
+            double xu, yv;
+            float u = random_double();
+            float v = random_double();
+            sr.sample(u, v, xu, yv);
+            direction[a_axis] = float(xu);
+            direction[b_axis] = float(yv);
+            return direction;
+        }
+    }
+    direction[a_axis] = a0 + random_double()*(a1-a0) - o[a_axis];
+    direction[b_axis] = b0 + random_double()*(b1-b0) - o[b_axis];
+    return direction;
+}
+
+// hittable::sample_surface for the same rect.
+inline bool aarect_sample_surface(hit_record& rec, float& area, int a_axis, int b_axis, int k_axis,
+                                  float a0, float a1, float b0, float b1, float k, material *mp) {
+    rec.u = random_double();
+    rec.v = random_double();
+    rec.p[a_axis] = a0 + rec.u*(a1-a0);
+    rec.p[b_axis] = b0 + rec.v*(b1-b0);
+    rec.p[k_axis] = k;
+    rec.p_error = point_error(max_abs(rec.p));
+    rec.normal = vec3(0, 0, 0);
+    rec.normal[k_axis] = 1;
+    rec.mat_ptr = mp;
+    rec.t = 0;
+    rec.prim = 0;
+    area = (a1-a0)*(b1-b0);
+    return true;
+}
+
+// Packet test shared by the three rect orientations: the plane is at coordinate k along axis
+// k_axis, and the rect spans [a0,a1] x [b0,b1] along the other two axes.
+inline int aarect_hit_packet(const ray_packet& p, int active, float t_min, float *t_max,
+                             hit_record *rec, int a_axis, int b_axis, int k_axis,
+                             float a0, float a1, float b0, float b1, float k, material *mp) {
+    float ts[ray_packet_size], as[ray_packet_size], bs[ray_packet_size];
+    int valid[ray_packet_size];
+    for (int i = 0; i < ray_packet_size; i++) {
+        float t = (k - p.origin[k_axis][i]) / p.direction[k_axis][i];
+        float a = p.origin[a_axis][i] + t*p.direction[a_axis][i];
+        float b = p.origin[b_axis][i] + t*p.direction[b_axis][i];
+        ts[i] = t;
+        as[i] = a;
+        bs[i] = b;
+        valid[i] = (t >= t_min) & (t <= t_max[i]) & (a >= a0) & (a <= a1) & (b >= b0) & (b <= b1);
+    }
+    int hits = 0;
+    for (int i = 0; i < p.count; i++) {
+        if (!(active & (1 << i)) || !valid[i])
+            continue;
+        hit_record& h = rec[i];
+        h.u = (as[i]-a0)/(a1-a0);
+        h.v = (bs[i]-b0)/(b1-b0);
+        h.t = ts[i];
+        h.mat_ptr = mp;
+        h.p[a_axis] = as[i];
+        h.p[b_axis] = bs[i];
+        h.p[k_axis] = k;
+        h.p_error = point_error(max_abs(h.p));
+        h.normal = vec3(0, 0, 0);
+        h.normal[k_axis] = 1;
+        t_max[i] = ts[i];
+        hits |= 1 << i;
+    }
+    return hits;
+}
+
 class xy_rect: public hittable  {
     public:
         xy_rect() {}
         xy_rect(float _x0, float _x1, float _y0, float _y1, float _k, material *mat) : x0(_x0), x1(_x1), y0(_y0), y1(_y1), k(_k), mp(mat) {};
         virtual bool hit(const ray& r, float t0, float t1, hit_record& rec) const;
         virtual bool bounding_box(float t0, float t1, aabb& box) const {
-               box =  aabb(vec3(x0,y0, k-0.0001), vec3(x1, y1, k+0.0001));
+               float pad = flat_box_pad(k, x1 - x0, y1 - y0);
+               box = aabb(vec3(x0,y0, k - pad), vec3(x1, y1, k + pad));
                return true; }
+        virtual float  pdf_value(const vec3& o, const vec3& v) const {
+            return aarect_pdf_value(o, v, 0, 1, 2, x0, x1, y0, y1, k);
+        }
+        virtual vec3 random(const vec3& o) const {
+            return aarect_random(o, 0, 1, 2, x0, x1, y0, y1, k);
+        }
+        virtual bool sample_surface(hit_record& rec, float& area) const {
+            return aarect_sample_surface(rec, area, 0, 1, 2, x0, x1, y0, y1, k, mp);
+        }
+        virtual int hit_packet(const ray_packet& p, int active, float t_min, float *t_max,
+                               hit_record *rec) const {
+            return aarect_hit_packet(p, active, t_min, t_max, rec, 0, 1, 2, x0, x1, y0, y1, k, mp);
+        }
+        virtual bool occluded(const ray& r, float t0, float t1) const {
+            float t;
+            return aarect_crossing(r, t0, t1, 0, 1, 2, x0, x1, y0, y1, k, t);
+        }
+        virtual bool intersect(const ray& r, float t0, float t1, hit_record& rec) const {
+            if (!aarect_crossing(r, t0, t1, 0, 1, 2, x0, x1, y0, y1, k, rec.t))
+                return false;
+            rec.prim = this;
+            return true;
+        }
+        virtual void finalize(const ray& r, hit_record& rec) const;
         material  *mp;
         float x0, x1, y0, y1, k;
 };
@@ -33,24 +229,34 @@ class xz_rect: public hittable  {
         xz_rect(float _x0, float _x1, float _z0, float _z1, float _k, material *mat) : x0(_x0), x1(_x1), z0(_z0), z1(_z1), k(_k), mp(mat) {};
         virtual bool hit(const ray& r, float t0, float t1, hit_record& rec) const;
         virtual bool bounding_box(float t0, float t1, aabb& box) const {
-            box =  aabb(vec3(x0,k-0.0001,z0), vec3(x1, k+0.0001, z1));
+            float pad = flat_box_pad(k, x1 - x0, z1 - z0);
+            box = aabb(vec3(x0,k - pad,z0), vec3(x1, k + pad, z1));
             return true; 
         }
         virtual float  pdf_value(const vec3& o, const vec3& v) const {
-            hit_record rec;
-            if (this->hit(ray(o, v), 0.001, FLT_MAX, rec)) {
-                float area = (x1-x0)*(z1-z0);
-                float distance_squared = rec.t * rec.t * v.squared_length();
-                float cosine = fabs(dot(v, rec.normal) / v.length());
-                return  distance_squared / (cosine * area);
-            }
-            else
-                return 0;
-        }
-        virtual vec3 random(const vec3& o) const { 
-            vec3 random_point = vec3(x0 + random_double()*(x1-x0), k,  z0 + random_double()*(z1-z0)); 
-            return random_point - o;
+            return aarect_pdf_value(o, v, 0, 2, 1, x0, x1, z0, z1, k);
+        }
+        virtual vec3 random(const vec3& o) const {
+            return aarect_random(o, 0, 2, 1, x0, x1, z0, z1, k);
         }
+        virtual bool sample_surface(hit_record& rec, float& area) const {
+            return aarect_sample_surface(rec, area, 0, 2, 1, x0, x1, z0, z1, k, mp);
+        }
+        virtual int hit_packet(const ray_packet& p, int active, float t_min, float *t_max,
+                               hit_record *rec) const {
+            return aarect_hit_packet(p, active, t_min, t_max, rec, 0, 2, 1, x0, x1, z0, z1, k, mp);
+        }
+        virtual bool occluded(const ray& r, float t0, float t1) const {
+            float t;
+            return aarect_crossing(r, t0, t1, 0, 2, 1, x0, x1, z0, z1, k, t);
+        }
+        virtual bool intersect(const ray& r, float t0, float t1, hit_record& rec) const {
+            if (!aarect_crossing(r, t0, t1, 0, 2, 1, x0, x1, z0, z1, k, rec.t))
+                return false;
+            rec.prim = this;
+            return true;
+        }
+        virtual void finalize(const ray& r, hit_record& rec) const;
         material  *mp;
         float x0, x1, z0, z1, k;
 };
@@ -61,8 +267,33 @@ class yz_rect: public hittable  {
         yz_rect(float _y0, float _y1, float _z0, float _z1, float _k, material *mat) : y0(_y0), y1(_y1), z0(_z0), z1(_z1), k(_k), mp(mat) {};
         virtual bool hit(const ray& r, float t0, float t1, hit_record& rec) const;
         virtual bool bounding_box(float t0, float t1, aabb& box) const {
-               box =  aabb(vec3(k-0.0001, y0, z0), vec3(k+0.0001, y1, z1));
+               float pad = flat_box_pad(k, y1 - y0, z1 - z0);
+               box = aabb(vec3(k - pad, y0, z0), vec3(k + pad, y1, z1));
                return true; }
+        virtual float  pdf_value(const vec3& o, const vec3& v) const {
+            return aarect_pdf_value(o, v, 1, 2, 0, y0, y1, z0, z1, k);
+        }
+        virtual vec3 random(const vec3& o) const {
+            return aarect_random(o, 1, 2, 0, y0, y1, z0, z1, k);
+        }
+        virtual bool sample_surface(hit_record& rec, float& area) const {
+            return aarect_sample_surface(rec, area, 1, 2, 0, y0, y1, z0, z1, k, mp);
+        }
+        virtual int hit_packet(const ray_packet& p, int active, float t_min, float *t_max,
+                               hit_record *rec) const {
+            return aarect_hit_packet(p, active, t_min, t_max, rec, 1, 2, 0, y0, y1, z0, z1, k, mp);
+        }
+        virtual bool occluded(const ray& r, float t0, float t1) const {
+            float t;
+            return aarect_crossing(r, t0, t1, 1, 2, 0, y0, y1, z0, z1, k, t);
+        }
+        virtual bool intersect(const ray& r, float t0, float t1, hit_record& rec) const {
+            if (!aarect_crossing(r, t0, t1, 1, 2, 0, y0, y1, z0, z1, k, rec.t))
+                return false;
+            rec.prim = this;
+            return true;
+        }
+        virtual void finalize(const ray& r, hit_record& rec) const;
         material  *mp;
         float y0, y1, z0, z1, k;
 };
@@ -70,55 +301,60 @@ class yz_rect: public hittable  {
 
 
 
-bool xy_rect::hit(const ray& r, float t0, float t1, hit_record& rec) const {
-    float t = (k-r.origin().z()) / r.direction().z();
-    if (t < t0 || t > t1)
-        return false;
-    float x = r.origin().x() + t*r.direction().x();
-    float y = r.origin().y() + t*r.direction().y();
-    if (x < x0 || x > x1 || y < y0 || y > y1) 
-        return false;
+void xy_rect::finalize(const ray& r, hit_record& rec) const {
+    float x = r.origin().x() + rec.t*r.direction().x();
+    float y = r.origin().y() + rec.t*r.direction().y();
     rec.u = (x-x0)/(x1-x0);
-    rec.v = (y-y0)/(y1-y0); 
-    rec.t = t;
+    rec.v = (y-y0)/(y1-y0);
     rec.mat_ptr = mp;
-    rec.p = r.point_at_parameter(t);
+    // The point goes on the plane exactly rather than where the rounded ray puts it, so that
+    // its error is all along the plane.
+    rec.p = vec3(x, y, k);
+    rec.p_error = point_error(max_abs(rec.p));
     rec.normal = vec3(0, 0, 1);
+}
+
+bool xy_rect::hit(const ray& r, float t0, float t1, hit_record& rec) const {
+    if (!intersect(r, t0, t1, rec))
+        return false;
+    finalize(r, rec);
     return true;
 }
 
 
-bool xz_rect::hit(const ray& r, float t0, float t1, hit_record& rec) const {
-    float t = (k-r.origin().y()) / r.direction().y();
-    if (t < t0 || t > t1)
-        return false;
-    float x = r.origin().x() + t*r.direction().x();
-    float z = r.origin().z() + t*r.direction().z();
-    if (x < x0 || x > x1 || z < z0 || z > z1) 
-        return false;
+void xz_rect::finalize(const ray& r, hit_record& rec) const {
+    float x = r.origin().x() + rec.t*r.direction().x();
+    float z = r.origin().z() + rec.t*r.direction().z();
     rec.u = (x-x0)/(x1-x0);
-    rec.v = (z-z0)/(z1-z0); 
-    rec.t = t;
+    rec.v = (z-z0)/(z1-z0);
     rec.mat_ptr = mp;
-    rec.p = r.point_at_parameter(t);
+    rec.p = vec3(x, k, z);
+    rec.p_error = point_error(max_abs(rec.p));
     rec.normal = vec3(0, 1, 0);
-    return true;
 }
 
-bool yz_rect::hit(const ray& r, float t0, float t1, hit_record& rec) const {
-    float t = (k-r.origin().x()) / r.direction().x();
-    if (t < t0 || t > t1)
-        return false;
-    float y = r.origin().y() + t*r.direction().y();
-    float z = r.origin().z() + t*r.direction().z();
-    if (y < y0 || y > y1 || z < z0 || z > z1) 
+bool xz_rect::hit(const ray& r, float t0, float t1, hit_record& rec) const {
+    if (!intersect(r, t0, t1, rec))
         return false;
+    finalize(r, rec);
+    return true;
+}
+
+void yz_rect::finalize(const ray& r, hit_record& rec) const {
+    float y = r.origin().y() + rec.t*r.direction().y();
+    float z = r.origin().z() + rec.t*r.direction().z();
     rec.u = (y-y0)/(y1-y0);
-    rec.v = (z-z0)/(z1-z0); 
-    rec.t = t;
+    rec.v = (z-z0)/(z1-z0);
     rec.mat_ptr = mp;
-    rec.p = r.point_at_parameter(t);
+    rec.p = vec3(k, y, z);
+    rec.p_error = point_error(max_abs(rec.p));
     rec.normal = vec3(1, 0, 0);
+}
+
+bool yz_rect::hit(const ray& r, float t0, float t1, hit_record& rec) const {
+    if (!intersect(r, t0, t1, rec))
+        return false;
+    finalize(r, rec);
     return true;
 }
 
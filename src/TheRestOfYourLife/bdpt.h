@@ -0,0 +1,477 @@
+#ifndef BDPTH
+#define BDPTH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include "../common/camera.h"
+#include "../common/film.h"
+#include "../common/hittable.h"
+#include "../common/random.h"
+#include "../common/render_stats.h"
+#include "../common/roulette.h"
+#include "material.h"
+#include "pdf.h"
+
+#include <algorithm>
+#include <float.h>
+#include <map>
+#include <math.h>
+#include <vector>
+
+
+// The surfaces that give off light, for paths that start on them. Each is picked in proportion
+// to its power, taken from the middle of its texture, and then a point on it uniformly.
+class bdpt_lights {
+    public:
+        bdpt_lights(const std::vector<hittable*>& emitters);
+
+        // Picks a light for the number u in [0,1), and gives the chance it had.
+        const hittable *pick(float u, float& chance) const;
+        // Density per unit area with which a light path starts at a point on a surface of
+        // material m: a light's chance over its area, which is the same for every light made of
+        // one constant material.
+        float origin_density(const material *m) const;
+
+        bool empty() const { return lights.empty(); }
+
+    private:
+        std::vector<const hittable*> lights;
+        std::vector<float> cdf;
+        std::map<const material*, float> density;
+};
+
+bdpt_lights::bdpt_lights(const std::vector<hittable*>& emitters) {
+    std::vector<float> power, area;
+    std::vector<const material*> mats;
+    for (size_t k = 0; k < emitters.size(); k++) {
+        hit_record rec;
+        float a;
+        if (!emitters[k]->sample_surface(rec, a) || !(a > 0) || !rec.mat_ptr)
+            continue;
+        rec.u = rec.v = 0.5f;
+        vec3 le = material_emitted(rec.mat_ptr, ray(rec.p + rec.normal, -rec.normal), rec);
+        float y = 0.2126f*le[0] + 0.7152f*le[1] + 0.0722f*le[2];
+        if (!(y > 0))
+            continue;
+        lights.push_back(emitters[k]);
+        power.push_back(y * a);
+        area.push_back(a);
+        mats.push_back(rec.mat_ptr);
+    }
+    double total = 0;
+    for (size_t k = 0; k < power.size(); k++)
+        total += power[k];
+    double sum = 0;
+    cdf.resize(power.size());
+    for (size_t k = 0; k < power.size(); k++) {
+        sum += power[k];
+        cdf[k] = float(sum / total);
+        density[mats[k]] = float(power[k] / total / area[k]);
+    }
+    if (!cdf.empty())
+        cdf.back() = 1;
+}
+
+const hittable *bdpt_lights::pick(float u, float& chance) const {
+    size_t k = std::upper_bound(cdf.begin(), cdf.end(), u) - cdf.begin();
+    if (k >= cdf.size())
+        k = cdf.size() - 1;
+    chance = cdf[k] - (k > 0 ? cdf[k-1] : 0);
+    return lights[k];
+}
+
+float bdpt_lights::origin_density(const material *m) const {
+    std::map<const material*, float>::const_iterator it = density.find(m);
+    return it == density.end() ? 0 : it->second;
+}
+
+
+enum bdpt_vertex_kind { bdpt_camera, bdpt_light, bdpt_surface };
+
+// One vertex of a camera or light subpath. Densities are per unit area at the vertex: pdf_fwd
+// for the way the subpath reached it, and pdf_rev for the way the other subpath would have.
+struct bdpt_vertex {
+    bdpt_vertex_kind kind;
+    vec3 p;
+    float p_error;      // the hit_record's bound on the rounding error in p
+    vec3 n;             // geometric normal; unused at the camera
+    vec3 beta;          // the subpath's throughput up to and including the vertex
+    vec3 albedo;        // the Lambertian reflectance, where connectible
+    vec3 emitted;       // light given off back along a camera subpath
+    const material *mat;
+    float pdf_fwd, pdf_rev;
+    bool delta;         // scattered specularly: no connection can be made here
+    bool connectible;   // the camera, a light's own vertex, or a Lambertian surface seen from
+                        // the side its normal faces
+};
+
+// Veach's bidirectional path tracer. Every camera sample also traces a path out from a light,
+// and every prefix of the one is joined to every prefix of the other with a shadow ray; light
+// paths joined straight to the camera land anywhere in the image and are splatted onto the film.
+// Each of the ways a path could be made is weighted against the others with the balance
+// heuristic, computed from the ratios of the densities along the path as in pbrt.
+//
+// Only Lambertian surfaces can be connected through. Metal, glass and media scatter as they do
+// for the path tracer and count as specular, so that caustics seen through glass come from the
+// light paths. The camera must be a pinhole, and the lights the surfaces of bdpt_lights.
+class bdpt_integrator {
+    public:
+        bdpt_integrator(hittable *world, const bdpt_lights& lights, const camera& cam,
+                        int nx, int ny, int max_depth, int roulette_depth, film& image_film);
+
+        // The camera path's share of the sample whose ray is r, with the random stream already
+        // begun for it; the light paths' share goes to the film.
+        vec3 trace(const ray& r) const;
+
+    private:
+        int walk(ray r, vec3 beta, float pdf_dir, bdpt_vertex *path, int max_vertices,
+                 uint64_t first_bounce) const;
+        vec3 connect(bdpt_vertex *light_path, int s, bdpt_vertex *camera_path, int t,
+                     float time, float& film_x, float& film_y) const;
+        float mis_weight(bdpt_vertex *light_path, int s, bdpt_vertex *camera_path, int t) const;
+
+        // Density per unit area at to, for a direction that v picks towards it.
+        float density(const bdpt_vertex& v, const bdpt_vertex& to) const;
+        float to_area(float pdf_dir, const bdpt_vertex& from, const bdpt_vertex& to) const;
+        float camera_direction_density(const vec3& unit_direction) const;
+        // Where p lands on the film, in pixels, and the cosine from the camera's axis. Returns
+        // false if it is behind the camera or outside the frame.
+        bool project(const vec3& p, float& x, float& y, float& cosine) const;
+        bool visible(const bdpt_vertex& a, const bdpt_vertex& b, float time) const;
+
+        hittable *world;
+        const bdpt_lights& lights;
+        film& image_film;
+        int nx, ny;
+        int max_depth;
+        int roulette_depth;
+        // The pinhole camera: the part of its image plane one unit in front of it that the frame
+        // covers has area plane_area.
+        vec3 eye, forward, corner, right, up;
+        float width, height, plane_area;
+};
+
+bdpt_integrator::bdpt_integrator(hittable *w, const bdpt_lights& l, const camera& cam, int x,
+                                 int y, int depth, int roulette, film& f)
+    : world(w), lights(l), image_film(f), nx(x), ny(y), max_depth(depth),
+      roulette_depth(roulette) {
+    eye = cam.origin;
+    forward = -cam.w;
+    corner = cam.lower_left_corner - cam.origin;
+    right = cam.u;
+    up = cam.v;
+    width = cam.horizontal.length();
+    height = cam.vertical.length();
+    float focus = dot(corner, forward);
+    plane_area = width * height / (focus * focus);
+}
+
+float bdpt_integrator::camera_direction_density(const vec3& d) const {
+    float cosine = dot(d, forward);
+    if (cosine <= 0)
+        return 0;
+    return 1 / (plane_area * cosine*cosine*cosine);
+}
+
+bool bdpt_integrator::project(const vec3& p, float& x, float& y, float& cosine) const {
+    vec3 d = p - eye;
+    float along = dot(d, forward);
+    if (along <= 0)
+        return false;
+    cosine = along / d.length();
+    vec3 q = d * (dot(corner, forward) / along) - corner;
+    x = dot(q, right) / width * nx;
+    y = dot(q, up) / height * ny;
+    return x >= 0 && x < nx && y >= 0 && y < ny;
+}
+
+// The shadow ray runs between the two points moved off their surfaces towards each other, so
+// that neither surface can block it.
+bool bdpt_integrator::visible(const bdpt_vertex& a, const bdpt_vertex& b, float t) const {
+    vec3 pa = a.kind == bdpt_camera ? a.p : offset_ray_origin(a.p, a.p_error, a.n, b.p - a.p);
+    vec3 pb = b.kind == bdpt_camera ? b.p : offset_ray_origin(b.p, b.p_error, b.n, a.p - b.p);
+    vec3 d = pb - pa;
+    float distance = d.length();
+    RT_COUNT(shadow_rays, 1);
+    return !world->occluded(ray(pa, d / distance, t), 0, distance);
+}
+
+float bdpt_integrator::to_area(float pdf_dir, const bdpt_vertex& from,
+                               const bdpt_vertex& to) const {
+    vec3 d = to.p - from.p;
+    float distance_squared = d.squared_length();
+    if (!(distance_squared > 0))
+        return 0;
+    if (to.kind != bdpt_camera)
+        pdf_dir *= fabs(dot(to.n, d)) / sqrt(distance_squared);
+    return pdf_dir / distance_squared;
+}
+
+float bdpt_integrator::density(const bdpt_vertex& v, const bdpt_vertex& to) const {
+    vec3 d = unit_vector(to.p - v.p);
+    float pdf_dir = 0;
+    if (v.kind == bdpt_camera)
+        pdf_dir = camera_direction_density(d);
+    else if (v.kind == bdpt_light || v.connectible || v.emitted.squared_length() > 0) {
+        // Lights give off, and Lambertian surfaces scatter, with a cosine distribution.
+        float cosine = dot(v.n, d);
+        pdf_dir = cosine > 0 ? cosine / M_PI : 0;
+    }
+    return to_area(pdf_dir, v, to);
+}
+
+// Extends the subpath whose first vertex is path[0] along r, where beta is the throughput and
+// pdf_dir the density of r's direction, until it leaves the scene, is absorbed, or has
+// max_vertices vertices. Returns how many it has.
+int bdpt_integrator::walk(ray r, vec3 beta, float pdf_dir, bdpt_vertex *path, int max_vertices,
+                          uint64_t first_bounce) const {
+    // Roulette goes by the throughput relative to the start, which on a light path is far above 1.
+    vec3 throughput(1, 1, 1);
+    int n = 1;
+    while (n < max_vertices) {
+        random_begin_bounce(first_bounce + n);
+        RT_COUNT(rays, 1);
+        hit_record hrec;
+        if (!world->hit(r, 0, MAXFLOAT, hrec))
+            break;
+        bdpt_vertex& v = path[n];
+        bdpt_vertex& prev = path[n-1];
+        v.kind = bdpt_surface;
+        v.p = hrec.p;
+        v.p_error = hrec.p_error;
+        v.n = hrec.normal;
+        v.beta = beta;
+        v.mat = hrec.mat_ptr;
+        v.emitted = material_emitted(hrec.mat_ptr, r, hrec);
+        v.pdf_fwd = to_area(pdf_dir, prev, v);
+        v.pdf_rev = 0;
+        v.delta = false;
+        v.connectible = false;
+        n++;
+
+        scatter_record srec;
+        if (!material_scatter(hrec.mat_ptr, r, hrec, srec))
+            break;
+        vec3 wo = -unit_vector(r.direction());
+        vec3 wi;
+        float pdf_rev_dir;
+        if (srec.is_specular) {
+            v.delta = true;
+            wi = srec.specular_ray.direction();
+            beta *= srec.attenuation;
+            throughput *= srec.attenuation;
+            pdf_dir = pdf_rev_dir = 0;
+        }
+        else {
+            if (hrec.mat_ptr->kind != material_lambertian || dot(v.n, wo) <= 0)
+                break;
+            v.connectible = true;
+            v.albedo = srec.attenuation;
+            wi = srec.pdf_ptr->generate();
+            pdf_dir = srec.pdf_ptr->value(wi);
+            float scattering_pdf = material_scattering_pdf(hrec.mat_ptr, r, hrec,
+                                                           ray(hrec.p, wi, r.time()));
+            if (!(pdf_dir > 0) || !(scattering_pdf > 0))
+                break;
+            vec3 factor = srec.attenuation * scattering_pdf / pdf_dir;
+            beta *= factor;
+            throughput *= factor;
+            pdf_rev_dir = dot(v.n, wo) / M_PI;
+        }
+        prev.pdf_rev = to_area(pdf_rev_dir, v, prev);
+        float q = roulette_survival(n - 2, roulette_depth, throughput[0], throughput[1],
+                                    throughput[2]);
+        if (q < 1) {
+            if (random_double() >= q)
+                break;
+            beta /= q;
+            throughput /= q;
+        }
+        r = spawn_ray(hrec, wi, r.time());
+    }
+    return n;
+}
+
+// The strategy with s light vertices and t camera vertices, weighted. Shadow rays are traced at
+// the sample's time, which both subpaths share. For t == 1 the result belongs at (film_x, film_y)
+// rather than at the sample's own pixel.
+vec3 bdpt_integrator::connect(bdpt_vertex *lp, int s, bdpt_vertex *cp, int t, float time,
+                              float& film_x, float& film_y) const {
+    vec3 l(0, 0, 0);
+    bdpt_vertex& pt = cp[t-1];
+    if (s == 0) {
+        // The camera path found a light by itself.
+        if (pt.emitted.squared_length() == 0)
+            return l;
+        l = pt.beta * pt.emitted;
+    }
+    else if (t == 1) {
+        // The light path seen from the camera.
+        bdpt_vertex& qs = lp[s-1];
+        if (!qs.connectible)
+            return l;
+        float cosine;
+        if (!project(qs.p, film_x, film_y, cosine))
+            return l;
+        vec3 d = pt.p - qs.p;
+        float distance_squared = d.squared_length();
+        vec3 w = d / sqrt(distance_squared);
+        float cos_q = dot(qs.n, w);
+        if (cos_q <= 0)
+            return l;
+        vec3 f = qs.kind == bdpt_light ? vec3(1, 1, 1) : qs.albedo / M_PI;
+        float importance = 1 / (plane_area * cosine*cosine*cosine*cosine);
+        l = qs.beta * f * (cos_q * importance * cosine / distance_squared);
+        if (l.squared_length() == 0 || !visible(qs, pt, time))
+            return vec3(0, 0, 0);
+    }
+    else {
+        bdpt_vertex& qs = lp[s-1];
+        if (!qs.connectible || !pt.connectible)
+            return l;
+        vec3 d = qs.p - pt.p;
+        float distance_squared = d.squared_length();
+        vec3 w = d / sqrt(distance_squared);
+        float cos_p = dot(pt.n, w), cos_q = -dot(qs.n, w);
+        if (cos_p <= 0 || cos_q <= 0)
+            return l;
+        vec3 fq = qs.kind == bdpt_light ? vec3(1, 1, 1) : qs.albedo / M_PI;
+        l = qs.beta * fq * (pt.albedo / M_PI) * pt.beta * (cos_p * cos_q / distance_squared);
+        if (l.squared_length() == 0 || !visible(pt, qs, time))
+            return vec3(0, 0, 0);
+    }
+    return l * mis_weight(lp, s, cp, t);
+}
+
+float bdpt_integrator::mis_weight(bdpt_vertex *lp, int s, bdpt_vertex *cp, int t) const {
+    if (s + t == 2)
+        return 1;
+    bdpt_vertex *qs = s > 0 ? &lp[s-1] : 0;
+    bdpt_vertex *pt = &cp[t-1];
+    bdpt_vertex *qs_minus = s > 1 ? &lp[s-2] : 0;
+    bdpt_vertex *pt_minus = t > 1 ? &cp[t-2] : 0;
+
+    // The connection changes the densities at the vertices either side of it, and makes both
+    // ends of it connectible; they are put back before returning.
+    float saved_pt = pt->pdf_rev, saved_pt_minus = pt_minus ? pt_minus->pdf_rev : 0;
+    float saved_qs = qs ? qs->pdf_rev : 0, saved_qs_minus = qs_minus ? qs_minus->pdf_rev : 0;
+    bool saved_pt_delta = pt->delta, saved_qs_delta = qs ? qs->delta : false;
+    pt->pdf_rev = s > 0 ? density(*qs, *pt) : lights.origin_density(pt->mat);
+    if (pt_minus)
+        pt_minus->pdf_rev = density(*pt, *pt_minus);
+    if (qs)
+        qs->pdf_rev = density(*pt, *qs);
+    if (qs_minus)
+        qs_minus->pdf_rev = density(*qs, *qs_minus);
+    pt->delta = false;
+    if (qs)
+        qs->delta = false;
+
+    // Specular vertices have no density either way; they count as 1 so that they cancel.
+    float sum = 0, ratio = 1;
+    for (int i = t-1; i > 0; i--) {
+        ratio *= (cp[i].pdf_rev != 0 ? cp[i].pdf_rev : 1) / (cp[i].pdf_fwd != 0 ? cp[i].pdf_fwd : 1);
+        if (!cp[i].delta && !cp[i-1].delta)
+            sum += ratio;
+    }
+    ratio = 1;
+    for (int i = s-1; i >= 0; i--) {
+        ratio *= (lp[i].pdf_rev != 0 ? lp[i].pdf_rev : 1) / (lp[i].pdf_fwd != 0 ? lp[i].pdf_fwd : 1);
+        if (!lp[i].delta && (i == 0 || !lp[i-1].delta))
+            sum += ratio;
+    }
+
+    pt->pdf_rev = saved_pt;
+    pt->delta = saved_pt_delta;
+    if (pt_minus)
+        pt_minus->pdf_rev = saved_pt_minus;
+    if (qs) {
+        qs->pdf_rev = saved_qs;
+        qs->delta = saved_qs_delta;
+    }
+    if (qs_minus)
+        qs_minus->pdf_rev = saved_qs_minus;
+    return 1 / (1 + sum);
+}
+
+vec3 bdpt_integrator::trace(const ray& r) const {
+    const int max_vertices = 64;
+    bdpt_vertex camera_path[max_vertices + 2], light_path[max_vertices + 1];
+    int camera_vertices = max_depth + 2 < max_vertices ? max_depth + 2 : max_vertices;
+    int light_vertices = max_depth + 1 < max_vertices ? max_depth + 1 : max_vertices;
+    bdpt_vertex& eye_vertex = camera_path[0];
+    eye_vertex.kind = bdpt_camera;
+    eye_vertex.p = r.origin();
+    eye_vertex.p_error = 0;
+    eye_vertex.n = forward;
+    eye_vertex.beta = vec3(1, 1, 1);
+    eye_vertex.emitted = vec3(0, 0, 0);
+    eye_vertex.mat = 0;
+    eye_vertex.pdf_fwd = 1;
+    eye_vertex.pdf_rev = 0;
+    eye_vertex.delta = false;
+    eye_vertex.connectible = true;
+    int nc = walk(r, vec3(1, 1, 1), camera_direction_density(unit_vector(r.direction())),
+                  camera_path, camera_vertices, 0);
+
+    // The light path's random numbers come after every bounce the camera path could use.
+    random_begin_bounce(max_vertices + 2);
+    int nl = 0;
+    float chance;
+    const hittable *light = lights.pick(random_double(), chance);
+    hit_record lrec;
+    float area;
+    if (chance > 0 && light->sample_surface(lrec, area)) {
+        bdpt_vertex& origin = light_path[0];
+        cosine_pdf emission(lrec.normal);
+        vec3 d = unit_vector(emission.generate());
+        float pdf_dir = emission.value(d);
+        float pdf_pos = chance / area;
+        origin.kind = bdpt_light;
+        origin.p = lrec.p;
+        origin.p_error = lrec.p_error;
+        origin.n = lrec.normal;
+        origin.emitted = vec3(0, 0, 0);
+        origin.mat = lrec.mat_ptr;
+        origin.beta = material_emitted(lrec.mat_ptr, ray(lrec.p + d, -d, r.time()), lrec)
+                    / pdf_pos;
+        origin.pdf_fwd = pdf_pos;
+        origin.pdf_rev = 0;
+        origin.delta = false;
+        origin.connectible = true;
+        nl = 1;
+        if (pdf_dir > 0)
+            nl = walk(spawn_ray(lrec, d, r.time()), origin.beta * (dot(lrec.normal, d) / pdf_dir),
+                      pdf_dir, light_path, light_vertices, max_vertices + 2);
+    }
+
+    vec3 l(0, 0, 0);
+    for (int t = 1; t <= nc; t++) {
+        for (int s = 0; s <= nl; s++) {
+            int depth = s + t - 2;
+            if ((s == 1 && t == 1) || depth < 0 || depth > max_depth)
+                continue;
+            float film_x = 0, film_y = 0;
+            vec3 c = connect(light_path, s, camera_path, t, r.time(), film_x, film_y);
+            if (!(c[0] == c[0] && c[1] == c[1] && c[2] == c[2]))
+                continue;
+            if (t == 1) {
+                if (c.squared_length() > 0)
+                    image_film.splat(film_x, film_y, c[0], c[1], c[2]);
+            }
+            else
+                l += c;
+        }
+    }
+    return l;
+}
+
+#endif
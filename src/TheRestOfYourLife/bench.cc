@@ -0,0 +1,235 @@
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include "../common/bench.h"
+#include "../common/fast_math.h"
+#include "../common/random.h"
+#include "aarect.h"
+#include "material.h"
+#include "onb.h"
+#include "pdf.h"
+#include "sphere.h"
+
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+
+// Benchmarks of the sampling kernels this book adds. The intersection kernels and full-frame
+// renders are in TheNextWeek/bench.cc. -filter name runs only the benchmarks whose names contain
+// name.
+
+const int bench_inputs = 4096;
+
+int main(int argc, char **argv) {
+    double min_time = 0.5;
+    const char *filter = 0;
+    for (int a = 1; a < argc; a++) {
+        if (!strcmp(argv[a], "-filter") && a+1 < argc)
+            filter = argv[++a];
+        else if (!strcmp(argv[a], "-min-time") && a+1 < argc)
+            min_time = atof(argv[++a]);
+        else {
+            std::cerr << "usage: " << argv[0] << " [-filter name] [-min-time seconds]\n";
+            return 1;
+        }
+    }
+    random_seed(1, 0);
+    bench_runner runner(min_time, filter, 1);
+
+    // Unit-sphere normals and points around a light, drawn once and cycled through.
+    std::vector<vec3> normals, points;
+    for (int i = 0; i < bench_inputs; i++) {
+        normals.push_back(unit_vector(random_in_unit_sphere()));
+        points.push_back(4 * unit_vector(random_in_unit_sphere()));
+    }
+
+    // The vec3 kernels on their own, to compare builds with and without RT_SIMD_VEC3. Each call
+    // depends on the last, so the timings are latencies rather than throughputs.
+    vec3 acc(1, 0, 0);
+    runner.run("vec3 dot", [&](long long i) {
+        bench_keep(dot(normals[i % bench_inputs], points[i % bench_inputs]));
+        return 0.0;
+    });
+    runner.run("vec3 cross", [&](long long i) {
+        acc = cross(acc, normals[i % bench_inputs]) + points[i % bench_inputs];
+        return 0.0;
+    });
+    runner.run("vec3 unit_vector", [&](long long i) {
+        acc = unit_vector(acc + points[i % bench_inputs]);
+        return 0.0;
+    });
+    runner.run("vec3 arithmetic", [&](long long i) {
+        acc = 0.5f*acc + points[i % bench_inputs] * normals[i % bench_inputs] - acc / 3.0f;
+        return 0.0;
+    });
+    bench_keep(acc[0]);
+
+    // libm's transcendentals against fast_math.h's, on the arguments shading gives them: angles
+    // of a turn, the coordinates of unit normals, and uniform random numbers.
+    std::vector<float> angles, uniforms;
+    for (int i = 0; i < bench_inputs; i++) {
+        angles.push_back(float(2*M_PI*random_double()));
+        uniforms.push_back(float(random_double()));
+    }
+    runner.run("libm sin and cos", [&](long long i) {
+        float x = angles[i % bench_inputs];
+        bench_keep(sinf(x) + cosf(x));
+        return 0.0;
+    });
+    runner.run("fast_sincos", [&](long long i) {
+        float s, c;
+        fast_sincos(angles[i % bench_inputs], s, c);
+        bench_keep(s + c);
+        return 0.0;
+    });
+    runner.run("libm atan2 and asin", [&](long long i) {
+        const vec3& n = normals[i % bench_inputs];
+        bench_keep(atan2f(n.z(), n.x()) + asinf(n.y()));
+        return 0.0;
+    });
+    runner.run("fast_atan2 and fast_asin", [&](long long i) {
+        const vec3& n = normals[i % bench_inputs];
+        bench_keep(fast_atan2(n.z(), n.x()) + fast_asin(n.y()));
+        return 0.0;
+    });
+    runner.run("libm log", [&](long long i) {
+        bench_keep(logf(uniforms[i % bench_inputs]));
+        return 0.0;
+    });
+    runner.run("fast_log", [&](long long i) {
+        bench_keep(fast_log(uniforms[i % bench_inputs]));
+        return 0.0;
+    });
+
+    runner.run("onb::build_from_w", [&](long long i) {
+        onb uvw;
+        uvw.build_from_w(normals[i % bench_inputs]);
+        bench_keep(uvw.u()[0]);
+        return 0.0;
+    });
+
+    runner.run("cosine_pdf::generate", [&](long long i) {
+        cosine_pdf p(normals[i % bench_inputs]);
+        bench_keep(p.generate()[0]);
+        return 0.0;
+    });
+
+    // One diffuse bounce's material and texture calls, through the virtual interface and through
+    // the switch on each built-in's kind, over a mix of materials in a fixed random order.
+    constant_texture grey(vec3(0.5, 0.5, 0.5)), red(vec3(0.65, 0.05, 0.05));
+    checker_texture checker(&grey, &red);
+    lambertian plain(&red), checked(&checker);
+    metal mirror(vec3(0.7, 0.6, 0.5), 0.1);
+    diffuse_light lamp(&grey);
+    material *mix[4] = { &plain, &checked, &mirror, &lamp };
+    std::vector<const material*> materials;
+    std::vector<hit_record> hits(bench_inputs);
+    std::vector<ray> rays;
+    for (int i = 0; i < bench_inputs; i++) {
+        materials.push_back(mix[int(4*random_double())]);
+        hits[i].p = points[i];
+        hits[i].normal = normals[i];
+        hits[i].u = random_double();
+        hits[i].v = random_double();
+        rays.push_back(ray(points[i] + normals[i], -normals[i]));
+    }
+    runner.run("bounce virtual", [&](long long i) {
+        int k = int(i % bench_inputs);
+        const material *m = materials[k];
+        scatter_record srec;
+        vec3 e = m->emitted(rays[k], hits[k], hits[k].u, hits[k].v, hits[k].p);
+        if (m->scatter(rays[k], hits[k], srec) && !srec.is_specular) {
+            vec3 d = srec.pdf_ptr->generate();
+            e += srec.attenuation * m->scattering_pdf(rays[k], hits[k], ray(hits[k].p, d))
+                                  / srec.pdf_ptr->value(d);
+        }
+        bench_keep(e[0]);
+        return 0.0;
+    });
+    runner.run("bounce switch", [&](long long i) {
+        int k = int(i % bench_inputs);
+        const material *m = materials[k];
+        scatter_record srec;
+        vec3 e = material_emitted(m, rays[k], hits[k]);
+        if (material_scatter(m, rays[k], hits[k], srec) && !srec.is_specular) {
+            vec3 d = pdf_generate(srec.pdf_ptr);
+            e += srec.attenuation * material_scattering_pdf(m, rays[k], hits[k], ray(hits[k].p, d))
+                                  / pdf_value(srec.pdf_ptr, d);
+        }
+        bench_keep(e[0]);
+        return 0.0;
+    });
+    const texture *textures[3] = { &grey, &checker, &red };
+    runner.run("texture virtual", [&](long long i) {
+        int k = int(i % bench_inputs);
+        bench_keep(textures[k % 3]->value(hits[k].u, hits[k].v, hits[k].p)[0]);
+        return 0.0;
+    });
+    runner.run("texture switch", [&](long long i) {
+        int k = int(i % bench_inputs);
+        bench_keep(texture_value(textures[k % 3], hits[k].u, hits[k].v, hits[k].p)[0]);
+        return 0.0;
+    });
+    // The same lookups a batch at a time, as the wavefront integrator makes them: each iteration
+    // is texture_batch points on one texture, so divide by that to compare.
+    std::vector<float> hit_u(bench_inputs), hit_v(bench_inputs);
+    std::vector<vec3> hit_p(bench_inputs), looked_up(texture_batch);
+    for (int i = 0; i < bench_inputs; i++) {
+        hit_u[i] = hits[i].u;
+        hit_v[i] = hits[i].v;
+        hit_p[i] = hits[i].p;
+    }
+    runner.run("texture batch", [&](long long i) {
+        int k = int(i * texture_batch % bench_inputs);
+        texture_value_batch(textures[i % 3], &hit_u[k], &hit_v[k], &hit_p[k], &looked_up[0],
+                            texture_batch);
+        bench_keep(looked_up[0][0]);
+        return 0.0;
+    });
+
+    lambertian white(new constant_texture(vec3(0.73, 0.73, 0.73)));
+    sphere light(vec3(0, 0, 0), 1, &white);
+    runner.run("sphere::random", [&](long long i) {
+        bench_keep(light.random(points[i % bench_inputs])[0]);
+        return 0.0;
+    });
+    // A shadow ray towards the sphere for each direction it is asked about.
+    runner.run("sphere::pdf_value", [&](long long i) {
+        const vec3& o = points[i % bench_inputs];
+        bench_keep(light.pdf_value(o, normals[i % bench_inputs] - o));
+        return 1.0;
+    });
+
+    // The Cornell box's light, sampled from points spread through the box below it, by area and
+    // by solid angle.
+    xz_rect panel(213, 343, 227, 332, 554, &white);
+    std::vector<vec3> room;
+    for (int i = 0; i < bench_inputs; i++)
+        room.push_back(vec3(555*random_double(), 554*random_double(), 555*random_double()));
+    const char *modes[2] = { "area", "solid angle" };
+    for (int m = 0; m < 2; m++) {
+        rect_sampling = m == 0 ? rect_sampling_area : rect_sampling_solid_angle;
+        std::string name = std::string("xz_rect::random ") + modes[m];
+        runner.run(name.c_str(), [&](long long i) {
+            bench_keep(panel.random(room[i % bench_inputs])[0]);
+            return 0.0;
+        });
+        name = std::string("xz_rect::pdf_value ") + modes[m];
+        runner.run(name.c_str(), [&](long long i) {
+            const vec3& o = room[i % bench_inputs];
+            bench_keep(panel.pdf_value(o, vec3(278, 554, 279) - o));
+            return 0.0;
+        });
+    }
+}
@@ -9,24 +9,20 @@
 // with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
 //==================================================================================================
 
-#include "random.h"
+#include "../common/random.h"
+#include "estimator.h"
 
 #include <iostream>
 #include <math.h>
 
 
 int main() {
-    int N = 1000000;
-    float sum = 0.0;
-    for (int i = 0; i < N; i++) {
-        float r1 = random_double();
+    long long N = 100000000;
+    // The integral of cos^3 over the hemisphere, from directions uniform over it.
+    estimate I = estimate_mean(N, [](long long) {
         float r2 = random_double();
-        float x = cos(2*M_PI*r1)*2*sqrt(r2*(1-r2));
-        float y = sin(2*M_PI*r1)*2*sqrt(r2*(1-r2));
         float z = 1 - r2;
-        sum += z*z*z / (1.0/(2.0*M_PI));
-    }
-    std::cout << "PI/2 = " << M_PI/2 << "\n";
-    std::cout << "Estimate = " << sum/N << "\n";
+        return z*z*z / (1.0/(2.0*M_PI));
+    });
+    return report_estimate("Estimate of PI/2", I, M_PI/2) ? 0 : 1;
 }
-
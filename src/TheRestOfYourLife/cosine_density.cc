@@ -9,31 +9,22 @@
 // with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
 //==================================================================================================
 
-#include "random.h"
-#include "vec3.h"
+#include "../common/random.h"
+#include "estimator.h"
 
 #include <iostream>
 #include <math.h>
 
 
-inline vec3 random_cosine_direction() {
-    float r1 = random_double();
-    float r2 = random_double();
-    float z = sqrt(1-r2);
-    float phi = 2*M_PI*r1;
-    float x = cos(phi)*sqrt(r2);
-    float y = sin(phi)*sqrt(r2);
-    return vec3(x, y, z);
-}
-
-
 int main() {
-    int N = 1000000;
-    float sum = 0.0;
-    for (int i = 0; i < N; i++) {
-        vec3 v = random_cosine_direction();
-        sum += v.z()*v.z()*v.z() / (v.z()/(M_PI));
-    }
-    std::cout << "PI/2 = " << M_PI/2 << "\n";
-    std::cout << "Estimate = " << sum/N << "\n";
+    long long N = 100000000;
+    // The integral of cos^3 over the hemisphere again, now importance sampled with cosine_pdf,
+    // which also checks that its generate() and value() agree.
+    cosine_pdf p(vec3(0, 0, 1));
+    estimate I = estimate_integral(p, N, [](const vec3& v) {
+        return v.z() > 0 ? v.z()*v.z()*v.z() : 0;
+    });
+    bool ok = report_estimate("Estimate of PI/2", I, M_PI/2);
+    ok = report_estimate("Integral of the pdf", estimate_normalization(p, N), 1) && ok;
+    return ok ? 0 : 1;
 }
@@ -0,0 +1,93 @@
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+// The CUDA side of -device cuda: one thread per pixel, each running device_trace_sample() for
+// every sample of its pixel. Build it with nvcc and link it into a main.cc built with RT_CUDA:
+//
+//     nvcc -O3 -c device_cuda.cu
+//     g++ -O3 -DRT_CUDA main.cc device_cuda.o -lcudart -lpthread
+//
+// or configure CMake with -DRT_CUDA=ON, which builds the two together as theRestOfYourLifeCuda.
+
+#include "device_kernel.h"
+
+#include <cuda_runtime.h>
+#include <string>
+#include <vector>
+
+
+__global__ void render_device_kernel(device_scene_view scene, device_camera cam, int nx, int ny,
+                                     int ns, uint64_t seed, float *rgb) {
+    int i = blockIdx.x*blockDim.x + threadIdx.x;
+    int j = blockIdx.y*blockDim.y + threadIdx.y;
+    if (i >= nx || j >= ny)
+        return;
+    dvec col = make_dvec(0, 0, 0);
+    for (int s = 0; s < ns; s++)
+        col = col + device_trace_sample(scene, cam, i, j, nx, ny, s, seed);
+    col = col / float(ns);
+    float *p = rgb + 3*(size_t(j)*nx + i);
+    p[0] = col.x;
+    p[1] = col.y;
+    p[2] = col.z;
+}
+
+// Device copies of the view's arrays, freed together however the render ends.
+struct device_allocations {
+    ~device_allocations() {
+        for (size_t k = 0; k < blocks.size(); k++)
+            cudaFree(blocks[k]);
+    }
+
+    template <typename T>
+    bool copy(const T *host, int count, const T*& device) {
+        device = 0;
+        if (count == 0)
+            return true;
+        void *block;
+        if (cudaMalloc(&block, count*sizeof(T)) != cudaSuccess)
+            return false;
+        blocks.push_back(block);
+        device = (const T*)block;
+        return cudaMemcpy(block, host, count*sizeof(T), cudaMemcpyHostToDevice) == cudaSuccess;
+    }
+
+    std::vector<void*> blocks;
+};
+
+bool render_device_cuda(const device_scene_view& scene, const device_camera& cam, int nx, int ny,
+                        int ns, uint64_t seed, float *rgb, std::string& error) {
+    device_allocations memory;
+    device_scene_view d = scene;
+    bool ok = memory.copy(scene.shapes, scene.shape_count, d.shapes)
+           && memory.copy(scene.nodes, scene.node_count, d.nodes)
+           && memory.copy(scene.transforms, scene.transform_count, d.transforms)
+           && memory.copy(scene.materials, scene.material_count, d.materials)
+           && memory.copy(scene.lights, scene.light_count, d.lights)
+           && memory.copy(scene.light_selection, scene.light_count, d.light_selection)
+           && memory.copy(scene.light_cdf, scene.light_count, d.light_cdf)
+           && memory.copy(scene.light_nodes, scene.light_node_count, d.light_nodes);
+    float *image = 0;
+    size_t bytes = 3*size_t(nx)*ny*sizeof(float);
+    if (ok && cudaMalloc((void**)&image, bytes) == cudaSuccess) {
+        memory.blocks.push_back(image);
+        dim3 threads(8, 8);
+        dim3 blocks((nx + threads.x - 1) / threads.x, (ny + threads.y - 1) / threads.y);
+        render_device_kernel<<<blocks, threads>>>(d, cam, nx, ny, ns, seed, image);
+        ok = cudaGetLastError() == cudaSuccess && cudaDeviceSynchronize() == cudaSuccess
+          && cudaMemcpy(rgb, image, bytes, cudaMemcpyDeviceToHost) == cudaSuccess;
+    }
+    else
+        ok = false;
+    if (!ok)
+        error = cudaGetErrorString(cudaGetLastError());
+    return ok;
+}
@@ -0,0 +1,538 @@
+#ifndef DEVICEKERNELH
+#define DEVICEKERNELH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include <float.h>
+#include <math.h>
+#include <stdint.h>
+
+
+// This book's path tracer in a form that compiles for a GPU as well as for the CPU. Shapes,
+// materials and lights are plain structs of floats and indices rather than objects, color()'s
+// recursion is a loop, and there are no virtual calls, heap or thread-local state. device_scene.h
+// builds the arrays from an ordinary scene, and device_cuda.cu runs the kernel with CUDA. The
+// kernel covers spheres, rects and boxes, flip_normals and instances, lambertian, metal,
+// dielectric and diffuse_light with constant colours, and mixture sampling of the lights against
+// the cosine. It draws its random numbers in its own order, so its images match the CPU
+// renderer's in expectation, not pixel for pixel.
+#if defined(__CUDACC__)
+#define RT_DEVICE __host__ __device__
+#else
+#define RT_DEVICE
+#endif
+
+
+struct dvec { float x, y, z; };
+
+RT_DEVICE inline dvec make_dvec(float x, float y, float z) { dvec v = { x, y, z }; return v; }
+RT_DEVICE inline dvec operator+(dvec a, dvec b) { return make_dvec(a.x+b.x, a.y+b.y, a.z+b.z); }
+RT_DEVICE inline dvec operator-(dvec a, dvec b) { return make_dvec(a.x-b.x, a.y-b.y, a.z-b.z); }
+RT_DEVICE inline dvec operator-(dvec a) { return make_dvec(-a.x, -a.y, -a.z); }
+RT_DEVICE inline dvec operator*(dvec a, dvec b) { return make_dvec(a.x*b.x, a.y*b.y, a.z*b.z); }
+RT_DEVICE inline dvec operator*(float t, dvec a) { return make_dvec(t*a.x, t*a.y, t*a.z); }
+RT_DEVICE inline dvec operator/(dvec a, float t) { return make_dvec(a.x/t, a.y/t, a.z/t); }
+RT_DEVICE inline float dot(dvec a, dvec b) { return a.x*b.x + a.y*b.y + a.z*b.z; }
+RT_DEVICE inline dvec cross(dvec a, dvec b) {
+    return make_dvec(a.y*b.z - a.z*b.y, a.z*b.x - a.x*b.z, a.x*b.y - a.y*b.x);
+}
+RT_DEVICE inline dvec unit(dvec a) { return a / sqrtf(dot(a, a)); }
+RT_DEVICE inline float component(dvec a, int axis) { return axis == 0 ? a.x : axis == 1 ? a.y : a.z; }
+
+
+enum device_shape_kind { device_sphere, device_rect, device_box };
+
+struct device_shape {
+    int32_t kind;
+    int32_t axis;        // rect: the axis it is perpendicular to
+    int32_t material;    // index into materials; -1 for the shapes lights are sampled by
+    int32_t transform;   // index into transforms, -1 for a shape in world space
+    int32_t flip;        // 1 where flip_normals turned the normal around
+    float p[6];          // sphere: centre, radius; rect: a0, a1, b0, b1, k; box: min, max
+};
+
+// Rows of the 3x4 matrices [L | d] of an instance, as affine_transform stores them.
+struct device_transform {
+    float to_object[3][4];
+    float to_world[3][4];
+};
+
+enum device_material_kind { device_lambertian, device_metal, device_dielectric, device_light };
+
+struct device_material {
+    int32_t kind;
+    float color[3];        // albedo, or a light's radiance
+    float param;           // metal: fuzz; dielectric: refractive index
+    float light_fraction;  // lambertian: the share of bounces that sample the lights
+};
+
+// linear_bvh_node, with a wider count. The first child of an interior node is the next node.
+struct device_bvh_node {
+    float bmin[3];
+    float bmax[3];
+    int32_t offset;   // leaf: first shape, interior: index of the second child
+    int32_t count;    // shapes in a leaf, 0 for interior nodes
+};
+
+// Everything the kernel reads, as pointers into memory it can reach, host or device.
+struct device_scene_view {
+    const device_shape *shapes;         // in the order the leaves of nodes list them
+    int shape_count;
+    const device_bvh_node *nodes;
+    int node_count;
+    const device_transform *transforms;
+    int transform_count;
+    const device_material *materials;
+    int material_count;
+    const device_shape *lights;         // in the order the leaves of light_nodes list them
+    const float *light_selection;       // the probability of sampling each light
+    const float *light_cdf;             // running sums of light_selection
+    int light_count;
+    const device_bvh_node *light_nodes;
+    int light_node_count;
+    int max_depth;
+    int roulette_depth;                 // as roulette_survival() takes it; -1 is off
+};
+
+struct device_camera {
+    dvec origin, lower_left_corner, horizontal, vertical, u, v;
+    float lens_radius;
+};
+
+
+// pcg32 and random_hash from random.h, for one sample's stream.
+struct device_rng {
+    uint64_t state, inc;
+};
+
+RT_DEVICE inline uint32_t device_next(device_rng& r) {
+    uint64_t old = r.state;
+    r.state = old * 6364136223846793005ULL + r.inc;
+    uint32_t xorshifted = uint32_t(((old >> 18) ^ old) >> 27);
+    uint32_t rot = uint32_t(old >> 59);
+    return (xorshifted >> rot) | (xorshifted << ((0u - rot) & 31));
+}
+
+RT_DEVICE inline float device_random(device_rng& r) {
+    return float(device_next(r) >> 8) * (1.0f / 16777216.0f);
+}
+
+RT_DEVICE inline uint64_t device_hash(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+RT_DEVICE inline device_rng device_rng_for(uint64_t seed, uint64_t pixel, uint64_t sample) {
+    device_rng r;
+    r.state = 0;
+    r.inc = 1;
+    device_next(r);
+    r.state += device_hash(device_hash(device_hash(seed) ^ pixel) ^ sample);
+    device_next(r);
+    return r;
+}
+
+
+RT_DEVICE inline dvec device_point(const float m[3][4], dvec p) {
+    return make_dvec(m[0][0]*p.x + m[0][1]*p.y + m[0][2]*p.z + m[0][3],
+                     m[1][0]*p.x + m[1][1]*p.y + m[1][2]*p.z + m[1][3],
+                     m[2][0]*p.x + m[2][1]*p.y + m[2][2]*p.z + m[2][3]);
+}
+
+RT_DEVICE inline dvec device_vector(const float m[3][4], dvec v) {
+    return make_dvec(m[0][0]*v.x + m[0][1]*v.y + m[0][2]*v.z,
+                     m[1][0]*v.x + m[1][1]*v.y + m[1][2]*v.z,
+                     m[2][0]*v.x + m[2][1]*v.y + m[2][2]*v.z);
+}
+
+RT_DEVICE inline dvec device_transposed_vector(const float m[3][4], dvec v) {
+    return make_dvec(m[0][0]*v.x + m[1][0]*v.y + m[2][0]*v.z,
+                     m[0][1]*v.x + m[1][1]*v.y + m[2][1]*v.z,
+                     m[0][2]*v.x + m[1][2]*v.y + m[2][2]*v.z);
+}
+
+// The in-plane axes of a rect perpendicular to axis, in the order aarect.h uses.
+RT_DEVICE inline int rect_a_axis(int axis) { return axis == 0 ? 1 : 0; }
+RT_DEVICE inline int rect_b_axis(int axis) { return axis == 2 ? 1 : 2; }
+
+// The nearest crossing of s by the ray in (t_min, t_max), with the shape's own normal, in the
+// shape's own space: outward for spheres and boxes, +axis for rects.
+RT_DEVICE inline bool device_local_hit(const device_shape& s, dvec o, dvec d, float t_min,
+                                       float t_max, float& t, dvec& normal) {
+    if (s.kind == device_sphere) {
+        dvec c = make_dvec(s.p[0], s.p[1], s.p[2]);
+        dvec oc = o - c;
+        float a = dot(d, d);
+        float b = dot(oc, d);
+        float cc = dot(oc, oc) - s.p[3]*s.p[3];
+        float discriminant = b*b - a*cc;
+        if (discriminant <= 0)
+            return false;
+        float root = sqrtf(discriminant);
+        t = (-b - root) / a;
+        if (!(t < t_max && t > t_min)) {
+            t = (-b + root) / a;
+            if (!(t < t_max && t > t_min))
+                return false;
+        }
+        normal = ((o + t*d) - c) / s.p[3];
+        return true;
+    }
+    if (s.kind == device_rect) {
+        int a = rect_a_axis(s.axis), b = rect_b_axis(s.axis);
+        t = (s.p[4] - component(o, s.axis)) / component(d, s.axis);
+        if (!(t > t_min && t < t_max))
+            return false;
+        float pa = component(o, a) + t*component(d, a);
+        float pb = component(o, b) + t*component(d, b);
+        if (pa < s.p[0] || pa > s.p[1] || pb < s.p[2] || pb > s.p[3])
+            return false;
+        float n[3] = { 0, 0, 0 };
+        n[s.axis] = 1;
+        normal = make_dvec(n[0], n[1], n[2]);
+        return true;
+    }
+    // A box is the overlap of three slabs. A ray that starts inside leaves through the far face.
+    float t_near = -FLT_MAX, t_far = FLT_MAX;
+    int near_face = 0, far_face = 0;
+    for (int a = 0; a < 3; a++) {
+        float inv = 1.0f / component(d, a);
+        float t0 = (s.p[a] - component(o, a)) * inv;
+        float t1 = (s.p[a+3] - component(o, a)) * inv;
+        int f0 = 2*a, f1 = 2*a + 1;   // face 2a is the min side, 2a+1 the max side
+        if (inv < 0) {
+            float tt = t0; t0 = t1; t1 = tt;
+            f0 = 2*a + 1; f1 = 2*a;
+        }
+        if (t0 > t_near) { t_near = t0; near_face = f0; }
+        if (t1 < t_far) { t_far = t1; far_face = f1; }
+    }
+    if (t_near > t_far)
+        return false;
+    int face;
+    if (t_near > t_min && t_near < t_max) { t = t_near; face = near_face; }
+    else if (t_far > t_min && t_far < t_max) { t = t_far; face = far_face; }
+    else return false;
+    float n[3] = { 0, 0, 0 };
+    n[face / 2] = face & 1 ? 1.0f : -1.0f;
+    normal = make_dvec(n[0], n[1], n[2]);
+    return true;
+}
+
+// device_local_hit() for a ray in world space, with the normal in world space and flipped as
+// the scene asked.
+RT_DEVICE inline bool device_shape_hit(const device_scene_view& s, const device_shape& shape,
+                                       dvec o, dvec d, float t_min, float t_max, float& t,
+                                       dvec& normal) {
+    const device_transform *x = shape.transform >= 0 ? &s.transforms[shape.transform] : 0;
+    if (x) {
+        o = device_point(x->to_object, o);
+        d = device_vector(x->to_object, d);
+    }
+    if (!device_local_hit(shape, o, d, t_min, t_max, t, normal))
+        return false;
+    if (x)
+        normal = unit(device_transposed_vector(x->to_object, normal));
+    if (shape.flip)
+        normal = -normal;
+    return true;
+}
+
+RT_DEVICE inline bool device_box_hit(const device_bvh_node& node, dvec o, dvec inv_d,
+                                     float t_min, float t_max) {
+    for (int a = 0; a < 3; a++) {
+        float t0 = (node.bmin[a] - component(o, a)) * component(inv_d, a);
+        float t1 = (node.bmax[a] - component(o, a)) * component(inv_d, a);
+        if (t0 > t1) { float tt = t0; t0 = t1; t1 = tt; }
+        t_min = t0 > t_min ? t0 : t_min;
+        t_max = t1 < t_max ? t1 : t_max;
+        if (t_max < t_min)
+            return false;
+    }
+    return true;
+}
+
+struct device_hit {
+    float t;
+    dvec normal;
+    int material;
+};
+
+const int device_stack_size = 64;
+
+RT_DEVICE inline bool device_scene_hit(const device_scene_view& s, dvec o, dvec d, float t_min,
+                                       float t_max, device_hit& hit) {
+    if (s.node_count == 0)
+        return false;
+    dvec inv_d = make_dvec(1.0f / d.x, 1.0f / d.y, 1.0f / d.z);
+    int stack[device_stack_size];
+    int stack_size = 0;
+    int current = 0;
+    bool found = false;
+    for (;;) {
+        const device_bvh_node& node = s.nodes[current];
+        if (device_box_hit(node, o, inv_d, t_min, t_max)) {
+            if (node.count > 0) {
+                for (int i = node.offset; i < node.offset + node.count; i++) {
+                    float t;
+                    dvec n;
+                    if (device_shape_hit(s, s.shapes[i], o, d, t_min, t_max, t, n)) {
+                        t_max = t;
+                        hit.t = t;
+                        hit.normal = n;
+                        hit.material = s.shapes[i].material;
+                        found = true;
+                    }
+                }
+            }
+            else if (stack_size < device_stack_size) {
+                stack[stack_size++] = node.offset;
+                current++;
+                continue;
+            }
+        }
+        if (stack_size == 0)
+            break;
+        current = stack[--stack_size];
+    }
+    return found;
+}
+
+
+// Sampling towards a light and the density of doing so, as xz_rect and sphere do it on the CPU.
+RT_DEVICE inline float device_light_shape_pdf(const device_shape& l, dvec o, dvec v) {
+    float t;
+    dvec n;
+    if (l.kind == device_rect) {
+        if (!device_local_hit(l, o, v, 0.001f, FLT_MAX, t, n))
+            return 0;
+        float area = (l.p[1] - l.p[0]) * (l.p[3] - l.p[2]);
+        float distance_squared = t*t * dot(v, v);
+        float cosine = fabsf(component(v, l.axis)) / sqrtf(dot(v, v));
+        return distance_squared / (cosine * area);
+    }
+    if (l.kind == device_sphere) {
+        if (!device_local_hit(l, o, v, 0.001f, FLT_MAX, t, n))
+            return 0;
+        dvec c = make_dvec(l.p[0], l.p[1], l.p[2]);
+        float cos_theta_max = sqrtf(1 - l.p[3]*l.p[3] / dot(c - o, c - o));
+        return 1 / (2*float(M_PI)*(1 - cos_theta_max));
+    }
+    return 0;
+}
+
+// onb::build_from_w and local().
+RT_DEVICE inline dvec device_local(dvec w, dvec a) {
+    w = unit(w);
+    dvec up = fabsf(w.x) > 0.9f ? make_dvec(0, 1, 0) : make_dvec(1, 0, 0);
+    dvec v = unit(cross(w, up));
+    dvec u = cross(w, v);
+    return a.x*u + a.y*v + a.z*w;
+}
+
+RT_DEVICE inline dvec device_light_shape_random(const device_shape& l, dvec o, device_rng& rng) {
+    if (l.kind == device_rect) {
+        float p[3];
+        p[rect_a_axis(l.axis)] = l.p[0] + device_random(rng)*(l.p[1] - l.p[0]);
+        p[rect_b_axis(l.axis)] = l.p[2] + device_random(rng)*(l.p[3] - l.p[2]);
+        p[l.axis] = l.p[4];
+        return make_dvec(p[0], p[1], p[2]) - o;
+    }
+    dvec c = make_dvec(l.p[0], l.p[1], l.p[2]);
+    float distance_squared = dot(c - o, c - o);
+    float r1 = device_random(rng);
+    float r2 = device_random(rng);
+    float z = 1 + r2*(sqrtf(1 - l.p[3]*l.p[3]/distance_squared) - 1);
+    float phi = 2*float(M_PI)*r1;
+    float s = sqrtf(1 - z*z);
+    return device_local(c - o, make_dvec(cosf(phi)*s, sinf(phi)*s, z));
+}
+
+// light_set::pdf_value: the lights whose bounds the direction passes through, weighted by how
+// often each is picked.
+RT_DEVICE inline float device_light_pdf(const device_scene_view& s, dvec o, dvec v) {
+    if (s.light_node_count == 0)
+        return 0;
+    dvec inv_v = make_dvec(1.0f / v.x, 1.0f / v.y, 1.0f / v.z);
+    int stack[device_stack_size];
+    int stack_size = 0;
+    int current = 0;
+    float sum = 0;
+    for (;;) {
+        const device_bvh_node& node = s.light_nodes[current];
+        if (device_box_hit(node, o, inv_v, 0.001f, FLT_MAX)) {
+            if (node.count > 0) {
+                for (int i = node.offset; i < node.offset + node.count; i++)
+                    sum += s.light_selection[i] * device_light_shape_pdf(s.lights[i], o, v);
+            }
+            else if (stack_size < device_stack_size) {
+                stack[stack_size++] = node.offset;
+                current++;
+                continue;
+            }
+        }
+        if (stack_size == 0)
+            break;
+        current = stack[--stack_size];
+    }
+    return sum;
+}
+
+RT_DEVICE inline dvec device_light_random(const device_scene_view& s, dvec o, device_rng& rng) {
+    float u = device_random(rng);
+    int lo = 0, hi = s.light_count - 1;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (s.light_cdf[mid] > u) hi = mid;
+        else lo = mid + 1;
+    }
+    return device_light_shape_random(s.lights[lo], o, rng);
+}
+
+RT_DEVICE inline dvec device_in_unit_sphere(device_rng& rng) {
+    dvec p;
+    do {
+        p = make_dvec(2*device_random(rng) - 1, 2*device_random(rng) - 1, 2*device_random(rng) - 1);
+    } while (dot(p, p) >= 1);
+    return p;
+}
+
+RT_DEVICE inline dvec device_reflect(dvec v, dvec n) { return v - 2*dot(v, n)*n; }
+
+
+// One camera sample of pixel (i, j): the radiance color() would estimate along its path.
+RT_DEVICE inline dvec device_trace_sample(const device_scene_view& s, const device_camera& cam,
+                                          int i, int j, int nx, int ny, uint32_t sample,
+                                          uint64_t seed) {
+    device_rng rng = device_rng_for(seed, uint64_t(j)*nx + i, sample);
+    float su = (i + device_random(rng)) / float(nx);
+    float sv = (j + device_random(rng)) / float(ny);
+    dvec o = cam.origin;
+    dvec d = cam.lower_left_corner + su*cam.horizontal + sv*cam.vertical - cam.origin;
+    if (cam.lens_radius > 0) {
+        // The concentric map of random_in_unit_disk().
+        float a = 2*device_random(rng) - 1;
+        float b = 2*device_random(rng) - 1;
+        float r = 0, phi = 0;
+        if (a*a > b*b) {
+            r = a;
+            phi = float(M_PI/4) * (b/a);
+        }
+        else if (b != 0) {
+            r = b;
+            phi = float(M_PI/2) - float(M_PI/4) * (a/b);
+        }
+        r *= cam.lens_radius;
+        dvec offset = r*cosf(phi)*cam.u + r*sinf(phi)*cam.v;
+        o = o + offset;
+        d = d - offset;
+    }
+    dvec radiance = make_dvec(0, 0, 0);
+    dvec throughput = make_dvec(1, 1, 1);
+    for (int depth = 0; ; depth++) {
+        device_hit hit = device_hit();
+        if (!device_scene_hit(s, o, d, 0.001f, FLT_MAX, hit))
+            break;
+        const device_material& m = s.materials[hit.material];
+        dvec p = o + hit.t*d;
+        dvec color = make_dvec(m.color[0], m.color[1], m.color[2]);
+        if (m.kind == device_light) {
+            if (dot(hit.normal, d) < 0)
+                radiance = radiance + throughput*color;
+            break;
+        }
+        if (depth >= s.max_depth)
+            break;
+        dvec direction;
+        dvec attenuation;
+        if (m.kind == device_lambertian) {
+            float fraction = s.light_count > 0 ? m.light_fraction : 0;
+            if (device_random(rng) < fraction)
+                direction = device_light_random(s, p, rng);
+            else {
+                float r1 = device_random(rng);
+                float r2 = device_random(rng);
+                float phi = 2*float(M_PI)*r1;
+                direction = device_local(hit.normal, make_dvec(cosf(phi)*sqrtf(r2),
+                                                               sinf(phi)*sqrtf(r2),
+                                                               sqrtf(1 - r2)));
+            }
+            float cosine = dot(unit(direction), hit.normal);
+            float scattering_pdf = cosine > 0 ? cosine / float(M_PI) : 0;
+            float pdf = fraction*device_light_pdf(s, p, direction)
+                      + (1 - fraction)*scattering_pdf;
+            if (!(pdf > 0) || scattering_pdf == 0)
+                break;
+            attenuation = (scattering_pdf / pdf)*color;
+        }
+        else if (m.kind == device_metal) {
+            direction = device_reflect(unit(d), hit.normal) + m.param*device_in_unit_sphere(rng);
+            attenuation = color;
+        }
+        else {
+            // dielectric, with Schlick's approximation choosing between reflection and refraction.
+            float ref_idx = m.param;
+            dvec outward_normal;
+            float ni_over_nt, cosine;
+            float dn = dot(d, hit.normal);
+            float length = sqrtf(dot(d, d));
+            if (dn > 0) {
+                outward_normal = -hit.normal;
+                ni_over_nt = ref_idx;
+                cosine = ref_idx * dn / length;
+            }
+            else {
+                outward_normal = hit.normal;
+                ni_over_nt = 1 / ref_idx;
+                cosine = -dn / length;
+            }
+            dvec uv = unit(d);
+            float dt = dot(uv, outward_normal);
+            float discriminant = 1 - ni_over_nt*ni_over_nt*(1 - dt*dt);
+            float reflect_prob = 1;
+            if (discriminant > 0) {
+                float r0 = (1 - ref_idx) / (1 + ref_idx);
+                r0 = r0*r0;
+                reflect_prob = r0 + (1 - r0)*powf(1 - cosine, 5);
+            }
+            if (device_random(rng) < reflect_prob)
+                direction = device_reflect(d, hit.normal);
+            else
+                direction = ni_over_nt*(uv - dt*outward_normal) - sqrtf(discriminant)*outward_normal;
+            attenuation = make_dvec(1, 1, 1);
+        }
+        throughput = throughput*attenuation;
+        // roulette_survival() from roulette.h.
+        if (s.roulette_depth >= 0 && depth >= s.roulette_depth) {
+            float q = throughput.x > throughput.y ? throughput.x : throughput.y;
+            q = q > throughput.z ? q : throughput.z;
+            if (q < 0.1f) {
+                q /= 0.1f;
+                if (device_random(rng) >= q)
+                    break;
+                throughput = throughput / q;
+            }
+        }
+        o = p;
+        d = direction;
+    }
+    // de_nan(), for the rare sample that divides by nothing.
+    if (!(radiance.x == radiance.x)) radiance.x = 0;
+    if (!(radiance.y == radiance.y)) radiance.y = 0;
+    if (!(radiance.z == radiance.z)) radiance.z = 0;
+    return radiance;
+}
+
+#endif
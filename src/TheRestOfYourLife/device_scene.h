@@ -0,0 +1,384 @@
+#ifndef DEVICESCENEH
+#define DEVICESCENEH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include "../common/box.h"
+#include "../common/bvh.h"
+#include "../common/camera.h"
+#include "../common/hittable_list.h"
+#include "../common/instance.h"
+#include "../common/linear_bvh.h"
+#include "aarect.h"
+#include "device_kernel.h"
+#include "light_set.h"
+#include "material.h"
+#include "sphere.h"
+#include "texture.h"
+
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+// A scene flattened into the arrays device_kernel.h reads. The containers (hittable_list,
+// bvh_node, linear_bvh) are dropped and one tree is built over all the shapes; flip_normals and
+// instance become flags and transform indices on the shapes beneath them.
+class device_scene {
+    public:
+        // Returns false, with the reason in error, for a scene the kernel cannot render.
+        bool build(hittable *world, hittable *light_shape, std::string& error);
+        device_scene_view view() const;
+
+        std::vector<device_shape> shapes;
+        std::vector<device_bvh_node> nodes;
+        std::vector<device_transform> transforms;
+        std::vector<device_material> materials;
+        std::vector<device_shape> lights;
+        std::vector<float> light_selection;
+        std::vector<float> light_cdf;
+        std::vector<device_bvh_node> light_nodes;
+
+    private:
+        bool add(hittable *h, int transform, bool flip, std::string& error);
+        bool add_light(hittable *h, float selection, std::string& error);
+        bool make_shape(hittable *h, device_shape& s, std::string& error);
+        int material_index(material *m, std::string& error);
+
+        std::unordered_map<material*, int> material_ids;
+        std::vector<affine_transform> object_to_world;
+};
+
+
+// The world-space bounds of a shape.
+inline aabb device_shape_bounds(const device_shape& s, const device_transform *transforms) {
+    vec3 lo, hi;
+    if (s.kind == device_sphere) {
+        vec3 c(s.p[0], s.p[1], s.p[2]);
+        lo = c - vec3(s.p[3], s.p[3], s.p[3]);
+        hi = c + vec3(s.p[3], s.p[3], s.p[3]);
+    }
+    else if (s.kind == device_rect) {
+        int a = rect_a_axis(s.axis), b = rect_b_axis(s.axis);
+        lo[a] = s.p[0]; hi[a] = s.p[1];
+        lo[b] = s.p[2]; hi[b] = s.p[3];
+        lo[s.axis] = s.p[4] - 0.0001f; hi[s.axis] = s.p[4] + 0.0001f;
+    }
+    else {
+        lo = vec3(s.p[0], s.p[1], s.p[2]);
+        hi = vec3(s.p[3], s.p[4], s.p[5]);
+    }
+    if (s.transform < 0)
+        return aabb(lo, hi);
+    const float (*m)[4] = transforms[s.transform].to_world;
+    vec3 wlo(FLT_MAX, FLT_MAX, FLT_MAX), whi(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    for (int corner = 0; corner < 8; corner++) {
+        vec3 p(corner & 1 ? hi[0] : lo[0], corner & 2 ? hi[1] : lo[1], corner & 4 ? hi[2] : lo[2]);
+        for (int r = 0; r < 3; r++) {
+            float x = m[r][0]*p[0] + m[r][1]*p[1] + m[r][2]*p[2] + m[r][3];
+            wlo[r] = std::min(wlo[r], x);
+            whi[r] = std::max(whi[r], x);
+        }
+    }
+    return aabb(wlo, whi);
+}
+
+// A median split on the longest axis of the centroids, two shapes to a leaf, laid out as
+// linear_bvh lays out its nodes. Reorders shapes, and values alongside them, into leaf order.
+inline int build_device_bvh(std::vector<device_shape>& shapes, std::vector<float>* values,
+                            const device_transform *transforms, int begin, int end,
+                            std::vector<device_bvh_node>& nodes) {
+    aabb bounds = device_shape_bounds(shapes[begin], transforms);
+    vec3 cmin = 0.5*(bounds.min() + bounds.max()), cmax = cmin;
+    for (int i = begin + 1; i < end; i++) {
+        aabb b = device_shape_bounds(shapes[i], transforms);
+        bounds = surrounding_box(bounds, b);
+        vec3 c = 0.5*(b.min() + b.max());
+        for (int a = 0; a < 3; a++) {
+            cmin[a] = std::min(cmin[a], c[a]);
+            cmax[a] = std::max(cmax[a], c[a]);
+        }
+    }
+    int index = int(nodes.size());
+    nodes.push_back(device_bvh_node());
+    device_bvh_node node;
+    for (int a = 0; a < 3; a++) {
+        node.bmin[a] = bounds.min()[a];
+        node.bmax[a] = bounds.max()[a];
+    }
+    if (end - begin <= 2) {
+        node.offset = begin;
+        node.count = end - begin;
+        nodes[index] = node;
+        return index;
+    }
+    vec3 extent = cmax - cmin;
+    int axis = extent[0] > extent[1] ? (extent[0] > extent[2] ? 0 : 2) : (extent[1] > extent[2] ? 1 : 2);
+    std::vector<int> order(end - begin);
+    for (int i = 0; i < end - begin; i++)
+        order[i] = begin + i;
+    int mid = (end - begin) / 2;
+    std::nth_element(order.begin(), order.begin() + mid, order.end(), [&](int x, int y) {
+        aabb bx = device_shape_bounds(shapes[x], transforms);
+        aabb by = device_shape_bounds(shapes[y], transforms);
+        return bx.min()[axis] + bx.max()[axis] < by.min()[axis] + by.max()[axis];
+    });
+    std::vector<device_shape> sorted;
+    std::vector<float> sorted_values;
+    for (int i : order) {
+        sorted.push_back(shapes[i]);
+        if (values)
+            sorted_values.push_back((*values)[i]);
+    }
+    std::copy(sorted.begin(), sorted.end(), shapes.begin() + begin);
+    if (values)
+        std::copy(sorted_values.begin(), sorted_values.end(), values->begin() + begin);
+    build_device_bvh(shapes, values, transforms, begin, begin + mid, nodes);
+    node.offset = build_device_bvh(shapes, values, transforms, begin + mid, end, nodes);
+    node.count = 0;
+    nodes[index] = node;
+    return index;
+}
+
+
+bool device_scene::make_shape(hittable *h, device_shape& s, std::string& error) {
+    s.axis = 0;
+    s.transform = -1;
+    s.flip = 0;
+    material *m;
+    if (sphere *sp = dynamic_cast<sphere*>(h)) {
+        s.kind = device_sphere;
+        float p[6] = { sp->center[0], sp->center[1], sp->center[2], sp->radius, 0, 0 };
+        std::copy(p, p + 6, s.p);
+        m = sp->mat_ptr;
+    }
+    else if (xy_rect *r = dynamic_cast<xy_rect*>(h)) {
+        s.kind = device_rect;
+        s.axis = 2;
+        float p[6] = { r->x0, r->x1, r->y0, r->y1, r->k, 0 };
+        std::copy(p, p + 6, s.p);
+        m = r->mp;
+    }
+    else if (xz_rect *r = dynamic_cast<xz_rect*>(h)) {
+        s.kind = device_rect;
+        s.axis = 1;
+        float p[6] = { r->x0, r->x1, r->z0, r->z1, r->k, 0 };
+        std::copy(p, p + 6, s.p);
+        m = r->mp;
+    }
+    else if (yz_rect *r = dynamic_cast<yz_rect*>(h)) {
+        s.kind = device_rect;
+        s.axis = 0;
+        float p[6] = { r->y0, r->y1, r->z0, r->z1, r->k, 0 };
+        std::copy(p, p + 6, s.p);
+        m = r->mp;
+    }
+    else if (box *b = dynamic_cast<box*>(h)) {
+        s.kind = device_box;
+        float p[6] = { b->pmin[0], b->pmin[1], b->pmin[2], b->pmax[0], b->pmax[1], b->pmax[2] };
+        std::copy(p, p + 6, s.p);
+        m = b->mat_ptr;
+    }
+    else {
+        error = "the device kernel has no shape like this scene's";
+        return false;
+    }
+    s.material = m ? material_index(m, error) : -1;
+    return !m || s.material >= 0;
+}
+
+int device_scene::material_index(material *m, std::string& error) {
+    auto found = material_ids.find(m);
+    if (found != material_ids.end())
+        return found->second;
+    device_material d;
+    d.param = 0;
+    d.light_fraction = m->light_fraction;
+    const texture *t = 0;
+    vec3 color(0, 0, 0);
+    if (m->kind == material_lambertian) {
+        d.kind = device_lambertian;
+        t = static_cast<lambertian*>(m)->albedo;
+    }
+    else if (m->kind == material_diffuse_light) {
+        d.kind = device_light;
+        t = static_cast<diffuse_light*>(m)->emit;
+    }
+    else if (m->kind == material_metal) {
+        d.kind = device_metal;
+        color = static_cast<metal*>(m)->albedo;
+        d.param = static_cast<metal*>(m)->fuzz;
+    }
+    else if (m->kind == material_dielectric) {
+        d.kind = device_dielectric;
+        color = vec3(1, 1, 1);
+        d.param = static_cast<dielectric*>(m)->ref_idx;
+    }
+    else {
+        error = "the device kernel has no material like this scene's";
+        return -1;
+    }
+    if (t) {
+        if (t->kind != texture_constant) {
+            error = "the device kernel only has constant textures";
+            return -1;
+        }
+        color = static_cast<const constant_texture*>(t)->color;
+    }
+    for (int c = 0; c < 3; c++)
+        d.color[c] = color[c];
+    materials.push_back(d);
+    material_ids[m] = int(materials.size()) - 1;
+    return int(materials.size()) - 1;
+}
+
+bool device_scene::add(hittable *h, int transform, bool flip, std::string& error) {
+    if (hittable_list *l = dynamic_cast<hittable_list*>(h)) {
+        for (int i = 0; i < l->list_size; i++)
+            if (!add(l->list[i], transform, flip, error))
+                return false;
+        return true;
+    }
+    if (bvh_node *b = dynamic_cast<bvh_node*>(h))
+        return add(b->left, transform, flip, error)
+            && (!b->right || add(b->right, transform, flip, error));
+    if (linear_bvh *b = dynamic_cast<linear_bvh*>(h)) {
+        for (size_t i = 0; i < b->prims.size(); i++)
+            if (!add(b->prims[i], transform, flip, error))
+                return false;
+        return true;
+    }
+    if (light_set *l = dynamic_cast<light_set*>(h)) {
+        for (size_t i = 0; i < l->lights.size(); i++)
+            if (!add(l->lights[i], transform, flip, error))
+                return false;
+        return true;
+    }
+    if (flip_normals *f = dynamic_cast<flip_normals*>(h))
+        return add(f->ptr, transform, !flip, error);
+    if (instance *in = dynamic_cast<instance*>(h)) {
+        // Nested instances compose into one transform.
+        affine_transform to_world = transform >= 0 ? object_to_world[transform] * in->to_world
+                                                   : in->to_world;
+        device_transform x;
+        affine_transform to_object = to_world.inverse();
+        for (int r = 0; r < 3; r++) {
+            for (int c = 0; c < 4; c++) {
+                x.to_world[r][c] = to_world.m[r][c];
+                x.to_object[r][c] = to_object.m[r][c];
+            }
+        }
+        transforms.push_back(x);
+        object_to_world.push_back(to_world);
+        return add(in->ptr, int(transforms.size()) - 1, flip, error);
+    }
+    device_shape s;
+    if (!make_shape(h, s, error))
+        return false;
+    if (s.material < 0) {
+        error = "a shape in the world has no material";
+        return false;
+    }
+    s.transform = transform;
+    s.flip = flip ? 1 : 0;
+    shapes.push_back(s);
+    return true;
+}
+
+bool device_scene::add_light(hittable *h, float selection, std::string& error) {
+    // Which way a light faces does not change how it is sampled.
+    while (flip_normals *f = dynamic_cast<flip_normals*>(h))
+        h = f->ptr;
+    device_shape s;
+    if (!make_shape(h, s, error))
+        return false;
+    if (s.kind == device_box) {
+        error = "the device kernel samples only spheres and rects";
+        return false;
+    }
+    lights.push_back(s);
+    light_selection.push_back(selection);
+    return true;
+}
+
+bool device_scene::build(hittable *world, hittable *light_shape, std::string& error) {
+    if (!add(world, -1, false, error))
+        return false;
+    if (light_set *l = dynamic_cast<light_set*>(light_shape)) {
+        for (size_t i = 0; i < l->lights.size(); i++)
+            if (!add_light(l->lights[i], l->selection[i], error))
+                return false;
+    }
+    else if (hittable_list *l = dynamic_cast<hittable_list*>(light_shape)) {
+        for (int i = 0; i < l->list_size; i++)
+            if (!add_light(l->list[i], 1.0f / l->list_size, error))
+                return false;
+    }
+    else if (light_shape && !add_light(light_shape, 1, error))
+        return false;
+    if (!shapes.empty())
+        build_device_bvh(shapes, 0, transforms.data(), 0, int(shapes.size()), nodes);
+    if (!lights.empty())
+        build_device_bvh(lights, &light_selection, transforms.data(), 0, int(lights.size()),
+                         light_nodes);
+    float sum = 0;
+    for (size_t i = 0; i < light_selection.size(); i++)
+        light_cdf.push_back(sum += light_selection[i]);
+    if (!light_cdf.empty())
+        light_cdf.back() = 1;
+    return true;
+}
+
+device_scene_view device_scene::view() const {
+    device_scene_view v;
+    v.shapes = shapes.data();
+    v.shape_count = int(shapes.size());
+    v.nodes = nodes.data();
+    v.node_count = int(nodes.size());
+    v.transforms = transforms.data();
+    v.transform_count = int(transforms.size());
+    v.materials = materials.data();
+    v.material_count = int(materials.size());
+    v.lights = lights.data();
+    v.light_selection = light_selection.data();
+    v.light_cdf = light_cdf.data();
+    v.light_count = int(lights.size());
+    v.light_nodes = light_nodes.data();
+    v.light_node_count = int(light_nodes.size());
+    v.max_depth = 50;
+    v.roulette_depth = -1;
+    return v;
+}
+
+inline device_camera make_device_camera(const camera& cam) {
+    device_camera d;
+    d.origin = make_dvec(cam.origin[0], cam.origin[1], cam.origin[2]);
+    d.lower_left_corner = make_dvec(cam.lower_left_corner[0], cam.lower_left_corner[1],
+                                    cam.lower_left_corner[2]);
+    d.horizontal = make_dvec(cam.horizontal[0], cam.horizontal[1], cam.horizontal[2]);
+    d.vertical = make_dvec(cam.vertical[0], cam.vertical[1], cam.vertical[2]);
+    d.u = make_dvec(cam.u[0], cam.u[1], cam.u[2]);
+    d.v = make_dvec(cam.v[0], cam.v[1], cam.v[2]);
+    d.lens_radius = cam.lens_radius;
+    return d;
+}
+
+
+#ifdef RT_CUDA
+// device_cuda.cu: copies the view's arrays to the GPU, traces ns samples of every pixel there
+// and writes their averages into rgb, nx*ny*3 floats with the framebuffer's layout. Returns
+// false, with CUDA's message in error, if anything fails.
+bool render_device_cuda(const device_scene_view& scene, const device_camera& cam, int nx, int ny,
+                        int ns, uint64_t seed, float *rgb, std::string& error);
+#endif
+
+#endif
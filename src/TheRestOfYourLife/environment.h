@@ -0,0 +1,178 @@
+#ifndef ENVIRONMENTH
+#define ENVIRONMENTH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include "../common/arena.h"
+#include "../common/hittable.h"
+#include "../common/random.h"
+#include "../common/stb_image.h"
+#include "../common/trace.h"
+
+#include <algorithm>
+#include <math.h>
+#include <vector>
+
+
+// Light from infinitely far away in every direction, read from an HDR image in latitude-longitude
+// layout: the top row looks straight up +y, the bottom row straight down, and columns go once
+// around y starting from -x. Rays that miss the world pick up radiance(); as a hittable it is
+// never hit, and is only there to be sampled through pdf_value() and random() in the list of
+// lights, in proportion to each pixel's brightness times the solid angle it covers.
+class environment_light : public hittable {
+    public:
+        // rgb is w*h linear pixels, top row first, as stbi_loadf returns them.
+        environment_light(const float *rgb, int w, int h, float scale = 1);
+        // A sky of one colour.
+        environment_light(const vec3& c);
+
+        // Makes the light in scene from the image at path. Returns 0 if it cannot be read.
+        static environment_light *load(arena& scene, const char *path, float scale = 1);
+
+        vec3 radiance(const vec3& direction) const;
+
+        virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+            return false;
+        }
+        virtual bool bounding_box(float t0, float t1, aabb& box) const { return false; }
+        virtual float pdf_value(const vec3& o, const vec3& v) const;
+        virtual vec3 random(const vec3& o) const;
+
+        int nx, ny;
+        std::vector<float> pixels;
+
+    private:
+        void build_distribution();
+        int pixel_index(const vec3& direction, float& sin_theta) const;
+
+        // Running sums, normalised to end at 1: marginal over rows, and conditional over the
+        // columns of each row, nx+1 entries a row.
+        std::vector<float> marginal;
+        std::vector<float> conditional;
+        // Each pixel's share of the sampling weight, times nx*ny, so that a direction's density
+        // is density[k] / (2 pi^2 sin theta).
+        std::vector<float> density;
+};
+
+environment_light::environment_light(const float *rgb, int w, int h, float scale)
+    : nx(w), ny(h), pixels(rgb, rgb + 3*size_t(w)*h) {
+    for (size_t k = 0; k < pixels.size(); k++)
+        pixels[k] *= scale;
+    build_distribution();
+}
+
+environment_light::environment_light(const vec3& c) : nx(1), ny(1), pixels(3) {
+    for (int a = 0; a < 3; a++)
+        pixels[a] = c[a];
+    build_distribution();
+}
+
+environment_light *environment_light::load(arena& scene, const char *path, float scale) {
+    trace_zone zone("texture load");
+    int w, h, n;
+    float *data = stbi_loadf(path, &w, &h, &n, 3);
+    if (!data)
+        return 0;
+    environment_light *env = scene.make<environment_light>(data, w, h, scale);
+    stbi_image_free(data);
+    return env;
+}
+
+// Pixels are weighed by luminance and by sin(theta) at their row's centre, which is how much
+// solid angle the rows near the poles lose. A black map is sampled uniformly.
+void environment_light::build_distribution() {
+    marginal.assign(ny + 1, 0);
+    conditional.assign(size_t(ny)*(nx + 1), 0);
+    density.assign(size_t(nx)*ny, 0);
+    std::vector<double> weight(size_t(nx)*ny);
+    double total = 0;
+    for (int j = 0; j < ny; j++) {
+        float sin_theta = sin(M_PI * (j + 0.5) / ny);
+        for (int i = 0; i < nx; i++) {
+            const float *p = &pixels[3*(size_t(j)*nx + i)];
+            double w = (0.2126*p[0] + 0.7152*p[1] + 0.0722*p[2]) * sin_theta;
+            weight[size_t(j)*nx + i] = w > 0 ? w : 0;
+            total += weight[size_t(j)*nx + i];
+        }
+    }
+    if (!(total > 0)) {
+        for (int j = 0; j < ny; j++)
+            for (int i = 0; i < nx; i++)
+                weight[size_t(j)*nx + i] = sin(M_PI * (j + 0.5) / ny);
+        total = 0;
+        for (size_t k = 0; k < weight.size(); k++)
+            total += weight[k];
+    }
+    double rows = 0;
+    for (int j = 0; j < ny; j++) {
+        double row = 0;
+        for (int i = 0; i < nx; i++)
+            row += weight[size_t(j)*nx + i];
+        float *c = &conditional[size_t(j)*(nx + 1)];
+        double sum = 0;
+        for (int i = 0; i < nx; i++) {
+            sum += weight[size_t(j)*nx + i];
+            c[i + 1] = row > 0 ? float(sum / row) : float(i + 1) / nx;
+        }
+        c[nx] = 1;
+        rows += row;
+        marginal[j + 1] = float(rows / total);
+    }
+    marginal[ny] = 1;
+    for (size_t k = 0; k < weight.size(); k++)
+        density[k] = float(weight[k] / total * weight.size());
+}
+
+int environment_light::pixel_index(const vec3& direction, float& sin_theta) const {
+    // sin(theta) from x and z rather than from y stays above 0 within a float of the poles.
+    vec3 d = unit_vector(direction);
+    sin_theta = sqrt(d.x()*d.x() + d.z()*d.z());
+    float theta = atan2(sin_theta, d.y());
+    float phi = atan2(d.z(), d.x()) + M_PI;
+    int i = int(phi / (2*M_PI) * nx);
+    int j = int(theta / M_PI * ny);
+    i = i < 0 ? 0 : i >= nx ? nx - 1 : i;
+    j = j < 0 ? 0 : j >= ny ? ny - 1 : j;
+    return j*nx + i;
+}
+
+vec3 environment_light::radiance(const vec3& direction) const {
+    float sin_theta;
+    const float *p = &pixels[3*size_t(pixel_index(direction, sin_theta))];
+    return vec3(p[0], p[1], p[2]);
+}
+
+float environment_light::pdf_value(const vec3& o, const vec3& v) const {
+    float sin_theta;
+    int k = pixel_index(v, sin_theta);
+    if (!(sin_theta > 0))
+        return 0;
+    return density[k] / (2*M_PI*M_PI * sin_theta);
+}
+
+// Picks a row from the marginal distribution and a column from that row's, then a uniform point
+// in the pixel, so the density is constant across each pixel in (u, v).
+vec3 environment_light::random(const vec3& o) const {
+    float r1 = random_double();
+    float r2 = random_double();
+    int j = int(std::upper_bound(marginal.begin() + 1, marginal.end(), r1) - marginal.begin()) - 1;
+    j = j < 0 ? 0 : j >= ny ? ny - 1 : j;
+    float dv = (r1 - marginal[j]) / (marginal[j+1] - marginal[j]);
+    const float *c = &conditional[size_t(j)*(nx + 1)];
+    int i = int(std::upper_bound(c + 1, c + nx + 1, r2) - c) - 1;
+    i = i < 0 ? 0 : i >= nx ? nx - 1 : i;
+    float du = (r2 - c[i]) / (c[i+1] - c[i]);
+    float theta = M_PI * (j + (dv > 0 && dv < 1 ? dv : 0.5f)) / ny;
+    float phi = 2*M_PI * (i + (du > 0 && du < 1 ? du : 0.5f)) / nx - M_PI;
+    return vec3(sin(theta)*cos(phi), cos(theta), sin(theta)*sin(phi));
+}
+
+#endif
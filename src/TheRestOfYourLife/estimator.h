@@ -0,0 +1,175 @@
+#ifndef ESTIMATORH
+#define ESTIMATORH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include "../common/hittable.h"
+#include "../common/random.h"
+#include "../common/tile_scheduler.h"
+#include "pdf.h"
+
+#include <atomic>
+#include <iostream>
+#include <math.h>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+
+// Samples are drawn and summed this many at a time: each block's values go into an array first,
+// and its mean and spread are taken in loops with nothing else in them, which the compiler turns
+// into vector code. A chunk of blocks draws from one random stream, and is the unit threads take.
+const int estimator_block = 256;
+const long long estimator_chunk = 1 << 16;
+
+// Two-sided 95% and 99.9% intervals of a normal distribution, in standard errors.
+const double estimator_z95 = 1.959964;
+const double estimator_z999 = 3.290527;
+
+
+// A mean and the spread of the samples around it, kept as Welford's running sum of squared
+// differences so that billions of samples lose no precision. Two of them combine with Chan et
+// al.'s pairwise update, which is how chunks summed on different threads come together.
+struct estimate {
+    estimate() : samples(0), mean(0), m2(0) {}
+
+    void add(double x) {
+        samples++;
+        double d = x - mean;
+        mean += d / samples;
+        m2 += d * (x - mean);
+    }
+    void add_block(const double *x, int n) {
+        double sum = 0;
+        for (int k = 0; k < n; k++)
+            sum += x[k];
+        double block_mean = sum / n, block_m2 = 0;
+        for (int k = 0; k < n; k++)
+            block_m2 += (x[k] - block_mean) * (x[k] - block_mean);
+        estimate b;
+        b.samples = n;
+        b.mean = block_mean;
+        b.m2 = block_m2;
+        merge(b);
+    }
+    void merge(const estimate& b) {
+        if (b.samples == 0)
+            return;
+        long long n = samples + b.samples;
+        double d = b.mean - mean;
+        mean += d * double(b.samples) / n;
+        m2 += b.m2 + d * d * (double(samples) * double(b.samples) / n);
+        samples = n;
+    }
+
+    // The variance of one sample, and the standard error of the mean.
+    double variance() const { return samples > 1 ? m2 / (samples - 1) : 0; }
+    double std_error() const { return samples > 0 ? sqrt(variance() / samples) : 0; }
+    // The interval z standard errors either side of the mean, and whether value is in it. A
+    // sampler that matches its integrand exactly has no spread at all, so agrees() also allows
+    // for samples computed in float being a rounding error off.
+    double lower(double z = estimator_z95) const { return mean - z * std_error(); }
+    double upper(double z = estimator_z95) const { return mean + z * std_error(); }
+    bool agrees(double value, double z = estimator_z999) const {
+        return fabs(mean - value) <= z * std_error() + 1e-6 * fabs(value);
+    }
+
+    long long samples;
+    double mean;
+    double m2;
+};
+
+inline std::ostream& operator<<(std::ostream& os, const estimate& e) {
+    return os << e.mean << " +- " << estimator_z95 * e.std_error() << " (95%, "
+              << e.samples << " samples)";
+}
+
+
+// Calls f(chunk, begin, end) for each chunk of the samples [0, n), spread over threads; threads =
+// 0 uses every hardware thread. Each chunk has a random stream of its own, keyed on seed and the
+// chunk's index, so what a chunk draws does not depend on which thread runs it.
+template <typename F>
+void estimator_for_chunks(long long n, F f, int threads = 0, uint64_t seed = 0) {
+    long long chunks = (n + estimator_chunk - 1) / estimator_chunk;
+    std::atomic<long long> next_chunk(0);
+    auto work = [&]() {
+        for (long long c = next_chunk++; c < chunks; c = next_chunk++) {
+            random_seed(seed, uint64_t(c));
+            long long end = (c+1) * estimator_chunk < n ? (c+1) * estimator_chunk : n;
+            f(c, c * estimator_chunk, end);
+        }
+    };
+    if (threads <= 0)
+        threads = default_thread_count();
+    if (threads > chunks)
+        threads = int(chunks > 0 ? chunks : 1);
+    std::vector<std::thread> workers;
+    for (int t = 1; t < threads; t++)
+        workers.push_back(std::thread(work));
+    work();
+    for (size_t t = 0; t < workers.size(); t++)
+        workers[t].join();
+}
+
+// The mean of f(i) over samples i = 0 .. n-1. f draws its random numbers with random_double(),
+// and is called from several threads at once. Chunks are merged in index order, so the answer is
+// the same for any number of threads.
+template <typename F>
+estimate estimate_mean(long long n, F f, int threads = 0, uint64_t seed = 0) {
+    long long chunks = (n + estimator_chunk - 1) / estimator_chunk;
+    std::vector<estimate> parts(size_t(chunks > 0 ? chunks : 0));
+    estimator_for_chunks(n, [&](long long c, long long begin, long long end) {
+        double block[estimator_block];
+        for (long long i = begin; i < end; i += estimator_block) {
+            int m = end - i < estimator_block ? int(end - i) : estimator_block;
+            for (int k = 0; k < m; k++)
+                block[k] = f(i + k);
+            parts[size_t(c)].add_block(block, m);
+        }
+    }, threads, seed);
+    estimate total;
+    for (size_t c = 0; c < parts.size(); c++)
+        total.merge(parts[c]);
+    return total;
+}
+
+// The integral of g over the sphere of directions by importance sampling p: the mean of
+// g(d) / p.value(d) over directions d from p.generate(). Directions p gives no density count as 0.
+template <typename G>
+estimate estimate_integral(const pdf& p, long long n, G g, int threads = 0, uint64_t seed = 0) {
+    return estimate_mean(n, [&](long long) {
+        vec3 d = p.generate();
+        float density = p.value(d);
+        return density > 0 ? double(g(d)) / density : 0.0;
+    }, threads, seed);
+}
+
+// The integral of p's density over the sphere, by sampling directions uniformly; it is 1 for a
+// pdf that does what it says.
+inline estimate estimate_normalization(const pdf& p, long long n, int threads = 0,
+                                       uint64_t seed = 0) {
+    return estimate_mean(n, [&](long long) {
+        float z = 1 - 2*float(random_double());
+        float r = sqrt(1 - z*z > 0 ? 1 - z*z : 0);
+        float phi = float(2*M_PI*random_double());
+        return 4*M_PI * p.value(vec3(r*cos(phi), r*sin(phi), z));
+    }, threads, seed);
+}
+
+// Prints e under name against the analytic answer, and returns whether they agree to 99.9%.
+inline bool report_estimate(const char *name, const estimate& e, double expected) {
+    bool ok = e.agrees(expected);
+    std::cout << name << " = " << e << ", expected " << expected
+              << (ok ? "" : "  ** OUTSIDE THE 99.9% INTERVAL **") << "\n";
+    return ok;
+}
+
+#endif
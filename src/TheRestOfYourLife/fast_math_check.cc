@@ -0,0 +1,117 @@
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include "../common/fast_math.h"
+
+#include <iostream>
+#include <math.h>
+#include <stdlib.h>
+
+
+// Checks the approximations in fast_math.h against libm in double precision, over a dense sweep
+// of each one's range, and fails if any error is above the bound fast_math.h gives for it. Errors
+// are taken as fractions of the larger of 1 and the right answer, as float rounding of the result
+// alone is that large. A few special values must come out exactly. Exits non-zero if any check
+// fails.
+
+const int fast_math_steps = 4000000;
+
+// Prints name's largest error, and returns whether it is within bound.
+bool report_error(const char *name, double worst, double at, double bound) {
+    bool ok = worst <= bound;
+    std::cout << name << ": largest error " << worst << " at " << at << ", bound " << bound
+              << (ok ? "" : "  ** ABOVE THE BOUND **") << "\n";
+    return ok;
+}
+
+double scaled_error(float got, double expected) {
+    return fabs(double(got) - expected) / (fabs(expected) > 1 ? fabs(expected) : 1);
+}
+
+// The largest error of f against g for x from lo to hi, where it was, and whether that is in
+// bound.
+template <typename F, typename G>
+bool check_range(const char *name, double lo, double hi, double bound, F f, G g) {
+    double worst = 0, at = lo;
+    for (int k = 0; k <= fast_math_steps; k++) {
+        float x = float(lo + (hi - lo) * k / fast_math_steps);
+        double e = scaled_error(f(x), g(double(x)));
+        if (!(e <= worst)) {
+            worst = e;
+            at = x;
+        }
+    }
+    return report_error(name, worst, at, bound);
+}
+
+bool check_exact(const char *name, float got, float expected) {
+    bool ok = got == expected || (isnan(got) && isnan(expected));
+    if (!ok)
+        std::cout << name << ": " << got << ", expected " << expected << "  ** WRONG **\n";
+    return ok;
+}
+
+int main() {
+    bool ok = true;
+    ok = check_range("fast_sin", -10, 10, 2e-7, fast_sin, [](double x) { return sin(x); }) && ok;
+    ok = check_range("fast_cos", -10, 10, 2e-7, fast_cos, [](double x) { return cos(x); }) && ok;
+    ok = check_range("fast_sin, large", -1e4, 1e4, 2e-7, fast_sin,
+                     [](double x) { return sin(x); }) && ok;
+    ok = check_range("fast_cos, large", -1e4, 1e4, 2e-7, fast_cos,
+                     [](double x) { return cos(x); }) && ok;
+
+    // atan2 around the circle, at radii from small to large.
+    double worst = 0, at = 0;
+    for (int k = 0; k <= fast_math_steps; k++) {
+        double angle = 2*M_PI * k / fast_math_steps - M_PI;
+        double radius = pow(10.0, 6.0 * (k % 13) / 12 - 3);
+        float y = float(radius * sin(angle)), x = float(radius * cos(angle));
+        double e = scaled_error(fast_atan2(y, x), atan2(double(y), double(x)));
+        if (!(e <= worst)) {
+            worst = e;
+            at = angle;
+        }
+    }
+    ok = report_error("fast_atan2", worst, at, 3e-7) && ok;
+
+    ok = check_range("fast_asin", -1, 1, 2e-7, fast_asin, [](double x) { return asin(x); }) && ok;
+
+    // log over many octaves, by steps in the exponent, and closely over [0.5, 2).
+    worst = 0;
+    at = 1;
+    for (int k = 0; k <= fast_math_steps; k++) {
+        float x = float(pow(10.0, -30 + 60.0 * k / fast_math_steps));
+        double e = scaled_error(fast_log(x), log(double(x)));
+        if (!(e <= worst)) {
+            worst = e;
+            at = x;
+        }
+    }
+    ok = report_error("fast_log", worst, at, 2e-7) && ok;
+    ok = check_range("fast_log, near 1", 0.5, 2, 2e-7, fast_log,
+                     [](double x) { return log(x); }) && ok;
+
+    ok = check_range("fast_pow5", 0, 1, 2e-7, fast_pow5, [](double x) { return pow(x, 5); }) && ok;
+
+    ok = check_exact("fast_log(0)", fast_log(0), -INFINITY) && ok;
+    ok = check_exact("fast_log(1)", fast_log(1), 0) && ok;
+    ok = check_exact("fast_log(inf)", fast_log(INFINITY), INFINITY) && ok;
+    ok = check_exact("fast_log(-1)", fast_log(-1), NAN) && ok;
+    ok = check_exact("fast_asin(1)", fast_asin(1), float(M_PI/2)) && ok;
+    ok = check_exact("fast_asin(-1)", fast_asin(-1), -float(M_PI/2)) && ok;
+    ok = check_exact("fast_atan2(0, -1)", fast_atan2(0, -1), float(M_PI)) && ok;
+    ok = check_exact("fast_atan2(-0, -1)", fast_atan2(-0.0f, -1), -float(M_PI)) && ok;
+    ok = check_exact("fast_atan2(0, 0)", fast_atan2(0, 0), 0) && ok;
+    ok = check_exact("fast_sin(0)", fast_sin(0), 0) && ok;
+    ok = check_exact("fast_cos(0)", fast_cos(0), 1) && ok;
+    std::cout << (ok ? "all within bounds\n" : "FAILED\n");
+    return ok ? 0 : 1;
+}
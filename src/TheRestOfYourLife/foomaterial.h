@@ -11,9 +11,9 @@
 // with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
 //==================================================================================================
 
-#include "hittable.h"
-#include "random.h"
-#include "ray.h"
+#include "../common/hittable.h"
+#include "../common/random.h"
+#include "../common/ray.h"
 #include "texture.h"
 
 
@@ -0,0 +1,144 @@
+#ifndef LIGHTSETH
+#define LIGHTSETH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include "../common/hittable.h"
+#include "../common/linear_bvh.h"
+#include "../common/random.h"
+
+#include <float.h>
+#include <unordered_map>
+#include <vector>
+
+
+// The shapes hittable_pdf samples towards, for scenes with many of them. The drop-in replacement
+// for a hittable_list of lights: random() picks a shape in proportion to its power from an alias
+// table, in constant time, and pdf_value() only asks the shapes whose bounds the direction passes
+// through, found with a BVH over the shapes, rather than every shape in turn.
+class light_set : public hittable {
+    public:
+        // power may be 0, which weights every shape the same, as hittable_list does.
+        light_set(hittable **l, const float *power, int n, float time0, float time1);
+        virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+            return tree.hit(r, t_min, t_max, rec);
+        }
+        virtual bool bounding_box(float t0, float t1, aabb& box) const {
+            return tree.bounding_box(t0, t1, box);
+        }
+        virtual bool occluded(const ray& r, float t_min, float t_max) const {
+            return tree.occluded(r, t_min, t_max);
+        }
+        virtual float pdf_value(const vec3& o, const vec3& v) const;
+        virtual vec3 random(const vec3& o) const;
+        // The probability random() picks shape i, in the constructor's order.
+        float probability(int i) const { return selection[i]; }
+
+        std::vector<hittable*> lights;
+        std::vector<float> selection;
+        // Vose's alias table: slot i is kept with probability keep[i] and otherwise gives alias[i].
+        std::vector<float> keep;
+        std::vector<int> alias;
+        linear_bvh tree;
+        // selection, reordered to match tree.prims.
+        std::vector<float> leaf_selection;
+};
+
+light_set::light_set(hittable **l, const float *power, int n, float time0, float time1)
+    : lights(l, l + n), selection(n), keep(n), alias(n), tree(l, n, time0, time1) {
+    double total = 0;
+    for (int i = 0; i < n; i++)
+        total += power ? power[i] : 1;
+    for (int i = 0; i < n; i++)
+        selection[i] = total > 0 ? float((power ? power[i] : 1) / total) : 1.0f / n;
+
+    // Slots below the mean are topped up from ones above it, so every slot holds mass 1/n.
+    std::vector<double> scaled(n);
+    std::vector<int> small, large;
+    for (int i = 0; i < n; i++) {
+        scaled[i] = double(selection[i]) * n;
+        alias[i] = i;
+        (scaled[i] < 1 ? small : large).push_back(i);
+    }
+    while (!small.empty() && !large.empty()) {
+        int s = small.back(), g = large.back();
+        small.pop_back();
+        keep[s] = float(scaled[s]);
+        alias[s] = g;
+        scaled[g] -= 1 - scaled[s];
+        if (scaled[g] < 1) {
+            large.pop_back();
+            small.push_back(g);
+        }
+    }
+    // What is left holds mass 1 up to rounding.
+    for (size_t i = 0; i < small.size(); i++)
+        keep[small[i]] = 1;
+    for (size_t i = 0; i < large.size(); i++)
+        keep[large[i]] = 1;
+
+    // A shape listed more than once is in the tree as often, so each copy gets an equal share.
+    std::unordered_map<hittable*, float> by_shape;
+    std::unordered_map<hittable*, int> copies;
+    for (int i = 0; i < n; i++) {
+        by_shape[l[i]] += selection[i];
+        copies[l[i]]++;
+    }
+    leaf_selection.resize(tree.prims.size());
+    for (size_t i = 0; i < tree.prims.size(); i++)
+        leaf_selection[i] = by_shape[tree.prims[i]] / copies[tree.prims[i]];
+}
+
+// Shapes the direction misses contribute zero, and those are exactly the ones whose bounds it
+// misses or whose pdf_value comes back zero.
+float light_set::pdf_value(const vec3& o, const vec3& v) const {
+    if (tree.node_count == 0)
+        return 0;
+    ray r(o, v);
+    int stack[64];
+    int stack_size = 0;
+    int current = 0;
+    float sum = 0;
+    for (;;) {
+        const linear_bvh_node& node = tree.nodes[current];
+        if (slab_hit(node.bmin, node.bmax, r, 0.001, FLT_MAX)) {
+            if (node.count > 0) {
+                for (int i = 0; i < node.count; i++)
+                    sum += leaf_selection[node.offset + i]
+                         * tree.prims[node.offset + i]->pdf_value(o, v);
+                if (stack_size == 0)
+                    break;
+                current = stack[--stack_size];
+            }
+            else {
+                stack[stack_size++] = node.offset;
+                current = current + 1;
+            }
+        }
+        else {
+            if (stack_size == 0)
+                break;
+            current = stack[--stack_size];
+        }
+    }
+    return sum;
+}
+
+vec3 light_set::random(const vec3& o) const {
+    int n = int(lights.size());
+    double u = random_double() * n;
+    int i = int(u);
+    if (i > n-1)
+        i = n-1;
+    return lights[u - i < keep[i] ? i : alias[i]]->random(o);
+}
+
+#endif
@@ -9,30 +9,64 @@
 // with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
 //==================================================================================================
 
+#include "../common/adaptive_sampler.h"
+#include "../common/arena.h"
+#include "../common/box.h"
+#include "../common/bvh.h"
+#include "../common/camera.h"
+#include "../common/checkpoint.h"
+#include "../common/denoise.h"
+#include "../common/film.h"
+#include "../common/framebuffer.h"
+#include "../common/hittable_list.h"
+#include "../common/instance.h"
+#include "../common/linear_bvh.h"
+#include "../common/moving_sphere.h"
+#include "../common/numa.h"
+#include "../common/render_stats.h"
+#include "../common/roulette.h"
+#include "../common/tile_scheduler.h"
+#include "../common/trace.h"
 #include "aarect.h"
-#include "box.h"
-#include "bvh.h"
-#include "camera.h"
-#include "hittable_list.h"
+#include "bdpt.h"
+#include "device_scene.h"
+#include "environment.h"
+#include "light_set.h"
 #include "material.h"
-#include "moving_sphere.h"
+#include "mis_tuner.h"
 #ifdef _MSC_VER
 #include "msc.h"
 #endif
+#include "../common/random.h"
+#include "path_guide.h"
 #include "pdf.h"
-#include "random.h"
+#include "radiance_cache.h"
+#include "spectral.h"
 #include "sphere.h"
 #define STB_IMAGE_IMPLEMENTATION
-#include "stb_image.h"
-#include "surface_texture.h"
+#include "../common/stb_image.h"
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "../common/stb_image_write.h"
+#include "../common/surface_texture.h"
 #include "texture.h"
+#include "wavefront.h"
 
+#include <chrono>
+#include <deque>
 #include <float.h>
+#include <fstream>
 #include <iostream>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <vector>
 
 
 inline vec3 de_nan(const vec3& c) {
     vec3 temp = c;
+    if (!(temp[0] == temp[0] && temp[1] == temp[1] && temp[2] == temp[2]))
+        RT_COUNT(nan_corrections, 1);
     if (!(temp[0] == temp[0])) temp[0] = 0;
     if (!(temp[1] == temp[1])) temp[1] = 0;
     if (!(temp[2] == temp[2])) temp[2] = 0;
@@ -41,94 +75,1097 @@ inline vec3 de_nan(const vec3& c) {
 
 
 
-vec3 color(const ray& r, hittable *world, hittable *light_shape, int depth) {
-    hit_record hrec;
-    if (world->hit(r, 0.001, MAXFLOAT, hrec)) {
-        scatter_record srec;
-        vec3 emitted = hrec.mat_ptr->emitted(r, hrec, hrec.u, hrec.v, hrec.p);
-        if (depth < 50 && hrec.mat_ptr->scatter(r, hrec, srec)) {
-            if (srec.is_specular) {
-                return srec.attenuation * color(srec.specular_ray, world, light_shape, depth+1);
+// How diffuse bounces weigh light against material sampling, and, while a pilot render fits the
+// materials' light_fraction, where their estimates go.
+mis_heuristic shading_heuristic = mis_balance;
+mis_tuner *shading_tuner = 0;
+// Past this many bounces paths go through Russian roulette; -1 turns it off.
+int roulette_depth = 3;
+// What diffuse bounces learn from and mix into their sampling under -guide, if anything.
+path_guide *guide = 0;
+// Under -preview-cache, the photons that Lambertian surfaces past the first hit take their light
+// from instead of tracing on. Off by default, as it blurs and biases what it reaches.
+radiance_cache *preview_cache = 0;
+// What rays that miss the world see, if anything. It is among the lights shade() samples too.
+environment_light *environment = 0;
+// The surfaces in the world that give off light, which -bdpt starts its light paths on. The
+// scene builders fill it in.
+std::vector<hittable*> scene_emitters;
+
+vec3 color(const ray& r, hittable *world, hittable *light_shape, int depth,
+           const vec3& throughput, vec3 *emitted_part = 0);
+
+// Shading for a ray whose closest hit has already been found, with the random stream already
+// moved to bounce depth+1. Packet tracing finds primary hits in bulk and continues from here.
+// throughput is what the radiance r brings back will be scaled by, roulette included. If
+// emitted_part is given, it gets the share of the result given off at the hit itself.
+vec3 shade(const ray& r, const hit_record& hrec, hittable *world, hittable *light_shape, int depth,
+           const vec3& throughput, vec3 *emitted_part = 0) {
+    scatter_record srec;
+    vec3 emitted = material_emitted(hrec.mat_ptr, r, hrec);
+    if (emitted_part)
+        *emitted_part = emitted;
+    if (depth < 50 && material_scatter(hrec.mat_ptr, r, hrec, srec)) {
+        if (srec.is_specular) {
+            vec3 attenuation = srec.attenuation;
+            vec3 next = throughput * attenuation;
+            float q = roulette_survival(depth, roulette_depth, next[0], next[1], next[2]);
+            if (q < 1) {
+                if (random_double() >= q)
+                    return vec3(0,0,0);
+                attenuation /= q;
+                next /= q;
             }
-            else {
-                hittable_pdf plight(light_shape, hrec.p);
-                mixture_pdf p(&plight, srec.pdf_ptr);
-                ray scattered = ray(hrec.p, p.generate(), r.time());
-                float pdf_val = p.value(scattered.direction());
-                delete srec.pdf_ptr;
-                return emitted
-                     + srec.attenuation * hrec.mat_ptr->scattering_pdf(r, hrec, scattered)
-                                        * color(scattered, world, light_shape, depth+1)
-                                        / pdf_val;
+            return attenuation * color(srec.specular_ray, world, light_shape, depth+1, next);
+        }
+        else if (preview_cache && depth > 0 && hrec.mat_ptr->kind == material_lambertian) {
+            vec3 irradiance = preview_cache->irradiance(hrec.p, hrec.normal);
+            return emitted + srec.attenuation * irradiance / float(M_PI);
+        }
+        else {
+            pdf_slot light_slot;
+            pdf *plight = light_slot.set(hittable_pdf(light_shape, hrec.p));
+            // A trained guide takes part of the material's share of the samples.
+            int leaf = guide ? guide->leaf_for(hrec.p) : 0;
+            guide_pdf pguide(guide, leaf);
+            mixture_pdf pguided(&pguide, srec.pdf_ptr, guide_fraction);
+            pdf *pmaterial = guide && guide->trained(leaf) ? &pguided : srec.pdf_ptr;
+            mixture_pdf p(plight, pmaterial, hrec.mat_ptr->light_fraction, shading_heuristic);
+            int strategy;
+            ray scattered = spawn_ray(hrec, p.generate(strategy), r.time());
+            float pdf_val = p.value(scattered.direction(), strategy);
+            float scattering_pdf = material_scattering_pdf(hrec.mat_ptr, r, hrec, scattered);
+            vec3 next = throughput * (srec.attenuation * scattering_pdf / pdf_val);
+            float q = roulette_survival(depth, roulette_depth, next[0], next[1], next[2]);
+            if (q < 1) {
+                if (random_double() >= q) {
+                    if (shading_tuner)
+                        shading_tuner->record(hrec.mat_ptr, strategy, vec3(0,0,0));
+                    if (guide && guide->learning)
+                        guide->record(hrec.p, scattered.direction(), vec3(0,0,0));
+                    return emitted;
+                }
+                pdf_val *= q;
+                next /= q;
+            }
+            vec3 incoming_emitted;
+            vec3 incoming = color(scattered, world, light_shape, depth+1, next, &incoming_emitted);
+            vec3 estimate = srec.attenuation * scattering_pdf * incoming / pdf_val;
+            if (shading_tuner)
+                shading_tuner->record(hrec.mat_ptr, strategy, estimate);
+            if (guide && guide->learning) {
+                // The guide learns the light that has bounced at least once more, weighted by the
+                // cosine; sampling the lights already finds the rest.
+                float cosine = dot(hrec.normal, unit_vector(scattered.direction()));
+                guide->record(hrec.p, scattered.direction(),
+                              (incoming - incoming_emitted) * (ffmax(cosine, 0) / pdf_val));
             }
+            return emitted + estimate;
         }
-        else
-            return emitted;
     }
     else
-        return vec3(0,0,0);
+        return emitted;
+}
+
+vec3 color(const ray& r, hittable *world, hittable *light_shape, int depth,
+           const vec3& throughput, vec3 *emitted_part) {
+    hit_record hrec;
+    random_begin_bounce(depth+1);
+    RT_COUNT(rays, 1);
+    RT_COUNT_DEPTH(depth, 1);
+    if (world->hit(r, 0, MAXFLOAT, hrec))
+        return shade(r, hrec, world, light_shape, depth, throughput, emitted_part);
+    vec3 sky = environment ? environment->radiance(r.direction()) : vec3(0,0,0);
+    if (emitted_part)
+        *emitted_part = sky;
+    return sky;
+}
+
+// An instance of p turned by angle degrees about y and then moved by offset, in place of the
+// book's translate(rotate_y(p)): one transform instead of two wrappers.
+hittable *place(arena& scene, hittable *p, float angle, const vec3& offset) {
+    return scene.make<instance>(p, affine_transform::translation(offset)
+                                   * affine_transform::rotation_y(angle));
+}
+
+// Scene builders fill in the objects, the shapes shade() samples directly (the lights, and the
+// glass ball for its caustic), and the camera, and add the surfaces that give off light to
+// scene_emitters.
+void cornell_box(arena& scene, hittable **world, hittable **lights, camera **cam, float aspect) {
+    int i = 0;
+    hittable **list = scene.make_array<hittable*>(8);
+    material *red = scene.make<lambertian>( scene.make<constant_texture>(vec3(0.65, 0.05, 0.05)) );
+    material *white = scene.make<lambertian>( scene.make<constant_texture>(vec3(0.73, 0.73, 0.73)) );
+    material *green = scene.make<lambertian>( scene.make<constant_texture>(vec3(0.12, 0.45, 0.15)) );
+    material *light = scene.make<diffuse_light>( scene.make<constant_texture>(vec3(15, 15, 15)) );
+    list[i++] = scene.make<flip_normals>(scene.make<yz_rect>(0, 555, 0, 555, 555, green));
+    list[i++] = scene.make<yz_rect>(0, 555, 0, 555, 0, red);
+    list[i++] = scene.make<flip_normals>(scene.make<xz_rect>(213, 343, 227, 332, 554, light));
+    scene_emitters.push_back(list[i-1]);
+    list[i++] = scene.make<flip_normals>(scene.make<xz_rect>(0, 555, 0, 555, 555, white));
+    list[i++] = scene.make<xz_rect>(0, 555, 0, 555, 0, white);
+    list[i++] = scene.make<flip_normals>(scene.make<xy_rect>(0, 555, 0, 555, 555, white));
+    material *glass = scene.make<dielectric>(1.5);
+    list[i++] = scene.make<sphere>(vec3(190, 90, 190),90 , glass);
+    list[i++] = place(scene, scene.make<box>(vec3(0, 0, 0), vec3(165, 330, 165), white), 15, vec3(265,0,295));
+    *world = scene.make<hittable_list>(list,i);
+    hittable **a = scene.make_array<hittable*>(2);
+    a[0] = scene.make<xz_rect>(213, 343, 227, 332, 554, (material*)0);
+    a[1] = scene.make<sphere>(vec3(190, 90, 190), 90, (material*)0);
+    *lights = scene.make<light_set>(a, (const float*)0, 2, 0.0, 1.0);
+    vec3 lookfrom(278, 278, -800);
+    vec3 lookat(278,278,0);
+    float dist_to_focus = 10.0;
+    float aperture = 0.0;
+    float vfov = 40.0;
+    *cam = scene.make<camera>(lookfrom, lookat, vec3(0,1,0),
+                      vfov, aspect, aperture, dist_to_focus, 0.0, 1.0);
+}
+
+// The Cornell box lit by a ceiling of n x n small panels instead of one light, brighter towards
+// the middle, with the same total power. light_set samples each panel in proportion to its power.
+void cornell_lights(arena& scene, hittable **world, hittable **lights, camera **cam, float aspect) {
+    const int n = 24;
+    hittable **list = scene.make_array<hittable*>(8);
+    hittable **ceiling = scene.make_array<hittable*>(n*n);
+    hittable **panels = scene.make_array<hittable*>(n*n + 1);
+    float *power = scene.make_array<float>(n*n + 1);
+    int i = 0;
+    material *red = scene.make<lambertian>( scene.make<constant_texture>(vec3(0.65, 0.05, 0.05)) );
+    material *white = scene.make<lambertian>( scene.make<constant_texture>(vec3(0.73, 0.73, 0.73)) );
+    material *green = scene.make<lambertian>( scene.make<constant_texture>(vec3(0.12, 0.45, 0.15)) );
+    list[i++] = scene.make<flip_normals>(scene.make<yz_rect>(0, 555, 0, 555, 555, green));
+    list[i++] = scene.make<yz_rect>(0, 555, 0, 555, 0, red);
+    list[i++] = scene.make<flip_normals>(scene.make<xz_rect>(0, 555, 0, 555, 555, white));
+    list[i++] = scene.make<xz_rect>(0, 555, 0, 555, 0, white);
+    list[i++] = scene.make<flip_normals>(scene.make<xy_rect>(0, 555, 0, 555, 555, white));
+    material *glass = scene.make<dielectric>(1.5);
+    list[i++] = scene.make<sphere>(vec3(190, 90, 190),90 , glass);
+    list[i++] = place(scene, scene.make<box>(vec3(0, 0, 0), vec3(165, 330, 165), white), 15, vec3(265,0,295));
+    // The book's light is 130 x 105 at radiance 15; the panels cover 400 x 400 at 8 x 8 each.
+    float cell = 400.0f / n, size = 8;
+    float total_weight = 0;
+    for (int j = 0; j < n*n; j++) {
+        float dx = (j % n + 0.5f) / n - 0.5f, dz = (j / n + 0.5f) / n - 0.5f;
+        total_weight += exp(-8*(dx*dx + dz*dz));
+    }
+    for (int j = 0; j < n*n; j++) {
+        float dx = (j % n + 0.5f) / n - 0.5f, dz = (j / n + 0.5f) / n - 0.5f;
+        float radiance = 15 * 130*105 / (size*size) * exp(-8*(dx*dx + dz*dz)) / total_weight;
+        float x0 = 77.5f + (j % n)*cell + (cell - size)/2, z0 = 77.5f + (j / n)*cell + (cell - size)/2;
+        material *light = scene.make<diffuse_light>(scene.make<constant_texture>(vec3(radiance, radiance, radiance)));
+        ceiling[j] = scene.make<flip_normals>(scene.make<xz_rect>(x0, x0+size, z0, z0+size, 554, light));
+        scene_emitters.push_back(ceiling[j]);
+        panels[j] = scene.make<xz_rect>(x0, x0+size, z0, z0+size, 554, (material*)0);
+        power[j] = radiance * size*size;
+    }
+    // The glass ball gets half of the samples, as in cornell_box.
+    panels[n*n] = scene.make<sphere>(vec3(190, 90, 190), 90, (material*)0);
+    float panel_power = 0;
+    for (int j = 0; j < n*n; j++)
+        panel_power += power[j];
+    power[n*n] = panel_power;
+    list[i++] = scene.make<linear_bvh>(ceiling, n*n, 0.0, 1.0);
+    *world = scene.make<hittable_list>(list,i);
+    *lights = scene.make<light_set>(panels, power, n*n + 1, 0.0, 1.0);
+    vec3 lookfrom(278, 278, -800);
+    vec3 lookat(278,278,0);
+    float dist_to_focus = 10.0;
+    float aperture = 0.0;
+    float vfov = 40.0;
+    *cam = scene.make<camera>(lookfrom, lookat, vec3(0,1,0),
+                      vfov, aspect, aperture, dist_to_focus, 0.0, 1.0);
+}
+
+// The Cornell box lit by a small, bright light in the middle of the ceiling, with the book's power,
+// over a glass ball that focuses it into a caustic on the floor. A path tracer only finds the
+// caustic when a bounce off the floor happens to go through the ball and on to the light; light
+// paths start there. The glass disperses like a dense flint, which only -spectral shows, as
+// coloured fringes around the caustic.
+void cornell_caustic(arena& scene, hittable **world, hittable **lights, camera **cam,
+                     float aspect) {
+    int i = 0;
+    hittable **list = scene.make_array<hittable*>(8);
+    material *red = scene.make<lambertian>( scene.make<constant_texture>(vec3(0.65, 0.05, 0.05)) );
+    material *white = scene.make<lambertian>( scene.make<constant_texture>(vec3(0.73, 0.73, 0.73)) );
+    material *green = scene.make<lambertian>( scene.make<constant_texture>(vec3(0.12, 0.45, 0.15)) );
+    float size = 30, radiance = 15 * 130*105 / (size*size);
+    material *light = scene.make<diffuse_light>( scene.make<constant_texture>(vec3(radiance, radiance, radiance)) );
+    list[i++] = scene.make<flip_normals>(scene.make<yz_rect>(0, 555, 0, 555, 555, green));
+    list[i++] = scene.make<yz_rect>(0, 555, 0, 555, 0, red);
+    list[i++] = scene.make<flip_normals>(scene.make<xz_rect>(278 - size/2, 278 + size/2, 278 - size/2, 278 + size/2, 554, light));
+    scene_emitters.push_back(list[i-1]);
+    list[i++] = scene.make<flip_normals>(scene.make<xz_rect>(0, 555, 0, 555, 555, white));
+    list[i++] = scene.make<xz_rect>(0, 555, 0, 555, 0, white);
+    list[i++] = scene.make<flip_normals>(scene.make<xy_rect>(0, 555, 0, 555, 555, white));
+    material *glass = scene.make<dielectric>(1.5, 0.01);
+    list[i++] = scene.make<sphere>(vec3(230, 200, 200), 90, glass);
+    list[i++] = place(scene, scene.make<box>(vec3(0, 0, 0), vec3(165, 330, 165), white), 15, vec3(265,0,295));
+    *world = scene.make<hittable_list>(list,i);
+    hittable **a = scene.make_array<hittable*>(2);
+    a[0] = scene.make<xz_rect>(278 - size/2, 278 + size/2, 278 - size/2, 278 + size/2, 554, (material*)0);
+    a[1] = scene.make<sphere>(vec3(230, 200, 200), 90, (material*)0);
+    *lights = scene.make<light_set>(a, (const float*)0, 2, 0.0, 1.0);
+    vec3 lookfrom(278, 278, -800);
+    vec3 lookat(278,278,0);
+    float dist_to_focus = 10.0;
+    float aperture = 0.0;
+    float vfov = 40.0;
+    *cam = scene.make<camera>(lookfrom, lookat, vec3(0,1,0),
+                      vfov, aspect, aperture, dist_to_focus, 0.0, 1.0);
 }
 
-void cornell_box(hittable **scene, camera **cam, float aspect) {
+// The Cornell box lit by the book's light turned to face the ceiling from below it, so that
+// everything under it is lit only by what the ceiling sends back down. Sampling the light finds
+// nothing from there; the light has to be found one bounce away.
+void cornell_bounce(arena& scene, hittable **world, hittable **lights, camera **cam,
+                    float aspect) {
     int i = 0;
-    hittable **list = new hittable*[8];
-    material *red = new lambertian( new constant_texture(vec3(0.65, 0.05, 0.05)) );
-    material *white = new lambertian( new constant_texture(vec3(0.73, 0.73, 0.73)) );
-    material *green = new lambertian( new constant_texture(vec3(0.12, 0.45, 0.15)) );
-    material *light = new diffuse_light( new constant_texture(vec3(15, 15, 15)) );
-    list[i++] = new flip_normals(new yz_rect(0, 555, 0, 555, 555, green));
-    list[i++] = new yz_rect(0, 555, 0, 555, 0, red);
-    list[i++] = new flip_normals(new xz_rect(213, 343, 227, 332, 554, light));
-    list[i++] = new flip_normals(new xz_rect(0, 555, 0, 555, 555, white));
-    list[i++] = new xz_rect(0, 555, 0, 555, 0, white);
-    list[i++] = new flip_normals(new xy_rect(0, 555, 0, 555, 555, white));
-    material *glass = new dielectric(1.5);
-    list[i++] = new sphere(vec3(190, 90, 190),90 , glass);
-    list[i++] = new translate(new rotate_y(
-                    new box(vec3(0, 0, 0), vec3(165, 330, 165), white),  15), vec3(265,0,295));
-    *scene = new hittable_list(list,i);
+    hittable **list = scene.make_array<hittable*>(8);
+    material *red = scene.make<lambertian>( scene.make<constant_texture>(vec3(0.65, 0.05, 0.05)) );
+    material *white = scene.make<lambertian>( scene.make<constant_texture>(vec3(0.73, 0.73, 0.73)) );
+    material *green = scene.make<lambertian>( scene.make<constant_texture>(vec3(0.12, 0.45, 0.15)) );
+    material *light = scene.make<diffuse_light>( scene.make<constant_texture>(vec3(15, 15, 15)) );
+    list[i++] = scene.make<flip_normals>(scene.make<yz_rect>(0, 555, 0, 555, 555, green));
+    list[i++] = scene.make<yz_rect>(0, 555, 0, 555, 0, red);
+    list[i++] = scene.make<xz_rect>(213, 343, 227, 332, 530, light);
+    scene_emitters.push_back(list[i-1]);
+    list[i++] = scene.make<flip_normals>(scene.make<xz_rect>(0, 555, 0, 555, 555, white));
+    list[i++] = scene.make<xz_rect>(0, 555, 0, 555, 0, white);
+    list[i++] = scene.make<flip_normals>(scene.make<xy_rect>(0, 555, 0, 555, 555, white));
+    list[i++] = place(scene, scene.make<box>(vec3(0, 0, 0), vec3(165, 165, 165), white), -18, vec3(130,0,65));
+    list[i++] = place(scene, scene.make<box>(vec3(0, 0, 0), vec3(165, 330, 165), white), 15, vec3(265,0,295));
+    *world = scene.make<hittable_list>(list,i);
+    *lights = scene.make<xz_rect>(213, 343, 227, 332, 530, (material*)0);
     vec3 lookfrom(278, 278, -800);
     vec3 lookat(278,278,0);
     float dist_to_focus = 10.0;
     float aperture = 0.0;
     float vfov = 40.0;
-    *cam = new camera(lookfrom, lookat, vec3(0,1,0),
+    *cam = scene.make<camera>(lookfrom, lookat, vec3(0,1,0),
+                      vfov, aspect, aperture, dist_to_focus, 0.0, 1.0);
+}
+
+// Glass, metal and matte balls on a matte ground, under the open sky. The scene has no lights of
+// its own: the environment lights it, a plain sky unless -env gives one.
+void spheres(arena& scene, hittable **world, hittable **lights, camera **cam, float aspect) {
+    int i = 0;
+    hittable **list = scene.make_array<hittable*>(5);
+    material *ground = scene.make<lambertian>( scene.make<constant_texture>(vec3(0.5, 0.5, 0.5)) );
+    material *matte = scene.make<lambertian>( scene.make<constant_texture>(vec3(0.1, 0.2, 0.5)) );
+    material *mirror = scene.make<metal>(vec3(0.8, 0.6, 0.2), 0.05);
+    material *glass = scene.make<dielectric>(1.5);
+    list[i++] = scene.make<sphere>(vec3(0, -1000, 0), 1000, ground);
+    list[i++] = scene.make<sphere>(vec3(-2.2, 1, 0), 1, matte);
+    list[i++] = scene.make<sphere>(vec3(0, 1, 0), 1, glass);
+    list[i++] = scene.make<sphere>(vec3(2.2, 1, 0), 1, mirror);
+    list[i++] = scene.make<sphere>(vec3(1, 0.4, 1.8), 0.4, matte);
+    *world = scene.make<hittable_list>(list,i);
+    *lights = 0;
+    vec3 lookfrom(0, 2, 9);
+    vec3 lookat(0, 0.8, 0);
+    float dist_to_focus = 10.0;
+    float aperture = 0.0;
+    float vfov = 35.0;
+    *cam = scene.make<camera>(lookfrom, lookat, vec3(0,1,0),
                       vfov, aspect, aperture, dist_to_focus, 0.0, 1.0);
 }
 
-int main() {
+// Writes the image to path, in the format its extension names. PNG goes through stb_image_write.
+bool write_output(const char *path, const framebuffer& fb) {
+    image_format format = image_format_for_path(path);
+    if (format != image_png)
+        return write_image(path, format, fb);
+    std::vector<unsigned char> rgb = framebuffer_to_rgb8(fb);
+    return stbi_write_png(path, fb.nx, fb.ny, 3, &rgb[0], 3*fb.nx) != 0;
+}
+
+// While a whole render runs, an interrupt stops this scheduler starting more tiles, and the tiles
+// finished so far are written out.
+tile_scheduler *interruptible = 0;
+
+void interrupt_render(int) {
+    if (interruptible)
+        interruptible->cancel();
+}
+
+// How camera samples are traced: packets of primary rays continued recursively by shade(), one
+// recursive color() call per sample, or all of a tile's samples as one wavefront.
+enum trace_mode { trace_packets, trace_scalar, trace_wavefront, trace_device_cpu, trace_device_cuda,
+                  trace_bdpt, trace_spectral };
+
+// Packet tracing makes camera rays a block at a time, for about this many samples.
+const int camera_batch_samples = 4096;
+
+// AOVs average at most this many of each pixel's camera samples, the same ones the image takes
+// first, so their edges line up with the image's.
+const int aov_max_samples = 16;
+
+// Fills in aovs from the primary hits of up to aov_max_samples of each pixel's first ns samples.
+// The camera rays are traced again, as packets, which costs little next to the paths themselves.
+// The albedo is the attenuation of the first hit's scatter_record, or, where the surface does
+// not scatter, its emission clamped to 1.
+void render_aovs(hittable *world, const camera& cam, int ns, unsigned int seed,
+                 tile_scheduler& scheduler, aov_buffers& aovs) {
+    int nx = aovs.albedo.nx, ny = aovs.albedo.ny;
+    int samples = ns < aov_max_samples ? ns : aov_max_samples;
+    scheduler.run([&](const tile& t) {
+        camera_rays rays;
+        cam.generate_rays(t, nx, ny, 0, samples, seed, rays);
+        int pixels = (t.x1 - t.x0) * (t.y1 - t.y0);
+        std::vector<vec3> albedo(pixels, vec3(0,0,0)), normal(pixels, vec3(0,0,0));
+        std::vector<float> depth(pixels, 0);
+        for (size_t b = 0; b < rays.size(); b += ray_packet_size) {
+            ray_packet packet;
+            packet.count = int(rays.size() - b < size_t(ray_packet_size) ? rays.size() - b
+                                                                         : ray_packet_size);
+            float t_max[ray_packet_size];
+            hit_record hrec[ray_packet_size];
+            for (int k = 0; k < packet.count; k++) {
+                packet.set(k, rays.get(b+k));
+                t_max[k] = MAXFLOAT;
+            }
+            packet.pad(t_max);
+            int hits = world->hit_packet(packet, (1 << packet.count) - 1, 0, t_max, hrec);
+            for (int k = 0; k < packet.count; k++) {
+                if (!(hits & (1 << k)))
+                    continue;
+                ray r = packet.get(k);
+                size_t pixel = (b+k) / samples;
+                scatter_record srec;
+                vec3 a;
+                if (material_scatter(hrec[k].mat_ptr, r, hrec[k], srec))
+                    a = srec.attenuation;
+                else {
+                    a = material_emitted(hrec[k].mat_ptr, r, hrec[k]);
+                    for (int c = 0; c < 3; c++)
+                        a[c] = a[c] < 1 ? a[c] : 1;
+                }
+                albedo[pixel] += a;
+                normal[pixel] += unit_vector(hrec[k].normal);
+                depth[pixel] += hrec[k].t * r.direction().length();
+            }
+        }
+        int k = 0;
+        for (int j = t.y1-1; j >= t.y0; j--) {
+            for (int i = t.x0; i < t.x1; i++, k++) {
+                vec3 a = albedo[k] / float(samples), n = normal[k] / float(samples);
+                float z = depth[k] / float(samples);
+                aovs.albedo.set(i, j, a[0], a[1], a[2]);
+                aovs.normal.set(i, j, n[0], n[1], n[2]);
+                aovs.depth.set(i, j, z, z, z);
+            }
+        }
+    });
+}
+
+int main(int argc, char **argv) {
     int nx = 500;
     int ny = 500;
     int ns = 10;
-    std::cout << "P3\n" << nx << " " << ny << "\n255\n";
+    int nthreads = default_thread_count();
+    int tile_size = 16;
+    tile_order order = tile_order_scanline;
+    int roi[4] = { 0, 0, 0, 0 };
+    bool numa = false;
+    unsigned int seed = 0;
+    const char *out_path = 0;
+    trace_mode mode = trace_packets;
+    int ray_sort_batch = 0;
+    bool progressive = false;
+    const char *checkpoint_path = 0;
+    double checkpoint_seconds = 60;
+    int checkpoint_passes = 0;
+    float adaptive_error = 0;
+    int max_spp = 4096;
+    float budget_spp = 0;
+    const char *heatmap_path = 0;
+    sample_pattern pattern = pattern_random;
+    int pilot_rounds = 0;
+    int guide_passes = 0;
+    int cache_photons = 0;
+    bool print_stats = false;
+    const char *stats_json_path = 0;
+    const char *trace_path = 0;
+    const char *albedo_path = 0;
+    const char *normal_path = 0;
+    const char *depth_path = 0;
+    bool denoise_atrous = false;
+    const char *denoise_command = 0;
+    const char *env_path = 0;
+    float env_scale = 1;
+    filter_kind filter = filter_box;
+    float filter_radius = 0;
+    void (*build)(arena&, hittable**, hittable**, camera**, float) = cornell_box;
+    for (int a = 1; a < argc; a++) {
+        if (!strcmp(argv[a], "-t") && a+1 < argc)
+            nthreads = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "-tile") && a+1 < argc)
+            tile_size = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "-tile-order") && a+1 < argc) {
+            a++;
+            if (!strcmp(argv[a], "scanline"))
+                order = tile_order_scanline;
+            else if (!strcmp(argv[a], "morton"))
+                order = tile_order_morton;
+            else if (!strcmp(argv[a], "hilbert"))
+                order = tile_order_hilbert;
+            else if (!strcmp(argv[a], "centre"))
+                order = tile_order_focus;
+            else {
+                std::cerr << "unknown tile order: " << argv[a] << "\n";
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[a], "-numa"))
+            numa = true;
+        else if (!strcmp(argv[a], "-roi") && a+4 < argc) {
+            for (int k = 0; k < 4; k++)
+                roi[k] = atoi(argv[++a]);
+        }
+        else if (!strcmp(argv[a], "-seed") && a+1 < argc)
+            seed = strtoul(argv[++a], 0, 10);
+        else if (!strcmp(argv[a], "-o") && a+1 < argc)
+            out_path = argv[++a];
+        else if (!strcmp(argv[a], "-ns") && a+1 < argc)
+            ns = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "-progressive"))
+            progressive = true;
+        else if (!strcmp(argv[a], "-checkpoint") && a+1 < argc)
+            checkpoint_path = argv[++a];
+        else if (!strcmp(argv[a], "-every") && a+1 < argc)
+            checkpoint_seconds = atof(argv[++a]);
+        else if (!strcmp(argv[a], "-every-passes") && a+1 < argc)
+            checkpoint_passes = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "-adaptive") && a+1 < argc)
+            adaptive_error = atof(argv[++a]);
+        else if (!strcmp(argv[a], "-max-spp") && a+1 < argc)
+            max_spp = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "-budget") && a+1 < argc)
+            budget_spp = atof(argv[++a]);
+        else if (!strcmp(argv[a], "-heatmap") && a+1 < argc)
+            heatmap_path = argv[++a];
+        else if (!strcmp(argv[a], "-sampler") && a+1 < argc) {
+            pattern = sample_pattern_for_name(argv[++a]);
+            if (pattern == pattern_unknown) {
+                std::cerr << "unknown sampler: " << argv[a] << "\n";
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[a], "-mis") && a+1 < argc) {
+            a++;
+            if (!strcmp(argv[a], "balance"))
+                shading_heuristic = mis_balance;
+            else if (!strcmp(argv[a], "power"))
+                shading_heuristic = mis_power;
+            else {
+                std::cerr << "unknown heuristic: " << argv[a] << "\n";
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[a], "-roulette") && a+1 < argc) {
+            a++;
+            roulette_depth = strcmp(argv[a], "off") ? atoi(argv[a]) : -1;
+        }
+        else if (!strcmp(argv[a], "-rect-sampling") && a+1 < argc) {
+            a++;
+            if (!strcmp(argv[a], "area"))
+                rect_sampling = rect_sampling_area;
+            else if (!strcmp(argv[a], "solid-angle"))
+                rect_sampling = rect_sampling_solid_angle;
+            else {
+                std::cerr << "unknown rect sampling: " << argv[a] << "\n";
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[a], "-mis-pilot") && a+1 < argc)
+            pilot_rounds = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "-guide") && a+1 < argc)
+            guide_passes = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "-preview-cache") && a+1 < argc)
+            cache_photons = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "-scene") && a+1 < argc) {
+            a++;
+            if (!strcmp(argv[a], "cornell_box"))
+                build = cornell_box;
+            else if (!strcmp(argv[a], "cornell_lights"))
+                build = cornell_lights;
+            else if (!strcmp(argv[a], "cornell_caustic"))
+                build = cornell_caustic;
+            else if (!strcmp(argv[a], "cornell_bounce"))
+                build = cornell_bounce;
+            else if (!strcmp(argv[a], "spheres"))
+                build = spheres;
+            else {
+                std::cerr << "unknown scene: " << argv[a] << "\n";
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[a], "-filter") && a+1 < argc) {
+            filter = filter_for_name(argv[++a]);
+            if (filter == filter_unknown) {
+                std::cerr << "unknown filter: " << argv[a] << "\n";
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[a], "-filter-radius") && a+1 < argc)
+            filter_radius = atof(argv[++a]);
+        else if (!strcmp(argv[a], "-env") && a+1 < argc)
+            env_path = argv[++a];
+        else if (!strcmp(argv[a], "-env-scale") && a+1 < argc)
+            env_scale = atof(argv[++a]);
+        else if (!strcmp(argv[a], "-stats"))
+            print_stats = true;
+        else if (!strcmp(argv[a], "-stats-json") && a+1 < argc)
+            stats_json_path = argv[++a];
+        else if (!strcmp(argv[a], "-trace") && a+1 < argc)
+            trace_path = argv[++a];
+        else if (!strcmp(argv[a], "-albedo") && a+1 < argc)
+            albedo_path = argv[++a];
+        else if (!strcmp(argv[a], "-normal") && a+1 < argc)
+            normal_path = argv[++a];
+        else if (!strcmp(argv[a], "-depth") && a+1 < argc)
+            depth_path = argv[++a];
+        else if (!strcmp(argv[a], "-denoise") && a+1 < argc) {
+            a++;
+            if (!strcmp(argv[a], "atrous"))
+                denoise_atrous = true;
+            else {
+                std::cerr << "unknown denoiser: " << argv[a] << "\n";
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[a], "-denoise-command") && a+1 < argc)
+            denoise_command = argv[++a];
+        else if (!strcmp(argv[a], "-scalar"))
+            mode = trace_scalar;
+        else if (!strcmp(argv[a], "-wavefront"))
+            mode = trace_wavefront;
+        else if (!strcmp(argv[a], "-ray-sort") && a+1 < argc) {
+            a++;
+            ray_sort_batch = strcmp(argv[a], "off") ? atoi(argv[a]) : 0;
+        }
+        else if (!strcmp(argv[a], "-bdpt"))
+            mode = trace_bdpt;
+        else if (!strcmp(argv[a], "-spectral"))
+            mode = trace_spectral;
+        else if (!strcmp(argv[a], "-device") && a+1 < argc) {
+            a++;
+            if (!strcmp(argv[a], "cpu"))
+                mode = trace_device_cpu;
+            else if (!strcmp(argv[a], "cuda"))
+                mode = trace_device_cuda;
+            else {
+                std::cerr << "unknown device: " << argv[a] << "\n";
+                return 1;
+            }
+        }
+        else {
+            std::cerr << "usage: " << argv[0] << " [-t threads] [-seed n] [-ns samples]\n"
+                      << "    [-tile size] [-tile-order scanline|morton|hilbert|centre]"
+                      << " [-roi x0 y0 x1 y1] [-numa]\n"
+                      << "    [-scene cornell_box|cornell_lights|cornell_caustic|cornell_bounce|spheres]"
+                      << " [-scalar|-wavefront|-bdpt|-spectral]\n"
+                      << "    [-ray-sort batch|off] [-device cpu|cuda] [-o image.ppm|png|pfm|exr]\n"
+                      << "    [-env image.hdr [-env-scale s]]"
+                      << " [-filter box|gaussian|mitchell|blackman-harris [-filter-radius r]]\n"
+                      << "    [-sampler random|stratified|halton|sobol|bluenoise]"
+                      << " [-mis balance|power] [-mis-pilot rounds]\n"
+                      << "    [-rect-sampling area|solid-angle] [-roulette off|min-depth]"
+                      << " [-guide passes] [-preview-cache photons]\n"
+                      << "    [-stats] [-stats-json file] [-trace file.json]\n"
+                      << "    [-progressive [-checkpoint file] [-every seconds] [-every-passes n]]\n"
+                      << "    [-adaptive error [-max-spp n] [-budget spp] [-heatmap image]]\n"
+                      << "    [-albedo image] [-normal image] [-depth image]"
+                      << " [-denoise atrous | -denoise-command command]\n";
+            return 1;
+        }
+    }
+    // Check the output format up front rather than after the render.
+    if (out_path && (image_format_for_path(out_path) == image_unknown)) {
+        std::cerr << "unsupported image format: " << out_path << "\n";
+        return 1;
+    }
+    if (heatmap_path && (image_format_for_path(heatmap_path) == image_unknown)) {
+        std::cerr << "unsupported image format: " << heatmap_path << "\n";
+        return 1;
+    }
+    const char *aov_paths[3] = { albedo_path, normal_path, depth_path };
+    for (int f = 0; f < 3; f++) {
+        if (aov_paths[f] && (image_format_for_path(aov_paths[f]) == image_unknown)) {
+            std::cerr << "unsupported image format: " << aov_paths[f] << "\n";
+            return 1;
+        }
+    }
+    bool device = mode == trace_device_cpu || mode == trace_device_cuda;
+    if ((filter != filter_box || filter_radius > 0) && (device || progressive || adaptive_error > 0)) {
+        std::cerr << "-filter works with whole renders on the CPU, not with -device, -progressive"
+                  << " or -adaptive, which average each pixel's own samples\n";
+        return 1;
+    }
+    if (mode == trace_bdpt && (progressive || adaptive_error > 0 || pilot_rounds > 0)) {
+        std::cerr << "-bdpt renders all samples at once, without -progressive, -adaptive"
+                  << " or -mis-pilot\n";
+        return 1;
+    }
+    if (mode == trace_spectral && (progressive || adaptive_error > 0)) {
+        std::cerr << "-spectral renders all samples at once, without -progressive or -adaptive\n";
+        return 1;
+    }
+    if (guide_passes > 0 && (device || mode == trace_wavefront || mode == trace_bdpt
+                             || mode == trace_spectral)) {
+        std::cerr << "-guide works with the packet and scalar tracers\n";
+        return 1;
+    }
+    if (cache_photons > 0 && (device || mode == trace_wavefront || mode == trace_bdpt
+                              || mode == trace_spectral || guide_passes > 0)) {
+        std::cerr << "-preview-cache works with the packet and scalar tracers, without -guide\n";
+        return 1;
+    }
+    if (ray_sort_batch > 0 && mode != trace_wavefront) {
+        std::cerr << "-ray-sort works with -wavefront, which traces each bounce as one batch\n";
+        return 1;
+    }
+    if (device && numa) {
+        std::cerr << "-numa works with the CPU tracers, not with -device\n";
+        return 1;
+    }
+    if (device && (progressive || adaptive_error > 0 || pilot_rounds > 0
+                   || shading_heuristic != mis_balance)) {
+        std::cerr << "-device renders all samples at once with the balance heuristic\n";
+        return 1;
+    }
+#ifndef RT_CUDA
+    if (mode == trace_device_cuda) {
+        std::cerr << "-device cuda needs a build with RT_CUDA and device_cuda.cu\n";
+        return 1;
+    }
+#endif
+#ifndef RT_STATS
+    if (print_stats || stats_json_path) {
+        std::cerr << "-stats and -stats-json need a build with RT_STATS defined\n";
+        return 1;
+    }
+#endif
+    if (trace_path)
+        trace_start();
+    trace_zone build_zone("scene build");
+    random_set_pattern(pattern, ns, nx);
     hittable *world;
     camera *cam;
     float aspect = float(ny) / float(nx);
-    cornell_box(&world, &cam, aspect);
-    hittable *light_shape = new xz_rect(213, 343, 227, 332, 554, 0);
-    hittable *glass_sphere = new sphere(vec3(190, 90, 190), 90, 0);
-    hittable *a[2];
-    a[0] = light_shape;
-    a[1] = glass_sphere;
-    hittable_list hlist(a,2);
-
-    for (int j = ny-1; j >= 0; j--) {
-        for (int i = 0; i < nx; i++) {
-            vec3 col(0, 0, 0);
-            for (int s=0; s < ns; s++) {
-                float u = float(i+random_double())/ float(nx);
-                float v = float(j+random_double())/ float(ny);
-                ray r = cam->get_ray(u, v);
-                vec3 p = r.point_at_parameter(2.0);
-                col += de_nan(color(r, world, &hlist, 0));
-            }
-            col /= float(ns);
-            col = vec3( sqrt(col[0]), sqrt(col[1]), sqrt(col[2]) );
-            int ir = int(255.99*col[0]);
-            int ig = int(255.99*col[1]);
-            int ib = int(255.99*col[2]);
-            std::cout << ir << " " << ig << " " << ib << "\n";
+    arena scene_arena;
+    hittable *lights;
+    build(scene_arena, &world, &lights, &cam, aspect);
+    numa_topology topology = numa_detect();
+    std::deque<arena> replica_arenas;
+    if (numa && topology.nodes() > 1) {
+        // Each other node builds a copy of the scene on a thread pinned there. The builders are
+        // deterministic, so the copies match; only the first one's emitters are kept.
+        int nodes = topology.nodes();
+        hittable **worlds = scene_arena.make_array<hittable*>(nodes);
+        hittable **node_lights = scene_arena.make_array<hittable*>(nodes);
+        worlds[0] = world;
+        node_lights[0] = lights;
+        replica_arenas.resize(nodes - 1);
+        size_t emitters = scene_emitters.size();
+        for (int node = 1; node < nodes; node++) {
+            std::thread builder([&]() {
+                numa_pin_thread(topology.node_cpus[node][0], node);
+                camera *replica_cam;
+                build(replica_arenas[node-1], &worlds[node], &node_lights[node], &replica_cam,
+                      aspect);
+            });
+            builder.join();
+            scene_emitters.resize(emitters);
         }
+        world = scene_arena.make<numa_replicated>(worlds, nodes);
+        if (lights)
+            lights = scene_arena.make<numa_replicated>(node_lights, nodes);
+        std::cerr << "numa: " << nodes << " copies of the scene\n";
+    }
+    if (env_path) {
+        environment = environment_light::load(scene_arena, env_path, env_scale);
+        if (!environment) {
+            std::cerr << "cannot read environment: " << env_path << "\n";
+            return 1;
+        }
+    }
+    else if (!lights)
+        environment = scene_arena.make<environment_light>(vec3(0.7, 0.8, 1.0));
+    if (mode == trace_bdpt) {
+        if (env_path || scene_emitters.empty()) {
+            std::cerr << "-bdpt needs a scene lit by its own surfaces\n";
+            return 1;
+        }
+        if (cam->lens_radius > 0) {
+            std::cerr << "-bdpt needs a pinhole camera\n";
+            return 1;
+        }
+    }
+    if (cache_photons > 0 && (env_path || scene_emitters.empty())) {
+        std::cerr << "-preview-cache needs a scene lit by its own surfaces\n";
+        return 1;
+    }
+    if (environment) {
+        if (device) {
+            std::cerr << "-device cannot render an environment light\n";
+            return 1;
+        }
+        if (lights) {
+            hittable **both = scene_arena.make_array<hittable*>(2);
+            both[0] = lights;
+            both[1] = environment;
+            lights = scene_arena.make<hittable_list>(both, 2);
+        }
+        else
+            lights = environment;
     }
-}
 
+    build_zone.end();
+
+    trace_zone render_zone("render");
+    // Pilot and training samples come after the render's own in each pixel's stream.
+    int spare_sample = ns > max_spp ? ns : max_spp;
+    if (pilot_rounds > 0) {
+        // Each round traces a few samples through every fourth pixel each way, on one thread so
+        // the fitted fractions, and so the image, do not depend on the thread count. Each NUMA
+        // node's copy of the scene has materials of its own, so the pilot runs once against each
+        // copy; the copies match and the samples are the same, so every copy fits the same
+        // fractions, and a pixel comes out the same whichever node's worker renders it.
+        const int stride = 4, pilot_spp = 4;
+        int first_sample = spare_sample;
+        spare_sample += pilot_rounds * pilot_spp;
+        int copies = int(replica_arenas.size()) + 1;
+        for (int node = 0; node < copies; node++) {
+            numa_current_node() = node;
+            mis_tuner tuner;
+            shading_tuner = &tuner;
+            for (int round = 0; round < pilot_rounds; round++) {
+                for (int j = stride/2; j < ny; j += stride) {
+                    for (int i = stride/2; i < nx; i += stride) {
+                        for (int s = 0; s < pilot_spp; s++) {
+                            random_begin_sample(seed, j*nx + i,
+                                                first_sample + round*pilot_spp + s);
+                            color(cam->pixel_ray(i, j, nx, ny), world, lights, 0, vec3(1,1,1));
+                        }
+                    }
+                }
+                tuner.update();
+            }
+            shading_tuner = 0;
+        }
+        numa_current_node() = 0;
+    }
+
+    framebuffer fb(nx, ny);
+    tile_scheduler scheduler(nx, ny, tile_size, nthreads, order);
+    if (numa) {
+        scheduler.on_worker_start([&](int id) {
+            int node;
+            int cpu = topology.worker_cpu(id, node);
+            numa_pin_thread(cpu, node);
+        });
+    }
+    if (roi[2] > roi[0] && roi[3] > roi[1]) {
+        // -roi counts rows down from the top of the image, and the framebuffer up from the bottom.
+        scheduler.focus(roi[0], ny - roi[3], roi[2], ny - roi[1]);
+    }
+    long long camera_samples = (long long)(nx) * ny * ns;
+    aabb scene_bounds;
+    if (guide_passes > 0 && world->bounding_box(0, 1, scene_bounds)) {
+        // Training pass k traces 2^k samples through every pixel, guided by what the passes
+        // before it learned, and is thrown away; the render samples what the last one learned.
+        guide = scene_arena.make<path_guide>(scene_bounds);
+        for (int pass = 0; pass < guide_passes; pass++) {
+            int first_sample = spare_sample, pass_spp = 1 << pass;
+            spare_sample += pass_spp;
+            guide->learning = true;
+            scheduler.run([&](const tile& t) {
+                for (int j = t.y1-1; j >= t.y0; j--) {
+                    for (int i = t.x0; i < t.x1; i++) {
+                        for (int s = 0; s < pass_spp; s++) {
+                            random_begin_sample(seed, j*nx + i, first_sample + s);
+                            color(cam->pixel_ray(i, j, nx, ny), world, lights, 0, vec3(1,1,1));
+                        }
+                    }
+                }
+            });
+            guide->learning = false;
+            guide->update();
+        }
+        std::cerr << "guide: " << guide->leaves() << " leaves\n";
+    }
+    if (cache_photons > 0 && world->bounding_box(0, 1, scene_bounds)) {
+        bdpt_lights emitters(scene_emitters);
+        preview_cache = scene_arena.make<radiance_cache>(world, emitters, scene_bounds,
+                                                         cache_photons, 50, roulette_depth, seed,
+                                                         nthreads);
+        std::cerr << "preview cache: " << preview_cache->size() << " photons\n";
+    }
+    if (progressive) {
+        // One sample per pixel per pass. The image and the checkpoint are written every so often,
+        // and a checkpoint left by an earlier run of the same render picks up where it stopped.
+        render_checkpoint progress(nx, ny);
+        progress.seed = seed;
+        if (checkpoint_path && load_checkpoint(checkpoint_path, progress))
+            std::cerr << "resuming from pass " << progress.passes << "\n";
+        std::chrono::steady_clock::time_point last_write = std::chrono::steady_clock::now();
+        int last_write_pass = progress.passes;
+        while (progress.passes < ns) {
+            int pass = progress.passes;
+            scheduler.run([&](const tile& t) {
+                for (int j = t.y1-1; j >= t.y0; j--) {
+                    for (int i = t.x0; i < t.x1; i++) {
+                        random_begin_sample(seed, j*nx + i, pass);
+                        ray r = cam->pixel_ray(i, j, nx, ny);
+                        vec3 col = de_nan(color(r, world, lights, 0, vec3(1,1,1)));
+                        float *sum = progress.sum.at(i, j);
+                        sum[0] += col[0];
+                        sum[1] += col[1];
+                        sum[2] += col[2];
+                    }
+                }
+            });
+            progress.passes++;
+            std::chrono::duration<double> since_write =
+                std::chrono::steady_clock::now() - last_write;
+            bool due = since_write.count() >= checkpoint_seconds
+                    || (checkpoint_passes > 0
+                        && progress.passes - last_write_pass >= checkpoint_passes);
+            if (due || progress.passes == ns) {
+                if (checkpoint_path && !save_checkpoint(checkpoint_path, progress))
+                    std::cerr << "could not write " << checkpoint_path << "\n";
+                // The finished image is written below, like any other render's.
+                if (out_path && progress.passes < ns && !write_output(out_path, progress.image()))
+                    std::cerr << "could not write " << out_path << "\n";
+                last_write = std::chrono::steady_clock::now();
+                last_write_pass = progress.passes;
+            }
+        }
+        fb = progress.image();
+    }
+    else if (adaptive_error > 0) {
+        // -ns samples for every pixel, then more where the noise is above -adaptive, until the
+        // budget (an average number of samples per pixel) is spent.
+        long long budget = (long long)((budget_spp > 0 ? budget_spp : 4*ns) * nx * ny);
+        adaptive_sampler sampler(nx, ny, ns, max_spp, budget, adaptive_error);
+        while (sampler.plan_round()) {
+            scheduler.run([&](const tile& t) {
+                for (int j = t.y1-1; j >= t.y0; j--) {
+                    for (int i = t.x0; i < t.x1; i++) {
+                        int first = sampler.first_sample(i, j);
+                        for (int s = first; s < first + sampler.wanted(i, j); s++) {
+                            random_begin_sample(seed, j*nx + i, s);
+                            ray r = cam->pixel_ray(i, j, nx, ny);
+                            vec3 col = de_nan(color(r, world, lights, 0, vec3(1,1,1)));
+                            sampler.add(i, j, col[0], col[1], col[2]);
+                        }
+                    }
+                }
+            });
+        }
+        std::cerr << "adaptive: " << double(sampler.samples_taken()) / (nx*ny)
+                  << " samples per pixel\n";
+        camera_samples = sampler.samples_taken();
+        fb = sampler.image();
+        if (heatmap_path && !write_output(heatmap_path, sampler.heatmap())) {
+            std::cerr << "could not write " << heatmap_path << "\n";
+            return 1;
+        }
+    }
+    else if (device) {
+        // The scene is flattened for device_kernel.h, which traces every sample on its own.
+        device_scene flat;
+        std::string error;
+        if (!flat.build(world, lights, error)) {
+            std::cerr << "-device: " << error << "\n";
+            return 1;
+        }
+        device_scene_view view = flat.view();
+        view.roulette_depth = roulette_depth;
+        device_camera dcam = make_device_camera(*cam);
+        if (mode == trace_device_cpu) {
+            scheduler.run([&](const tile& t) {
+                for (int j = t.y1-1; j >= t.y0; j--) {
+                    for (int i = t.x0; i < t.x1; i++) {
+                        dvec col = make_dvec(0, 0, 0);
+                        for (int s = 0; s < ns; s++)
+                            col = col + device_trace_sample(view, dcam, i, j, nx, ny, s, seed);
+                        col = col / float(ns);
+                        fb.set(i, j, col.x, col.y, col.z);
+                    }
+                }
+            });
+        }
+#ifdef RT_CUDA
+        else if (!render_device_cuda(view, dcam, nx, ny, ns, seed, &fb.pixels[0], error)) {
+            std::cerr << "-device cuda: " << error << "\n";
+            return 1;
+        }
+#endif
+    }
+    else {
+        // Each tile filters its samples into a film_tile, which takes in the pixels around it that
+        // the filter reaches; the box filter keeps every sample in its own pixel.
+        film image_film(nx, ny, pixel_filter(filter, filter_radius));
+        bdpt_lights emitters(scene_emitters);
+        bdpt_integrator bdpt(world, emitters, *cam, nx, ny, 50, roulette_depth, image_film);
+        spectral_integrator spectral(world, lights, 50, shading_heuristic, roulette_depth,
+                                     environment);
+        interruptible = &scheduler;
+        signal(SIGINT, interrupt_render);
+        scheduler.run([&](const tile& t) {
+            film_tile ft(image_film, t);
+            if (mode == trace_scalar || mode == trace_bdpt || mode == trace_spectral) {
+                for (int j = t.y1-1; j >= t.y0; j--) {
+                    for (int i = t.x0; i < t.x1; i++) {
+                        for (int s=0; s < ns; s++) {
+                            random_begin_sample(seed, j*nx + i, s);
+                            float du, dv;
+                            ray r = cam->pixel_ray(i, j, nx, ny, du, dv);
+                            vec3 col;
+                            if (mode == trace_bdpt)
+                                col = de_nan(bdpt.trace(r));
+                            else if (mode == trace_spectral)
+                                col = de_nan(spectral.trace(r, float(random_double())));
+                            else
+                                col = de_nan(color(r, world, lights, 0, vec3(1,1,1)));
+                            ft.add(i, j, du, dv, col[0], col[1], col[2]);
+                        }
+                    }
+                }
+                image_film.merge(ft);
+                return;
+            }
+            camera_rays rays;
+            if (mode == trace_wavefront) {
+                // The camera stage makes a path for every sample in the tile, the integrator runs
+                // them all, and each pixel then sums its own paths in sample order.
+                cam->generate_rays(t, nx, ny, 0, ns, seed, rays);
+                std::vector<path_state> paths(rays.size());
+                for (size_t k = 0; k < rays.size(); k++) {
+                    paths[k].r = rays.get(k);
+                    paths[k].throughput = vec3(1, 1, 1);
+                    paths[k].radiance = vec3(0, 0, 0);
+                    paths[k].sample_key = rays.sample_key(k);
+                    paths[k].depth = 0;
+                }
+                wavefront_integrator integrator(world, lights, 50, shading_heuristic,
+                                                roulette_depth, environment, ray_sort_batch);
+                integrator.trace(paths);
+                size_t k = 0;
+                for (int j = t.y1-1; j >= t.y0; j--) {
+                    for (int i = t.x0; i < t.x1; i++) {
+                        for (int s=0; s < ns; s++, k++) {
+                            vec3 col = de_nan(paths[k].radiance);
+                            ft.add(i, j, rays.jitter[0][k], rays.jitter[1][k],
+                                   col[0], col[1], col[2]);
+                        }
+                    }
+                }
+                image_film.merge(ft);
+                return;
+            }
+            // The tile's camera rays are made a block of samples at a time and traced as packets;
+            // each sample then carries on from its primary hit exactly as color() would, so both
+            // paths give the same image. Each pixel adds up its samples in order.
+            int pixels = (t.x1 - t.x0) * (t.y1 - t.y0);
+            int batch = camera_batch_samples / pixels > 1 ? camera_batch_samples / pixels : 1;
+            for (int s0 = 0; s0 < ns; s0 += batch) {
+                int n = ns - s0 < batch ? ns - s0 : batch;
+                cam->generate_rays(t, nx, ny, s0, n, seed, rays);
+                for (size_t b = 0; b < rays.size(); b += ray_packet_size) {
+                    ray_packet packet;
+                    packet.count = int(rays.size() - b < size_t(ray_packet_size) ? rays.size() - b
+                                                                                 : ray_packet_size);
+                    float t_max[ray_packet_size];
+                    hit_record hrec[ray_packet_size];
+                    for (int k = 0; k < packet.count; k++) {
+                        packet.set(k, rays.get(b+k));
+                        t_max[k] = MAXFLOAT;
+                    }
+                    packet.pad(t_max);
+                    RT_COUNT(rays, packet.count);
+                    RT_COUNT_DEPTH(0, packet.count);
+                    int hits = world->hit_packet(packet, (1 << packet.count) - 1, 0, t_max,
+                                                 hrec);
+                    for (int k = 0; k < packet.count; k++) {
+                        vec3 col(0, 0, 0);
+                        if (hits & (1 << k)) {
+                            random_resume_sample(rays.sample_key(b+k), 1);
+                            col = de_nan(shade(packet.get(k), hrec[k], world, lights, 0,
+                                               vec3(1,1,1)));
+                        }
+                        else if (environment)
+                            col = de_nan(environment->radiance(packet.get(k).direction()));
+                        uint32_t pixel = rays.pixel[b+k];
+                        ft.add(int(pixel % nx), int(pixel / nx), rays.jitter[0][b+k],
+                               rays.jitter[1][b+k], col[0], col[1], col[2]);
+                    }
+                }
+            }
+            image_film.merge(ft);
+        });
+        signal(SIGINT, SIG_DFL);
+        interruptible = 0;
+        if (scheduler.was_cancelled())
+            std::cerr << "interrupted: writing the tiles finished so far\n";
+        // Light paths splat onto the film from every sample of every pixel, so each pixel's
+        // share of them is a sum over the whole render, to be divided by the samples per pixel.
+        fb = image_film.image(mode == trace_bdpt ? 1.0f / ns : 0);
+    }
+    render_zone.end();
+    if (!scheduler.was_cancelled()
+            && (albedo_path || normal_path || depth_path || denoise_atrous || denoise_command)) {
+        trace_zone zone("aovs and denoise");
+        aov_buffers aovs(nx, ny);
+        render_aovs(world, *cam, ns, seed, scheduler, aovs);
+        const framebuffer *aov_images[3] = { &aovs.albedo, &aovs.normal, &aovs.depth };
+        for (int f = 0; f < 3; f++) {
+            if (aov_paths[f] && !write_output(aov_paths[f], *aov_images[f])) {
+                std::cerr << "could not write " << aov_paths[f] << "\n";
+                return 1;
+            }
+        }
+        if (denoise_atrous) {
+            atrous_denoiser filter(scheduler);
+            filter.run(fb, aovs, fb);
+        }
+        else if (denoise_command) {
+            command_denoiser filter(denoise_command, out_path ? out_path : "denoise");
+            if (!filter.run(fb, aovs, fb)) {
+                std::cerr << "denoiser failed: " << denoise_command << "\n";
+                return 1;
+            }
+        }
+    }
+    trace_zone output_zone("output");
+    if (!out_path)
+        write_ppm_p3(std::cout, fb);
+    else if (!write_output(out_path, fb)) {
+        std::cerr << "could not write " << out_path << "\n";
+        return 1;
+    }
+    output_zone.end();
+
+    // The counters include the pilot rounds' rays, but the rates are per sample of the image.
+#ifdef RT_STATS
+    if (print_stats)
+        render_stats_print(std::cerr, render_stats_collect(), camera_samples);
+    if (stats_json_path) {
+        std::ofstream out(stats_json_path);
+        render_stats_write_json(out, render_stats_collect(), camera_samples);
+        if (!out) {
+            std::cerr << "could not write " << stats_json_path << "\n";
+            return 1;
+        }
+    }
+#else
+    (void)camera_samples;
+#endif
+    if (trace_path && !trace_write(trace_path)) {
+        std::cerr << "could not write " << trace_path << "\n";
+        return 1;
+    }
+}
@@ -11,18 +11,22 @@
 // with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
 //==================================================================================================
 
-#include "hittable.h"
+#include "../common/fast_math.h"
+#include "../common/hittable.h"
+#include "../common/random.h"
+#include "../common/ray.h"
+#include "../common/render_stats.h"
 #include "onb.h"
 #include "pdf.h"
-#include "random.h"
-#include "ray.h"
 #include "texture.h"
 
+#include <new>
+
 
 float schlick(float cosine, float ref_idx) {
     float r0 = (1-ref_idx) / (1+ref_idx);
     r0 = r0*r0;
-    return r0 + (1-r0)*pow((1 - cosine),5);
+    return r0 + (1-r0)*rt_pow5(1 - cosine);
 }
 
 bool refract(const vec3& v, const vec3& n, float ni_over_nt, vec3& refracted) {
@@ -43,16 +47,48 @@ vec3 reflect(const vec3& v, const vec3& n) {
 }
 
 
+// The pdf of a diffuse scatter is built in place in the record with set_pdf, so scattering never
+// touches the heap. pdf_ptr then points into the record, which is why records cannot be copied.
 struct scatter_record
 {
+    scatter_record() : pdf_ptr(0) {}
+    ~scatter_record() { clear_pdf(); }
+
+    template <typename P> void set_pdf(const P& p) {
+        static_assert(sizeof(P) <= sizeof(pdf_space), "pdf too large for scatter_record");
+        clear_pdf();
+        pdf_ptr = new (pdf_space) P(p);
+    }
+    void clear_pdf() {
+        if (pdf_ptr)
+            pdf_ptr->~pdf();
+        pdf_ptr = 0;
+    }
+
     ray specular_ray;
     bool is_specular;
     vec3 attenuation;
     pdf *pdf_ptr;
+
+    private:
+        scatter_record(const scatter_record&);
+        scatter_record& operator=(const scatter_record&);
+
+        // Room for any of cosine_pdf, hittable_pdf or mixture_pdf, aligned for a SIMD vec3.
+        alignas(16) unsigned char pdf_space[64];
 };
 
+// Tagged like the textures in texture.h: material_scatter(), material_scattering_pdf() and
+// material_emitted() call the built-in materials directly, and the rest through the virtual
+// interface. A built-in that leaves one of the three to the base class gets the base's answer
+// inline.
+enum material_kind { material_other, material_lambertian, material_metal, material_dielectric,
+                     material_diffuse_light, material_isotropic };
+
 class material  {
     public:
+        material() : light_fraction(0.5), kind(material_other) {}
+        virtual ~material() {}
         virtual bool scatter(const ray& r_in, const hit_record& hrec, scatter_record& srec) const {
             return false;
         }
@@ -62,14 +98,34 @@ class material  {
         virtual vec3 emitted(const ray& r_in, const hit_record& rec, float u, float v, const vec3& p) const {
             return vec3(0,0,0);
         }
+
+        // The share of diffuse bounces off this material that sample towards the lights rather
+        // than from scattering_pdf. mis_tuner fits it to the scene.
+        float light_fraction;
+        material_kind kind;
 };
 
-class dielectric : public material {
+// ref_idx is the index of refraction at the helium d line, 587.6nm, and dispersion is Cauchy's B
+// coefficient in square micrometres: the index at wavelength l is ref_idx + B (1/l^2 - 1/0.5876^2).
+// RGB renders use ref_idx throughout; only spectral ones see the index change with wavelength.
+class dielectric final : public material {
     public:
-        dielectric(float ri) : ref_idx(ri) {}
+        dielectric(float ri, float b = 0) : ref_idx(ri), dispersion(b) {
+            kind = material_dielectric;
+        }
         virtual bool scatter(const ray& r_in, const hit_record& hrec, scatter_record& srec) const {
+            return scatter_with_index(r_in, hrec, srec, ref_idx);
+        }
+        // The index of refraction at a wavelength in nanometres.
+        float index_at(float wavelength) const {
+            float um = wavelength * 0.001f;
+            return ref_idx + dispersion * (1 / (um*um) - 1 / (0.5876f*0.5876f));
+        }
+        bool scatter_with_index(const ray& r_in, const hit_record& hrec, scatter_record& srec,
+                                float index) const {
+            RT_COUNT_SCATTER("dielectric");
             srec.is_specular = true;
-            srec.pdf_ptr = 0;
+            srec.clear_pdf();
             srec.attenuation = vec3(1.0, 1.0, 1.0);
             vec3 outward_normal;
              vec3 reflected = reflect(r_in.direction(), hrec.normal);
@@ -79,42 +135,47 @@ class dielectric : public material {
              float cosine;
              if (dot(r_in.direction(), hrec.normal) > 0) {
                   outward_normal = -hrec.normal;
-                  ni_over_nt = ref_idx;
-                  cosine = ref_idx * dot(r_in.direction(), hrec.normal) / r_in.direction().length();
+                  ni_over_nt = index;
+                  cosine = index * dot(r_in.direction(), hrec.normal) / r_in.direction().length();
              }
              else {
                   outward_normal = hrec.normal;
-                  ni_over_nt = 1.0 / ref_idx;
+                  ni_over_nt = 1.0 / index;
                   cosine = -dot(r_in.direction(), hrec.normal) / r_in.direction().length();
              }
              if (refract(r_in.direction(), outward_normal, ni_over_nt, refracted)) {
-                reflect_prob = schlick(cosine, ref_idx);
+                reflect_prob = schlick(cosine, index);
              }
              else {
                 reflect_prob = 1.0;
              }
              if (random_double() < reflect_prob) {
-                srec.specular_ray = ray(hrec.p, reflected);
+                srec.specular_ray = spawn_ray(hrec, reflected);
              }
              else {
-                srec.specular_ray = ray(hrec.p, refracted);
+                srec.specular_ray = spawn_ray(hrec, refracted);
              }
              return true;
         }
 
         float ref_idx;
+        float dispersion;
 };
 
 
-class metal : public material {
+class metal final : public material {
     public:
-        metal(const vec3& a, float f) : albedo(a) { if (f < 1) fuzz = f; else fuzz = 1; }
+        metal(const vec3& a, float f) : albedo(a) {
+            kind = material_metal;
+            if (f < 1) fuzz = f; else fuzz = 1;
+        }
         virtual bool scatter(const ray& r_in, const hit_record& hrec, scatter_record& srec) const {
+            RT_COUNT_SCATTER("metal");
             vec3 reflected = reflect(unit_vector(r_in.direction()), hrec.normal);
-            srec.specular_ray = ray(hrec.p, reflected + fuzz*random_in_unit_sphere());
+            srec.specular_ray = spawn_ray(hrec, reflected + fuzz*random_in_unit_sphere());
             srec.attenuation = albedo;
             srec.is_specular = true;
-            srec.pdf_ptr = 0;
+            srec.clear_pdf();
             return true;
         }
         vec3 albedo;
@@ -123,9 +184,9 @@ class metal : public material {
 
 
 
-class lambertian : public material {
+class lambertian final : public material {
     public:
-        lambertian(texture *a) : albedo(a) {}
+        lambertian(texture *a) : albedo(a) { kind = material_lambertian; }
         float scattering_pdf(const ray& r_in, const hit_record& rec, const ray& scattered) const {
             float cosine = dot(rec.normal, unit_vector(scattered.direction()));
             if (cosine < 0)
@@ -133,21 +194,26 @@ class lambertian : public material {
             return cosine / M_PI;
         }
         bool scatter(const ray& r_in, const hit_record& hrec, scatter_record& srec) const {
+            return scatter(hrec, texture_value(albedo, hrec.u, hrec.v, hrec.p), srec);
+        }
+        // scatter() with the albedo at the hit already looked up, as batched shading does.
+        bool scatter(const hit_record& hrec, const vec3& albedo_value, scatter_record& srec) const {
+            RT_COUNT_SCATTER("lambertian");
             srec.is_specular = false;
-            srec.attenuation = albedo->value(hrec.u, hrec.v, hrec.p);
-            srec.pdf_ptr = new cosine_pdf(hrec.normal);
+            srec.attenuation = albedo_value;
+            srec.set_pdf(cosine_pdf(hrec.normal));
             return true;
         }
         texture *albedo;
 };
 
 
-class diffuse_light : public material  {
+class diffuse_light final : public material  {
     public:
-        diffuse_light(texture *a) : emit(a) {}
+        diffuse_light(texture *a) : emit(a) { kind = material_diffuse_light; }
         virtual vec3 emitted(const ray& r_in, const hit_record& rec, float u, float v, const vec3& p) const {
             if (dot(rec.normal, r_in.direction()) < 0.0)
-                return emit->value(u, v, p);
+                return texture_value(emit, u, v, p);
             else
                 return vec3(0,0,0);
         }
@@ -155,19 +221,70 @@ class diffuse_light : public material  {
 };
 
 
-/*
-class isotropic : public material {
+// The phase function of constant_medium. Directions are drawn from the phase function itself, so
+// like a mirror's they carry the albedo alone and are not mixed with light sampling.
+class isotropic final : public material {
     public:
-        isotropic(texture *a) : albedo(a) {}
-        virtual bool scatter(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered) const  {
-             scattered = ray(rec.p, random_in_unit_sphere());
-             attenuation = albedo->value(rec.u, rec.v, rec.p);
-             return true;
+        isotropic(texture *a) : albedo(a) { kind = material_isotropic; }
+        virtual bool scatter(const ray& r_in, const hit_record& hrec, scatter_record& srec) const {
+            RT_COUNT_SCATTER("isotropic");
+            srec.is_specular = true;
+            srec.clear_pdf();
+            srec.specular_ray = ray(hrec.p, random_in_unit_sphere(), r_in.time());
+            srec.attenuation = texture_value(albedo, hrec.u, hrec.v, hrec.p);
+            return true;
         }
 
         texture *albedo;
 };
-*/
+
+inline bool material_scatter(const material *m, const ray& r_in, const hit_record& hrec,
+                             scatter_record& srec) {
+#ifndef RT_VIRTUAL_DISPATCH
+    switch (m->kind) {
+        case material_lambertian:
+            return static_cast<const lambertian*>(m)->scatter(r_in, hrec, srec);
+        case material_metal: return static_cast<const metal*>(m)->scatter(r_in, hrec, srec);
+        case material_dielectric:
+            return static_cast<const dielectric*>(m)->scatter(r_in, hrec, srec);
+        case material_diffuse_light: return false;
+        case material_isotropic:
+            return static_cast<const isotropic*>(m)->scatter(r_in, hrec, srec);
+        default: break;
+    }
+#endif
+    return m->scatter(r_in, hrec, srec);
+}
+
+inline float material_scattering_pdf(const material *m, const ray& r_in, const hit_record& hrec,
+                                     const ray& scattered) {
+#ifndef RT_VIRTUAL_DISPATCH
+    switch (m->kind) {
+        case material_lambertian:
+            return static_cast<const lambertian*>(m)->scattering_pdf(r_in, hrec, scattered);
+        case material_metal: case material_dielectric: case material_diffuse_light:
+        case material_isotropic:
+            return 0;
+        default: break;
+    }
+#endif
+    return m->scattering_pdf(r_in, hrec, scattered);
+}
+
+inline vec3 material_emitted(const material *m, const ray& r_in, const hit_record& hrec) {
+#ifndef RT_VIRTUAL_DISPATCH
+    switch (m->kind) {
+        case material_diffuse_light:
+            return static_cast<const diffuse_light*>(m)->emitted(r_in, hrec, hrec.u, hrec.v,
+                                                                 hrec.p);
+        case material_lambertian: case material_metal: case material_dielectric:
+        case material_isotropic:
+            return vec3(0,0,0);
+        default: break;
+    }
+#endif
+    return m->emitted(r_in, hrec, hrec.u, hrec.v, hrec.p);
+}
 
 
 /*
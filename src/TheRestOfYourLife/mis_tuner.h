@@ -0,0 +1,76 @@
+#ifndef MISTUNERH
+#define MISTUNERH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include "material.h"
+
+#include <math.h>
+#include <mutex>
+#include <unordered_map>
+
+
+// Fits each material's light_fraction to the scene from the estimates of a short pilot render.
+// With fraction c of the samples from the lights, the variance of the mixture estimate f/p falls
+// as c grows exactly when the light-sampled estimates have the larger mean square, M0 > M1. So
+// each update moves c in proportion to sqrt(M0) against sqrt(M1), and stops where the two agree:
+//
+//     c' = c sqrt(M0) / (c sqrt(M0) + (1-c) sqrt(M1))
+//
+// The fraction stays in [lo, hi], so neither strategy is ever dropped and the estimate stays
+// unbiased for the paths the pilot never saw.
+class mis_tuner {
+    public:
+        mis_tuner(float lo = 0.1, float hi = 0.9) : lowest(lo), highest(hi) {}
+
+        // One diffuse bounce off m that sampled with strategy (0 for the lights) and came back
+        // with estimate, the radiance it carries divided by its density.
+        void record(material *m, int strategy, const vec3& estimate) {
+            double y = 0.2126*estimate[0] + 0.7152*estimate[1] + 0.0722*estimate[2];
+            if (!(y == y))
+                return;
+            std::lock_guard<std::mutex> guard(lock);
+            moments& s = stats[m];
+            s.sum[strategy] += y*y;
+            s.n[strategy]++;
+        }
+
+        // Moves every material seen since the last update, and forgets what was recorded.
+        void update() {
+            std::lock_guard<std::mutex> guard(lock);
+            for (std::unordered_map<material*, moments>::iterator it = stats.begin();
+                 it != stats.end(); ++it) {
+                const moments& s = it->second;
+                if (s.n[0] == 0 || s.n[1] == 0)
+                    continue;
+                double c = it->first->light_fraction;
+                double r0 = c * sqrt(s.sum[0] / s.n[0]);
+                double r1 = (1 - c) * sqrt(s.sum[1] / s.n[1]);
+                if (r0 + r1 > 0)
+                    c = r0 / (r0 + r1);
+                it->first->light_fraction = float(c < lowest ? lowest : c > highest ? highest : c);
+            }
+            stats.clear();
+        }
+
+    private:
+        struct moments {
+            moments() { sum[0] = sum[1] = 0; n[0] = n[1] = 0; }
+            double sum[2];
+            long long n[2];
+        };
+
+        float lowest, highest;
+        std::unordered_map<material*, moments> stats;
+        std::mutex lock;
+};
+
+#endif
@@ -0,0 +1,238 @@
+#ifndef PATHGUIDEH
+#define PATHGUIDEH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include "../common/aabb.h"
+#include "../common/random.h"
+#include "pdf.h"
+
+#include <algorithm>
+#include <atomic>
+#include <math.h>
+#include <stdint.h>
+#include <vector>
+
+
+// Each leaf's histogram splits the sphere of directions into guide_bins x guide_bins cells of equal
+// solid angle, evenly in cos(theta) and phi about z.
+const int guide_bins = 16;
+const int guide_cells = guide_bins * guide_bins;
+// A leaf splits once a pass records more than this many bounces in it, times the square root of
+// how many passes there have been, as in Mueller et al.'s SD-tree, down to guide_max_depth.
+const int guide_split_records = 4000;
+const int guide_max_depth = 10;
+// A leaf needs this many records in a pass before its histogram replaces the one it had.
+const int guide_min_records = 64;
+// The share of non-light samples a guided bounce takes from the histogram rather than the material.
+const float guide_fraction = 0.5;
+
+inline int guide_cell(const vec3& unit_direction) {
+    float u = 0.5f * (unit_direction.z() + 1);
+    float v = float((atan2(unit_direction.y(), unit_direction.x()) + M_PI) / (2*M_PI));
+    int iu = int(u * guide_bins), iv = int(v * guide_bins);
+    iu = iu < 0 ? 0 : iu >= guide_bins ? guide_bins - 1 : iu;
+    iv = iv < 0 ? 0 : iv >= guide_bins ? guide_bins - 1 : iv;
+    return iu * guide_bins + iv;
+}
+
+
+// Learns where the light arriving at diffuse bounces comes from, after Mueller, Gross and Novak,
+// "Practical Path Guiding for Efficient Light-Transport Simulation": an octree over the scene,
+// each leaf holding a histogram of the incident radiance over directions. Training passes record
+// every diffuse bounce's estimate while sampling from what the passes before them learned, and
+// update() turns the records into the distributions the next pass, or the render, samples.
+//
+// Records go into the histograms as 64-bit fixed point with atomic adds, which do not depend on
+// the order they happen in, so the learned guide, and so the image, is the same for any number of
+// threads.
+class path_guide {
+    public:
+        path_guide(const aabb& scene_bounds);
+
+        // A diffuse bounce at p that went in the given direction and brought back estimate, the
+        // radiance divided by the density it was sampled with.
+        void record(const vec3& p, const vec3& direction, const vec3& estimate);
+        // Replaces each leaf's distribution with what it recorded, if that was enough, and splits
+        // the leaves that recorded the most. Call it between passes, with no records under way.
+        void update();
+
+        // The leaf holding p, and whether it has a distribution to sample yet.
+        int leaf_for(const vec3& p) const;
+        bool trained(int leaf) const { return guided[leaf] != 0; }
+        // A direction from a trained leaf's distribution, and the density of one.
+        vec3 generate(int leaf) const;
+        float value(int leaf, const vec3& direction) const;
+
+        int leaves() const { return int(guided.size()); }
+
+        // Set while a training pass runs; shade() only records then.
+        bool learning;
+
+    private:
+        struct node {
+            int child;  // first of eight children in octant order, or -1 for a leaf
+            int leaf;   // for a leaf, the index of its histograms
+            int depth;
+        };
+
+        void resize_records();
+
+        aabb bounds;
+        std::vector<node> nodes;
+        int passes;
+        // Per leaf: whether it has a distribution, and its cumulative distribution over cells.
+        std::vector<char> guided;
+        std::vector<float> cdf;
+        // Per leaf: this pass's records, and the energy they brought in each cell.
+        std::vector<std::atomic<long long> > records;
+        std::vector<std::atomic<uint64_t> > energy;
+};
+
+// Estimates are stored in units of 2^-16 and cut off at 2^24, so a pass would need 2^24 of the
+// largest ones in one cell to overflow.
+const float guide_energy_scale = 65536;
+const float guide_energy_max = 16777216;
+
+path_guide::path_guide(const aabb& scene_bounds)
+    : learning(false), bounds(scene_bounds), passes(0) {
+    // A little room around the scene, so that points on its faces land inside.
+    vec3 lo = bounds.min(), hi = bounds.max();
+    vec3 pad = 0.001f * (hi - lo) + vec3(1e-3f, 1e-3f, 1e-3f);
+    bounds = aabb(lo - pad, hi + pad);
+    node root = { -1, 0, 0 };
+    nodes.push_back(root);
+    guided.assign(1, 0);
+    cdf.assign(guide_cells, 0.0f);
+    resize_records();
+}
+
+void path_guide::resize_records() {
+    std::vector<std::atomic<long long> >(guided.size()).swap(records);
+    std::vector<std::atomic<uint64_t> >(guided.size() * guide_cells).swap(energy);
+    for (size_t k = 0; k < records.size(); k++)
+        records[k].store(0, std::memory_order_relaxed);
+    for (size_t k = 0; k < energy.size(); k++)
+        energy[k].store(0, std::memory_order_relaxed);
+}
+
+int path_guide::leaf_for(const vec3& p) const {
+    vec3 lo = bounds.min(), hi = bounds.max();
+    int n = 0;
+    while (nodes[n].child >= 0) {
+        int octant = 0;
+        for (int a = 0; a < 3; a++) {
+            float mid = 0.5f * (lo[a] + hi[a]);
+            if (p[a] >= mid) {
+                octant |= 1 << a;
+                lo[a] = mid;
+            }
+            else
+                hi[a] = mid;
+        }
+        n = nodes[n].child + octant;
+    }
+    return nodes[n].leaf;
+}
+
+void path_guide::record(const vec3& p, const vec3& direction, const vec3& estimate) {
+    int leaf = leaf_for(p);
+    records[leaf].fetch_add(1, std::memory_order_relaxed);
+    float y = 0.2126f*estimate[0] + 0.7152f*estimate[1] + 0.0722f*estimate[2];
+    if (!(y > 0))
+        return;
+    y = y < guide_energy_max ? y : guide_energy_max;
+    uint64_t units = uint64_t(y * guide_energy_scale);
+    if (units > 0)
+        energy[size_t(leaf) * guide_cells + guide_cell(unit_vector(direction))]
+            .fetch_add(units, std::memory_order_relaxed);
+}
+
+void path_guide::update() {
+    passes++;
+    int leaf_count = int(guided.size());
+    for (int l = 0; l < leaf_count; l++) {
+        if (records[l].load(std::memory_order_relaxed) < guide_min_records)
+            continue;
+        const std::atomic<uint64_t> *e = &energy[size_t(l) * guide_cells];
+        double total = 0;
+        for (int c = 0; c < guide_cells; c++)
+            total += double(e[c].load(std::memory_order_relaxed));
+        if (!(total > 0))
+            continue;
+        double sum = 0;
+        float *f = &cdf[size_t(l) * guide_cells];
+        for (int c = 0; c < guide_cells; c++) {
+            sum += double(e[c].load(std::memory_order_relaxed));
+            f[c] = float(sum / total);
+        }
+        f[guide_cells - 1] = 1;
+        guided[l] = 1;
+    }
+
+    // Leaves that saw many bounces split in eight; each child starts from its parent's
+    // distribution and records on its own from the next pass.
+    double threshold = guide_split_records * sqrt(double(passes));
+    size_t node_count = nodes.size();
+    for (size_t n = 0; n < node_count; n++) {
+        if (nodes[n].child >= 0 || nodes[n].depth >= guide_max_depth)
+            continue;
+        int parent = nodes[n].leaf;
+        if (records[parent].load(std::memory_order_relaxed) <= threshold)
+            continue;
+        int first = int(nodes.size());
+        for (int c = 0; c < 8; c++) {
+            node child = { -1, c == 0 ? parent : int(guided.size()), nodes[n].depth + 1 };
+            if (c > 0) {
+                guided.push_back(guided[parent]);
+                cdf.insert(cdf.end(), cdf.begin() + size_t(parent) * guide_cells,
+                           cdf.begin() + size_t(parent + 1) * guide_cells);
+            }
+            nodes.push_back(child);
+        }
+        nodes[n].child = first;
+        nodes[n].leaf = -1;
+    }
+    resize_records();
+}
+
+vec3 path_guide::generate(int leaf) const {
+    const float *f = &cdf[size_t(leaf) * guide_cells];
+    int c = int(std::upper_bound(f, f + guide_cells, float(random_double())) - f);
+    c = c < guide_cells ? c : guide_cells - 1;
+    float u = (c / guide_bins + float(random_double())) / guide_bins;
+    float v = (c % guide_bins + float(random_double())) / guide_bins;
+    float z = 2*u - 1;
+    float r = sqrt(ffmax(0.0f, 1 - z*z));
+    float phi = float(2*M_PI*v - M_PI);
+    return vec3(r*cos(phi), r*sin(phi), z);
+}
+
+float path_guide::value(int leaf, const vec3& direction) const {
+    const float *f = &cdf[size_t(leaf) * guide_cells];
+    int c = guide_cell(unit_vector(direction));
+    float p = f[c] - (c > 0 ? f[c-1] : 0);
+    return p * float(guide_cells / (4*M_PI));
+}
+
+
+// A leaf's distribution as a pdf, to mix with a material's own.
+class guide_pdf final : public pdf {
+    public:
+        guide_pdf(const path_guide *g, int l) : guide(g), leaf(l) {}
+        virtual float value(const vec3& direction) const { return guide->value(leaf, direction); }
+        virtual vec3 generate() const { return guide->generate(leaf); }
+
+        const path_guide *guide;
+        int leaf;
+};
+
+#endif
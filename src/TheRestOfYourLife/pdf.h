@@ -11,8 +11,12 @@
 // with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
 //==================================================================================================
 
+#include "../common/fast_math.h"
+#include "../common/random.h"
 #include "onb.h"
-#include "random.h"
+
+#include <math.h>
+#include <new>
 
 
 inline vec3 random_cosine_direction() {
@@ -20,8 +24,10 @@ inline vec3 random_cosine_direction() {
     float r2 = random_double();
     float z = sqrt(1-r2);
     float phi = 2*M_PI*r1;
-    float x = cos(phi)*sqrt(r2);
-    float y = sin(phi)*sqrt(r2);
+    float s, c;
+    rt_sincos(phi, s, c);
+    float x = c*sqrt(r2);
+    float y = s*sqrt(r2);
     return vec3(x, y, z);
 }
 
@@ -30,8 +36,10 @@ inline vec3 random_to_sphere(float radius, float distance_squared) {
     float r2 = random_double();
     float z = 1 + r2*(sqrt(1-radius*radius/distance_squared) - 1);
     float phi = 2*M_PI*r1;
-    float x = cos(phi)*sqrt(1-z*z);
-    float y = sin(phi)*sqrt(1-z*z);
+    float s, c;
+    rt_sincos(phi, s, c);
+    float x = c*sqrt(1-z*z);
+    float y = s*sqrt(1-z*z);
     return vec3(x, y, z);
 }
 
@@ -46,17 +54,27 @@ vec3 random_in_unit_sphere() {
 
 
 
+// Tagged like the textures in texture.h: pdf_value() and pdf_generate() call the built-in pdfs
+// directly, and the rest through the virtual interface.
+enum pdf_kind { pdf_other, pdf_cosine, pdf_hittable, pdf_mixture };
+
 class pdf  {
     public:
+        pdf() : kind(pdf_other) {}
         virtual float value(const vec3& direction) const = 0;
         virtual vec3 generate() const = 0;
         virtual ~pdf() {}
+
+        pdf_kind kind;
 };
 
+inline float pdf_value(const pdf *p, const vec3& direction);
+inline vec3 pdf_generate(const pdf *p);
 
-class cosine_pdf : public pdf {
+
+class cosine_pdf final : public pdf {
     public:
-        cosine_pdf(const vec3& w) { uvw.build_from_w(w); }
+        cosine_pdf(const vec3& w) { kind = pdf_cosine; uvw.build_from_w(w); }
         virtual float value(const vec3& direction) const {
             float cosine = dot(unit_vector(direction), uvw.w());
             if (cosine > 0)
@@ -70,9 +88,9 @@ class cosine_pdf : public pdf {
         onb uvw;
 };
 
-class hittable_pdf : public pdf {
+class hittable_pdf final : public pdf {
     public:
-        hittable_pdf(hittable *p, const vec3& origin) : ptr(p), o(origin) {}
+        hittable_pdf(hittable *p, const vec3& origin) : ptr(p), o(origin) { kind = pdf_hittable; }
         virtual float value(const vec3& direction) const {
             return ptr->pdf_value(o, direction);
         }
@@ -83,19 +101,97 @@ class hittable_pdf : public pdf {
         hittable *ptr;
 };
 
-class mixture_pdf : public pdf {
+// How a one-sample MIS estimate weighs the strategy it sampled against the others. Either way a
+// sample's estimate is f / value(direction, strategy): the balance heuristic gives the mixture
+// density itself, as the book uses, and the power heuristic squares each strategy's density
+// before weighing, which lowers noise when one strategy is far better than the other for the
+// direction sampled.
+enum mis_heuristic { mis_balance, mis_power };
+
+// Picks p[0] with probability fraction and p[1] otherwise. Defaults to the book's even split.
+class mixture_pdf final : public pdf {
     public:
-        mixture_pdf(pdf *p0, pdf *p1 ) { p[0] = p0; p[1] = p1; }
+        mixture_pdf(pdf *p0, pdf *p1, float fraction = 0.5, mis_heuristic h = mis_balance)
+            : fraction0(fraction), heuristic(h) { kind = pdf_mixture; p[0] = p0; p[1] = p1; }
         virtual float value(const vec3& direction) const {
-            return 0.5 * p[0]->value(direction) + 0.5 *p[1]->value(direction);
+            return double(fraction0) * pdf_value(p[0], direction)
+                 + double(1 - fraction0) * pdf_value(p[1], direction);
         }
         virtual vec3 generate() const {
-            if (random_double() < 0.5)
-                return p[0]->generate();
-            else
-                return p[1]->generate();
+            int strategy;
+            return generate(strategy);
+        }
+        // Also says which of p[0] and p[1] made the direction.
+        vec3 generate(int& strategy) const {
+            strategy = random_double() < fraction0 ? 0 : 1;
+            return pdf_generate(p[strategy]);
+        }
+        // The density to divide a sample made by strategy by, under the heuristic.
+        float value(const vec3& direction, int strategy) const {
+            if (heuristic == mis_balance)
+                return value(direction);
+            float d0 = fraction0 * pdf_value(p[0], direction);
+            float d1 = (1 - fraction0) * pdf_value(p[1], direction);
+            float chosen = strategy == 0 ? d0 : d1;
+            // A direction its own strategy could not have made carries no weight.
+            if (chosen <= 0)
+                return HUGE_VALF;
+            return (d0*d0 + d1*d1) / chosen;
         }
         pdf *p[2];
+        float fraction0;
+        mis_heuristic heuristic;
 };
 
+// A built-in pdf made on the stack, in room enough for any of them. pdf_value() and pdf_generate()
+// are inlined where the pdf is made, so the compiler sees every case of their switches applied to
+// it; in an object of its own size, the cases for the larger kinds would read past its end, and
+// GCC warns that they do (-Warray-bounds), though the kind tag never lets them run. In here every
+// case stays in bounds. scatter_record keeps its pdf the same way.
+class pdf_slot {
+    public:
+        pdf_slot() : ptr(0) {}
+        ~pdf_slot() { if (ptr) ptr->~pdf(); }
+
+        template <typename P> P *set(const P& p) {
+            static_assert(sizeof(P) <= sizeof(space), "pdf too large for pdf_slot");
+            if (ptr)
+                ptr->~pdf();
+            P *made = new (space) P(p);
+            ptr = made;
+            return made;
+        }
+
+    private:
+        pdf_slot(const pdf_slot&);
+        pdf_slot& operator=(const pdf_slot&);
+
+        pdf *ptr;
+        alignas(16) unsigned char space[64];
+};
+
+inline float pdf_value(const pdf *p, const vec3& direction) {
+#ifndef RT_VIRTUAL_DISPATCH
+    switch (p->kind) {
+        case pdf_cosine: return static_cast<const cosine_pdf*>(p)->value(direction);
+        case pdf_hittable: return static_cast<const hittable_pdf*>(p)->value(direction);
+        case pdf_mixture: return static_cast<const mixture_pdf*>(p)->value(direction);
+        default: break;
+    }
+#endif
+    return p->value(direction);
+}
+
+inline vec3 pdf_generate(const pdf *p) {
+#ifndef RT_VIRTUAL_DISPATCH
+    switch (p->kind) {
+        case pdf_cosine: return static_cast<const cosine_pdf*>(p)->generate();
+        case pdf_hittable: return static_cast<const hittable_pdf*>(p)->generate();
+        case pdf_mixture: return static_cast<const mixture_pdf*>(p)->generate();
+        default: break;
+    }
+#endif
+    return p->generate();
+}
+
 #endif
@@ -0,0 +1,354 @@
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include "../common/hittable_list.h"
+#include "../common/random.h"
+#include "aarect.h"
+#include "estimator.h"
+#include "light_set.h"
+#include "material.h"
+#include "onb.h"
+#include "pdf.h"
+#include "sphere.h"
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+
+// Checks that each pdf's generate() makes directions with the density its value() gives, by
+// Pearson's chi-square test, after the tests in pbrt and Mitsuba. Directions are binned by angle
+// theta from an axis, out to theta_max, and by phi about it, with one more bin for everything
+// beyond theta_max. Each bin expects the number of samples value() integrates to over it, found by
+// adaptive cubature; bins expecting fewer than chi2_min_expected samples are pooled. A test fails
+// if its p-value is below chi2_significance, corrected for the number of tests run, or if a
+// direction lands where value() is 0. Exits non-zero if any test fails.
+
+const int chi2_theta_bins = 48;
+const int chi2_phi_bins = 96;
+const double chi2_min_expected = 5;
+const double chi2_significance = 0.01;
+// Cells of a bin are split until their integral changes by less than this fraction of the whole
+// pdf per unit of solid angle and value() is 0 at all or none of their points, or they are
+// chi2_max_splits down. Bins found empty next to ones that are not are split chi2_edge_splits down
+// regardless, to find the slivers of a shape's edges and corners that their points miss.
+const double chi2_tolerance = 1e-6;
+const int chi2_max_splits = 6;
+const int chi2_edge_splits = 4;
+
+
+// The regularised upper incomplete gamma function Q(a, x), by its series below a + 1 and its
+// continued fraction above, as in Numerical Recipes.
+double gamma_q(double a, double x) {
+    if (x <= 0)
+        return 1;
+    double log_prefix = a * log(x) - x - lgamma(a);
+    if (x < a + 1) {
+        double term = 1 / a, sum = term;
+        for (int n = 1; n < 1000 && fabs(term) > fabs(sum) * 1e-15; n++) {
+            term *= x / (a + n);
+            sum += term;
+        }
+        return 1 - sum * exp(log_prefix);
+    }
+    const double tiny = 1e-300;
+    double b = x + 1 - a, c = 1 / tiny, d = 1 / b, h = d;
+    for (int n = 1; n < 1000; n++) {
+        double an = -n * (n - a);
+        b += 2;
+        d = an * d + b;
+        d = fabs(d) < tiny ? tiny : d;
+        c = b + an / c;
+        c = fabs(c) < tiny ? tiny : c;
+        d = 1 / d;
+        double delta = d * c;
+        h *= delta;
+        if (fabs(delta - 1) < 1e-15)
+            break;
+    }
+    return exp(log_prefix) * h;
+}
+
+
+struct chi2_test {
+    const char *name;
+    const pdf *p;
+    vec3 axis;
+    float theta_max;
+};
+
+class chi2_bins {
+    public:
+        chi2_bins(const vec3& axis, float theta_max) : max_theta(theta_max) {
+            frame.build_from_w(axis);
+        }
+        int count() const { return chi2_theta_bins * chi2_phi_bins + 1; }
+        int bin(const vec3& direction) const {
+            vec3 d = unit_vector(direction);
+            float c = dot(d, frame.w());
+            float theta = acos(c < -1 ? -1 : c > 1 ? 1 : c);
+            if (theta >= max_theta)
+                return count() - 1;
+            float phi = atan2(dot(d, frame.v()), dot(d, frame.u())) + M_PI;
+            int i = int(theta / max_theta * chi2_theta_bins);
+            int j = int(phi / (2*M_PI) * chi2_phi_bins);
+            i = i < chi2_theta_bins ? i : chi2_theta_bins - 1;
+            j = j < 0 ? 0 : j < chi2_phi_bins ? j : chi2_phi_bins - 1;
+            return i * chi2_phi_bins + j;
+        }
+        // The integral of p.value() over the bins, the last one being all the rest of the sphere.
+        std::vector<double> integrate(const pdf& p) const;
+
+    private:
+        double bin_integral(const pdf& p, int k, int forced_splits) const;
+        double cell(const pdf& p, double t0, double t1, double p0, double p1, int splits,
+                    int forced_splits) const;
+        double grid(const pdf& p, double t0, double t1, double p0, double p1, int n,
+                    int& zeros) const;
+        vec3 direction(double theta, double phi) const {
+            return frame.local(float(sin(theta)*cos(phi - M_PI)), float(sin(theta)*sin(phi - M_PI)),
+                               float(cos(theta)));
+        }
+
+        onb frame;
+        float max_theta;
+};
+
+// The midpoint rule on an n x n grid over the cell, with d(omega) = sin(theta) d(theta) d(phi).
+// zeros counts the points where value() is 0.
+double chi2_bins::grid(const pdf& p, double t0, double t1, double p0, double p1, int n,
+                       int& zeros) const {
+    double dt = (t1 - t0) / n, dp = (p1 - p0) / n, sum = 0;
+    zeros = 0;
+    for (int a = 0; a < n; a++) {
+        double theta = t0 + (a + 0.5) * dt;
+        for (int b = 0; b < n; b++) {
+            float v = p.value(direction(theta, p0 + (b + 0.5) * dp));
+            zeros += v > 0 ? 0 : 1;
+            sum += v * sin(theta);
+        }
+    }
+    return sum * dt * dp;
+}
+
+double chi2_bins::cell(const pdf& p, double t0, double t1, double p0, double p1, int splits,
+                       int forced_splits) const {
+    int coarse_zeros, fine_zeros;
+    double coarse = grid(p, t0, t1, p0, p1, 2, coarse_zeros);
+    double fine = grid(p, t0, t1, p0, p1, 4, fine_zeros);
+    double solid_angle = (cos(t0) - cos(t1)) * (p1 - p0);
+    bool settled = fabs(fine - coarse) <= chi2_tolerance * solid_angle
+                && (fine_zeros == 0 || fine_zeros == 16);
+    if (splits >= chi2_max_splits || (settled && splits >= forced_splits))
+        return fine;
+    double tm = 0.5 * (t0 + t1), pm = 0.5 * (p0 + p1);
+    return cell(p, t0, tm, p0, pm, splits + 1, forced_splits)
+         + cell(p, t0, tm, pm, p1, splits + 1, forced_splits)
+         + cell(p, tm, t1, p0, pm, splits + 1, forced_splits)
+         + cell(p, tm, t1, pm, p1, splits + 1, forced_splits);
+}
+
+double chi2_bins::bin_integral(const pdf& p, int k, int forced_splits) const {
+    int i = k / chi2_phi_bins, j = k % chi2_phi_bins;
+    double t0 = double(max_theta) * i / chi2_theta_bins;
+    double t1 = double(max_theta) * (i+1) / chi2_theta_bins;
+    return cell(p, t0, t1, 2*M_PI * j / chi2_phi_bins, 2*M_PI * (j+1) / chi2_phi_bins, 0,
+                forced_splits);
+}
+
+std::vector<double> chi2_bins::integrate(const pdf& p) const {
+    std::vector<double> e(count());
+    std::vector<int> edges;
+    for (int pass = 0; pass < 2; pass++) {
+        // The first pass takes every bin, the second the empty ones next to ones that are not.
+        int jobs = pass == 0 ? count() - 1 : int(edges.size());
+        std::atomic<int> next(0);
+        auto work = [&]() {
+            for (int job = next++; job < jobs; job = next++) {
+                int k = pass == 0 ? job : edges[job];
+                e[k] = bin_integral(p, k, pass == 0 ? 0 : chi2_edge_splits);
+            }
+        };
+        std::vector<std::thread> workers;
+        for (int t = 1; t < default_thread_count(); t++)
+            workers.push_back(std::thread(work));
+        work();
+        for (size_t t = 0; t < workers.size(); t++)
+            workers[t].join();
+        for (int k = 0; pass == 0 && k < count() - 1; k++) {
+            int i = k / chi2_phi_bins, j = k % chi2_phi_bins;
+            bool edge = false;
+            for (int di = -1; di <= 1 && e[k] <= 0; di++) {
+                for (int dj = -1; dj <= 1; dj++) {
+                    int ni = i + di, nj = (j + dj + chi2_phi_bins) % chi2_phi_bins;
+                    if (ni >= 0 && ni < chi2_theta_bins && e[ni * chi2_phi_bins + nj] > 0)
+                        edge = true;
+                }
+            }
+            if (edge)
+                edges.push_back(k);
+        }
+    }
+    // Beyond theta_max, in bands of theta.
+    double rest = 0;
+    if (max_theta < M_PI) {
+        for (int i = 0; i < chi2_theta_bins; i++) {
+            double t0 = max_theta + (M_PI - max_theta) * i / chi2_theta_bins;
+            double t1 = max_theta + (M_PI - max_theta) * (i+1) / chi2_theta_bins;
+            for (int j = 0; j < chi2_phi_bins; j++)
+                rest += cell(p, t0, t1, 2*M_PI * j / chi2_phi_bins,
+                             2*M_PI * (j+1) / chi2_phi_bins, chi2_max_splits - 2, 0);
+        }
+    }
+    e[count() - 1] = rest;
+    return e;
+}
+
+// Runs one test on n samples, and prints and returns whether it passed at the given significance.
+bool run_chi2_test(const chi2_test& test, long long n, double significance) {
+    chi2_bins bins(test.axis, test.theta_max);
+    std::vector<double> integral = bins.integrate(*test.p);
+    std::vector<std::atomic<long long> > observed(bins.count());
+    for (size_t k = 0; k < observed.size(); k++)
+        observed[k].store(0, std::memory_order_relaxed);
+    std::atomic<long long> outside(0);
+    estimator_for_chunks(n, [&](long long, long long begin, long long end) {
+        std::vector<long long> local(bins.count(), 0);
+        long long local_outside = 0;
+        for (long long i = begin; i < end; i++) {
+            vec3 d = test.p->generate();
+            local[bins.bin(d)]++;
+            if (!(test.p->value(d) > 0))
+                local_outside++;
+        }
+        for (size_t k = 0; k < local.size(); k++)
+            if (local[k])
+                observed[k].fetch_add(local[k], std::memory_order_relaxed);
+        outside.fetch_add(local_outside, std::memory_order_relaxed);
+    });
+
+    // No direction may come out where value() says there is no density.
+    if (outside.load() > 0) {
+        std::cout << test.name << ": FAILED, " << outside.load()
+                  << " samples where value() is 0\n";
+        return false;
+    }
+    // Smallest expectations first, pooled until each pool expects enough. Bins the cubature
+    // found nothing in go into the first pool with the rest.
+    double total = 0;
+    std::vector<int> order;
+    for (int k = 0; k < bins.count(); k++) {
+        total += integral[k];
+        order.push_back(k);
+    }
+    std::sort(order.begin(), order.end(), [&](int a, int b) { return integral[a] < integral[b]; });
+    double chi2 = 0, pool_expected = 0, pool_observed = 0;
+    int dof = -1;
+    for (size_t k = 0; k < order.size(); k++) {
+        pool_expected += integral[order[k]] * n;
+        pool_observed += double(observed[order[k]].load());
+        if (pool_expected >= chi2_min_expected || k + 1 == order.size()) {
+            double d = pool_observed - pool_expected;
+            chi2 += d * d / pool_expected;
+            dof++;
+            pool_expected = pool_observed = 0;
+        }
+    }
+    double p_value = dof > 0 ? gamma_q(0.5 * dof, 0.5 * chi2) : 1;
+    bool ok = p_value >= significance;
+    std::cout << test.name << ": " << (ok ? "ok" : "FAILED") << ", chi2 " << chi2 << " with "
+              << dof << " degrees of freedom, p = " << p_value << ", value() integrates to "
+              << total << "\n";
+    return ok;
+}
+
+
+int main(int argc, char **argv) {
+    long long n = 2000000;
+    const char *filter = 0;
+    for (int a = 1; a < argc; a++) {
+        if (!strcmp(argv[a], "-n") && a+1 < argc)
+            n = atoll(argv[++a]);
+        else if (!strcmp(argv[a], "-filter") && a+1 < argc)
+            filter = argv[++a];
+        else {
+            std::cerr << "usage: " << argv[0] << " [-n samples] [-filter name]\n";
+            return 1;
+        }
+    }
+
+    lambertian white(new constant_texture(vec3(0.73, 0.73, 0.73)));
+    vec3 tilted = unit_vector(vec3(0.3, -0.5, 0.8));
+    cosine_pdf cosine_up(vec3(0, 0, 1)), cosine_tilted(tilted);
+
+    sphere ball(vec3(0, 0, 0), 1, &white);
+    vec3 near(0, 0, 1.5), far(2, 3, -6);
+    hittable_pdf ball_near(&ball, near), ball_far(&ball, far);
+
+    // The Cornell box's light, seen from the middle of the room and from near a corner.
+    xz_rect panel(213, 343, 227, 332, 554, &white);
+    vec3 middle(278, 278, 278), corner(40, 60, 500), light_centre(278, 554, 279.5);
+    hittable_pdf panel_middle(&panel, middle), panel_corner(&panel, corner);
+
+    // The Cornell box's light with a glass ball, as cornell_caustic samples them, with the cosine
+    // lobe of the floor below them.
+    sphere glass_ball(vec3(230, 200, 200), 90, &white);
+    hittable *both[2] = { &panel, &glass_ball };
+    light_set lights(both, 0, 2, 0, 1);
+    vec3 floor_point(300, 0, 250);
+    hittable_pdf lights_floor(&lights, floor_point);
+    cosine_pdf floor_cosine(vec3(0, 1, 0));
+    mixture_pdf floor_mixture(&lights_floor, &floor_cosine);
+
+    // Rect sampling changes how panel pdfs generate and evaluate, so each mode runs its own tests.
+    struct mode_tests {
+        const char *name;
+        rect_sampling_mode mode;
+    } modes[2] = { { "area", rect_sampling_area }, { "solid angle", rect_sampling_solid_angle } };
+
+    std::vector<chi2_test> tests;
+    tests.push_back(chi2_test{ "cosine_pdf up", &cosine_up, vec3(0, 0, 1), float(M_PI) });
+    tests.push_back(chi2_test{ "cosine_pdf tilted", &cosine_tilted, tilted, float(M_PI) });
+    // The ball fills asin(1/1.5) and asin(1/7) of the view from the two points.
+    tests.push_back(chi2_test{ "sphere near", &ball_near, -near, float(asin(1/1.5) * 1.2) });
+    tests.push_back(chi2_test{ "sphere far", &ball_far, -far, float(asin(1/7.0) * 1.2) });
+    size_t fixed_tests = tests.size();
+    for (int m = 0; m < 2; m++) {
+        tests.push_back(chi2_test{ m ? "xz_rect middle, solid angle" : "xz_rect middle, area",
+                                   &panel_middle, light_centre - middle, 0.5f });
+        tests.push_back(chi2_test{ m ? "xz_rect corner, solid angle" : "xz_rect corner, area",
+                                   &panel_corner, light_centre - corner, 0.25f });
+        tests.push_back(chi2_test{ m ? "light_set, solid angle" : "light_set, area",
+                                   &lights_floor, vec3(0, 1, 0), float(M_PI/2) });
+        tests.push_back(chi2_test{ m ? "mixture_pdf, solid angle" : "mixture_pdf, area",
+                                   &floor_mixture, vec3(0, 1, 0), float(M_PI) });
+    }
+
+    std::vector<size_t> selected;
+    for (size_t t = 0; t < tests.size(); t++)
+        if (!filter || strstr(tests[t].name, filter))
+            selected.push_back(t);
+    // Sidak's correction keeps the chance of any false failure at chi2_significance.
+    double significance = 1 - pow(1 - chi2_significance, 1.0 / (selected.size() ? selected.size()
+                                                                                 : 1));
+    bool ok = true;
+    for (size_t s = 0; s < selected.size(); s++) {
+        size_t t = selected[s];
+        if (t >= fixed_tests)
+            rect_sampling = modes[(t - fixed_tests) / 4].mode;
+        ok = run_chi2_test(tests[t], n, significance) && ok;
+    }
+    return ok ? 0 : 1;
+}
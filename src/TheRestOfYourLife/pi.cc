@@ -9,32 +9,29 @@
 // with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
 //==================================================================================================
 
-#include "random.h"
+#include "../common/random.h"
+#include "estimator.h"
 
 #include <iostream>
 #include <math.h>
-#include <stdlib.h>
 
 
 int main() {
-    int inside_circle = 0;
-    int inside_circle_stratified = 0;
-    int sqrt_N = 30000;
-    for (int i = 0; i < sqrt_N; i++) {
-        for (int j = 0; j < sqrt_N; j++) {
-            float x = 2*random_double() - 1;
-            float y = 2*random_double() - 1;
-            if (x*x + y*y < 1)
-                inside_circle++;
-            x = 2*((i + random_double()) / sqrt_N) - 1;
-            y = 2*((j + random_double()) / sqrt_N) - 1;
-            if (x*x + y*y < 1)
-                inside_circle_stratified++;
-        }
-    }
-    std::cout << "Regular    Estimate of Pi = " <<
-          4*float(inside_circle) / (sqrt_N*sqrt_N) << "\n";
-    std::cout << "Stratified Estimate of Pi = " <<
-          4*float(inside_circle_stratified) / (sqrt_N*sqrt_N) << "\n";
+    long long sqrt_N = 30000;
+    long long N = sqrt_N*sqrt_N;
+    estimate regular = estimate_mean(N, [](long long) {
+        float x = 2*random_double() - 1;
+        float y = 2*random_double() - 1;
+        return x*x + y*y < 1 ? 4.0 : 0.0;
+    });
+    // Sample i falls in its own cell of a sqrt_N x sqrt_N grid over the square.
+    estimate stratified = estimate_mean(N, [sqrt_N](long long i) {
+        float x = 2*((i / sqrt_N + random_double()) / sqrt_N) - 1;
+        float y = 2*((i % sqrt_N + random_double()) / sqrt_N) - 1;
+        return x*x + y*y < 1 ? 4.0 : 0.0;
+    });
+    bool ok = report_estimate("Regular    Estimate of Pi", regular, M_PI);
+    // The interval assumes independent samples; stratified ones are closer than it says.
+    ok = report_estimate("Stratified Estimate of Pi", stratified, M_PI) && ok;
+    return ok ? 0 : 1;
 }
-
@@ -0,0 +1,204 @@
+#ifndef RADIANCECACHEH
+#define RADIANCECACHEH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include "../common/aabb.h"
+#include "../common/bvh.h"
+#include "../common/hittable.h"
+#include "../common/random.h"
+#include "../common/roulette.h"
+#include "bdpt.h"
+#include "material.h"
+#include "pdf.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <vector>
+
+
+// Where a photon landed on a Lambertian surface, the surface's normal there, and the power it
+// brought.
+struct cache_photon {
+    vec3 p;
+    vec3 normal;
+    vec3 power;
+};
+
+// The lookup radius is set so that, were the photons spread evenly over the faces of the scene's
+// bounding box, this many would fall within it of any point.
+const float radiance_cache_neighbours = 50;
+
+// A photon map for quick, biased previews. A pre-pass shoots photons from the lights and keeps
+// every one that lands on a Lambertian surface; afterwards the irradiance at any point is the
+// power of the photons within the lookup radius that face about the same way, over the disc they
+// cover. The light leaving a Lambertian surface is then its albedo over pi times that, with no
+// further bounces, so paths that reach the cache stop there.
+//
+// Photons are kept in a hash grid of cells twice the radius across, so a lookup visits at most
+// eight cells. Each photon traces from a random stream keyed on its index, so the map does not
+// depend on the thread count.
+class radiance_cache {
+    public:
+        radiance_cache(hittable *world, const bdpt_lights& lights, const aabb& bounds,
+                       int photons, int max_depth, int roulette_depth, unsigned int seed,
+                       int threads);
+
+        // The irradiance at p on a surface facing normal.
+        vec3 irradiance(const vec3& p, const vec3& normal) const;
+
+        size_t size() const { return stored.size(); }
+
+    private:
+        void trace(hittable *world, const bdpt_lights& lights, int max_depth, int roulette_depth,
+                   vec3 scale, std::vector<cache_photon>& out) const;
+        uint32_t cell_hash(int x, int y, int z) const {
+            return (uint32_t(x) * 73856093u ^ uint32_t(y) * 19349663u ^ uint32_t(z) * 83492791u)
+                   & (uint32_t(cell_start.size()) - 2);
+        }
+
+        std::vector<cache_photon> stored;       // sorted by cell hash
+        std::vector<uint32_t> cell_start;       // a power of two plus one entries
+        vec3 origin;
+        float radius, cell_size;
+};
+
+radiance_cache::radiance_cache(hittable *world, const bdpt_lights& lights, const aabb& bounds,
+                               int photons, int max_depth, int roulette_depth, unsigned int seed,
+                               int threads) {
+    origin = bounds.min();
+    // Each thread traces a contiguous run of photon indices, and the runs are joined in order.
+    if (threads < 1)
+        threads = 1;
+    std::vector<std::vector<cache_photon> > parts(threads);
+    bvh_parallel_for(threads, threads, [&](int begin, int end) {
+        for (int t = begin; t < end; t++) {
+            int first = int((long long)(photons) * t / threads);
+            int last = int((long long)(photons) * (t+1) / threads);
+            for (int k = first; k < last; k++) {
+                // Photons have streams of their own, under a seed the pixels' do not use.
+                random_begin_sample(seed ^ 0x9e3779b9u, uint64_t(k), 0);
+                trace(world, lights, max_depth, roulette_depth, vec3(1, 1, 1) / float(photons),
+                      parts[t]);
+            }
+        }
+    });
+    std::vector<cache_photon> all;
+    for (int t = 0; t < threads; t++)
+        all.insert(all.end(), parts[t].begin(), parts[t].end());
+
+    vec3 e = bounds.max() - bounds.min();
+    float faces = 2 * (e[0]*e[1] + e[1]*e[2] + e[2]*e[0]);
+    radius = sqrtf(radiance_cache_neighbours * faces / float(M_PI * (all.size() + 1)));
+    cell_size = 2 * radius;
+
+    // A counting sort by cell hash, with about two slots per photon.
+    uint32_t slots = 2;
+    while (slots < 2 * all.size() && slots < (1u << 30))
+        slots *= 2;
+    cell_start.assign(slots + 1, 0);
+    std::vector<uint32_t> hash(all.size());
+    for (size_t k = 0; k < all.size(); k++) {
+        vec3 c = (all[k].p - origin) / cell_size;
+        hash[k] = cell_hash(int(floorf(c[0])), int(floorf(c[1])), int(floorf(c[2])));
+        cell_start[hash[k] + 1]++;
+    }
+    for (uint32_t s = 0; s < slots; s++)
+        cell_start[s + 1] += cell_start[s];
+    stored.resize(all.size());
+    std::vector<uint32_t> next(cell_start.begin(), cell_start.end() - 1);
+    for (size_t k = 0; k < all.size(); k++)
+        stored[next[hash[k]]++] = all[k];
+}
+
+void radiance_cache::trace(hittable *world, const bdpt_lights& lights, int max_depth,
+                           int roulette_depth, vec3 scale, std::vector<cache_photon>& out) const {
+    float chance;
+    const hittable *light = lights.pick(random_double(), chance);
+    hit_record lrec;
+    float area;
+    if (!(chance > 0) || !light->sample_surface(lrec, area))
+        return;
+    cosine_pdf emission(lrec.normal);
+    vec3 d = unit_vector(emission.generate());
+    if (!(dot(lrec.normal, d) > 0))
+        return;
+    // Power over the photon count: radiance times pi times area, over the chance of the light.
+    vec3 power = material_emitted(lrec.mat_ptr, ray(lrec.p + d, -d), lrec)
+               * scale * float(M_PI * area / chance);
+    ray r = spawn_ray(lrec, d);
+    for (int depth = 0; depth < max_depth; depth++) {
+        random_begin_bounce(depth + 1);
+        hit_record hrec;
+        if (!world->hit(r, 0, MAXFLOAT, hrec))
+            return;
+        scatter_record srec;
+        if (!material_scatter(hrec.mat_ptr, r, hrec, srec))
+            return;
+        vec3 wi;
+        if (srec.is_specular) {
+            wi = srec.specular_ray.direction();
+            power *= srec.attenuation;
+        }
+        else {
+            if (hrec.mat_ptr->kind != material_lambertian)
+                return;
+            cache_photon photon = { hrec.p, hrec.normal, power };
+            out.push_back(photon);
+            // Cosine-distributed bounces carry the albedo alone.
+            wi = srec.pdf_ptr->generate();
+            power *= srec.attenuation;
+        }
+        float q = roulette_survival(depth, roulette_depth, power[0], power[1], power[2]);
+        if (q < 1) {
+            if (random_double() >= q)
+                return;
+            power /= q;
+        }
+        r = spawn_ray(hrec, wi, r.time());
+    }
+}
+
+vec3 radiance_cache::irradiance(const vec3& p, const vec3& normal) const {
+    vec3 sum(0, 0, 0);
+    if (stored.empty())
+        return sum;
+    vec3 lo = (p - origin - vec3(radius, radius, radius)) / cell_size;
+    vec3 hi = (p - origin + vec3(radius, radius, radius)) / cell_size;
+    int x0 = int(floorf(lo[0])), y0 = int(floorf(lo[1])), z0 = int(floorf(lo[2]));
+    int x1 = int(floorf(hi[0])), y1 = int(floorf(hi[1])), z1 = int(floorf(hi[2]));
+    float radius_squared = radius * radius;
+    // Cells that hash alike are visited once each.
+    uint32_t seen[8];
+    int nseen = 0;
+    for (int z = z0; z <= z1; z++) {
+        for (int y = y0; y <= y1; y++) {
+            for (int x = x0; x <= x1; x++) {
+                uint32_t h = cell_hash(x, y, z);
+                bool again = false;
+                for (int s = 0; s < nseen; s++)
+                    again = again || seen[s] == h;
+                if (again)
+                    continue;
+                seen[nseen++] = h;
+                for (uint32_t k = cell_start[h]; k < cell_start[h + 1]; k++) {
+                    const cache_photon& photon = stored[k];
+                    if ((photon.p - p).squared_length() <= radius_squared
+                            && dot(photon.normal, normal) > 0.5f)
+                        sum += photon.power;
+                }
+            }
+        }
+    }
+    return sum / float(M_PI * radius_squared);
+}
+
+#endif
@@ -0,0 +1,320 @@
+#ifndef SPECTRALH
+#define SPECTRALH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include "../common/hittable.h"
+#include "../common/random.h"
+#include "../common/render_stats.h"
+#include "../common/roulette.h"
+#include "environment.h"
+#include "material.h"
+#include "pdf.h"
+
+#include <float.h>
+#include <math.h>
+
+
+// Spectral paths carry four wavelengths at once, in the range the eye sees.
+const int spectral_lanes = 4;
+const float spectral_min = 380;
+const float spectral_max = 780;
+
+// Values at a path's four wavelengths. Under RT_SIMD_VEC3 they share one vector register, like a
+// vec3 with its fourth lane in use, and each operation is one instruction.
+#if defined(VEC3_SSE) || defined(VEC3_NEON)
+#define SPECTRUM4_LANES
+#endif
+
+class spectrum4 {
+    public:
+        spectrum4() {}
+        explicit spectrum4(float t) {
+#ifdef SPECTRUM4_LANES
+            m = vec3_splat(t);
+#else
+            for (int k = 0; k < spectral_lanes; k++)
+                e[k] = t;
+#endif
+        }
+        float operator[](int k) const { return e[k]; }
+        float& operator[](int k) { return e[k]; }
+
+        inline spectrum4& operator+=(const spectrum4& s);
+        inline spectrum4& operator*=(const spectrum4& s);
+        inline spectrum4& operator*=(float t) { return *this *= spectrum4(t); }
+
+        float sum() const { return (e[0] + e[1]) + (e[2] + e[3]); }
+        float max() const {
+            float a = e[0] > e[1] ? e[0] : e[1], b = e[2] > e[3] ? e[2] : e[3];
+            return a > b ? a : b;
+        }
+
+#ifdef SPECTRUM4_LANES
+        union {
+            float e[4];
+            vec3_lanes m;
+        };
+#else
+        float e[4];
+#endif
+};
+
+inline spectrum4 operator+(const spectrum4& a, const spectrum4& b) {
+    spectrum4 r;
+#ifdef SPECTRUM4_LANES
+    r.m = vec3_add(a.m, b.m);
+#else
+    for (int k = 0; k < spectral_lanes; k++)
+        r.e[k] = a.e[k] + b.e[k];
+#endif
+    return r;
+}
+
+inline spectrum4 operator*(const spectrum4& a, const spectrum4& b) {
+    spectrum4 r;
+#ifdef SPECTRUM4_LANES
+    r.m = vec3_mul(a.m, b.m);
+#else
+    for (int k = 0; k < spectral_lanes; k++)
+        r.e[k] = a.e[k] * b.e[k];
+#endif
+    return r;
+}
+
+inline spectrum4 operator*(const spectrum4& a, float t) { return a * spectrum4(t); }
+inline spectrum4 operator*(float t, const spectrum4& a) { return a * spectrum4(t); }
+
+inline spectrum4& spectrum4::operator+=(const spectrum4& s) { return *this = *this + s; }
+inline spectrum4& spectrum4::operator*=(const spectrum4& s) { return *this = *this * s; }
+
+
+// The CIE 1931 colour matching functions at a wavelength in nanometres, from the multi-lobe
+// Gaussian fit of Wyman, Sloan and Shirley, "Simple Analytic Approximations to the CIE XYZ Color
+// Matching Functions".
+inline float cie_lobe(float l, float mu, float below, float above) {
+    float t = (l - mu) / (l < mu ? below : above);
+    return expf(-0.5f * t*t);
+}
+
+inline vec3 cie_xyz(float l) {
+    float x = 1.056f*cie_lobe(l, 599.8f, 37.9f, 31.0f) + 0.362f*cie_lobe(l, 442.0f, 16.0f, 26.7f)
+            - 0.065f*cie_lobe(l, 501.1f, 20.4f, 26.2f);
+    float y = 0.821f*cie_lobe(l, 568.8f, 46.9f, 40.5f) + 0.286f*cie_lobe(l, 530.9f, 16.3f, 31.1f);
+    float z = 1.217f*cie_lobe(l, 437.0f, 11.8f, 36.0f) + 0.681f*cie_lobe(l, 459.0f, 26.0f, 13.8f);
+    return vec3(x, y, z);
+}
+
+// RGB colours become spectra as mixtures of three smooth bands, blue below about 490nm, green up
+// to about 580nm and red above, which add up to 1 at every wavelength, so white is flat. The
+// weights are picked so that the spectrum comes back to the colour it was made from, and clamped
+// to what a surface can reflect, which only very saturated colours reach.
+inline float spectral_band(int band, float l) {
+    float t1 = (l - 475) / 30, t2 = (l - 565) / 30;
+    t1 = t1 < 0 ? 0 : t1 > 1 ? 1 : t1;
+    t2 = t2 < 0 ? 0 : t2 > 1 ? 1 : t2;
+    t1 = t1*t1*(3 - 2*t1);
+    t2 = t2*t2*(3 - 2*t2);
+    return band == 0 ? t2 : band == 1 ? t1 - t2 : 1 - t1;
+}
+
+// What linear sRGB channel c takes from light at wavelength l, scaled so that a flat spectrum of
+// 1 comes out as (1, 1, 1), and the 3x3 matrix that takes a colour to the weights of its bands.
+struct spectral_tables {
+    spectral_tables();
+    vec3 rgb_weight(float l) const {
+        vec3 xyz = cie_xyz(l);
+        vec3 rgb( 3.2404542f*xyz[0] - 1.5371385f*xyz[1] - 0.4985314f*xyz[2],
+                 -0.9692660f*xyz[0] + 1.8760108f*xyz[1] + 0.0415560f*xyz[2],
+                  0.0556434f*xyz[0] - 0.2040259f*xyz[1] + 1.0572252f*xyz[2]);
+        return rgb * channel_scale;
+    }
+
+    vec3 channel_scale;
+    float to_bands[3][3];
+};
+
+spectral_tables::spectral_tables() {
+    channel_scale = vec3(1, 1, 1);
+    vec3 total(0, 0, 0);
+    for (float l = spectral_min + 0.5f; l < spectral_max; l += 1)
+        total += rgb_weight(l);
+    channel_scale = vec3(1, 1, 1) / total;
+    // The colour each band comes out as, and its inverse.
+    double q[3][3] = { { 0 } };
+    for (float l = spectral_min + 0.5f; l < spectral_max; l += 1) {
+        vec3 w = rgb_weight(l);
+        for (int c = 0; c < 3; c++)
+            for (int b = 0; b < 3; b++)
+                q[c][b] += w[c] * spectral_band(b, l);
+    }
+    double det = q[0][0]*(q[1][1]*q[2][2] - q[1][2]*q[2][1])
+               - q[0][1]*(q[1][0]*q[2][2] - q[1][2]*q[2][0])
+               + q[0][2]*(q[1][0]*q[2][1] - q[1][1]*q[2][0]);
+    for (int r = 0; r < 3; r++) {
+        for (int c = 0; c < 3; c++) {
+            int r1 = (c+1) % 3, r2 = (c+2) % 3, c1 = (r+1) % 3, c2 = (r+2) % 3;
+            to_bands[r][c] = float((q[r1][c1]*q[r2][c2] - q[r1][c2]*q[r2][c1]) / det);
+        }
+    }
+}
+
+inline const spectral_tables& spectral_table() {
+    static const spectral_tables tables;
+    return tables;
+}
+
+
+// A path's wavelengths: a hero wavelength picked uniformly and three more spaced evenly after it
+// around the range, after Wilkie et al., "Hero Wavelength Spectral Sampling". All four follow the
+// hero's path; where a dispersive surface splits them, terminate_secondary() keeps the hero alone.
+class wavelengths {
+    public:
+        wavelengths(float u);
+
+        // The spectrum of an RGB reflectance, and of an RGB emission, at these wavelengths.
+        spectrum4 reflectance(const vec3& rgb) const { return from_rgb(rgb, 1); }
+        spectrum4 emission(const vec3& rgb) const { return from_rgb(rgb, FLT_MAX); }
+        // The colour of the radiance estimate l.
+        vec3 to_rgb(const spectrum4& l) const {
+            return vec3((l * weight[0]).sum(), (l * weight[1]).sum(), (l * weight[2]).sum());
+        }
+        // Drops the three wavelengths that follow the hero, scaling throughput to make up for
+        // them, so that it is still an unbiased estimate.
+        void terminate_secondary(spectrum4& throughput) {
+            if (single)
+                return;
+            single = true;
+            throughput[0] *= spectral_lanes;
+            for (int k = 1; k < spectral_lanes; k++)
+                throughput[k] = 0;
+        }
+
+        float lambda[4];
+        bool single;
+
+    private:
+        spectrum4 from_rgb(const vec3& rgb, float most) const;
+
+        spectrum4 band[3];
+        spectrum4 weight[3];
+};
+
+wavelengths::wavelengths(float u) : single(false) {
+    const spectral_tables& tables = spectral_table();
+    float range = spectral_max - spectral_min;
+    for (int k = 0; k < spectral_lanes; k++) {
+        float f = u + float(k) / spectral_lanes;
+        lambda[k] = spectral_min + range * (f < 1 ? f : f - 1);
+        vec3 w = tables.rgb_weight(lambda[k]) * (range / spectral_lanes);
+        for (int b = 0; b < 3; b++) {
+            band[b][k] = spectral_band(b, lambda[k]);
+            weight[b][k] = w[b];
+        }
+    }
+}
+
+spectrum4 wavelengths::from_rgb(const vec3& rgb, float most) const {
+    const spectral_tables& tables = spectral_table();
+    spectrum4 s(0);
+    for (int b = 0; b < 3; b++) {
+        float x = tables.to_bands[b][0]*rgb[0] + tables.to_bands[b][1]*rgb[1]
+                + tables.to_bands[b][2]*rgb[2];
+        x = x < 0 ? 0 : x > most ? most : x;
+        s += band[b] * x;
+    }
+    return s;
+}
+
+
+// A path tracer that carries four wavelengths per path instead of red, green and blue. It makes
+// the same choices as color(), sampling the lights and the material by the same heuristic with
+// the same random streams, but dielectrics with dispersion bend each wavelength their own way.
+// Textures and emitters stay RGB and are turned into spectra where a path meets them.
+class spectral_integrator {
+    public:
+        spectral_integrator(hittable *w, hittable *l, int max_depth = 50,
+                            mis_heuristic h = mis_balance, int min_roulette_depth = 3,
+                            environment_light *env = 0)
+            : world(w), light_shape(l), depth_limit(max_depth), heuristic(h),
+              roulette_depth(min_roulette_depth), environment(env) {}
+
+        // The colour r brings back, at wavelengths picked with u.
+        vec3 trace(const ray& r, float u) const;
+
+    private:
+        hittable *world;
+        hittable *light_shape;
+        int depth_limit;
+        mis_heuristic heuristic;
+        int roulette_depth;
+        environment_light *environment;
+};
+
+vec3 spectral_integrator::trace(const ray& camera_ray, float u) const {
+    wavelengths lambda(u);
+    spectrum4 throughput(1), radiance(0);
+    ray r = camera_ray;
+    for (int depth = 0; ; depth++) {
+        random_begin_bounce(depth+1);
+        RT_COUNT(rays, 1);
+        RT_COUNT_DEPTH(depth, 1);
+        hit_record hrec;
+        if (!world->hit(r, 0, FLT_MAX, hrec)) {
+            if (environment)
+                radiance += throughput * lambda.emission(environment->radiance(r.direction()));
+            break;
+        }
+        scatter_record srec;
+        vec3 emitted = material_emitted(hrec.mat_ptr, r, hrec);
+        if (emitted[0] != 0 || emitted[1] != 0 || emitted[2] != 0)
+            radiance += throughput * lambda.emission(emitted);
+        if (depth >= depth_limit)
+            break;
+        bool scattered_ok;
+        const dielectric *glass = hrec.mat_ptr->kind == material_dielectric
+                                ? static_cast<const dielectric*>(hrec.mat_ptr) : 0;
+        if (glass && glass->dispersion != 0) {
+            lambda.terminate_secondary(throughput);
+            float index = glass->index_at(lambda.lambda[0]);
+            scattered_ok = glass->scatter_with_index(r, hrec, srec, index);
+        }
+        else
+            scattered_ok = material_scatter(hrec.mat_ptr, r, hrec, srec);
+        if (!scattered_ok)
+            break;
+        if (srec.is_specular) {
+            throughput *= lambda.reflectance(srec.attenuation);
+            r = srec.specular_ray;
+        }
+        else {
+            pdf_slot light_slot;
+            pdf *plight = light_slot.set(hittable_pdf(light_shape, hrec.p));
+            mixture_pdf p(plight, srec.pdf_ptr, hrec.mat_ptr->light_fraction, heuristic);
+            int strategy;
+            ray scattered = spawn_ray(hrec, p.generate(strategy), r.time());
+            float pdf_val = p.value(scattered.direction(), strategy);
+            float scattering_pdf = material_scattering_pdf(hrec.mat_ptr, r, hrec, scattered);
+            throughput *= lambda.reflectance(srec.attenuation) * (scattering_pdf / pdf_val);
+            r = scattered;
+        }
+        float m = throughput.max();
+        float q = roulette_survival(depth, roulette_depth, m, m, m);
+        if (q < 1) {
+            if (random_double() >= q)
+                break;
+            throughput *= 1 / q;
+        }
+    }
+    return lambda.to_rgb(radiance);
+}
+
+#endif
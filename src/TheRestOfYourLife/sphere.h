@@ -11,7 +11,7 @@
 // with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
 //==================================================================================================
 
-#include "hittable.h"
+#include "../common/hittable.h"
 #include "onb.h"
 #include "pdf.h"
 
@@ -22,16 +22,21 @@ class sphere: public hittable  {
         sphere(vec3 cen, float r, material *m) : center(cen), radius(r), mat_ptr(m)  {};
         virtual bool hit(const ray& r, float tmin, float tmax, hit_record& rec) const;
         virtual bool bounding_box(float t0, float t1, aabb& box) const;
+        virtual bool hit_interval(const ray& r, float& t_enter, float& t_exit) const;
+        virtual bool occluded(const ray& r, float t_min, float t_max) const;
+        virtual bool intersect(const ray& r, float t_min, float t_max, hit_record& rec) const;
+        virtual void finalize(const ray& r, hit_record& rec) const;
         virtual float  pdf_value(const vec3& o, const vec3& v) const;
         virtual vec3 random(const vec3& o) const;
+        virtual int hit_packet(const ray_packet& p, int active, float t_min, float *t_max,
+                               hit_record *rec) const;
         vec3 center;
         float radius;
         material *mat_ptr;
 };
 
 float sphere::pdf_value(const vec3& o, const vec3& v) const {
-    hit_record rec;
-    if (this->hit(ray(o, v), 0.001, FLT_MAX, rec)) {
+    if (occluded(ray(o, v), 0.001, FLT_MAX)) {
         float cos_theta_max = sqrt(1 - radius*radius/(center-o).squared_length());
         float solid_angle = 2*M_PI*(1-cos_theta_max);
         return  1 / solid_angle;
@@ -54,7 +59,37 @@ bool sphere::bounding_box(float t0, float t1, aabb& box) const {
     return true;
 }
 
-bool sphere::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+// Both roots at once, computed as hit() computes them.
+bool sphere::hit_interval(const ray& r, float& t_enter, float& t_exit) const {
+    vec3 oc = r.origin() - center;
+    float a = dot(r.direction(), r.direction());
+    float b = dot(oc, r.direction());
+    float c = dot(oc, oc) - radius*radius;
+    float discriminant = b*b - a*c;
+    if (discriminant <= 0)
+        return false;
+    t_enter = (-b - sqrt(b*b-a*c))/a;
+    t_exit = (-b + sqrt(b*b-a*c))/a;
+    return t_exit > t_enter;
+}
+
+// The roots as hit() finds them, without the point, normal and uv.
+bool sphere::occluded(const ray& r, float t_min, float t_max) const {
+    vec3 oc = r.origin() - center;
+    float a = dot(r.direction(), r.direction());
+    float b = dot(oc, r.direction());
+    float c = dot(oc, oc) - radius*radius;
+    float discriminant = b*b - a*c;
+    if (discriminant <= 0)
+        return false;
+    float temp = (-b - sqrt(b*b-a*c))/a;
+    if (temp < t_max && temp > t_min)
+        return true;
+    temp = (-b + sqrt(b*b-a*c))/a;
+    return temp < t_max && temp > t_min;
+}
+
+bool sphere::intersect(const ray& r, float t_min, float t_max, hit_record& rec) const {
     vec3 oc = r.origin() - center;
     float a = dot(r.direction(), r.direction());
     float b = dot(oc, r.direction());
@@ -64,25 +99,73 @@ bool sphere::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
         float temp = (-b - sqrt(b*b-a*c))/a;
         if (temp < t_max && temp > t_min) {
             rec.t = temp;
-            rec.p = r.point_at_parameter(rec.t);
-            get_sphere_uv((rec.p-center)/radius, rec.u, rec.v);
-            rec.normal = (rec.p - center) / radius;
-            rec.mat_ptr = mat_ptr;
+            rec.prim = this;
             return true;
         }
         temp = (-b + sqrt(b*b-a*c))/a;
         if (temp < t_max && temp > t_min) {
             rec.t = temp;
-            rec.p = r.point_at_parameter(rec.t);
-            get_sphere_uv((rec.p-center)/radius, rec.u, rec.v);
-            rec.normal = (rec.p - center) / radius;
-            rec.mat_ptr = mat_ptr;
+            rec.prim = this;
             return true;
         }
     }
     return false;
 }
 
+void sphere::finalize(const ray& r, hit_record& rec) const {
+    rec.p = r.point_at_parameter(rec.t);
+    rec.p_error = reproject_to_sphere(rec.p, center, radius);
+    get_sphere_uv((rec.p-center)/radius, rec.u, rec.v);
+    rec.normal = (rec.p - center) / radius;
+    rec.mat_ptr = mat_ptr;
+}
+
+bool sphere::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+    if (!intersect(r, t_min, t_max, rec))
+        return false;
+    finalize(r, rec);
+    return true;
+}
+
+int sphere::hit_packet(const ray_packet& p, int active, float t_min, float *t_max,
+                       hit_record *rec) const {
+    // The root is found for every ray with the same branch-free arithmetic, so the compiler can
+    // run it across the packet in SIMD lanes; only the rays that hit go on to fill in a record.
+    float root[ray_packet_size];
+    int valid[ray_packet_size];
+    for (int k = 0; k < ray_packet_size; k++) {
+        float ocx = p.origin[0][k] - center[0];
+        float ocy = p.origin[1][k] - center[1];
+        float ocz = p.origin[2][k] - center[2];
+        float dx = p.direction[0][k], dy = p.direction[1][k], dz = p.direction[2][k];
+        float a = dx*dx + dy*dy + dz*dz;
+        float b = ocx*dx + ocy*dy + ocz*dz;
+        float c = ocx*ocx + ocy*ocy + ocz*ocz - radius*radius;
+        float discriminant = b*b - a*c;
+        float s = sqrtf(discriminant > 0 ? discriminant : 0);
+        float near_t = (-b - s)/a;
+        float far_t = (-b + s)/a;
+        int near_ok = near_t < t_max[k] && near_t > t_min;
+        int far_ok = far_t < t_max[k] && far_t > t_min;
+        root[k] = near_ok ? near_t : far_t;
+        valid[k] = (discriminant > 0) & (near_ok | far_ok);
+    }
+    int hits = 0;
+    for (int k = 0; k < p.count; k++) {
+        if (!(active & (1 << k)) || !valid[k])
+            continue;
+        hit_record& h = rec[k];
+        h.t = root[k];
+        h.p = p.get(k).point_at_parameter(h.t);
+        h.p_error = reproject_to_sphere(h.p, center, radius);
+        get_sphere_uv((h.p-center)/radius, h.u, h.v);
+        h.normal = (h.p - center) / radius;
+        h.mat_ptr = mat_ptr;
+        t_max[k] = h.t;
+        hits |= 1 << k;
+    }
+    return hits;
+}
 
 #endif
 
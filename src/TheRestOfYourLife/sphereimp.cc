@@ -9,12 +9,11 @@
 // with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
 //==================================================================================================
 
-#include "random.h"
-#include "vec3.h"
+#include "../common/random.h"
+#include "estimator.h"
 
 #include <iostream>
 #include <math.h>
-#include <stdlib.h>
 
 
 vec3 random_on_unit_sphere() {
@@ -32,13 +31,12 @@ inline float pdf(const vec3& p) {
 }
 
 int main() {
-    int N = 1000000;
-    float sum;
-    for (int i = 0; i < N; i++) {
-            vec3 d = random_on_unit_sphere();
-            float cosine_squared = d.z()*d.z();
-            sum += cosine_squared / pdf(d);
-    }
-    std::cout << "I =" << sum/N << "\n";
+    long long N = 100000000;
+    // The integral of cos^2 over the sphere, from directions uniform over it.
+    estimate I = estimate_mean(N, [](long long) {
+        vec3 d = random_on_unit_sphere();
+        float cosine_squared = d.z()*d.z();
+        return cosine_squared / pdf(d);
+    });
+    return report_estimate("I", I, 4*M_PI/3) ? 0 : 1;
 }
-
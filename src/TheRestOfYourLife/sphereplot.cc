@@ -9,7 +9,7 @@
 // with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
 //==================================================================================================
 
-#include "random.h"
+#include "../common/random.h"
 
 #include <iostream>
 #include <math.h>
@@ -11,52 +11,161 @@
 // with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
 //==================================================================================================
 
-#include "perlin.h"
+#include "../common/fast_math.h"
+#include "../common/perlin.h"
+#include "../common/texture_base.h"
 
 
-class texture  {
-    public:
-        virtual vec3 value(float u, float v, const vec3& p) const = 0;
-};
+// The built-in textures are closed to extension and tagged with their kind. texture_value()
+// switches on the tag and calls them directly, where the compiler can inline them, and only
+// other textures pay for the virtual call. Building with RT_VIRTUAL_DISPATCH defined sends every
+// call through the virtual interface instead, to compare the two.
+
+// Batched lookups work through their points this many at a time, with scratch arrays on the stack.
+const int texture_batch = 64;
+
+inline vec3 texture_value(const texture *t, float u, float v, const vec3& p);
+inline void texture_value_batch(const texture *t, const float *u, const float *v, const vec3 *p,
+                                vec3 *out, int n);
 
-class constant_texture : public texture {
+class constant_texture final : public texture {
     public:
-        constant_texture() { }
-        constant_texture(vec3 c) : color(c) { }
+        constant_texture() { kind = texture_constant; }
+        constant_texture(vec3 c) : color(c) { kind = texture_constant; }
         virtual vec3 value(float u, float v, const vec3& p) const {
             return color;
         }
+        virtual void value_batch(const float *u, const float *v, const vec3 *p, vec3 *out,
+                                 int n) const {
+            for (int k = 0; k < n; k++)
+                out[k] = color;
+        }
         vec3 color;
 };
 
-class checker_texture : public texture {
+class checker_texture final : public texture {
     public:
-        checker_texture() { }
-        checker_texture(texture *t0, texture *t1): even(t0), odd(t1) { }
+        checker_texture() { kind = texture_checker; }
+        checker_texture(texture *t0, texture *t1): even(t0), odd(t1) { kind = texture_checker; }
         virtual vec3 value(float u, float v, const vec3& p) const {
-            float sines = sin(10*p.x())*sin(10*p.y())*sin(10*p.z());
+            float sines = rt_sin(10*p.x())*rt_sin(10*p.y())*rt_sin(10*p.z());
             if (sines < 0)
-                return odd->value(u, v, p);
+                return texture_value(odd, u, v, p);
             else
-                return even->value(u, v, p);
+                return texture_value(even, u, v, p);
         }
+        virtual void value_batch(const float *u, const float *v, const vec3 *p, vec3 *out,
+                                 int n) const;
         texture *odd;
         texture *even;
 };
 
 
-class noise_texture : public texture {
+class noise_texture final : public texture {
     public:
-        noise_texture() {}
-        noise_texture(float sc) : scale(sc) {}
+        noise_texture() { kind = texture_noise; }
+        noise_texture(float sc) : scale(sc) { kind = texture_noise; }
         virtual vec3 value(float u, float v, const vec3& p) const {
 //            return vec3(1,1,1)*0.5*(1 + noise.turb(scale * p));
 //            return vec3(1,1,1)*noise.turb(scale * p);
-              return vec3(1,1,1)*0.5*(1 + sin(scale*p.x() + 5*noise.turb(scale*p))) ;
+              return vec3(1,1,1)*0.5*(1 + rt_sin(scale*p.x() + 5*turb(scale*p))) ;
+        }
+        virtual void value_batch(const float *u, const float *v, const vec3 *p, vec3 *out,
+                                 int n) const;
+        // Bakes the turbulence over a world-space box, for a texture whose objects stay inside it.
+        // Points outside the box are still evaluated in full.
+        void bake(const vec3& lo, const vec3& hi, int n) {
+            vec3 a = scale*lo, b = scale*hi;
+            baked.bake(noise, vec3(fminf(a[0], b[0]), fminf(a[1], b[1]), fminf(a[2], b[2])),
+                       vec3(fmaxf(a[0], b[0]), fmaxf(a[1], b[1]), fmaxf(a[2], b[2])), n);
+        }
+        float turb(const vec3& p) const {
+            float t;
+            return baked.lookup(p, t) ? t : noise.turb(p);
         }
         perlin noise;
+        perlin_volume baked;
         float scale;
 };
 
+void checker_texture::value_batch(const float *u, const float *v, const vec3 *p, vec3 *out,
+                                  int n) const {
+    for (int b = 0; b < n; b += texture_batch) {
+        int m = n - b < texture_batch ? n - b : texture_batch;
+        float sines[texture_batch];
+        for (int k = 0; k < m; k++)
+            sines[k] = rt_sin(10*p[b+k].x())*rt_sin(10*p[b+k].y())*rt_sin(10*p[b+k].z());
+        // Points whose side is a constant take its colour straight away; the rest are gathered
+        // into one batch per side and handed to that side's texture.
+        for (int side = 0; side < 2; side++) {
+            const texture *t = side ? odd : even;
+            if (t->kind == texture_constant) {
+                vec3 c = static_cast<const constant_texture*>(t)->color;
+                for (int k = 0; k < m; k++)
+                    out[b+k] = (sines[k] < 0) == (side == 1) ? c : out[b+k];
+                continue;
+            }
+            int index[texture_batch], count = 0;
+            float su[texture_batch], sv[texture_batch];
+            vec3 sp[texture_batch], so[texture_batch];
+            for (int k = 0; k < m; k++) {
+                if ((sines[k] < 0) == (side == 1)) {
+                    index[count] = b+k;
+                    su[count] = u[b+k];
+                    sv[count] = v[b+k];
+                    sp[count++] = p[b+k];
+                }
+            }
+            texture_value_batch(t, su, sv, sp, so, count);
+            for (int k = 0; k < count; k++)
+                out[index[k]] = so[k];
+        }
+    }
+}
+
+void noise_texture::value_batch(const float *u, const float *v, const vec3 *p, vec3 *out,
+                                int n) const {
+    // turb already runs its octaves side by side; the sines are then taken together.
+    for (int b = 0; b < n; b += texture_batch) {
+        int m = n - b < texture_batch ? n - b : texture_batch;
+        float t[texture_batch];
+        for (int k = 0; k < m; k++)
+            t[k] = turb(scale*p[b+k]);
+        for (int k = 0; k < m; k++)
+            out[b+k] = vec3(1,1,1)*0.5*(1 + rt_sin(scale*p[b+k].x() + 5*t[k]));
+    }
+}
+
+inline void texture_value_batch(const texture *t, const float *u, const float *v, const vec3 *p,
+                                vec3 *out, int n) {
+#ifndef RT_VIRTUAL_DISPATCH
+    switch (t->kind) {
+        case texture_constant:
+            static_cast<const constant_texture*>(t)->value_batch(u, v, p, out, n);
+            return;
+        case texture_checker:
+            static_cast<const checker_texture*>(t)->value_batch(u, v, p, out, n);
+            return;
+        case texture_noise:
+            static_cast<const noise_texture*>(t)->value_batch(u, v, p, out, n);
+            return;
+        default: break;
+    }
+#endif
+    t->value_batch(u, v, p, out, n);
+}
+
+inline vec3 texture_value(const texture *t, float u, float v, const vec3& p) {
+#ifndef RT_VIRTUAL_DISPATCH
+    switch (t->kind) {
+        case texture_constant: return static_cast<const constant_texture*>(t)->color;
+        case texture_checker: return static_cast<const checker_texture*>(t)->value(u, v, p);
+        case texture_noise: return static_cast<const noise_texture*>(t)->value(u, v, p);
+        default: break;
+    }
+#endif
+    return t->value(u, v, p);
+}
+
 #endif
 
@@ -9,22 +9,19 @@
 // with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
 //==================================================================================================
 
-#include "random.h"
+#include "../common/random.h"
+#include "estimator.h"
 
 #include <iostream>
 #include <math.h>
-#include <stdlib.h>
 
 
 int main() {
-    int inside_circle = 0;
-    int inside_circle_stratified = 0;
-    int N = 1000000;
-    float sum;
-    for (int i = 0; i < N; i++) {
-            float x = 2*random_double();
-            sum += x*x;
-    }
-    std::cout << "I =" << 2*sum/N << "\n";
+    long long N = 100000000;
+    // The integral of x^2 over [0,2], sampling x uniformly.
+    estimate I = estimate_mean(N, [](long long) {
+        float x = 2*random_double();
+        return 2*x*x;
+    });
+    return report_estimate("I", I, 8.0/3.0) ? 0 : 1;
 }
-
@@ -18,6 +18,30 @@
 inline float ffmin(float a, float b) { return a < b ? a : b; }
 inline float ffmax(float a, float b) { return a > b ? a : b; }
 
+// Half the thickness to give the box of a flat shape in the plane at k, with sides a and b long,
+// so that slab tests still see it. It is a fraction of the shape's size and of its distance from
+// the origin; a fixed distance rounds away to nothing in scenes thousands of units across.
+inline float flat_box_pad(float k, float a, float b) {
+    return 1e-4f * ffmax(fabsf(k), ffmax(fabsf(a), fabsf(b)));
+}
+
+// Whether r passes through the box from lo to hi (three floats each) between tmin and tmax. The
+// near and far plane of each axis are picked by the sign of the ray's direction rather than
+// sorted, and the three spans are intersected without an early out, so the whole test compiles
+// to multiplies and min/max instructions with no branches. Every BVH's box test is this one.
+inline bool slab_hit(const float *lo, const float *hi, const ray& r, float tmin, float tmax) {
+    const float *planes[2] = { lo, hi };
+    const vec3& origin = r.origin();
+    const vec3& inv_dir = r.inv_direction();
+    for (int a = 0; a < 3; a++) {
+        float t0 = (planes[r.sign(a)][a] - origin[a]) * inv_dir[a];
+        float t1 = (planes[1 - r.sign(a)][a] - origin[a]) * inv_dir[a];
+        tmin = ffmax(t0, tmin);
+        tmax = ffmin(t1, tmax);
+    }
+    return tmin < tmax;
+}
+
 class aabb {
     public:
         aabb() {}
@@ -27,17 +51,7 @@ class aabb {
         vec3 max() const {return _max; }
 
         bool hit(const ray& r, float tmin, float tmax) const {
-            for (int a = 0; a < 3; a++) {
-                float t0 = ffmin((_min[a] - r.origin()[a]) / r.direction()[a],
-                                (_max[a] - r.origin()[a]) / r.direction()[a]);
-                float t1 = ffmax((_min[a] - r.origin()[a]) / r.direction()[a],
-                                (_max[a] - r.origin()[a]) / r.direction()[a]);
-                tmin = ffmax(t0, tmin);
-                tmax = ffmin(t1, tmax);
-                if (tmax <= tmin)
-                    return false;
-            }
-            return true;
+            return slab_hit(_min.e, _max.e, r, tmin, tmax);
         }
 
         float area() const {
@@ -64,12 +78,12 @@ class aabb {
 };
 
 aabb surrounding_box(aabb box0, aabb box1) {
-    vec3 small( fmin(box0.min().x(), box1.min().x()),
-                fmin(box0.min().y(), box1.min().y()),
-                fmin(box0.min().z(), box1.min().z()));
-    vec3 big  ( fmax(box0.max().x(), box1.max().x()),
-                fmax(box0.max().y(), box1.max().y()),
-                fmax(box0.max().z(), box1.max().z()));
+    vec3 small( ffmin(box0.min().x(), box1.min().x()),
+                ffmin(box0.min().y(), box1.min().y()),
+                ffmin(box0.min().z(), box1.min().z()));
+    vec3 big  ( ffmax(box0.max().x(), box1.max().x()),
+                ffmax(box0.max().y(), box1.max().y()),
+                ffmax(box0.max().z(), box1.max().z()));
     return aabb(small,big);
 }
 
@@ -0,0 +1,152 @@
+#ifndef ADAPTIVESAMPLERH
+#define ADAPTIVESAMPLERH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include "framebuffer.h"
+
+#include <algorithm>
+#include <math.h>
+#include <vector>
+
+
+// Running sum of a pixel's samples, plus the mean and variance of their luminance, kept with
+// Welford's method so no sample has to be stored.
+struct pixel_stats {
+    pixel_stats() : n(0), mean(0), m2(0) { sum[0] = sum[1] = sum[2] = 0; }
+
+    void add(float r, float g, float b) {
+        sum[0] += r;
+        sum[1] += g;
+        sum[2] += b;
+        n++;
+        double y = 0.2126*r + 0.7152*g + 0.0722*b;
+        double delta = y - mean;
+        mean += delta / n;
+        m2 += delta * (y - mean);
+    }
+
+    // Standard error of the mean luminance, relative to the mean. The small constant keeps black
+    // pixels, which never vary, from dividing by zero, and stops dark pixels counting for too much.
+    double relative_error() const {
+        if (n < 2)
+            return HUGE_VAL;
+        double variance = m2 / (n - 1);
+        return sqrt(variance / n) / (mean + 0.01);
+    }
+
+    float sum[3];
+    int n;
+    double mean;
+    double m2;
+};
+
+
+// Spends a budget of samples where the image is still noisy. Every pixel first takes min_samples,
+// then each round gives another batch to the pixels whose relative error is above the threshold,
+// the noisiest first when the budget will not stretch to all of them. A pixel's k-th sample is
+// always sample k of its random stream, so the result does not depend on thread count.
+class adaptive_sampler {
+    public:
+        adaptive_sampler(int nx, int ny, int min_samples, int max_samples, long long budget,
+                         float threshold);
+
+        // Plans the next round. Returns false when every pixel has converged, reached
+        // max_samples, or the budget is spent.
+        bool plan_round();
+
+        // How many samples pixel (i,j) takes this round, starting at sample index first_sample().
+        int wanted(int i, int j) const { return round_samples[size_t(j)*nx + i]; }
+        int first_sample(int i, int j) const { return stats[size_t(j)*nx + i].n; }
+
+        // Pixels are only ever touched by the tile that owns them, so tiles can add concurrently.
+        void add(int i, int j, float r, float g, float b) { stats[size_t(j)*nx + i].add(r, g, b); }
+
+        framebuffer image() const;
+
+        // Each pixel's sample count as a fraction of max_samples, in all three channels.
+        framebuffer heatmap() const;
+
+        long long samples_taken() const { return taken; }
+
+    private:
+        int nx, ny;
+        int min_samples, max_samples;
+        long long budget;
+        float threshold;
+        long long taken;
+        int rounds;
+        std::vector<pixel_stats> stats;
+        std::vector<int> round_samples;
+};
+
+
+adaptive_sampler::adaptive_sampler(int w, int h, int min_spp, int max_spp, long long total,
+                                   float error)
+    : nx(w), ny(h), min_samples(min_spp < 2 ? 2 : min_spp),
+      max_samples(max_spp < min_samples ? min_samples : max_spp), budget(total),
+      threshold(error), taken(0), rounds(0), stats(size_t(w)*h),
+      round_samples(size_t(w)*h, 0) {}
+
+bool adaptive_sampler::plan_round() {
+    size_t n = stats.size();
+    if (rounds++ == 0) {
+        // Every pixel needs a few samples before its variance means anything.
+        std::fill(round_samples.begin(), round_samples.end(), min_samples);
+        taken += (long long)(n) * min_samples;
+        return n > 0;
+    }
+
+    std::vector<std::pair<double, int> > noisy;
+    for (size_t p = 0; p < n; p++) {
+        round_samples[p] = 0;
+        double e = stats[p].relative_error();
+        if (stats[p].n < max_samples && e > threshold)
+            noisy.push_back(std::make_pair(e, int(p)));
+    }
+    std::sort(noisy.begin(), noisy.end(), [](const std::pair<double, int>& a,
+                                             const std::pair<double, int>& b) {
+        return a.first > b.first || (a.first == b.first && a.second < b.second);
+    });
+
+    long long planned = 0;
+    for (size_t k = 0; k < noisy.size() && taken + planned < budget; k++) {
+        const pixel_stats& s = stats[noisy[k].second];
+        long long batch = std::min(min_samples, max_samples - s.n);
+        batch = std::min(batch, budget - taken - planned);
+        round_samples[noisy[k].second] = int(batch);
+        planned += batch;
+    }
+    taken += planned;
+    return planned > 0;
+}
+
+framebuffer adaptive_sampler::image() const {
+    framebuffer fb(nx, ny);
+    for (size_t p = 0; p < stats.size(); p++) {
+        // Scaled like vec3::operator/=, so a pixel that takes k samples matches a k-sample render.
+        float scale = stats[p].n > 0 ? 1.0f / float(stats[p].n) : 0.0f;
+        for (int c = 0; c < 3; c++)
+            fb.pixels[3*p + c] = stats[p].sum[c] * scale;
+    }
+    return fb;
+}
+
+framebuffer adaptive_sampler::heatmap() const {
+    framebuffer fb(nx, ny);
+    for (size_t p = 0; p < stats.size(); p++) {
+        float f = float(stats[p].n) / float(max_samples);
+        fb.pixels[3*p] = fb.pixels[3*p + 1] = fb.pixels[3*p + 2] = f;
+    }
+    return fb;
+}
+
+#endif
@@ -0,0 +1,147 @@
+#ifndef ARENAH
+#define ARENAH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include <atomic>
+#include <new>
+#include <stddef.h>
+#include <utility>
+#include <vector>
+
+
+// Every type made in an arena gets a small index, assigned the first time any arena makes one.
+inline size_t arena_next_type_slot() {
+    static std::atomic<size_t> next_slot(0);
+    return next_slot++;
+}
+
+template <typename T> size_t arena_type_slot() {
+    static const size_t slot = arena_next_type_slot();
+    return slot;
+}
+
+
+// Owns all of the objects of a scene. Objects are placed in blocks that hold only one type, so a
+// scene's spheres, materials and textures each sit together in memory, and the whole scene is
+// destroyed and freed in one step when the arena is released.
+class arena {
+    public:
+        arena() : total_bytes(0) {}
+        ~arena() { release(); }
+
+        // Constructs a T in the arena. It lives until the arena is released.
+        template <typename T, typename... Args> T* make(Args&&... args);
+
+        // An uninitialized array of n trivially destructible elements, such as hittable* lists.
+        template <typename T> T* make_array(size_t n);
+
+        // Takes ownership of memory allocated elsewhere, e.g. image data from stbi_load, which is
+        // handed to free_fn when the arena is released.
+        void adopt(void *p, void (*free_fn)(void*));
+
+        // Destroys every object, in the reverse of the order each type's objects were made, and
+        // frees all blocks. The arena can be reused afterwards.
+        void release();
+
+        size_t bytes_allocated() const { return total_bytes; }
+
+    private:
+        struct pool_base {
+            virtual ~pool_base() {}
+        };
+
+        template <typename T> struct pool : public pool_base {
+            pool() : used(0), capacity(0) {}
+            ~pool() {
+                for (size_t b = blocks.size(); b-- > 0;) {
+                    size_t n = b+1 == blocks.size() ? used : block_sizes[b];
+                    for (size_t i = n; i-- > 0;)
+                        blocks[b][i].~T();
+                    ::operator delete(blocks[b]);
+                }
+            }
+            std::vector<T*> blocks;
+            std::vector<size_t> block_sizes;
+            size_t used;       // objects constructed in the last block
+            size_t capacity;   // size of the last block
+        };
+
+        struct adopted {
+            void *p;
+            void (*free_fn)(void*);
+        };
+
+        arena(const arena&);
+        arena& operator=(const arena&);
+
+        std::vector<pool_base*> pools;
+        std::vector<void*> raw_blocks;
+        std::vector<adopted> adopted_blocks;
+        size_t total_bytes;
+};
+
+
+template <typename T, typename... Args>
+T* arena::make(Args&&... args) {
+    size_t slot = arena_type_slot<T>();
+    if (slot >= pools.size())
+        pools.resize(slot+1, 0);
+    if (!pools[slot])
+        pools[slot] = new pool<T>();
+    pool<T> *p = static_cast<pool<T>*>(pools[slot]);
+
+    if (p->used == p->capacity) {
+        // Blocks double in size, up to a few thousand objects, so a scene of a million spheres
+        // costs a few hundred allocations rather than a million.
+        size_t n = p->capacity == 0 ? 16 : (p->capacity < 4096 ? 2*p->capacity : p->capacity);
+        p->blocks.push_back(static_cast<T*>(::operator new(n*sizeof(T))));
+        p->block_sizes.push_back(n);
+        p->used = 0;
+        p->capacity = n;
+        total_bytes += n*sizeof(T);
+    }
+    T *obj = new (p->blocks.back() + p->used) T(std::forward<Args>(args)...);
+    p->used++;
+    return obj;
+}
+
+template <typename T>
+T* arena::make_array(size_t n) {
+    void *block = ::operator new(n*sizeof(T));
+    raw_blocks.push_back(block);
+    total_bytes += n*sizeof(T);
+    return static_cast<T*>(block);
+}
+
+void arena::adopt(void *p, void (*free_fn)(void*)) {
+    if (!p)
+        return;
+    adopted a;
+    a.p = p;
+    a.free_fn = free_fn;
+    adopted_blocks.push_back(a);
+}
+
+void arena::release() {
+    for (size_t i = pools.size(); i-- > 0;)
+        delete pools[i];
+    pools.clear();
+    for (size_t i = 0; i < raw_blocks.size(); i++)
+        ::operator delete(raw_blocks[i]);
+    raw_blocks.clear();
+    for (size_t i = 0; i < adopted_blocks.size(); i++)
+        adopted_blocks[i].free_fn(adopted_blocks[i].p);
+    adopted_blocks.clear();
+    total_bytes = 0;
+}
+
+#endif
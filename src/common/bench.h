@@ -0,0 +1,161 @@
+#ifndef BENCHH
+#define BENCHH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string.h>
+#include <string>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+
+// Results the compiler must not optimize away are added here.
+static volatile double bench_sink;
+
+inline void bench_keep(double x) { bench_sink = bench_sink + x; }
+
+
+// Counts the calling thread's cache misses in user code, as the hardware counts them, from start()
+// to stop(), through Linux's perf events. Where there are no counters, as in most virtual
+// machines, or the kernel does not allow reading them, available() is false and stop() gives -1.
+class cache_miss_counter {
+    public:
+        cache_miss_counter();
+        ~cache_miss_counter();
+
+        bool available() const { return fd >= 0; }
+        void start();
+        long long stop();
+
+    private:
+        int fd;
+};
+
+
+// Runs benchmarks in the style of Google Benchmark. The first batch has one iteration, and each
+// batch after that is bigger, until one batch takes at least min_seconds. The time per iteration
+// comes from that last batch. An iteration is one call of body(i), where i counts up from 0, and
+// body returns how many rays that call traced. The report gives millions of rays per second, in
+// all and per core, so runs on different machines and thread counts compare. Benchmarks that
+// trace no rays leave the rates blank.
+class bench_runner {
+    public:
+        bench_runner(double min_seconds = 0.5, const char *name_filter = 0, int num_threads = 1)
+            : min_time(min_seconds), filter(name_filter ? name_filter : ""), threads(num_threads),
+              header_printed(false) {}
+
+        // Whether name is picked out by the filter, a substring any selected name contains.
+        bool selected(const char *name) const {
+            return filter.empty() || strstr(name, filter.c_str()) != 0;
+        }
+
+        template <typename F> void run(const char *name, F body);
+
+        double min_time;
+        std::string filter;
+        int threads;
+
+    private:
+        void print_header();
+
+        bool header_printed;
+};
+
+
+template <typename F> void bench_runner::run(const char *name, F body) {
+    if (!selected(name))
+        return;
+    long long iterations = 1;
+    for (;;) {
+        double rays = 0;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (long long i = 0; i < iterations; i++)
+            rays += body(i);
+        double seconds = std::chrono::duration<double>(
+                             std::chrono::steady_clock::now() - start).count();
+        if (seconds >= min_time || iterations >= (1LL << 40)) {
+            print_header();
+            double ns = seconds * 1e9 / iterations;
+            double rate = seconds > 0 ? rays / seconds : 0;
+            std::cout << std::left << std::setw(32) << name << std::right << std::fixed
+                      << std::setprecision(ns < 100 ? 2 : 0) << std::setw(16) << ns << " ns"
+                      << std::setw(14) << iterations << std::setprecision(3);
+            if (rays > 0)
+                std::cout << std::setw(14) << rate * 1e-6 << std::setw(14) << rate * 1e-6 / threads;
+            std::cout << "\n";
+            return;
+        }
+        // Aim for the batch to take about 1.4 times the minimum, but grow at most tenfold.
+        double scale = seconds > 0 ? 1.4 * min_time / seconds : 10;
+        iterations = (long long)(iterations * (scale < 10 ? (scale > 2 ? scale : 2) : 10));
+    }
+}
+
+void bench_runner::print_header() {
+    if (header_printed)
+        return;
+    header_printed = true;
+    std::cout << std::left << std::setw(32) << "benchmark" << std::right << std::setw(19)
+              << "time/iter" << std::setw(14) << "iterations" << std::setw(14) << "Mrays/s"
+              << std::setw(14) << "Mrays/s/core" << "\n";
+}
+
+
+cache_miss_counter::cache_miss_counter() : fd(-1) {
+#ifdef __linux__
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    fd = int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+#endif
+}
+
+cache_miss_counter::~cache_miss_counter() {
+#ifdef __linux__
+    if (fd >= 0)
+        close(fd);
+#endif
+}
+
+void cache_miss_counter::start() {
+#ifdef __linux__
+    if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+}
+
+long long cache_miss_counter::stop() {
+    long long misses = -1;
+#ifdef __linux__
+    if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(fd, &misses, sizeof(misses)) != sizeof(misses))
+            misses = -1;
+    }
+#endif
+    return misses;
+}
+
+#endif
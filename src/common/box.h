@@ -0,0 +1,163 @@
+#ifndef BOXH
+#define BOXH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include "hittable.h"
+
+#include <algorithm>
+#include <float.h>
+
+
+// The span [t_near, t_far] of the line o + t d inside [pmin,pmax], and the faces it enters and
+// leaves through, as 2*axis plus 1 for the face at pmax[axis]. t is found by dividing, as the
+// rects do, so a box hits where its faces would.
+inline bool box_span(const float o[3], const float d[3], const vec3& pmin, const vec3& pmax,
+                     float& t_near, float& t_far, int& near_face, int& far_face) {
+    t_near = -FLT_MAX;
+    t_far = FLT_MAX;
+    near_face = far_face = 0;
+    for (int a = 0; a < 3; a++) {
+        if (d[a] == 0) {
+            // Parallel to both faces: the ray is either between them all along or never.
+            if (o[a] < pmin[a] || o[a] > pmax[a])
+                return false;
+            continue;
+        }
+        float ta = (pmin[a] - o[a]) / d[a];
+        float tb = (pmax[a] - o[a]) / d[a];
+        int fa = 2*a, fb = 2*a + 1;
+        if (d[a] < 0) {
+            std::swap(ta, tb);
+            std::swap(fa, fb);
+        }
+        if (ta > t_near) {
+            t_near = ta;
+            near_face = fa;
+        }
+        if (tb < t_far) {
+            t_far = tb;
+            far_face = fb;
+        }
+    }
+    return t_near <= t_far;
+}
+
+// Which face a ray crosses the box through first within [t_min,t_max].
+inline bool box_slab(const float o[3], const float d[3], const vec3& pmin, const vec3& pmax,
+                     float t_min, float t_max, float& t, int& face) {
+    float t_near, t_far;
+    int near_face, far_face;
+    if (!box_span(o, d, pmin, pmax, t_near, t_far, near_face, far_face))
+        return false;
+    // A ray that starts inside leaves through the far face, as it would through the rects.
+    if (t_near >= t_min && t_near <= t_max) {
+        t = t_near;
+        face = near_face;
+    }
+    else if (t_far >= t_min && t_far <= t_max) {
+        t = t_far;
+        face = far_face;
+    }
+    else
+        return false;
+    return true;
+}
+
+// An axis-aligned box, intersected as the overlap of three slabs rather than as six rects.
+class box: public hittable  {
+    public:
+        box() {}
+        box(const vec3& p0, const vec3& p1, material *ptr) : pmin(p0), pmax(p1), mat_ptr(ptr) {}
+        virtual bool hit(const ray& r, float t0, float t1, hit_record& rec) const;
+        virtual bool bounding_box(float t0, float t1, aabb& box) const {
+               box =  aabb(pmin, pmax);
+               return true; }
+        virtual int hit_packet(const ray_packet& p, int active, float t_min, float *t_max,
+                               hit_record *rec) const;
+        virtual bool hit_interval(const ray& r, float& t_enter, float& t_exit) const {
+            const float o[3] = { r.origin()[0], r.origin()[1], r.origin()[2] };
+            const float d[3] = { r.direction()[0], r.direction()[1], r.direction()[2] };
+            int near_face, far_face;
+            if (!box_span(o, d, pmin, pmax, t_enter, t_exit, near_face, far_face))
+                return false;
+            return t_exit > t_enter;
+        }
+        virtual bool occluded(const ray& r, float t_min, float t_max) const {
+            const float o[3] = { r.origin()[0], r.origin()[1], r.origin()[2] };
+            const float d[3] = { r.direction()[0], r.direction()[1], r.direction()[2] };
+            float t;
+            int face;
+            return box_slab(o, d, pmin, pmax, t_min, t_max, t, face);
+        }
+        virtual bool intersect(const ray& r, float t0, float t1, hit_record& rec) const {
+            const float o[3] = { r.origin()[0], r.origin()[1], r.origin()[2] };
+            const float d[3] = { r.direction()[0], r.direction()[1], r.direction()[2] };
+            if (!box_slab(o, d, pmin, pmax, t0, t1, rec.t, rec.prim_id))
+                return false;
+            rec.prim = this;
+            return true;
+        }
+        virtual void finalize(const ray& r, hit_record& rec) const {
+            set_face_hit(r, rec.t, rec.prim_id, rec);
+        }
+        void set_face_hit(const ray& r, float t, int face, hit_record& rec) const;
+        vec3 pmin, pmax;
+        material *mat_ptr;
+};
+
+// The normal points out of the face, and u,v run over the face's two other axes in the order
+// the rects use: (y,z) on the x faces and x then the remaining axis on the others.
+void box::set_face_hit(const ray& r, float t, int face, hit_record& rec) const {
+    int a = face / 2;
+    int ua = a == 0 ? 1 : 0;
+    int va = a == 2 ? 1 : 2;
+    rec.t = t;
+    rec.mat_ptr = mat_ptr;
+    rec.p = r.point_at_parameter(t);
+    float pu = r.origin()[ua] + t*r.direction()[ua];
+    float pv = r.origin()[va] + t*r.direction()[va];
+    rec.u = (pu - pmin[ua]) / (pmax[ua] - pmin[ua]);
+    rec.v = (pv - pmin[va]) / (pmax[va] - pmin[va]);
+    // As for the rects, the point goes on the face's plane exactly.
+    rec.p[a] = face & 1 ? pmax[a] : pmin[a];
+    rec.p_error = point_error(max_abs(rec.p));
+    rec.normal = vec3(0, 0, 0);
+    rec.normal[a] = face & 1 ? 1 : -1;
+}
+
+bool box::hit(const ray& r, float t0, float t1, hit_record& rec) const {
+    if (!intersect(r, t0, t1, rec))
+        return false;
+    finalize(r, rec);
+    return true;
+}
+
+int box::hit_packet(const ray_packet& p, int active, float t_min, float *t_max,
+                    hit_record *rec) const {
+    int hits = 0;
+    for (int i = 0; i < p.count; i++) {
+        if (!(active & (1 << i)))
+            continue;
+        const float o[3] = { p.origin[0][i], p.origin[1][i], p.origin[2][i] };
+        const float d[3] = { p.direction[0][i], p.direction[1][i], p.direction[2][i] };
+        float t;
+        int face;
+        if (!box_slab(o, d, pmin, pmax, t_min, t_max[i], t, face))
+            continue;
+        set_face_hit(p.get(i), t, face, rec[i]);
+        t_max[i] = t;
+        hits |= 1 << i;
+    }
+    return hits;
+}
+
+#endif
@@ -0,0 +1,546 @@
+#ifndef BVHH
+#define BVHH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include "hittable.h"
+#include "hittable_list.h"
+#include "render_stats.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+
+enum bvh_split_method { bvh_split_median, bvh_split_sah };
+
+// Relative costs used by the SAH builder: testing a node's box against a ray, and testing a ray
+// against one primitive (a virtual hit() call).
+const float bvh_traversal_cost = 0.125;
+const float bvh_intersection_cost = 1.0;
+const int bvh_sah_bins = 12;
+const int bvh_max_leaf_size = 4;
+
+// Below this many levels nodes are split at the median rather than by the SAH. Median splits
+// halve the primitives, so no tree is deeper than bvh_sah_depth + 31 levels, and the fixed
+// traversal stacks of the trees collapsed from one (bvh4, compressed_bvh) cannot overflow.
+const int bvh_sah_depth = 32;
+const int bvh_max_depth = bvh_sah_depth + 31;
+
+// Subtrees at least this large are handed to another thread when one is idle, and ranges at least
+// this large are binned by several threads at once.
+const int bvh_parallel_subtree_size = 4096;
+const int bvh_parallel_bin_size = 65536;
+
+// bvh_node::update() builds the tree again once its SAH cost is this many times what it was when
+// it was last built.
+const float bvh_rebuild_cost_ratio = 1.5;
+
+struct bvh_build_stats {
+    int interior_nodes;
+    int leaves;
+    int primitives;
+    int max_depth;
+    float sah_cost;   // expected cost of tracing a ray that hits the root box, in the units above
+    float build_ms;   // wall time of the constructor that built the tree
+};
+
+struct bvh_build_prim {
+    aabb box;
+    vec3 centroid;
+    hittable *ptr;
+};
+
+struct bvh_build_context {
+    bvh_split_method method;
+    std::atomic<int> idle_threads;
+};
+
+// Runs f(begin, end) over [0,n) in up to `threads` chunks, the first one on the calling thread.
+template <typename F>
+void bvh_parallel_for(int n, int threads, F f) {
+    if (threads > n) threads = n;
+    if (threads < 1) threads = 1;
+    std::vector<std::thread> workers;
+    for (int t = 1; t < threads; t++)
+        workers.push_back(std::thread(f, int((long long)(n)*t/threads),
+                                         int((long long)(n)*(t+1)/threads)));
+    f(0, int((long long)(n)/threads));
+    for (size_t t = 0; t < workers.size(); t++)
+        workers[t].join();
+}
+
+class bvh_node : public hittable  {
+    public:
+        bvh_node() : left(0), right(0), left_count(0), right_count(0), build_ms(0),
+                     built_cost(0) {}
+        // num_threads = 0 uses every hardware thread, 1 builds on the calling thread only.
+        bvh_node(hittable **l, int n, float time0, float time1,
+                 bvh_split_method method = bvh_split_sah, int num_threads = 0);
+        ~bvh_node();
+        virtual bool hit(const ray& r, float tmin, float tmax, hit_record& rec) const;
+        virtual bool bounding_box(float t0, float t1, aabb& box) const;
+        virtual bool occluded(const ray& r, float t_min, float t_max) const;
+        virtual bool intersect(const ray& r, float t_min, float t_max, hit_record& rec) const;
+        bvh_build_stats build_stats() const;
+
+        // For trees kept from one frame to the next while their primitives move. refit() makes
+        // every box bound its children again over [time0, time1], keeping the tree's shape;
+        // rotate() then swaps children with grandchildren wherever that shrinks a box, and returns
+        // how many it swapped; rebuild() starts over from the same primitives. update() refits,
+        // rotates if asked, and rebuilds when the SAH cost has grown past bvh_rebuild_cost_ratio
+        // times built_cost, returning true if it did.
+        void refit(float time0, float time1);
+        int rotate(float time0, float time1);
+        void rebuild(float time0, float time1, bvh_split_method method = bvh_split_sah);
+        bool update(float time0, float time1, bool rotations = true,
+                    bvh_split_method method = bvh_split_sah);
+
+        hittable *left;
+        hittable *right;    // null when the node is a leaf with a single child
+        aabb box;
+        int left_count;     // primitives directly under each side, 0 when that side is a bvh_node
+        int right_count;
+        float build_ms;     // set on the root only
+        float built_cost;   // SAH cost when the tree was built, set on the root only
+
+    private:
+        bvh_node(bvh_build_prim *prims, int n, bvh_build_context& ctx, int depth);
+        void build(bvh_build_prim *prims, int n, bvh_build_context& ctx, int depth);
+        void make_leaf(bvh_build_prim *prims, int n);
+        hittable *make_child(bvh_build_prim *prims, int n, int& count, bvh_build_context& ctx,
+                             int depth);
+        void accumulate_stats(bvh_build_stats& s, int depth, float root_area) const;
+        void collect_primitives(std::vector<hittable*>& prims) const;
+        static aabb side_box(const hittable *side, int count, float time0, float time1);
+};
+
+
+bvh_node::~bvh_node() {
+    // Interior nodes and multi-primitive leaf lists belong to the tree; the primitives do not.
+    hittable *children[2] = { left, right };
+    int counts[2] = { left_count, right_count };
+    for (int c = 0; c < 2; c++) {
+        if (!children[c])
+            continue;
+        if (counts[c] == 0)
+            delete static_cast<bvh_node*>(children[c]);
+        else if (counts[c] > 2) {
+            hittable_list *list = static_cast<hittable_list*>(children[c]);
+            delete[] list->list;
+            delete list;
+        }
+    }
+}
+
+bool bvh_node::bounding_box(float t0, float t1, aabb& b) const {
+    b = box;
+    return true;
+}
+
+bool bvh_node::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+    if (!intersect(r, t_min, t_max, rec))
+        return false;
+    finalize_hit(r, rec);
+    return true;
+}
+
+bool bvh_node::intersect(const ray& r, float t_min, float t_max, hit_record& rec) const {
+    RT_COUNT(node_visits, 1);
+    if (!box.hit(r, t_min, t_max))
+        return false;
+    RT_COUNT(primitive_tests, left_count + right_count);
+    // Children write rec only when they find a closer hit, so the right side searches just the
+    // interval in front of whatever the left side found.
+    bool hit_left = left->intersect(r, t_min, t_max, rec);
+    bool hit_right = right && right->intersect(r, t_min, hit_left ? rec.t : t_max, rec);
+    return hit_left || hit_right;
+}
+
+bool bvh_node::occluded(const ray& r, float t_min, float t_max) const {
+    RT_COUNT(node_visits, 1);
+    if (!box.hit(r, t_min, t_max))
+        return false;
+    RT_COUNT(primitive_tests, left_count + right_count);
+    return left->occluded(r, t_min, t_max) || (right && right->occluded(r, t_min, t_max));
+}
+
+
+bvh_node::bvh_node(hittable **l, int n, float time0, float time1, bvh_split_method method,
+                   int num_threads) {
+    trace_zone zone("bvh build", "primitives", n);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    if (num_threads < 1) {
+        num_threads = int(std::thread::hardware_concurrency());
+        if (num_threads < 1) num_threads = 1;
+    }
+
+    // Bounds are looked up once per primitive into a flat array, rather than twice per comparison
+    // while sorting; the build only ever touches this array.
+    std::vector<bvh_build_prim> prims(n);
+    bvh_parallel_for(n, n >= bvh_parallel_bin_size ? num_threads : 1, [&](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            if (!l[i]->bounding_box(time0, time1, prims[i].box))
+                std::cerr << "no bounding box in bvh_node constructor\n";
+            prims[i].centroid = 0.5*(prims[i].box.min() + prims[i].box.max());
+            prims[i].ptr = l[i];
+        }
+    });
+
+    bvh_build_context ctx;
+    ctx.method = method;
+    ctx.idle_threads = num_threads - 1;
+    build(prims.data(), n, ctx, 0);
+    build_ms = float(std::chrono::duration<double, std::milli>(
+                         std::chrono::steady_clock::now() - start).count());
+    built_cost = build_stats().sah_cost;
+}
+
+bvh_node::bvh_node(bvh_build_prim *prims, int n, bvh_build_context& ctx, int depth)
+    : build_ms(0), built_cost(0) {
+    build(prims, n, ctx, depth);
+}
+
+void bvh_node::make_leaf(bvh_build_prim *prims, int n) {
+    if (n <= 2) {
+        left = prims[0].ptr;
+        right = n == 2 ? prims[1].ptr : 0;
+        left_count = 1;
+        right_count = n == 2 ? 1 : 0;
+    }
+    else {
+        hittable **list = new hittable*[n];
+        for (int i = 0; i < n; i++)
+            list[i] = prims[i].ptr;
+        left = new hittable_list(list, n);
+        right = 0;
+        left_count = n;
+        right_count = 0;
+    }
+}
+
+hittable *bvh_node::make_child(bvh_build_prim *prims, int n, int& count, bvh_build_context& ctx,
+                               int depth) {
+    count = n == 1 ? 1 : 0;
+    return n == 1 ? prims[0].ptr : new bvh_node(prims, n, ctx, depth);
+}
+
+inline bool bvh_claim_thread(std::atomic<int>& idle) {
+    int available = idle.load();
+    while (available > 0)
+        if (idle.compare_exchange_weak(available, available - 1))
+            return true;
+    return false;
+}
+
+inline int bvh_sah_bin(const bvh_build_prim& p, int axis, float cmin, float scale) {
+    int b = int((p.centroid[axis] - cmin) * scale);
+    return b < 0 ? 0 : (b >= bvh_sah_bins ? bvh_sah_bins - 1 : b);
+}
+
+struct bvh_sah_bins_3d {
+    int count[3][bvh_sah_bins];
+    aabb bounds[3][bvh_sah_bins];
+
+    bvh_sah_bins_3d() {
+        for (int a = 0; a < 3; a++)
+            for (int b = 0; b < bvh_sah_bins; b++)
+                count[a][b] = 0;
+    }
+    void add(int axis, int b, const aabb& box) {
+        bounds[axis][b] = count[axis][b]++ ? surrounding_box(bounds[axis][b], box) : box;
+    }
+    void merge(const bvh_sah_bins_3d& o) {
+        for (int a = 0; a < 3; a++)
+            for (int b = 0; b < bvh_sah_bins; b++)
+                if (o.count[a][b]) {
+                    bounds[a][b] = count[a][b] ? surrounding_box(bounds[a][b], o.bounds[a][b])
+                                               : o.bounds[a][b];
+                    count[a][b] += o.count[a][b];
+                }
+    }
+};
+
+void bvh_node::build(bvh_build_prim *prims, int n, bvh_build_context& ctx, int depth) {
+    box = prims[0].box;
+    aabb centroid_bounds(prims[0].centroid, prims[0].centroid);
+    for (int i = 1; i < n; i++) {
+        box = surrounding_box(box, prims[i].box);
+        centroid_bounds = surrounding_box(centroid_bounds, aabb(prims[i].centroid, prims[i].centroid));
+    }
+
+    if (n <= 2) {
+        make_leaf(prims, n);
+        return;
+    }
+
+    int mid = -1;
+    if (ctx.method == bvh_split_sah && depth < bvh_sah_depth) {
+        float cmin[3], scale[3];
+        for (int a = 0; a < 3; a++) {
+            cmin[a] = centroid_bounds.min()[a];
+            float extent = centroid_bounds.max()[a] - cmin[a];
+            scale[a] = extent > 0 ? bvh_sah_bins / extent : 0;
+        }
+
+        // Bin the centroids along all three axes in one pass. Large ranges near the root are
+        // split across idle threads, each filling its own bins, which are merged afterwards.
+        bvh_sah_bins_3d bins;
+        int helpers = 0;
+        if (n >= bvh_parallel_bin_size)
+            while (helpers < n / bvh_parallel_bin_size && bvh_claim_thread(ctx.idle_threads))
+                helpers++;
+        std::vector<bvh_sah_bins_3d> partial(helpers + 1);
+        std::atomic<int> next_chunk(0);
+        bvh_parallel_for(n, helpers + 1, [&](int begin, int end) {
+            bvh_sah_bins_3d& local = partial[next_chunk++];
+            for (int i = begin; i < end; i++)
+                for (int a = 0; a < 3; a++)
+                    if (scale[a] > 0)
+                        local.add(a, bvh_sah_bin(prims[i], a, cmin[a], scale[a]), prims[i].box);
+        });
+        ctx.idle_threads += helpers;
+        for (size_t i = 0; i < partial.size(); i++)
+            bins.merge(partial[i]);
+
+        // Sweep each axis from both ends, so that every candidate plane is priced from its
+        // prefix and suffix bounds.
+        float best_cost = FLT_MAX;
+        int best_axis = -1;
+        int best_bin = -1;
+        for (int axis = 0; axis < 3; axis++) {
+            if (scale[axis] <= 0)
+                continue;
+            const int *count = bins.count[axis];
+            const aabb *bounds = bins.bounds[axis];
+            float right_area[bvh_sah_bins];
+            int right_count[bvh_sah_bins];
+            aabb acc;
+            int acc_count = 0;
+            for (int b = bvh_sah_bins-1; b > 0; b--) {
+                if (count[b])
+                    acc = acc_count ? surrounding_box(acc, bounds[b]) : bounds[b];
+                acc_count += count[b];
+                right_area[b] = acc_count ? acc.area() : 0;
+                right_count[b] = acc_count;
+            }
+            acc_count = 0;
+            for (int b = 0; b < bvh_sah_bins-1; b++) {
+                if (count[b])
+                    acc = acc_count ? surrounding_box(acc, bounds[b]) : bounds[b];
+                acc_count += count[b];
+                if (acc_count == 0 || right_count[b+1] == 0)
+                    continue;
+                float cost = acc.area()*acc_count + right_area[b+1]*right_count[b+1];
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best_axis = axis;
+                    best_bin = b;
+                }
+            }
+        }
+
+        if (best_axis >= 0) {
+            float split_cost = bvh_traversal_cost
+                             + bvh_intersection_cost * best_cost / box.area();
+            float leaf_cost = bvh_intersection_cost * n;
+            if (n <= bvh_max_leaf_size && leaf_cost <= split_cost) {
+                make_leaf(prims, n);
+                return;
+            }
+            float axis_min = cmin[best_axis], axis_scale = scale[best_axis];
+            bvh_build_prim *split = std::partition(prims, prims + n,
+                [=](const bvh_build_prim& p) {
+                    return bvh_sah_bin(p, best_axis, axis_min, axis_scale) <= best_bin;
+                });
+            mid = int(split - prims);
+        }
+        else if (n <= bvh_max_leaf_size) {
+            // All centroids coincide, so no plane separates anything.
+            make_leaf(prims, n);
+            return;
+        }
+    }
+
+    if (mid <= 0 || mid >= n) {
+        int axis = centroid_bounds.longest_axis();
+        mid = n/2;
+        std::nth_element(prims, prims + mid, prims + n,
+                         [axis](const bvh_build_prim& a, const bvh_build_prim& b) {
+                             return a.centroid[axis] < b.centroid[axis];
+                         });
+    }
+
+    // The two halves are disjoint ranges of the array, so a large left half can be built on
+    // another thread while this one builds the right half.
+    if (mid >= bvh_parallel_subtree_size && n - mid >= bvh_parallel_subtree_size
+        && bvh_claim_thread(ctx.idle_threads)) {
+        std::thread worker([&]() { left = make_child(prims, mid, left_count, ctx, depth+1); });
+        right = make_child(prims + mid, n - mid, right_count, ctx, depth+1);
+        worker.join();
+        ctx.idle_threads++;
+    }
+    else {
+        left = make_child(prims, mid, left_count, ctx, depth+1);
+        right = make_child(prims + mid, n - mid, right_count, ctx, depth+1);
+    }
+}
+
+
+aabb bvh_node::side_box(const hittable *side, int count, float time0, float time1) {
+    if (count == 0)
+        return static_cast<const bvh_node*>(side)->box;
+    aabb b;
+    side->bounding_box(time0, time1, b);
+    return b;
+}
+
+void bvh_node::refit(float time0, float time1) {
+    if (left_count == 0)
+        static_cast<bvh_node*>(left)->refit(time0, time1);
+    if (right && right_count == 0)
+        static_cast<bvh_node*>(right)->refit(time0, time1);
+    box = side_box(left, left_count, time0, time1);
+    if (right)
+        box = surrounding_box(box, side_box(right, right_count, time0, time1));
+}
+
+// After Kopta et al., "Fast, Effective BVH Updates for Animated Scenes". Swapping one side of a
+// node with a grandchild under the other side leaves the node's own box as it was and changes
+// only the other side's, so each node takes whichever of its four swaps shrinks that box most.
+// Subtrees go first, so that a node sees its children's boxes as they end up.
+int bvh_node::rotate(float time0, float time1) {
+    int rotations = 0;
+    if (left_count == 0)
+        rotations += static_cast<bvh_node*>(left)->rotate(time0, time1);
+    if (!right)
+        return rotations;
+    if (right_count == 0)
+        rotations += static_cast<bvh_node*>(right)->rotate(time0, time1);
+
+    hittable **sides[2] = { &left, &right };
+    int *counts[2] = { &left_count, &right_count };
+    aabb boxes[2] = { side_box(left, left_count, time0, time1),
+                      side_box(right, right_count, time0, time1) };
+    float best_gain = 0;
+    int best_side = -1, best_grandchild = -1;
+    for (int s = 0; s < 2; s++) {
+        if (*counts[1-s] != 0)
+            continue;
+        bvh_node *other = static_cast<bvh_node*>(*sides[1-s]);
+        if (!other->right)
+            continue;
+        aabb grandchildren[2] = { side_box(other->left, other->left_count, time0, time1),
+                                  side_box(other->right, other->right_count, time0, time1) };
+        for (int g = 0; g < 2; g++) {
+            // Side s goes down into other, in place of grandchild g, which comes up.
+            float gain = other->box.area()
+                       - surrounding_box(boxes[s], grandchildren[1-g]).area();
+            if (gain > best_gain) {
+                best_gain = gain;
+                best_side = s;
+                best_grandchild = g;
+            }
+        }
+    }
+    if (best_side < 0)
+        return rotations;
+
+    bvh_node *other = static_cast<bvh_node*>(*sides[1-best_side]);
+    hittable **down = sides[best_side];
+    hittable **up = best_grandchild == 0 ? &other->left : &other->right;
+    int *down_count = counts[best_side];
+    int *up_count = best_grandchild == 0 ? &other->left_count : &other->right_count;
+    std::swap(*down, *up);
+    std::swap(*down_count, *up_count);
+    other->box = surrounding_box(side_box(other->left, other->left_count, time0, time1),
+                                 side_box(other->right, other->right_count, time0, time1));
+    return rotations + 1;
+}
+
+void bvh_node::collect_primitives(std::vector<hittable*>& prims) const {
+    const hittable *children[2] = { left, right };
+    int counts[2] = { left_count, right_count };
+    for (int c = 0; c < 2; c++) {
+        if (!children[c])
+            continue;
+        if (counts[c] == 0)
+            static_cast<const bvh_node*>(children[c])->collect_primitives(prims);
+        else if (counts[c] == 1)
+            prims.push_back(const_cast<hittable*>(children[c]));
+        else {
+            const hittable_list *list = static_cast<const hittable_list*>(children[c]);
+            prims.insert(prims.end(), list->list, list->list + list->list_size);
+        }
+    }
+}
+
+void bvh_node::rebuild(float time0, float time1, bvh_split_method method) {
+    std::vector<hittable*> prims;
+    collect_primitives(prims);
+    // The new tree is built aside and traded for this one's, so that whatever points at this
+    // node keeps working, and the old children go when the new node does.
+    bvh_node fresh(prims.data(), int(prims.size()), time0, time1, method);
+    std::swap(left, fresh.left);
+    std::swap(right, fresh.right);
+    std::swap(left_count, fresh.left_count);
+    std::swap(right_count, fresh.right_count);
+    box = fresh.box;
+    build_ms = fresh.build_ms;
+    built_cost = fresh.built_cost;
+}
+
+bool bvh_node::update(float time0, float time1, bool rotations, bvh_split_method method) {
+    refit(time0, time1);
+    if (rotations)
+        rotate(time0, time1);
+    if (build_stats().sah_cost <= bvh_rebuild_cost_ratio * built_cost)
+        return false;
+    rebuild(time0, time1, method);
+    return true;
+}
+
+bvh_build_stats bvh_node::build_stats() const {
+    bvh_build_stats s;
+    s.interior_nodes = s.leaves = s.primitives = s.max_depth = 0;
+    s.sah_cost = 0;
+    s.build_ms = build_ms;
+    accumulate_stats(s, 1, box.area());
+    return s;
+}
+
+void bvh_node::accumulate_stats(bvh_build_stats& s, int depth, float root_area) const {
+    // A node's box is tested whenever its parent's box is hit, and its direct primitives whenever
+    // its own box is hit; the chance of either is the ratio of surface areas.
+    float p = root_area > 0 ? box.area() / root_area : 1;
+    if (depth == 1)
+        s.sah_cost += bvh_traversal_cost;
+    s.sah_cost += p * bvh_intersection_cost * (left_count + right_count);
+    s.primitives += left_count + right_count;
+    if (depth > s.max_depth)
+        s.max_depth = depth;
+    if (left_count && (right_count || !right))
+        s.leaves++;
+    else
+        s.interior_nodes++;
+    const hittable *children[2] = { left_count ? 0 : left, right_count ? 0 : right };
+    for (int c = 0; c < 2; c++) {
+        if (children[c]) {
+            s.sah_cost += p * bvh_traversal_cost;
+            static_cast<const bvh_node*>(children[c])->accumulate_stats(s, depth+1, root_area);
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,427 @@
+#ifndef BVH4H
+#define BVH4H
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include "bvh.h"
+#include "hittable.h"
+#include "render_stats.h"
+#include "trace.h"
+
+#include <float.h>
+#include <stdint.h>
+#include <vector>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define BVH4_SSE
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define BVH4_NEON
+#endif
+
+
+// A 4-wide BVH node. The bounds of all four children are stored as structure-of-arrays, so one ray
+// is tested against all of them with a single pass of 4-wide SIMD operations.
+struct bvh4_node {
+    float bmin[3][4];   // bmin[axis][child]
+    float bmax[3][4];
+    int32_t child[4];   // >= 0: index of an interior node, < 0: leaf starting at primitive ~child
+    int32_t count[4];   // primitives in a leaf child, 0 for interior children and empty slots
+};
+
+
+// Each node visited pops one stack entry and pushes at most four, and collapsing never makes the
+// tree deeper than the binary one, so traversal stacks of this size are always enough.
+const int bvh4_stack_size = 3*bvh_max_depth + 4;
+
+// A collapsed SAH BVH: every node holds up to four children, pulled up from the binary bvh_node
+// that is built (and then discarded) by the constructor.
+class bvh4 : public hittable {
+    public:
+        bvh4() {}
+        bvh4(hittable **l, int n, float time0, float time1, int num_threads = 0);
+        virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+        virtual bool bounding_box(float t0, float t1, aabb& box) const;
+        virtual bool occluded(const ray& r, float t_min, float t_max) const;
+        virtual bool intersect(const ray& r, float t_min, float t_max, hit_record& rec) const;
+        virtual int hit_packet(const ray_packet& p, int active, float t_min, float *t_max,
+                               hit_record *rec) const;
+
+        std::vector<bvh4_node> nodes;
+        std::vector<hittable*> prims;
+        aabb bounds;
+
+    private:
+        struct collapse_item {
+            const hittable *ptr;
+            const bvh_node *node;   // non-null for an interior node that can still be opened
+            int count;              // the parent's count for this side (0 for any bvh_node)
+            aabb box;
+        };
+
+        int collapse(const bvh_node *root, float time0, float time1);
+        void add_item(std::vector<collapse_item>& items, const hittable *child, int count,
+                      float time0, float time1) const;
+        void add_leaf_prims(const hittable *child, int count);
+};
+
+
+bvh4::bvh4(hittable **l, int n, float time0, float time1, int num_threads) {
+    trace_zone zone("bvh4 build", "primitives", n);
+    bvh_node binary(l, n, time0, time1, bvh_split_sah, num_threads);
+    bounds = binary.box;
+    prims.reserve(n);
+    collapse(&binary, time0, time1);
+}
+
+bool bvh4::bounding_box(float t0, float t1, aabb& box) const {
+    box = bounds;
+    return !nodes.empty();
+}
+
+void bvh4::add_item(std::vector<collapse_item>& items, const hittable *child, int count,
+                    float time0, float time1) const {
+    if (!child)
+        return;
+    collapse_item item;
+    item.ptr = child;
+    const bvh_node *node = count == 0 ? static_cast<const bvh_node*>(child) : 0;
+    // A bvh_node whose children are both primitives is a leaf in this tree too.
+    if (node && node->left_count && (node->right_count || !node->right))
+        node = 0;
+    item.node = node;
+    item.count = count;
+    child->bounding_box(time0, time1, item.box);
+    items.push_back(item);
+}
+
+void bvh4::add_leaf_prims(const hittable *child, int count) {
+    // count is the parent's count for this side: 1 for a bare primitive, more than 2 for a leaf
+    // list, and 0 for a bvh_node whose own children are all primitives.
+    if (count == 1)
+        prims.push_back(const_cast<hittable*>(child));
+    else if (count > 1) {
+        const hittable_list *list = static_cast<const hittable_list*>(child);
+        for (int i = 0; i < list->list_size; i++)
+            prims.push_back(list->list[i]);
+    }
+    else {
+        const bvh_node *node = static_cast<const bvh_node*>(child);
+        add_leaf_prims(node->left, node->left_count);
+        if (node->right)
+            add_leaf_prims(node->right, node->right_count);
+    }
+}
+
+int bvh4::collapse(const bvh_node *root, float time0, float time1) {
+    std::vector<collapse_item> items;
+    add_item(items, root->left, root->left_count, time0, time1);
+    add_item(items, root->right, root->right_count, time0, time1);
+
+    // Open the largest interior child until there are four; the biggest boxes are the ones most
+    // likely to be hit, so they gain the most from being tested in the same SIMD pass.
+    while (items.size() < 4) {
+        int best = -1;
+        for (size_t i = 0; i < items.size(); i++)
+            if (items[i].node && (best < 0 || items[i].box.area() > items[best].box.area()))
+                best = int(i);
+        if (best < 0)
+            break;
+        const bvh_node *node = items[best].node;
+        items.erase(items.begin() + best);
+        add_item(items, node->left, node->left_count, time0, time1);
+        add_item(items, node->right, node->right_count, time0, time1);
+    }
+
+    int index = int(nodes.size());
+    nodes.push_back(bvh4_node());
+    bvh4_node node;
+    for (int c = 0; c < 4; c++) {
+        for (int a = 0; a < 3; a++) {
+            // Empty slots get an inverted box that no ray can hit.
+            node.bmin[a][c] = FLT_MAX;
+            node.bmax[a][c] = -FLT_MAX;
+        }
+        node.child[c] = 0;
+        node.count[c] = 0;
+    }
+    for (size_t c = 0; c < items.size(); c++) {
+        for (int a = 0; a < 3; a++) {
+            node.bmin[a][c] = items[c].box.min()[a];
+            node.bmax[a][c] = items[c].box.max()[a];
+        }
+        if (items[c].node) {
+            node.child[c] = collapse(items[c].node, time0, time1);
+        }
+        else {
+            int first = int(prims.size());
+            add_leaf_prims(items[c].ptr, items[c].count);
+            node.child[c] = ~first;
+            node.count[c] = int(prims.size()) - first;
+        }
+    }
+    nodes[index] = node;
+    return index;
+}
+
+#if defined(BVH4_SSE)
+typedef __m128 bvh4_float;
+inline bvh4_float bvh4_load(const float *p) { return _mm_loadu_ps(p); }
+inline bvh4_float bvh4_splat(float f) { return _mm_set1_ps(f); }
+inline bvh4_float bvh4_add(bvh4_float a, bvh4_float b) { return _mm_add_ps(a, b); }
+inline bvh4_float bvh4_sub(bvh4_float a, bvh4_float b) { return _mm_sub_ps(a, b); }
+inline bvh4_float bvh4_mul(bvh4_float a, bvh4_float b) { return _mm_mul_ps(a, b); }
+inline bvh4_float bvh4_min(bvh4_float a, bvh4_float b) { return _mm_min_ps(a, b); }
+inline bvh4_float bvh4_max(bvh4_float a, bvh4_float b) { return _mm_max_ps(a, b); }
+inline int bvh4_le_mask(bvh4_float a, bvh4_float b) { return _mm_movemask_ps(_mm_cmple_ps(a, b)); }
+inline void bvh4_store(float *p, bvh4_float a) { _mm_storeu_ps(p, a); }
+#elif defined(BVH4_NEON)
+typedef float32x4_t bvh4_float;
+inline bvh4_float bvh4_load(const float *p) { return vld1q_f32(p); }
+inline bvh4_float bvh4_splat(float f) { return vdupq_n_f32(f); }
+inline bvh4_float bvh4_add(bvh4_float a, bvh4_float b) { return vaddq_f32(a, b); }
+inline bvh4_float bvh4_sub(bvh4_float a, bvh4_float b) { return vsubq_f32(a, b); }
+inline bvh4_float bvh4_mul(bvh4_float a, bvh4_float b) { return vmulq_f32(a, b); }
+inline bvh4_float bvh4_min(bvh4_float a, bvh4_float b) { return vminq_f32(a, b); }
+inline bvh4_float bvh4_max(bvh4_float a, bvh4_float b) { return vmaxq_f32(a, b); }
+inline int bvh4_le_mask(bvh4_float a, bvh4_float b) {
+    uint32x4_t le = vcleq_f32(a, b);
+    return int((vgetq_lane_u32(le, 0) & 1) | (vgetq_lane_u32(le, 1) & 2)
+             | (vgetq_lane_u32(le, 2) & 4) | (vgetq_lane_u32(le, 3) & 8));
+}
+inline void bvh4_store(float *p, bvh4_float a) { vst1q_f32(p, a); }
+#else
+struct bvh4_float { float v[4]; };
+inline bvh4_float bvh4_load(const float *p) { bvh4_float r; for (int i = 0; i < 4; i++) r.v[i] = p[i]; return r; }
+inline bvh4_float bvh4_splat(float f) { bvh4_float r; for (int i = 0; i < 4; i++) r.v[i] = f; return r; }
+inline bvh4_float bvh4_add(bvh4_float a, bvh4_float b) { for (int i = 0; i < 4; i++) a.v[i] += b.v[i]; return a; }
+inline bvh4_float bvh4_sub(bvh4_float a, bvh4_float b) { for (int i = 0; i < 4; i++) a.v[i] -= b.v[i]; return a; }
+inline bvh4_float bvh4_mul(bvh4_float a, bvh4_float b) { for (int i = 0; i < 4; i++) a.v[i] *= b.v[i]; return a; }
+inline bvh4_float bvh4_min(bvh4_float a, bvh4_float b) { for (int i = 0; i < 4; i++) a.v[i] = ffmin(a.v[i], b.v[i]); return a; }
+inline bvh4_float bvh4_max(bvh4_float a, bvh4_float b) { for (int i = 0; i < 4; i++) a.v[i] = ffmax(a.v[i], b.v[i]); return a; }
+inline int bvh4_le_mask(bvh4_float a, bvh4_float b) {
+    int m = 0;
+    for (int i = 0; i < 4; i++) m |= (a.v[i] <= b.v[i]) << i;
+    return m;
+}
+inline void bvh4_store(float *p, bvh4_float a) { for (int i = 0; i < 4; i++) p[i] = a.v[i]; }
+#endif
+
+// Per-ray state, set up once per traversal: the ray's origin and cached inverse direction
+// splatted across all four lanes, and for each axis whether the near slab plane is the max or the
+// min. The test is slab_hit()'s, four children at a time.
+struct bvh4_ray {
+    bvh4_ray() {}
+    explicit bvh4_ray(const ray& r) {
+        for (int a = 0; a < 3; a++) {
+            origin[a] = bvh4_splat(r.origin()[a]);
+            inv_dir[a] = bvh4_splat(r.inv_direction()[a]);
+            near_is_max[a] = r.sign(a);
+        }
+    }
+    bvh4_float origin[3];
+    bvh4_float inv_dir[3];
+    int near_is_max[3];
+};
+
+// Returns a bit mask of the children whose boxes the ray enters within [tmin,tmax], and writes
+// the entry distance of every child to tnear.
+inline int bvh4_hit_children(const bvh4_node& node, const bvh4_ray& r, float tmin, float tmax,
+                             float tnear[4]) {
+    bvh4_float t0 = bvh4_splat(tmin);
+    bvh4_float t1 = bvh4_splat(tmax);
+    for (int a = 0; a < 3; a++) {
+        const float *near_plane = r.near_is_max[a] ? node.bmax[a] : node.bmin[a];
+        const float *far_plane = r.near_is_max[a] ? node.bmin[a] : node.bmax[a];
+        t0 = bvh4_max(t0, bvh4_mul(bvh4_sub(bvh4_load(near_plane), r.origin[a]), r.inv_dir[a]));
+        t1 = bvh4_min(t1, bvh4_mul(bvh4_sub(bvh4_load(far_plane), r.origin[a]), r.inv_dir[a]));
+    }
+    bvh4_store(tnear, t0);
+    return bvh4_le_mask(t0, t1);
+}
+
+bool bvh4::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+    if (!intersect(r, t_min, t_max, rec))
+        return false;
+    finalize_hit(r, rec);
+    return true;
+}
+
+bool bvh4::intersect(const ray& r, float t_min, float t_max, hit_record& rec) const {
+    if (nodes.empty())
+        return false;
+
+    bvh4_ray br(r);
+
+    // Stack entries carry the distance at which the ray entered the child, so that entries made
+    // obsolete by a closer hit are dropped without touching their node.
+    struct entry { int32_t child; int32_t count; float tnear; };
+    entry stack[bvh4_stack_size];
+    int stack_size = 0;
+    stack[stack_size].child = 0;
+    stack[stack_size].count = 0;
+    stack[stack_size].tnear = t_min;
+    stack_size++;
+
+    bool hit_anything = false;
+    while (stack_size > 0) {
+        entry e = stack[--stack_size];
+        if (e.tnear > t_max)
+            continue;
+        if (e.child < 0) {
+            int first = ~e.child;
+            RT_COUNT(primitive_tests, e.count);
+            for (int i = 0; i < e.count; i++) {
+                if (prims[first + i]->intersect(r, t_min, t_max, rec)) {
+                    hit_anything = true;
+                    t_max = rec.t;
+                }
+            }
+            continue;
+        }
+
+        const bvh4_node& node = nodes[e.child];
+        float tnear[4];
+        RT_COUNT(node_visits, 1);
+        int mask = bvh4_hit_children(node, br, t_min, t_max, tnear);
+        if (!mask)
+            continue;
+
+        // Push the hit children farthest first, so the nearest one is popped next.
+        int order[4];
+        int n = 0;
+        for (int c = 0; c < 4; c++) {
+            if (!(mask & (1 << c)))
+                continue;
+            int k = n++;
+            while (k > 0 && tnear[order[k-1]] < tnear[c]) {
+                order[k] = order[k-1];
+                k--;
+            }
+            order[k] = c;
+        }
+        for (int k = 0; k < n; k++) {
+            int c = order[k];
+            stack[stack_size].child = node.child[c];
+            stack[stack_size].count = node.count[c];
+            stack[stack_size].tnear = tnear[c];
+            stack_size++;
+        }
+    }
+    return hit_anything;
+}
+
+// Any hit will do, so the children are neither sorted nor pruned by distance, and the leaves
+// under a node are tested as soon as the node is opened.
+bool bvh4::occluded(const ray& r, float t_min, float t_max) const {
+    if (nodes.empty())
+        return false;
+
+    bvh4_ray br(r);
+
+    int32_t stack[bvh4_stack_size];
+    int stack_size = 0;
+    stack[stack_size++] = 0;
+    while (stack_size > 0) {
+        const bvh4_node& node = nodes[stack[--stack_size]];
+        float tnear[4];
+        RT_COUNT(node_visits, 1);
+        int mask = bvh4_hit_children(node, br, t_min, t_max, tnear);
+        for (int c = 0; c < 4; c++) {
+            if (!(mask & (1 << c)))
+                continue;
+            if (node.child[c] >= 0) {
+                stack[stack_size++] = node.child[c];
+                continue;
+            }
+            int first = ~node.child[c];
+            RT_COUNT(primitive_tests, node.count[c]);
+            for (int i = 0; i < node.count[c]; i++)
+                if (prims[first + i]->occluded(r, t_min, t_max))
+                    return true;
+        }
+    }
+    return false;
+}
+
+int bvh4::hit_packet(const ray_packet& p, int active, float t_min, float *t_max,
+                     hit_record *rec) const {
+    if (nodes.empty())
+        return 0;
+
+    bvh4_ray br[ray_packet_size];
+    for (int k = 0; k < p.count; k++)
+        br[k] = bvh4_ray(p.get(k));
+
+    // The packet goes down the tree together: each node is fetched once for all of its rays, and
+    // a child is only visited by the rays that entered its box.
+    struct entry { int32_t child; int32_t count; int mask; };
+    entry stack[bvh4_stack_size];
+    int stack_size = 0;
+    stack[stack_size].child = 0;
+    stack[stack_size].count = 0;
+    stack[stack_size].mask = active & ((1 << p.count) - 1);
+    stack_size++;
+
+    int hits = 0;
+    while (stack_size > 0) {
+        entry e = stack[--stack_size];
+        if (e.child < 0) {
+            int first = ~e.child;
+            RT_COUNT(primitive_tests, e.count * render_stats_lanes(e.mask));
+            for (int i = 0; i < e.count; i++)
+                hits |= prims[first + i]->hit_packet(p, e.mask, t_min, t_max, rec);
+            continue;
+        }
+
+        const bvh4_node& node = nodes[e.child];
+        int child_mask[4] = { 0, 0, 0, 0 };
+        float child_tnear[4] = { FLT_MAX, FLT_MAX, FLT_MAX, FLT_MAX };
+        for (int k = 0; k < p.count; k++) {
+            if (!(e.mask & (1 << k)))
+                continue;
+            float tnear[4];
+            RT_COUNT(node_visits, 1);
+            int mask = bvh4_hit_children(node, br[k], t_min, t_max[k], tnear);
+            for (int c = 0; c < 4; c++) {
+                if (mask & (1 << c)) {
+                    child_mask[c] |= 1 << k;
+                    child_tnear[c] = ffmin(child_tnear[c], tnear[c]);
+                }
+            }
+        }
+
+        // Push farthest first, ordered by the closest entry of any ray in the packet.
+        int order[4];
+        int n = 0;
+        for (int c = 0; c < 4; c++) {
+            if (!child_mask[c])
+                continue;
+            int k = n++;
+            while (k > 0 && child_tnear[order[k-1]] < child_tnear[c]) {
+                order[k] = order[k-1];
+                k--;
+            }
+            order[k] = c;
+        }
+        for (int k = 0; k < n; k++) {
+            int c = order[k];
+            stack[stack_size].child = node.child[c];
+            stack[stack_size].count = node.count[c];
+            stack[stack_size].mask = child_mask[c];
+            stack_size++;
+        }
+    }
+    return hits;
+}
+
+#endif
@@ -0,0 +1,182 @@
+#ifndef CAMERAH
+#define CAMERAH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include "random.h"
+#include "ray.h"
+#include "tile_scheduler.h"
+
+#include <stdint.h>
+#include <vector>
+
+
+// Shirley and Chiu's concentric map of the unit square onto the unit disk. It takes exactly two
+// random numbers, where rejection sampling takes a varying number, and keeps strata of a sample
+// pattern together.
+vec3 random_in_unit_disk() {
+    float a = 2*random_double() - 1;
+    float b = 2*random_double() - 1;
+    if (a == 0 && b == 0)
+        return vec3(0, 0, 0);
+    float r, phi;
+    if (a*a > b*b) {
+        r = a;
+        phi = float(M_PI/4) * (b/a);
+    }
+    else {
+        r = b;
+        phi = float(M_PI/2) - float(M_PI/4) * (a/b);
+    }
+    return vec3(r*cos(phi), r*sin(phi), 0);
+}
+
+// Camera rays for a block of samples, one array per component so they load straight into ray
+// packets. sample[k] is the index of ray k among its pixel's samples, and pixel[k] is j*nx + i.
+struct camera_rays {
+    void clear() {
+        for (int a = 0; a < 3; a++) {
+            origin[a].clear();
+            direction[a].clear();
+        }
+        time.clear();
+        pixel.clear();
+        sample.clear();
+        jitter[0].clear();
+        jitter[1].clear();
+    }
+    void push(const ray& r, uint32_t p, uint32_t s, float du, float dv) {
+        for (int a = 0; a < 3; a++) {
+            origin[a].push_back(r.origin()[a]);
+            direction[a].push_back(r.direction()[a]);
+        }
+        time.push_back(r.time());
+        pixel.push_back(p);
+        sample.push_back(s);
+        jitter[0].push_back(du);
+        jitter[1].push_back(dv);
+    }
+    size_t size() const { return time.size(); }
+    ray get(size_t k) const {
+        return ray(vec3(origin[0][k], origin[1][k], origin[2][k]),
+                   vec3(direction[0][k], direction[1][k], direction[2][k]), time[k]);
+    }
+    // The key random_sample_key() gives while ray k's sample is being traced.
+    uint64_t sample_key(size_t k) const { return (uint64_t(pixel[k]) << 32) | sample[k]; }
+
+    std::vector<float> origin[3];
+    std::vector<float> direction[3];
+    std::vector<float> time;
+    std::vector<uint32_t> pixel;
+    std::vector<uint32_t> sample;
+    std::vector<float> jitter[2];   // where in its pixel each ray starts, in [0,1) each way
+};
+
+class camera {
+    public:
+        // new:  add t0 and t1
+        camera(vec3 lookfrom, vec3 lookat, vec3 vup, float vfov, float aspect, float aperture, float focus_dist, float t0, float t1) { // vfov is top to bottom in degrees
+            time0 = t0;
+            time1 = t1;
+            lens_radius = aperture / 2;
+            float theta = vfov*M_PI/180;
+            half_height = tan(theta/2);
+            float half_width = aspect * half_height;
+            origin = lookfrom;
+            w = unit_vector(lookfrom - lookat);
+            u = unit_vector(cross(vup, w));
+            v = cross(w, u);
+            lower_left_corner = origin  - half_width*focus_dist*u -half_height*focus_dist*v - focus_dist*w;
+            horizontal = 2*half_width*focus_dist*u;
+            vertical = 2*half_height*focus_dist*v;
+        }
+
+        // new: add time to construct ray
+        ray get_ray(float s, float t) const {
+            return lens_ray(lower_left_corner + s*horizontal + t*vertical - origin);
+        }
+
+        // The ray for the sample of pixel (i, j) of an nx by ny image that random_begin_sample()
+        // last began: two numbers jitter it within the pixel, to (du, dv), then the lens and the
+        // shutter draw theirs. It is the ray generate_rays() makes for the same sample, so
+        // renderers that trace one sample at a time make the same image as those that use it.
+        ray pixel_ray(int i, int j, int nx, int ny, float& du, float& dv) const {
+            vec3 step_x = horizontal / float(nx);
+            vec3 step_y = vertical / float(ny);
+            return jittered_ray(lower_left_corner - origin + float(i)*step_x + float(j)*step_y,
+                                step_x, step_y, du, dv);
+        }
+        ray pixel_ray(int i, int j, int nx, int ny) const {
+            float du, dv;
+            return pixel_ray(i, j, nx, ny, du, dv);
+        }
+
+        // The rays for samples [first_sample, first_sample + samples) of every pixel in the tile,
+        // rows top first, each pixel's samples together, into out. Each sample begins its random
+        // stream as random_begin_sample(seed, j*nx + i, s) and draws the numbers pixel_ray()
+        // would, but the step between pixels and the corner of each pixel are worked out once.
+        void generate_rays(const tile& t, int nx, int ny, int first_sample, int samples,
+                           unsigned int seed, camera_rays& out) const {
+            out.clear();
+            vec3 step_x = horizontal / float(nx);
+            vec3 step_y = vertical / float(ny);
+            vec3 corner = lower_left_corner - origin;
+            for (int j = t.y1-1; j >= t.y0; j--) {
+                for (int i = t.x0; i < t.x1; i++) {
+                    vec3 pixel_corner = corner + float(i)*step_x + float(j)*step_y;
+                    uint32_t pixel = uint32_t(j*nx + i);
+                    for (int s = first_sample; s < first_sample + samples; s++) {
+                        random_begin_sample(seed, pixel, s);
+                        float du, dv;
+                        ray r = jittered_ray(pixel_corner, step_x, step_y, du, dv);
+                        out.push(r, pixel, uint32_t(s), du, dv);
+                    }
+                }
+            }
+        }
+
+        // The angle between the rays through neighbouring rows of an image ny pixels high.
+        float pixel_spread(int ny) const { return 2*half_height / ny; }
+
+        vec3 origin;
+        vec3 lower_left_corner;
+        vec3 horizontal;
+        vec3 vertical;
+        vec3 u, v, w;
+        float time0, time1;  // new variables for shutter open/close times
+        float lens_radius;
+        float half_height;
+
+    private:
+        ray jittered_ray(const vec3& pixel_corner, const vec3& step_x, const vec3& step_y,
+                         float& du, float& dv) const {
+            du = random_double();
+            dv = random_double();
+            return lens_ray(pixel_corner + du*step_x + dv*step_y);
+        }
+
+        // The ray from a point on the lens to the point at to from the centre of the lens, at a
+        // time while the shutter is open. A pinhole draws no lens position and a shutter that
+        // opens and closes at once draws no time.
+        ray lens_ray(const vec3& to) const {
+            vec3 from = origin;
+            vec3 direction = to;
+            if (lens_radius > 0) {
+                vec3 rd = lens_radius*random_in_unit_disk();
+                vec3 offset = u * rd.x() + v * rd.y();
+                from += offset;
+                direction -= offset;
+            }
+            float time = time0 == time1 ? time0 : time0 + random_double()*(time1-time0);
+            return ray(from, direction, time);
+        }
+};
+#endif
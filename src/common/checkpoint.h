@@ -0,0 +1,84 @@
+#ifndef CHECKPOINTH
+#define CHECKPOINTH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include "framebuffer.h"
+
+#include <fstream>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+
+
+// A progressive render in flight: the per-pixel sum of every pass so far. Pass p adds sample p of
+// every pixel, so a render stopped after n passes and resumed gives the same image as one that
+// ran n+m passes straight through.
+struct render_checkpoint {
+    render_checkpoint(int nx, int ny) : sum(nx, ny), passes(0), seed(0) {}
+
+    // The image so far, as the mean of the passes.
+    framebuffer image() const {
+        framebuffer fb(sum.nx, sum.ny);
+        // Scaled the way vec3::operator/= does it, so the result matches an ordinary render.
+        float scale = passes > 0 ? 1.0f / float(passes) : 0.0f;
+        for (size_t i = 0; i < sum.pixels.size(); i++)
+            fb.pixels[i] = sum.pixels[i] * scale;
+        return fb;
+    }
+
+    framebuffer sum;
+    int passes;
+    uint32_t seed;
+};
+
+
+const uint32_t checkpoint_magic = 0x31435452;   // "RTC1"
+
+// Writes to a temporary file and renames it over path, so a job killed mid-write still leaves the
+// previous checkpoint intact.
+bool save_checkpoint(const char *path, const render_checkpoint& c) {
+    std::string tmp = std::string(path) + ".tmp";
+    {
+        std::ofstream out(tmp.c_str(), std::ios::binary);
+        if (!out)
+            return false;
+        uint32_t header[5] = { checkpoint_magic, uint32_t(c.sum.nx), uint32_t(c.sum.ny),
+                               uint32_t(c.passes), c.seed };
+        out.write((const char*)header, sizeof(header));
+        out.write((const char*)&c.sum.pixels[0], c.sum.pixels.size()*sizeof(float));
+        if (!out)
+            return false;
+    }
+    return rename(tmp.c_str(), path) == 0;
+}
+
+// Loads a checkpoint made for an image of the same size and seed. Returns false, leaving c as it
+// was, if there is no such file or it belongs to a different render.
+bool load_checkpoint(const char *path, render_checkpoint& c) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        return false;
+    uint32_t header[5];
+    in.read((char*)header, sizeof(header));
+    if (!in || header[0] != checkpoint_magic || int(header[1]) != c.sum.nx
+            || int(header[2]) != c.sum.ny || header[4] != c.seed)
+        return false;
+    std::vector<float> pixels(c.sum.pixels.size());
+    in.read((char*)&pixels[0], pixels.size()*sizeof(float));
+    if (!in)
+        return false;
+    c.sum.pixels.swap(pixels);
+    c.passes = int(header[3]);
+    return true;
+}
+
+#endif
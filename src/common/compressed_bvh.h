@@ -0,0 +1,295 @@
+#ifndef COMPRESSEDBVHH
+#define COMPRESSEDBVHH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include "bvh4.h"
+#include "hittable.h"
+#include "render_stats.h"
+#include "trace.h"
+
+#include <float.h>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#ifdef BVH4_SSE
+#include <emmintrin.h>
+#endif
+
+
+// A bvh4_node in 64 bytes instead of 128, after Ylitie, Karras and Laine, "Efficient
+// Incoherent Ray Traversal on GPUs Through Compressed Wide BVHs". The children's bounds are
+// stored as 8-bit steps of a power-of-two grid anchored at the node's own minimum corner, one
+// grid size per axis. Each step rounds outwards, so the decoded boxes hold everything the exact
+// ones did, and are at most a 255th of the node wider on each side.
+struct compressed_bvh_node {
+    float origin[3];        // the node's minimum corner
+    int8_t exponent[3];     // the grid step along each axis is 2^exponent
+    uint8_t valid;          // one bit per child slot that is in use
+    uint8_t qmin[3][4];     // qmin[axis][child], in grid steps from origin
+    uint8_t qmax[3][4];
+    int32_t child[4];       // >= 0: index of an interior node, < 0: leaf starting at primitive ~child
+    uint8_t count[4];       // primitives in a leaf child, 0 for interior children and empty slots
+    uint8_t pad[4];
+};
+
+static_assert(sizeof(compressed_bvh_node) == 64, "compressed_bvh_node should be 64 bytes");
+// Leaves are at most a bvh_node leaf's two sides, which is what count has room for.
+static_assert(2*bvh_max_leaf_size <= 255, "bvh leaves must fit compressed_bvh_node::count");
+
+// 2^e as a float, for e in [-126, 127], without a call to ldexpf.
+inline float compressed_bvh_step(int e) {
+    uint32_t bits = uint32_t(e + 127) << 23;
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+// Where grid step q lies. Building and traversal share it, so they round the same way.
+inline float compressed_bvh_plane(float origin, int q, float step) {
+    return origin + float(q) * step;
+}
+
+
+// The same tree as bvh4, built the same way and then compressed node by node, so it has a third of
+// the memory traffic of the pointer-based bvh_node for the same leaves. Rays decode the child
+// boxes as they go; nothing else changes, and the traversal stacks are bvh4_stack_size deep too.
+class compressed_bvh : public hittable {
+    public:
+        compressed_bvh() {}
+        compressed_bvh(hittable **l, int n, float time0, float time1, int num_threads = 0);
+        virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+        virtual bool bounding_box(float t0, float t1, aabb& box) const;
+        virtual bool occluded(const ray& r, float t_min, float t_max) const;
+        virtual bool intersect(const ray& r, float t_min, float t_max, hit_record& rec) const;
+
+        size_t node_bytes() const { return nodes.size() * sizeof(compressed_bvh_node); }
+
+        std::vector<compressed_bvh_node> nodes;
+        std::vector<hittable*> prims;
+        aabb bounds;
+
+    private:
+        static compressed_bvh_node compress(const bvh4_node& wide);
+};
+
+
+compressed_bvh::compressed_bvh(hittable **l, int n, float time0, float time1, int num_threads) {
+    trace_zone zone("compressed bvh build", "primitives", n);
+    bvh4 wide(l, n, time0, time1, num_threads);
+    bounds = wide.bounds;
+    prims.swap(wide.prims);
+    nodes.resize(wide.nodes.size());
+    for (size_t i = 0; i < wide.nodes.size(); i++)
+        nodes[i] = compress(wide.nodes[i]);
+}
+
+compressed_bvh_node compressed_bvh::compress(const bvh4_node& wide) {
+    compressed_bvh_node node;
+    memset(&node, 0, sizeof(node));
+    for (int c = 0; c < 4; c++)
+        if (wide.bmin[0][c] <= wide.bmax[0][c])
+            node.valid |= 1 << c;
+    for (int a = 0; a < 3; a++) {
+        float lo = FLT_MAX, hi = -FLT_MAX;
+        for (int c = 0; c < 4; c++) {
+            if (node.valid & (1 << c)) {
+                lo = ffmin(lo, wide.bmin[a][c]);
+                hi = ffmax(hi, wide.bmax[a][c]);
+            }
+        }
+        if (!node.valid)
+            lo = hi = 0;
+        // The smallest step whose 255th grid line still reaches the far side.
+        int e = -126;
+        if (hi > lo) {
+            int exp;
+            frexpf((hi - lo) / 255.0f, &exp);
+            e = exp > -126 ? exp : -126;
+            while (e > -126 && compressed_bvh_plane(lo, 255, compressed_bvh_step(e-1)) >= hi)
+                e--;
+        }
+        while (e < 127 && compressed_bvh_plane(lo, 255, compressed_bvh_step(e)) < hi)
+            e++;
+        float step = compressed_bvh_step(e);
+        node.origin[a] = lo;
+        node.exponent[a] = int8_t(e);
+        for (int c = 0; c < 4; c++) {
+            if (!(node.valid & (1 << c)))
+                continue;
+            int q0 = int(floorf((wide.bmin[a][c] - lo) / step));
+            int q1 = int(ceilf((wide.bmax[a][c] - lo) / step));
+            q0 = q0 < 0 ? 0 : q0 > 255 ? 255 : q0;
+            q1 = q1 < 0 ? 0 : q1 > 255 ? 255 : q1;
+            // Division rounds, so check each side against the exact bound it has to hold.
+            while (q0 > 0 && compressed_bvh_plane(lo, q0, step) > wide.bmin[a][c])
+                q0--;
+            while (q1 < 255 && compressed_bvh_plane(lo, q1, step) < wide.bmax[a][c])
+                q1++;
+            node.qmin[a][c] = uint8_t(q0);
+            node.qmax[a][c] = uint8_t(q1);
+        }
+    }
+    for (int c = 0; c < 4; c++) {
+        node.child[c] = wide.child[c];
+        node.count[c] = uint8_t(wide.count[c]);
+    }
+    return node;
+}
+
+bool compressed_bvh::bounding_box(float t0, float t1, aabb& box) const {
+    box = bounds;
+    return !nodes.empty();
+}
+
+// Four grid steps as floats, in the same lanes as bvh4_float.
+#if defined(BVH4_SSE)
+inline bvh4_float compressed_bvh_load_steps(const uint8_t *q) {
+    int32_t packed;
+    memcpy(&packed, q, sizeof(packed));
+    __m128i zero = _mm_setzero_si128();
+    __m128i wide = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero), zero);
+    return _mm_cvtepi32_ps(wide);
+}
+#elif defined(BVH4_NEON)
+inline bvh4_float compressed_bvh_load_steps(const uint8_t *q) {
+    uint8_t bytes[8] = { q[0], q[1], q[2], q[3], 0, 0, 0, 0 };
+    return vcvtq_f32_u32(vmovl_u16(vget_low_u16(vmovl_u8(vld1_u8(bytes)))));
+}
+#else
+inline bvh4_float compressed_bvh_load_steps(const uint8_t *q) {
+    float f[4] = { float(q[0]), float(q[1]), float(q[2]), float(q[3]) };
+    return bvh4_load(f);
+}
+#endif
+
+// bvh4_hit_children() on the decoded boxes.
+inline int compressed_bvh_hit_children(const compressed_bvh_node& node, const bvh4_ray& r,
+                                       float tmin, float tmax, float tnear[4]) {
+    bvh4_float t0 = bvh4_splat(tmin);
+    bvh4_float t1 = bvh4_splat(tmax);
+    for (int a = 0; a < 3; a++) {
+        // compressed_bvh_plane(), four lanes at a time.
+        bvh4_float origin = bvh4_splat(node.origin[a]);
+        bvh4_float step = bvh4_splat(compressed_bvh_step(node.exponent[a]));
+        bvh4_float lo = bvh4_add(origin, bvh4_mul(compressed_bvh_load_steps(node.qmin[a]), step));
+        bvh4_float hi = bvh4_add(origin, bvh4_mul(compressed_bvh_load_steps(node.qmax[a]), step));
+        bvh4_float near_plane = r.near_is_max[a] ? hi : lo;
+        bvh4_float far_plane = r.near_is_max[a] ? lo : hi;
+        t0 = bvh4_max(t0, bvh4_mul(bvh4_sub(near_plane, r.origin[a]), r.inv_dir[a]));
+        t1 = bvh4_min(t1, bvh4_mul(bvh4_sub(far_plane, r.origin[a]), r.inv_dir[a]));
+    }
+    bvh4_store(tnear, t0);
+    return bvh4_le_mask(t0, t1) & node.valid;
+}
+
+bool compressed_bvh::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+    if (!intersect(r, t_min, t_max, rec))
+        return false;
+    finalize_hit(r, rec);
+    return true;
+}
+
+bool compressed_bvh::intersect(const ray& r, float t_min, float t_max, hit_record& rec) const {
+    if (nodes.empty())
+        return false;
+
+    bvh4_ray br(r);
+
+    // As in bvh4::intersect().
+    struct entry { int32_t child; int32_t count; float tnear; };
+    entry stack[bvh4_stack_size];
+    int stack_size = 0;
+    stack[stack_size].child = 0;
+    stack[stack_size].count = 0;
+    stack[stack_size].tnear = t_min;
+    stack_size++;
+
+    bool hit_anything = false;
+    while (stack_size > 0) {
+        entry e = stack[--stack_size];
+        if (e.tnear > t_max)
+            continue;
+        if (e.child < 0) {
+            int first = ~e.child;
+            RT_COUNT(primitive_tests, e.count);
+            for (int i = 0; i < e.count; i++) {
+                if (prims[first + i]->intersect(r, t_min, t_max, rec)) {
+                    hit_anything = true;
+                    t_max = rec.t;
+                }
+            }
+            continue;
+        }
+
+        const compressed_bvh_node& node = nodes[e.child];
+        float tnear[4];
+        RT_COUNT(node_visits, 1);
+        int mask = compressed_bvh_hit_children(node, br, t_min, t_max, tnear);
+        if (!mask)
+            continue;
+
+        int order[4];
+        int n = 0;
+        for (int c = 0; c < 4; c++) {
+            if (!(mask & (1 << c)))
+                continue;
+            int k = n++;
+            while (k > 0 && tnear[order[k-1]] < tnear[c]) {
+                order[k] = order[k-1];
+                k--;
+            }
+            order[k] = c;
+        }
+        for (int k = 0; k < n; k++) {
+            int c = order[k];
+            stack[stack_size].child = node.child[c];
+            stack[stack_size].count = node.count[c];
+            stack[stack_size].tnear = tnear[c];
+            stack_size++;
+        }
+    }
+    return hit_anything;
+}
+
+bool compressed_bvh::occluded(const ray& r, float t_min, float t_max) const {
+    if (nodes.empty())
+        return false;
+
+    bvh4_ray br(r);
+
+    int32_t stack[bvh4_stack_size];
+    int stack_size = 0;
+    stack[stack_size++] = 0;
+    while (stack_size > 0) {
+        const compressed_bvh_node& node = nodes[stack[--stack_size]];
+        float tnear[4];
+        RT_COUNT(node_visits, 1);
+        int mask = compressed_bvh_hit_children(node, br, t_min, t_max, tnear);
+        for (int c = 0; c < 4; c++) {
+            if (!(mask & (1 << c)))
+                continue;
+            if (node.child[c] >= 0) {
+                stack[stack_size++] = node.child[c];
+                continue;
+            }
+            int first = ~node.child[c];
+            RT_COUNT(primitive_tests, node.count[c]);
+            for (int i = 0; i < node.count[c]; i++)
+                if (prims[first + i]->occluded(r, t_min, t_max))
+                    return true;
+        }
+    }
+    return false;
+}
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef CMEDH
+#define CMEDH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include "fast_math.h"
+#include "hittable.h"
+#include "random.h"
+
+
+// A medium of constant density filling a closed boundary. Light travels through it an
+// exponentially distributed distance before it scatters, so hit() needs only where the ray enters
+// and leaves, which it asks the boundary for in a single query, and one random number. The phase
+// function is each book's isotropic material, which the medium does not own.
+class constant_medium : public hittable  {
+    public:
+        constant_medium(hittable *b, float d, material *phase)
+            : boundary(b), density(d), phase_function(phase) {}
+        virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+        virtual bool bounding_box(float t0, float t1, aabb& box) const {
+            return boundary->bounding_box(t0, t1, box);
+        }
+        hittable *boundary;
+        float density;
+        material *phase_function;
+};
+
+
+bool constant_medium::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+    float t_enter, t_exit;
+    if (!boundary->hit_interval(r, t_enter, t_exit))
+        return false;
+    if (t_enter < t_min) t_enter = t_min;
+    if (t_exit > t_max) t_exit = t_max;
+    if (t_enter >= t_exit)
+        return false;
+    if (t_enter < 0)
+        t_enter = 0;
+
+    float length = r.direction().length();
+    float distance_inside_boundary = (t_exit - t_enter) * length;
+    float hit_distance = -(1/density) * rt_log(random_double());
+    if (hit_distance >= distance_inside_boundary)
+        return false;
+
+    rec.t = t_enter + hit_distance / length;
+    rec.p = r.point_at_parameter(rec.t);
+    rec.p_error = 0;  // inside the medium rather than on a surface; rays leave from p itself
+    rec.normal = vec3(1,0,0);  // arbitrary
+    rec.mat_ptr = phase_function;
+    return true;
+}
+
+
+#endif
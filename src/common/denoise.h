@@ -0,0 +1,180 @@
+#ifndef DENOISEH
+#define DENOISEH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include "framebuffer.h"
+#include "tile_scheduler.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+// What the camera rays see first, averaged over each pixel's samples: the surface's reflectance,
+// its world-space shading normal, and its distance from the camera in every channel. Pixels whose
+// rays hit nothing are zero in all three. Denoisers use them to tell edges and texture from noise.
+struct aov_buffers {
+    aov_buffers(int w, int h) : albedo(w, h), normal(w, h), depth(w, h) {}
+
+    framebuffer albedo;
+    framebuffer normal;
+    framebuffer depth;
+};
+
+
+// A post-process that turns a noisy image and its AOVs into a clean one.
+class denoiser {
+    public:
+        virtual ~denoiser() {}
+        // Writes the filtered beauty image into out, which may be beauty itself. Returns false
+        // if it could not, and then leaves out alone.
+        virtual bool run(const framebuffer& beauty, const aov_buffers& aovs, framebuffer& out) = 0;
+};
+
+
+// The edge-avoiding a-trous wavelet filter of Dammertz et al. Each pass is a 5x5 B3-spline blur
+// whose taps are twice as far apart as the last pass's, with every tap weighed down by how much
+// its colour, normal and depth differ from the centre's. The image is divided by the albedo
+// first and multiplied back after, so texture detail is kept and only the lighting is blurred.
+class atrous_denoiser : public denoiser {
+    public:
+        atrous_denoiser(tile_scheduler& s, int passes = 5, float sigma_color = 0.4f,
+                        float sigma_normal = 0.3f, float sigma_depth = 0.05f)
+            : scheduler(s), passes(passes), sigma_color(sigma_color),
+              sigma_normal(sigma_normal), sigma_depth(sigma_depth) {}
+
+        virtual bool run(const framebuffer& beauty, const aov_buffers& aovs, framebuffer& out);
+
+    private:
+        tile_scheduler& scheduler;
+        int passes;
+        float sigma_color, sigma_normal, sigma_depth;
+};
+
+// Below this, an albedo channel is taken as black and the lighting is filtered as it is.
+const float denoise_min_albedo = 0.01f;
+
+bool atrous_denoiser::run(const framebuffer& beauty, const aov_buffers& aovs, framebuffer& out) {
+    int nx = beauty.nx, ny = beauty.ny;
+    framebuffer current(nx, ny), next(nx, ny);
+    for (size_t k = 0; k < beauty.pixels.size(); k++) {
+        float a = aovs.albedo.pixels[k];
+        current.pixels[k] = a > denoise_min_albedo ? beauty.pixels[k] / a : beauty.pixels[k];
+    }
+    const float kernel[5] = { 1.0f/16, 1.0f/4, 3.0f/8, 1.0f/4, 1.0f/16 };
+    for (int pass = 0; pass < passes; pass++) {
+        int step = 1 << pass;
+        // Later passes see an already smoothed image, so colour differences count for more.
+        float color_scale = 1 / (sigma_color*sigma_color) * float(1 << pass);
+        float normal_scale = 1 / (sigma_normal*sigma_normal);
+        scheduler.run([&](const tile& t) {
+            for (int j = t.y0; j < t.y1; j++) {
+                for (int i = t.x0; i < t.x1; i++) {
+                    const float *c = current.at(i, j);
+                    const float *n = aovs.normal.at(i, j);
+                    float z = aovs.depth.at(i, j)[0];
+                    float depth_scale = 1 / (sigma_depth * step * (z > 0 ? z : 1));
+                    // Colours are compared after c/(1+c), so that bright lights do not swamp
+                    // the comparison.
+                    float ct[3];
+                    for (int a = 0; a < 3; a++)
+                        ct[a] = c[a] / (1 + fabs(c[a]));
+                    float sum[3] = { 0, 0, 0 }, total = 0;
+                    for (int dy = -2; dy <= 2; dy++) {
+                        int y = j + dy*step;
+                        if (y < 0 || y >= ny)
+                            continue;
+                        for (int dx = -2; dx <= 2; dx++) {
+                            int x = i + dx*step;
+                            if (x < 0 || x >= nx)
+                                continue;
+                            const float *cq = current.at(x, y);
+                            const float *nq = aovs.normal.at(x, y);
+                            float dc = 0, dn = 0;
+                            for (int a = 0; a < 3; a++) {
+                                float e = ct[a] - cq[a] / (1 + fabs(cq[a]));
+                                dc += e*e;
+                                dn += (n[a] - nq[a]) * (n[a] - nq[a]);
+                            }
+                            float dz = fabs(z - aovs.depth.at(x, y)[0]);
+                            float w = kernel[dx+2] * kernel[dy+2]
+                                    * exp(-dc*color_scale - dn*normal_scale - dz*depth_scale);
+                            for (int a = 0; a < 3; a++)
+                                sum[a] += w * cq[a];
+                            total += w;
+                        }
+                    }
+                    // The centre tap always has weight, so total is never zero.
+                    next.set(i, j, sum[0] / total, sum[1] / total, sum[2] / total);
+                }
+            }
+        });
+        std::swap(current, next);
+    }
+    for (size_t k = 0; k < current.pixels.size(); k++) {
+        float a = aovs.albedo.pixels[k];
+        if (a > denoise_min_albedo)
+            current.pixels[k] *= a;
+    }
+    out = current;
+    return true;
+}
+
+
+// Hands the work to an external program, such as Open Image Denoise's oidnDenoise. The noisy
+// image, albedo and normals are written as PFM files, the command is run through the shell with
+// {color}, {albedo}, {normal} and {output} replaced by their paths, and the result is read back
+// from {output}, which must also be a PFM. The files are named after prefix and removed after.
+// For example: oidnDenoise --hdr {color} --alb {albedo} --nrm {normal} -o {output}
+class command_denoiser : public denoiser {
+    public:
+        command_denoiser(const std::string& command, const std::string& prefix)
+            : command(command), prefix(prefix) {}
+
+        virtual bool run(const framebuffer& beauty, const aov_buffers& aovs, framebuffer& out);
+
+    private:
+        std::string command;
+        std::string prefix;
+};
+
+bool command_denoiser::run(const framebuffer& beauty, const aov_buffers& aovs, framebuffer& out) {
+    const char *names[4] = { "{color}", "{albedo}", "{normal}", "{output}" };
+    const framebuffer *inputs[3] = { &beauty, &aovs.albedo, &aovs.normal };
+    std::string paths[4];
+    bool ok = true;
+    for (int f = 0; f < 4; f++) {
+        paths[f] = prefix + "." + std::string(names[f] + 1, strlen(names[f]) - 2) + ".pfm";
+        if (f < 3)
+            ok = ok && write_image(paths[f].c_str(), image_pfm, *inputs[f]);
+    }
+    std::string line = command;
+    for (int f = 0; f < 4; f++) {
+        size_t length = strlen(names[f]);
+        for (size_t at; (at = line.find(names[f])) != std::string::npos; )
+            line.replace(at, length, paths[f]);
+    }
+    framebuffer result(0, 0);
+    ok = ok && system(line.c_str()) == 0 && read_pfm(paths[3].c_str(), result)
+            && result.nx == beauty.nx && result.ny == beauty.ny;
+    for (int f = 0; f < 4; f++)
+        remove(paths[f].c_str());
+    if (ok)
+        out = result;
+    return ok;
+}
+
+#endif
@@ -0,0 +1,253 @@
+#ifndef DISTRIBUTEDH
+#define DISTRIBUTEDH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include "framebuffer.h"
+
+#include <iostream>
+#include <ostream>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+#ifdef _MSC_VER
+#define popen _popen
+#define pclose _pclose
+const char *const pipe_read_mode = "rb";
+#else
+const char *const pipe_read_mode = "r";
+#endif
+
+
+// A frame rendered in pieces, each by its own process, possibly on another machine. Sample s of
+// pixel p draws from the random stream seeded by (seed, p, s) wherever it is traced, so a piece
+// holds exactly the samples the whole render would have taken there. A piece is a band of rows,
+// a range of samples, or both. Its part is the plain sum of its samples, so parts with different
+// sample counts merge with the right weights: each pixel is the sum over all parts divided by the
+// number of samples they took there.
+
+// Rows [y0, y1) and samples [first_sample, first_sample + samples) of a frame.
+struct render_piece {
+    int y0, y1;
+    int first_sample, samples;
+};
+
+// Splits a frame ny rows high with ns samples per pixel into row_bands bands of rows, each split
+// into sample_ranges ranges of samples. Bands of rows alone merge into exactly the image one
+// process would make; splitting the samples changes the order the sums are added up in.
+std::vector<render_piece> split_frame(int ny, int ns, int row_bands, int sample_ranges) {
+    if (row_bands < 1) row_bands = 1;
+    if (row_bands > ny) row_bands = ny;
+    if (sample_ranges < 1) sample_ranges = 1;
+    if (sample_ranges > ns) sample_ranges = ns;
+    std::vector<render_piece> pieces;
+    for (int b = 0; b < row_bands; b++) {
+        for (int r = 0; r < sample_ranges; r++) {
+            render_piece p;
+            p.y0 = int((long long)(ny) * b / row_bands);
+            p.y1 = int((long long)(ny) * (b+1) / row_bands);
+            p.first_sample = int((long long)(ns) * r / sample_ranges);
+            p.samples = int((long long)(ns) * (r+1) / sample_ranges) - p.first_sample;
+            pieces.push_back(p);
+        }
+    }
+    return pieces;
+}
+
+// What one piece of a frame nx by frame_ny brings back: for every pixel in its rows, the sum of
+// its samples. sum holds only the piece's rows, so row j of the frame is row j - piece.y0 of sum.
+struct render_part {
+    render_part(int nx, const render_piece& p, int ny, uint32_t s)
+        : sum(nx, p.y1 - p.y0), piece(p), frame_ny(ny), seed(s) {}
+
+    framebuffer sum;
+    render_piece piece;
+    int frame_ny;
+    uint32_t seed;
+};
+
+
+const uint32_t render_part_magic = 0x31505452;   // "RTP1"
+
+void write_render_part(std::ostream& out, const render_part& p) {
+    uint32_t header[8] = { render_part_magic, uint32_t(p.sum.nx), uint32_t(p.frame_ny),
+                           uint32_t(p.piece.y0), uint32_t(p.piece.y1),
+                           uint32_t(p.piece.first_sample), uint32_t(p.piece.samples), p.seed };
+    out.write((const char*)header, sizeof(header));
+    out.write((const char*)&p.sum.pixels[0], p.sum.pixels.size()*sizeof(float));
+}
+
+// Reads a part from the n bytes at data, as write_render_part wrote it. Returns false, leaving
+// p as it was, if they are not a whole part, or its header does not describe a piece of a frame.
+bool read_render_part(const char *data, size_t n, render_part& p) {
+    uint32_t header[8];
+    if (n < sizeof(header))
+        return false;
+    memcpy(header, data, sizeof(header));
+    int nx = int(header[1]), frame_ny = int(header[2]);
+    render_piece piece = { int(header[3]), int(header[4]), int(header[5]), int(header[6]) };
+    if (header[0] != render_part_magic || nx <= 0 || piece.y0 < 0 || piece.y1 <= piece.y0
+            || frame_ny < piece.y1 || piece.first_sample < 0 || piece.samples <= 0)
+        return false;
+    // The size is checked before the part is made, so a bad header cannot ask for a huge buffer.
+    size_t row_bytes = size_t(nx)*3*sizeof(float);
+    if ((n - sizeof(header)) % row_bytes != 0
+            || (n - sizeof(header)) / row_bytes != size_t(piece.y1 - piece.y0))
+        return false;
+    render_part part(nx, piece, frame_ny, header[7]);
+    memcpy(&part.sum.pixels[0], data + sizeof(header), part.sum.pixels.size()*sizeof(float));
+    p = part;
+    return true;
+}
+
+
+// Adds parts up into a whole frame.
+class render_merger {
+    public:
+        render_merger(int w, int h, uint32_t s) : sum(w, h), samples(h, 0), seed(s) {}
+
+        // Returns false, adding nothing, if p belongs to a frame of another size or seed.
+        bool add(const render_part& p) {
+            if (p.sum.nx != sum.nx || p.frame_ny != sum.ny || p.seed != seed)
+                return false;
+            for (int j = p.piece.y0; j < p.piece.y1; j++) {
+                const float *from = p.sum.at(0, j - p.piece.y0);
+                float *to = sum.at(0, j);
+                for (int k = 0; k < 3*sum.nx; k++)
+                    to[k] += from[k];
+                samples[j] += p.piece.samples;
+            }
+            return true;
+        }
+
+        // Rows no part covered.
+        int missing_rows() const {
+            int n = 0;
+            for (int j = 0; j < sum.ny; j++)
+                n += samples[j] == 0;
+            return n;
+        }
+
+        // The mean of each pixel's samples, scaled the way vec3::operator/= does it, so that a
+        // frame merged from bands of rows matches a render made in one go.
+        framebuffer image() const {
+            framebuffer fb(sum.nx, sum.ny);
+            for (int j = 0; j < sum.ny; j++) {
+                float scale = samples[j] > 0 ? 1.0f / float(samples[j]) : 0.0f;
+                const float *from = sum.at(0, j);
+                float *to = fb.at(0, j);
+                for (int k = 0; k < 3*sum.nx; k++)
+                    to[k] = from[k] * scale;
+            }
+            return fb;
+        }
+
+        framebuffer sum;
+        std::vector<int> samples;   // per row
+        uint32_t seed;
+};
+
+
+// Runs each command through the shell, all at once, and returns what each wrote to its standard
+// output. ok[i] is false for a command that could not be started or did not exit with status 0.
+std::vector<std::string> run_commands(const std::vector<std::string>& commands,
+                                      std::vector<bool>& ok) {
+    std::vector<std::string> output(commands.size());
+    std::vector<char> status(commands.size(), 0);
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < commands.size(); i++) {
+        workers.push_back(std::thread([&, i]() {
+            FILE *pipe = popen(commands[i].c_str(), pipe_read_mode);
+            if (!pipe)
+                return;
+            char buf[1 << 16];
+            size_t n;
+            while ((n = fread(buf, 1, sizeof(buf), pipe)) > 0)
+                output[i].append(buf, n);
+            status[i] = pclose(pipe) == 0;
+        }));
+    }
+    for (size_t i = 0; i < workers.size(); i++)
+        workers[i].join();
+    ok.assign(status.begin(), status.end());
+    return output;
+}
+
+// The command that renders piece: the worker command with every {host} replaced by host, and the
+// options that pick out the piece and send its part to standard output added at the end.
+std::string piece_command(const std::string& worker, const std::string& host,
+                          const render_piece& piece) {
+    std::string command = worker;
+    for (size_t at; (at = command.find("{host}")) != std::string::npos; )
+        command.replace(at, 6, host);
+    char options[128];
+    snprintf(options, sizeof(options), " -rows %d:%d -samples %d:%d -part -", piece.y0, piece.y1,
+             piece.first_sample, piece.samples);
+    return command + options;
+}
+
+
+// Merges parts, given as the bytes of each and a name for each to report errors by, into the
+// frame of the first. Fails unless every part is whole and of the same frame, and every row of
+// the frame is covered.
+bool merge_render_parts(const std::vector<std::string>& data, const std::vector<std::string>& names,
+                        framebuffer& fb) {
+    render_merger *merger = 0;
+    bool ok = !data.empty();
+    for (size_t i = 0; i < data.size() && ok; i++) {
+        render_part part(1, render_piece(), 1, 0);
+        if (!read_render_part(data[i].data(), data[i].size(), part)) {
+            std::cerr << names[i] << ": not a render part\n";
+            ok = false;
+            break;
+        }
+        if (!merger)
+            merger = new render_merger(part.sum.nx, part.frame_ny, part.seed);
+        if (!merger->add(part)) {
+            std::cerr << names[i] << ": part of a different frame or seed\n";
+            ok = false;
+        }
+    }
+    if (ok && merger->missing_rows() > 0) {
+        std::cerr << merger->missing_rows() << " rows of the frame are in no part\n";
+        ok = false;
+    }
+    if (ok)
+        fb = merger->image();
+    delete merger;
+    return ok;
+}
+
+// Renders an nx by ny frame with ns samples per pixel as row_bands by sample_ranges pieces, each
+// by the worker command on one of hosts in turn, and merges what they send back into fb.
+bool render_distributed(const std::string& worker, const std::vector<std::string>& hosts,
+                        int row_bands, int sample_ranges, int ny, int ns, framebuffer& fb) {
+    std::vector<render_piece> pieces = split_frame(ny, ns, row_bands, sample_ranges);
+    std::vector<std::string> commands, names;
+    for (size_t i = 0; i < pieces.size(); i++) {
+        commands.push_back(piece_command(worker, hosts[i % hosts.size()], pieces[i]));
+        names.push_back(commands.back());
+    }
+    std::vector<bool> ok;
+    std::vector<std::string> parts = run_commands(commands, ok);
+    for (size_t i = 0; i < ok.size(); i++) {
+        if (!ok[i]) {
+            std::cerr << "failed: " << commands[i] << "\n";
+            return false;
+        }
+    }
+    return merge_render_parts(parts, names, fb);
+}
+
+#endif
@@ -0,0 +1,166 @@
+#ifndef FASTMATHH
+#define FASTMATHH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+
+// Single precision approximations of the transcendentals that shading calls for every sample,
+// after the Cephes library's: a range reduction, then a short polynomial. They have no tables, no
+// calls and no branches, only selects, and inline where libm's calls cannot; atan2 and asin take
+// a third of libm's time, and sin and cos together a little less. Their largest errors, as
+// fractions of the larger of 1 and the result, which fast_math_check.cc measures against libm,
+// are:
+//
+//     fast_sincos   2e-7 for |x| < 1e4
+//     fast_atan2    3e-7
+//     fast_asin     2e-7
+//     fast_log      2e-7 for x in [1e-30, 1e30], and -inf at 0
+//     fast_pow5     2e-7 for x in [0, 1]
+//
+// Building with RT_FAST_MATH defined makes the rt_ functions below use them. Without it the rt_
+// functions call libm exactly as the code did before them, so images do not change.
+
+// The bits of pi/2 in three floats, each exact to the width that q * it needs, for reducing
+// arguments without losing the low bits.
+const float fast_half_pi_hi = 1.5703125f;
+const float fast_half_pi_mid = 4.8375129699707031e-4f;
+const float fast_half_pi_lo = 7.5497899548918821e-8f;
+
+// The bits of a float, and the float with given bits.
+inline uint32_t fast_bits(float x) {
+    uint32_t b;
+    memcpy(&b, &x, sizeof(b));
+    return b;
+}
+
+inline float fast_from_bits(uint32_t b) {
+    float x;
+    memcpy(&x, &b, sizeof(x));
+    return x;
+}
+
+inline void fast_sincos(float x, float& s, float& c) {
+    // x = r + q pi/2 with |r| <= pi/4; the polynomials are good on that range. q is rounded by
+    // conversion to int rather than by floorf, which is a call without SSE4.1.
+    float t = x * float(2/M_PI);
+    int k = int(t + copysignf(0.5f, t));
+    float q = float(k);
+    float r = ((x - q * fast_half_pi_hi) - q * fast_half_pi_mid) - q * fast_half_pi_lo;
+    float r2 = r * r;
+    float sr = r + r * r2 * (-1.6666654611e-1f + r2 * (8.3321608736e-3f
+                                                       + r2 * -1.9515295891e-4f));
+    float cr = 1 - 0.5f * r2 + r2 * r2 * (4.166664568298827e-2f
+                                          + r2 * (-1.388731625493765e-3f
+                                                  + r2 * 2.443315711809948e-5f));
+    // The quadrant picks which of sin r and cos r each is, and its sign. This is done on the
+    // bits, with masks, so that loops over it have no branches and vectorize.
+    uint32_t swap = 0u - uint32_t(k & 1);
+    uint32_t sb = fast_bits(sr), cb = fast_bits(cr);
+    s = fast_from_bits(((sb & ~swap) | (cb & swap)) ^ (uint32_t(k & 2) << 30));
+    c = fast_from_bits(((cb & ~swap) | (sb & swap)) ^ (uint32_t((k + 1) & 2) << 30));
+}
+
+inline float fast_sin(float x) {
+    float s, c;
+    fast_sincos(x, s, c);
+    return s;
+}
+
+inline float fast_cos(float x) {
+    float s, c;
+    fast_sincos(x, s, c);
+    return c;
+}
+
+// atan of a in [0, 1], taking a above tan(pi/8) to (a-1)/(a+1) first.
+inline float fast_atan_unit(float a) {
+    bool upper = a > 0.41421356f;
+    float z = upper ? (a - 1) / (a + 1) : a;
+    float z2 = z * z;
+    float p = (((8.05374449538e-2f * z2 - 1.38776856032e-1f) * z2 + 1.99777106478e-1f) * z2
+               - 3.33329491539e-1f) * z2 * z + z;
+    return upper ? float(M_PI/4) + p : p;
+}
+
+inline float fast_atan2(float y, float x) {
+    float ax = fabsf(x), ay = fabsf(y);
+    float hi = ax > ay ? ax : ay, lo = ax > ay ? ay : ax;
+    float a = fast_atan_unit(hi > 0 ? lo / hi : 0);
+    a = ay > ax ? float(M_PI/2) - a : a;
+    a = x < 0 ? float(M_PI) - a : a;
+    return copysignf(a, y);
+}
+
+inline float fast_asin(float x) {
+    // Above 1/2, asin x = pi/2 - 2 asin(sqrt((1 - x)/2)).
+    float a = fabsf(x);
+    bool upper = a > 0.5f;
+    float z = upper ? 0.5f * (1 - a) : a * a;
+    float w = upper ? sqrtf(z) : a;
+    float p = ((((4.2163199048e-2f * z + 2.4181311049e-2f) * z + 4.5470025998e-2f) * z
+                + 7.4953002686e-2f) * z + 1.6666752422e-1f) * z * w + w;
+    return copysignf(upper ? float(M_PI/2) - 2 * p : p, x);
+}
+
+// For positive normal floats, 0 and infinity; denormals are taken as 0.
+inline float fast_log(float x) {
+    // x = m 2^e with m in [sqrt(1/2), sqrt(2)); log m = 2 atanh s with s = (m-1)/(m+1), which
+    // is at most 0.172, so a few terms of atanh's series are enough.
+    uint32_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+    int e = int((bits >> 23) & 0xff) - 126;
+    bits = (bits & 0x807fffffu) | 0x3f000000u;
+    float m;
+    memcpy(&m, &bits, sizeof(m));
+    bool low = m < 0.70710678f;
+    e = low ? e - 1 : e;
+    m = low ? m + m : m;
+    float s = (m - 1) / (m + 1), s2 = s * s;
+    float y = 2 * s + 2 * s * s2 * (0.33333333f + s2 * (0.2f + s2 * (0.14285715f
+                                                                    + s2 * 0.11111111f)));
+    // log 2 in two parts, as for pi/2 above.
+    float fe = float(e);
+    float r = (y + -2.12194440e-4f * fe) + 0.693359375f * fe;
+    r = x < 1.17549435e-38f ? -INFINITY : r;
+    r = x > 3.40282347e+38f ? x : r;
+    return x < 0 ? NAN : r;
+}
+
+inline float fast_pow5(float x) {
+    float x2 = x * x;
+    return x2 * x2 * x;
+}
+
+
+#if defined(RT_FAST_MATH)
+inline void rt_sincos(float x, float& s, float& c) { fast_sincos(x, s, c); }
+inline float rt_sin(float x) { return fast_sin(x); }
+inline float rt_atan2(float y, float x) { return fast_atan2(y, x); }
+inline float rt_asin(float x) { return fast_asin(x); }
+inline double rt_log(double x) { return fast_log(float(x)); }
+inline double rt_pow5(float x) { return fast_pow5(x); }
+#else
+inline void rt_sincos(float x, float& s, float& c) {
+    s = sin(x);
+    c = cos(x);
+}
+inline float rt_sin(float x) { return sin(x); }
+inline float rt_atan2(float y, float x) { return atan2(y, x); }
+inline float rt_asin(float x) { return asin(x); }
+inline double rt_log(double x) { return log(x); }
+inline double rt_pow5(float x) { return pow(x, 5); }
+#endif
+
+#endif
@@ -0,0 +1,284 @@
+#ifndef FILMH
+#define FILMH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include "framebuffer.h"
+#include "tile_scheduler.h"
+
+#include <atomic>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+
+enum filter_kind {
+    filter_box,
+    filter_gaussian,
+    filter_mitchell,
+    filter_blackman_harris,
+    filter_unknown
+};
+
+static const char *filter_names[] = { "box", "gaussian", "mitchell", "blackman-harris" };
+
+filter_kind filter_for_name(const char *name) {
+    for (int f = 0; f < int(filter_unknown); f++)
+        if (!strcmp(name, filter_names[f]))
+            return filter_kind(f);
+    return filter_unknown;
+}
+
+// Footprints are cut off here, so that a sample never reaches more than a few pixels each way.
+const float pixel_filter_max_radius = 4;
+const int pixel_filter_max_width = 2*int(pixel_filter_max_radius) + 2;
+const int pixel_filter_table_size = 256;
+
+// A separable reconstruction filter, f(x, y) = f(x) f(y), tabulated over [0, radius]. Radius 0
+// picks each kind's usual one: half a pixel for the box, which is the pixel-sized average the
+// renderers have always taken, 1.5 for the Gaussian and 2 for Mitchell-Netravali and
+// Blackman-Harris.
+class pixel_filter {
+    public:
+        pixel_filter(filter_kind kind = filter_box, float r = 0);
+
+        // The pixels whose centres lie within radius of a sample at offset d in [0,1) along one
+        // axis of pixel 0: first is the lowest one, relative to pixel 0, and their weights go in
+        // w. Centres exactly radius above the sample count and those radius below do not, so
+        // each sample falls in one pixel of the box filter. Returns how many there are.
+        int footprint(float d, int& first, float w[pixel_filter_max_width]) const {
+            first = int(floorf(d - radius - 0.5f)) + 1;
+            int last = int(floorf(d + radius - 0.5f));
+            for (int k = first; k <= last; k++)
+                w[k - first] = eval(d - 0.5f - float(k));
+            return last - first + 1;
+        }
+
+        // How many pixels beyond its own a sample can reach.
+        int margin() const { return int(ceilf(radius + 0.5f)); }
+
+        filter_kind kind;
+        float radius;
+
+    private:
+        float eval(float x) const {
+            x = fabsf(x);
+            if (x > radius)
+                return 0;
+            int k = int(x * (pixel_filter_table_size / radius));
+            return table[k < pixel_filter_table_size ? k : pixel_filter_table_size - 1];
+        }
+
+        float table[pixel_filter_table_size];
+};
+
+pixel_filter::pixel_filter(filter_kind k, float r) : kind(k) {
+    static const float default_radius[] = { 0.5, 1.5, 2, 2 };
+    radius = r > 0 ? r : default_radius[kind];
+    if (radius > pixel_filter_max_radius)
+        radius = pixel_filter_max_radius;
+    for (int i = 0; i < pixel_filter_table_size; i++) {
+        float x = (i + 0.5f) * radius / pixel_filter_table_size;
+        float f = 1;
+        if (kind == filter_gaussian) {
+            // Shifted down to reach 0 at the radius rather than stopping short of it.
+            const float alpha = 2;
+            f = expf(-alpha*x*x) - expf(-alpha*radius*radius);
+        }
+        else if (kind == filter_mitchell) {
+            // B = C = 1/3, stretched from its natural [-2, 2] to [-radius, radius].
+            const float b = 1.0f/3, c = 1.0f/3;
+            float t = 2*x / radius;
+            if (t < 1)
+                f = ((12 - 9*b - 6*c)*t*t*t + (-18 + 12*b + 6*c)*t*t + (6 - 2*b)) / 6;
+            else
+                f = ((-b - 6*c)*t*t*t + (6*b + 30*c)*t*t + (-12*b - 48*c)*t + (8*b + 24*c)) / 6;
+        }
+        else if (kind == filter_blackman_harris) {
+            float t = x / (2*radius) + 0.5f;
+            f = 0.35875f - 0.48829f*cosf(2*M_PI*t) + 0.14128f*cosf(4*M_PI*t)
+              - 0.01168f*cosf(6*M_PI*t);
+        }
+        table[i] = f;
+    }
+}
+
+
+class film;
+
+// Weighted sums for one tile of a film, and for the margin around it that its samples' filters
+// reach, kept by the one thread rendering the tile and added to the film with film::merge().
+class film_tile {
+    public:
+        film_tile(const film& f, const tile& t);
+
+        // A sample at offset (du, dv) in [0,1)^2 within pixel (i, j), which must be in the tile.
+        void add(int i, int j, float du, float dv, float r, float g, float b);
+
+        int x0, y0, x1, y1;       // the pixels covered, margin included and clipped to the film
+        std::vector<float> cells; // red, green, blue and weight for each of them, rows bottom first
+
+    private:
+        const pixel_filter& filter;
+};
+
+// Film sums are fixed point with this many units to 1, which leaves an int64_t room for sums up to
+// about 2^37, far beyond any pixel's.
+const double film_fixed_one = 16777216.0;   // 2^24
+
+// An image built up from filtered samples. Tiles add theirs through film_tile, and splat() takes
+// samples from anywhere in the frame at any time, as light tracing makes them. Both add into the
+// film with atomic adds, so neither takes a lock; splatted light goes into a buffer of its own
+// that image() adds on unweighted, scaled by the caller. The sums are kept in fixed point, each
+// addend rounded to a multiple of 1/film_fixed_one, because integer adds give the same total in
+// any order: pixels that several tiles' margins reach, and splats from any thread, come out the
+// same however the threads are scheduled.
+class film {
+    public:
+        film(int w, int h, const pixel_filter& f = pixel_filter())
+            : nx(w), ny(h), filter(f), sums(4*size_t(w)*size_t(h)), splats(3*size_t(w)*size_t(h)) {
+            for (size_t k = 0; k < sums.size(); k++)
+                sums[k].store(0, std::memory_order_relaxed);
+            for (size_t k = 0; k < splats.size(); k++)
+                splats[k].store(0, std::memory_order_relaxed);
+        }
+
+        void merge(const film_tile& t);
+        // Light arriving at film position (x, y), in pixels from the bottom left corner, spread
+        // over the pixels the filter reaches.
+        void splat(float x, float y, float r, float g, float b);
+        // Each pixel's weighted mean, plus splat_scale times what was splatted onto it. Pixels
+        // whose weights sum to 0 or less, which only a filter with negative lobes leaves, are black.
+        framebuffer image(float splat_scale = 0) const;
+
+        int nx, ny;
+        pixel_filter filter;
+
+    private:
+        static void add(std::atomic<int64_t>& a, float v) {
+            double x = double(v) * film_fixed_one;
+            // NaNs are dropped, and anything past the range clamped, rather than overflowing.
+            if (!(x == x))
+                return;
+            const double limit = 4e18;
+            x = x < -limit ? -limit : (x > limit ? limit : x);
+            a.fetch_add(int64_t(llround(x)), std::memory_order_relaxed);
+        }
+        static float value(const std::atomic<int64_t>& a) {
+            return float(double(a.load(std::memory_order_relaxed)) / film_fixed_one);
+        }
+
+        std::vector<std::atomic<int64_t> > sums;   // red, green, blue and weight
+        std::vector<std::atomic<int64_t> > splats;
+};
+
+film_tile::film_tile(const film& f, const tile& t) : filter(f.filter) {
+    int m = filter.margin();
+    x0 = t.x0 - m > 0 ? t.x0 - m : 0;
+    y0 = t.y0 - m > 0 ? t.y0 - m : 0;
+    x1 = t.x1 + m < f.nx ? t.x1 + m : f.nx;
+    y1 = t.y1 + m < f.ny ? t.y1 + m : f.ny;
+    cells.assign(4*size_t(x1 - x0)*size_t(y1 - y0), 0.0f);
+}
+
+void film_tile::add(int i, int j, float du, float dv, float r, float g, float b) {
+    float wx[pixel_filter_max_width], wy[pixel_filter_max_width];
+    int fx, fy;
+    int nwx = filter.footprint(du, fx, wx);
+    int nwy = filter.footprint(dv, fy, wy);
+    int w = x1 - x0;
+    for (int y = 0; y < nwy; y++) {
+        int py = j + fy + y;
+        if (py < y0 || py >= y1 || wy[y] == 0)
+            continue;
+        for (int x = 0; x < nwx; x++) {
+            int px = i + fx + x;
+            if (px < x0 || px >= x1)
+                continue;
+            float weight = wx[x] * wy[y];
+            if (weight == 0)
+                continue;
+            float *cell = &cells[4*(size_t(py - y0)*w + (px - x0))];
+            cell[0] += weight * r;
+            cell[1] += weight * g;
+            cell[2] += weight * b;
+            cell[3] += weight;
+        }
+    }
+}
+
+void film::merge(const film_tile& t) {
+    int w = t.x1 - t.x0;
+    for (int j = t.y0; j < t.y1; j++) {
+        for (int i = t.x0; i < t.x1; i++) {
+            const float *cell = &t.cells[4*(size_t(j - t.y0)*w + (i - t.x0))];
+            if (cell[3] == 0)
+                continue;
+            std::atomic<int64_t> *sum = &sums[4*(size_t(j)*nx + i)];
+            for (int c = 0; c < 4; c++)
+                add(sum[c], cell[c]);
+        }
+    }
+}
+
+void film::splat(float x, float y, float r, float g, float b) {
+    int i = int(floorf(x)), j = int(floorf(y));
+    float wx[pixel_filter_max_width], wy[pixel_filter_max_width];
+    int fx, fy;
+    int nwx = filter.footprint(x - float(i), fx, wx);
+    int nwy = filter.footprint(y - float(j), fy, wy);
+    // Splats are not divided by a sum of weights later, so each one's weights add up to 1.
+    float total = 0;
+    for (int yk = 0; yk < nwy; yk++)
+        for (int xk = 0; xk < nwx; xk++)
+            total += wx[xk] * wy[yk];
+    if (!(total > 0))
+        return;
+    r /= total;
+    g /= total;
+    b /= total;
+    for (int yk = 0; yk < nwy; yk++) {
+        int py = j + fy + yk;
+        if (py < 0 || py >= ny)
+            continue;
+        for (int xk = 0; xk < nwx; xk++) {
+            int px = i + fx + xk;
+            float weight = wx[xk] * wy[yk];
+            if (px < 0 || px >= nx || weight == 0)
+                continue;
+            std::atomic<int64_t> *s = &splats[3*(size_t(py)*nx + px)];
+            add(s[0], weight * r);
+            add(s[1], weight * g);
+            add(s[2], weight * b);
+        }
+    }
+}
+
+framebuffer film::image(float splat_scale) const {
+    framebuffer fb(nx, ny);
+    for (int j = 0; j < ny; j++) {
+        for (int i = 0; i < nx; i++) {
+            const std::atomic<int64_t> *sum = &sums[4*(size_t(j)*nx + i)];
+            const std::atomic<int64_t> *s = &splats[3*(size_t(j)*nx + i)];
+            float w = value(sum[3]);
+            float *p = fb.at(i, j);
+            for (int c = 0; c < 3; c++) {
+                p[c] = w > 0 ? value(sum[c]) / w : 0;
+                if (splat_scale != 0)
+                    p[c] += splat_scale * value(s[c]);
+            }
+        }
+    }
+    return fb;
+}
+
+#endif
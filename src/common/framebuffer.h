@@ -0,0 +1,236 @@
+#ifndef FRAMEBUFFERH
+#define FRAMEBUFFERH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include <fstream>
+#include <iostream>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+
+// Linear RGB pixels, with j = 0 as the bottom row of the image. Each pixel is written by exactly
+// one tile, so threads can fill in a shared framebuffer without locking.
+class framebuffer {
+    public:
+        framebuffer(int w, int h) : nx(w), ny(h), pixels(3*size_t(w)*size_t(h), 0.0f) {}
+
+        float* at(int i, int j) { return &pixels[3*(size_t(j)*nx + i)]; }
+        const float* at(int i, int j) const { return &pixels[3*(size_t(j)*nx + i)]; }
+
+        void set(int i, int j, float r, float g, float b) {
+            float *p = at(i, j);
+            p[0] = r; p[1] = g; p[2] = b;
+        }
+
+        int nx, ny;
+        std::vector<float> pixels;
+};
+
+
+// ASCII PPM, gamma 2, top row first.
+void write_ppm_p3(std::ostream& out, const framebuffer& fb) {
+    out << "P3\n" << fb.nx << " " << fb.ny << "\n255\n";
+    for (int j = fb.ny-1; j >= 0; j--) {
+        for (int i = 0; i < fb.nx; i++) {
+            const float *p = fb.at(i, j);
+            int ir = int(255.99*sqrt(p[0]));
+            int ig = int(255.99*sqrt(p[1]));
+            int ib = int(255.99*sqrt(p[2]));
+            out << ir << " " << ig << " " << ib << "\n";
+        }
+    }
+}
+
+
+// Gamma 2 and clamped to [0,255], top row first, three bytes per pixel.
+std::vector<unsigned char> framebuffer_to_rgb8(const framebuffer& fb) {
+    std::vector<unsigned char> rgb(3*size_t(fb.nx)*size_t(fb.ny));
+    size_t k = 0;
+    for (int j = fb.ny-1; j >= 0; j--) {
+        for (int i = 0; i < fb.nx; i++) {
+            const float *p = fb.at(i, j);
+            for (int c = 0; c < 3; c++) {
+                int v = p[c] > 0 ? int(255.99*sqrt(p[c])) : 0;
+                rgb[k++] = (unsigned char)(v < 255 ? v : 255);
+            }
+        }
+    }
+    return rgb;
+}
+
+// Binary PPM, written in one block.
+void write_ppm_p6(std::ostream& out, const framebuffer& fb) {
+    std::vector<unsigned char> rgb = framebuffer_to_rgb8(fb);
+    out << "P6\n" << fb.nx << " " << fb.ny << "\n255\n";
+    out.write((const char*)&rgb[0], rgb.size());
+}
+
+// Portable float map: linear little-endian floats, bottom row first, which is the framebuffer's
+// own layout, so the pixels go out as they are.
+void write_pfm(std::ostream& out, const framebuffer& fb) {
+    out << "PF\n" << fb.nx << " " << fb.ny << "\n-1.0\n";
+    out.write((const char*)&fb.pixels[0], fb.pixels.size()*sizeof(float));
+}
+
+// Reads a portable float map, colour (PF) or grey (Pf), of either byte order. Grey pixels are
+// copied into all three channels.
+bool read_pfm(const char *path, framebuffer& fb) {
+    std::ifstream in(path, std::ios::binary);
+    std::string magic;
+    int w, h;
+    float scale;
+    if (!(in >> magic >> w >> h >> scale) || (magic != "PF" && magic != "Pf") || w <= 0 || h <= 0)
+        return false;
+    in.get();   // the single whitespace character before the pixels
+    int channels = magic == "PF" ? 3 : 1;
+    std::vector<uint32_t> raw(size_t(channels)*w*h);
+    if (!in.read((char*)&raw[0], raw.size()*4))
+        return false;
+    uint32_t probe = 1;
+    bool little_endian_host = *(unsigned char*)&probe == 1;
+    bool swap = (scale < 0) != little_endian_host;
+    fb = framebuffer(w, h);
+    for (size_t k = 0; k < size_t(w)*h; k++) {
+        for (int c = 0; c < 3; c++) {
+            uint32_t v = raw[k*channels + (channels == 3 ? c : 0)];
+            if (swap)
+                v = (v >> 24) | ((v >> 8) & 0xff00) | ((v << 8) & 0xff0000) | (v << 24);
+            memcpy(&fb.pixels[3*k + c], &v, 4);
+        }
+    }
+    return true;
+}
+
+
+inline uint16_t float_to_half(float f) {
+    uint32_t x;
+    memcpy(&x, &f, 4);
+    uint32_t sign = (x >> 16) & 0x8000;
+    int32_t exponent = int32_t((x >> 23) & 0xff) - 127 + 15;
+    uint32_t mantissa = x & 0x7fffff;
+    if (((x >> 23) & 0xff) == 0xff)     // inf and nan
+        return uint16_t(sign | 0x7c00 | (mantissa ? 0x200 : 0));
+    if (exponent >= 31)                  // too large, becomes inf
+        return uint16_t(sign | 0x7c00);
+    if (exponent <= 0) {                 // denormal or zero
+        if (exponent < -10)
+            return uint16_t(sign);
+        mantissa |= 0x800000;
+        uint32_t shift = uint32_t(14 - exponent);
+        uint32_t half = mantissa >> shift;
+        if ((mantissa >> (shift-1)) & 1)  // round half up
+            half++;
+        return uint16_t(sign | half);
+    }
+    uint32_t half = sign | (uint32_t(exponent) << 10) | (mantissa >> 13);
+    if (mantissa & 0x1000)               // round half up; a carry into the exponent is correct
+        half++;
+    return uint16_t(half);
+}
+
+struct byte_writer {
+    std::vector<unsigned char> bytes;
+    void u8(unsigned char v) { bytes.push_back(v); }
+    void u32(uint32_t v) { for (int i = 0; i < 4; i++) u8((unsigned char)(v >> (8*i))); }
+    void u64(uint64_t v) { for (int i = 0; i < 8; i++) u8((unsigned char)(v >> (8*i))); }
+    void f32(float f) { uint32_t v; memcpy(&v, &f, 4); u32(v); }
+    void str(const char *s) { while (*s) u8((unsigned char)*s++); u8(0); }
+    void attribute(const char *name, const char *type, uint32_t size) {
+        str(name); str(type); u32(size);
+    }
+};
+
+// OpenEXR with half-float B, G, R channels, uncompressed scanlines, linear values.
+void write_exr(std::ostream& out, const framebuffer& fb) {
+    byte_writer w;
+    w.u32(20000630);   // magic number
+    w.u32(2);          // version 2, single-part scanline file
+
+    const char *channels[3] = { "B", "G", "R" };
+    w.attribute("channels", "chlist", 3*(2 + 16) + 1);
+    for (int c = 0; c < 3; c++) {
+        w.str(channels[c]);
+        w.u32(1);      // HALF
+        w.u32(0);      // pLinear and reserved bytes
+        w.u32(1);      // x sampling
+        w.u32(1);      // y sampling
+    }
+    w.u8(0);
+    w.attribute("compression", "compression", 1);
+    w.u8(0);           // NO_COMPRESSION
+    w.attribute("dataWindow", "box2i", 16);
+    w.u32(0); w.u32(0); w.u32(uint32_t(fb.nx-1)); w.u32(uint32_t(fb.ny-1));
+    w.attribute("displayWindow", "box2i", 16);
+    w.u32(0); w.u32(0); w.u32(uint32_t(fb.nx-1)); w.u32(uint32_t(fb.ny-1));
+    w.attribute("lineOrder", "lineOrder", 1);
+    w.u8(0);           // INCREASING_Y
+    w.attribute("pixelAspectRatio", "float", 4);
+    w.f32(1);
+    w.attribute("screenWindowCenter", "v2f", 8);
+    w.f32(0); w.f32(0);
+    w.attribute("screenWindowWidth", "float", 4);
+    w.f32(1);
+    w.u8(0);           // end of header
+
+    // Scanline offsets, then one block per scanline holding each channel's row in turn. EXR
+    // puts y = 0 at the top.
+    uint32_t line_bytes = uint32_t(3*2*fb.nx);
+    uint64_t first_line = w.bytes.size() + 8*uint64_t(fb.ny);
+    for (int y = 0; y < fb.ny; y++)
+        w.u64(first_line + uint64_t(y)*(8 + line_bytes));
+    for (int y = 0; y < fb.ny; y++) {
+        w.u32(uint32_t(y));
+        w.u32(line_bytes);
+        for (int c = 2; c >= 0; c--) {
+            for (int i = 0; i < fb.nx; i++) {
+                uint16_t h = float_to_half(fb.at(i, fb.ny-1-y)[c]);
+                w.u8((unsigned char)(h & 0xff));
+                w.u8((unsigned char)(h >> 8));
+            }
+        }
+    }
+    out.write((const char*)&w.bytes[0], w.bytes.size());
+}
+
+
+enum image_format { image_p3, image_p6, image_png, image_pfm, image_exr, image_unknown };
+
+// Output files are typed by extension: .ppm is written as binary P6.
+image_format image_format_for_path(const char *path) {
+    const char *dot = strrchr(path, '.');
+    if (!dot) return image_unknown;
+    if (!strcmp(dot, ".ppm")) return image_p6;
+    if (!strcmp(dot, ".png")) return image_png;
+    if (!strcmp(dot, ".pfm")) return image_pfm;
+    if (!strcmp(dot, ".exr")) return image_exr;
+    return image_unknown;
+}
+
+// Writes every format that needs nothing beyond this header. PNG needs stb_image_write, so the
+// renderers that ship it write PNGs themselves; this returns false for it.
+bool write_image(const char *path, image_format format, const framebuffer& fb) {
+    if (format == image_png || format == image_unknown)
+        return false;
+    std::ofstream out(path, std::ios::binary);
+    if (!out)
+        return false;
+    if (format == image_p3) write_ppm_p3(out, fb);
+    else if (format == image_p6) write_ppm_p6(out, fb);
+    else if (format == image_pfm) write_pfm(out, fb);
+    else write_exr(out, fb);
+    return bool(out);
+}
+
+#endif
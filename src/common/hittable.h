@@ -0,0 +1,387 @@
+#ifndef HITTABLEH
+#define HITTABLEH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include "aabb.h"
+#include "fast_math.h"
+#include "ray_offset.h"
+
+#include <float.h>
+#include <vector>
+
+
+class hittable;
+class material;
+
+// The shortest span hittable::hit_interval() finds, as a fraction of the distances along the ray.
+const float hit_interval_margin = 1e-5f;
+
+void get_sphere_uv(const vec3& p, float& u, float& v) {
+    float phi = rt_atan2(p.z(), p.x());
+    float theta = rt_asin(p.y());
+    u = 1-(phi + M_PI) / (2*M_PI);
+    v = (theta + M_PI/2) / M_PI;
+}
+
+
+struct hit_record
+{
+    float t;
+    float u;
+    float v;
+    vec3 p;
+    float p_error;     // bound on the rounding error in each coordinate of p
+    vec3 normal;
+    material *mat_ptr;
+    const hittable *prim;   // set by intersect(): what finalize()s the rest, null if nothing
+    int prim_id;            // which part of prim was hit, for prim's own use
+    float footprint;   // width of the ray's cone at p, filled in by color() rather than by hit()
+};
+
+// A ray from the surface point of rec in direction dir.
+inline ray spawn_ray(const hit_record& rec, const vec3& dir, float time = 0) {
+    return ray(offset_ray_origin(rec.p, rec.p_error, rec.normal, dir), dir, time);
+}
+
+class hittable  {
+    public:
+        virtual ~hittable() {}
+        virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const = 0;
+        virtual bool bounding_box(float t0, float t1, aabb& box) const = 0;
+        virtual float  pdf_value(const vec3& o, const vec3& v) const  {return 0.0;}
+        virtual vec3 random(const vec3& o) const {return vec3(1, 0, 0);}
+        // A point drawn uniformly over the surface, with its normal, uv and material in rec, and
+        // the surface's area, for integrators that start paths on the lights. Shapes that cannot
+        // be sampled this way return false.
+        virtual bool sample_surface(hit_record& rec, float& area) const { return false; }
+        // Traces the rays of a packet selected by the active mask, narrowing t_max[k] and filling
+        // in rec[k] for every ray k that hits. Returns the mask of rays that hit. The default
+        // traces the rays one at a time; primitives that can do better override it.
+        virtual int hit_packet(const ray_packet& p, int active, float t_min, float *t_max,
+                               hit_record *rec) const;
+        // The span [t_enter, t_exit] of the whole line through r that lies inside this shape,
+        // for closed shapes that bound a medium. The default finds the two ends with two hit()
+        // calls, and so misses spans shorter than hit_interval_margin of the distances along
+        // the ray; shapes that can find both in one query override it, and miss only empty ones.
+        virtual bool hit_interval(const ray& r, float& t_enter, float& t_exit) const;
+        // Whether r hits anything between t_min and t_max, for shadow rays. It may stop at the
+        // first hit it finds, in any order, and fills in nothing. The default calls hit();
+        // shapes and hierarchies that can skip the work of finding the nearest hit override it.
+        virtual bool occluded(const ray& r, float t_min, float t_max) const {
+            hit_record rec;
+            return hit(r, t_min, t_max, rec);
+        }
+        // The traversal half of hit(): finds the same hit, but need only set t, prim and prim_id.
+        // Hierarchies find their nearest hit this way and then call finalize_hit() once, so the
+        // normal, uv and material are worked out for the hit that is kept and not for every
+        // closer one met on the way. The default calls hit() and leaves prim null.
+        virtual bool intersect(const ray& r, float t_min, float t_max, hit_record& rec) const {
+            if (!hit(r, t_min, t_max, rec))
+                return false;
+            rec.prim = 0;
+            return true;
+        }
+        // Fills in p, normal, u, v and mat_ptr for a hit intersect() found on r.
+        virtual void finalize(const ray& r, hit_record& rec) const {}
+};
+
+inline void finalize_hit(const ray& r, hit_record& rec) {
+    if (rec.prim)
+        rec.prim->finalize(r, rec);
+}
+
+int hittable::hit_packet(const ray_packet& p, int active, float t_min, float *t_max,
+                         hit_record *rec) const {
+    int hits = 0;
+    for (int k = 0; k < p.count; k++) {
+        if ((active & (1 << k)) && hit(p.get(k), t_min, t_max[k], rec[k])) {
+            t_max[k] = rec[k].t;
+            hits |= 1 << k;
+        }
+    }
+    return hits;
+}
+
+bool hittable::hit_interval(const ray& r, float& t_enter, float& t_exit) const {
+    hit_record rec1, rec2;
+    if (!hit(r, -FLT_MAX, FLT_MAX, rec1))
+        return false;
+    // The far side is looked for past a margin that scales with the coordinates along the ray,
+    // as its rounding error does, so that the near side is not found again.
+    float scale = fabsf(rec1.t) + r.origin().length() / r.direction().length();
+    if (!hit(r, rec1.t + hit_interval_margin * scale, FLT_MAX, rec2))
+        return false;
+    t_enter = rec1.t;
+    t_exit = rec2.t;
+    return true;
+}
+
+class flip_normals : public hittable {
+    public:
+        flip_normals(hittable *p) : ptr(p) {}
+        virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+            if (ptr->hit(r, t_min, t_max, rec)) {
+                rec.normal = -rec.normal;
+                return true;
+            }
+            else
+                return false;
+        }
+        virtual bool bounding_box(float t0, float t1, aabb& box) const {
+            return ptr->bounding_box(t0, t1, box);
+        }
+        virtual int hit_packet(const ray_packet& p, int active, float t_min, float *t_max,
+                               hit_record *rec) const {
+            int hits = ptr->hit_packet(p, active, t_min, t_max, rec);
+            for (int k = 0; k < p.count; k++)
+                if (hits & (1 << k))
+                    rec[k].normal = -rec[k].normal;
+            return hits;
+        }
+        virtual bool hit_interval(const ray& r, float& t_enter, float& t_exit) const {
+            return ptr->hit_interval(r, t_enter, t_exit);
+        }
+        virtual bool occluded(const ray& r, float t_min, float t_max) const {
+            return ptr->occluded(r, t_min, t_max);
+        }
+        virtual bool sample_surface(hit_record& rec, float& area) const {
+            if (!ptr->sample_surface(rec, area))
+                return false;
+            rec.normal = -rec.normal;
+            return true;
+        }
+        hittable *ptr;
+};
+
+class translate : public hittable {
+    public:
+        translate(hittable *p, const vec3& displacement) : ptr(p), offset(displacement) {}
+        virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+        virtual bool bounding_box(float t0, float t1, aabb& box) const;
+        virtual int hit_packet(const ray_packet& p, int active, float t_min, float *t_max,
+                               hit_record *rec) const;
+        virtual bool occluded(const ray& r, float t_min, float t_max) const {
+            return ptr->occluded(ray(r.origin() - offset, r.direction(), r.time()), t_min, t_max);
+        }
+        hittable *ptr;
+        vec3 offset;
+};
+
+bool translate::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+    ray moved_r(r.origin() - offset, r.direction(), r.time());
+    if (ptr->hit(moved_r, t_min, t_max, rec)) {
+        rec.p += offset;
+        rec.p_error += FLT_EPSILON * max_abs(rec.p);
+        return true;
+    }
+    else
+        return false;
+}
+
+int translate::hit_packet(const ray_packet& p, int active, float t_min, float *t_max,
+                          hit_record *rec) const {
+    ray_packet moved_p = p;
+    for (int a = 0; a < 3; a++)
+        for (int k = 0; k < p.count; k++)
+            moved_p.origin[a][k] -= offset[a];
+    int hits = ptr->hit_packet(moved_p, active, t_min, t_max, rec);
+    for (int k = 0; k < p.count; k++) {
+        if (hits & (1 << k)) {
+            rec[k].p += offset;
+            rec[k].p_error += FLT_EPSILON * max_abs(rec[k].p);
+        }
+    }
+    return hits;
+}
+
+bool translate::bounding_box(float t0, float t1, aabb& box) const {
+    if (ptr->bounding_box(t0, t1, box)) {
+        box = aabb(box.min() + offset, box.max()+offset);
+        return true;
+    }
+    else
+        return false;
+}
+
+
+// translate with an offset that changes over the shutter: p follows a path through n offsets,
+// reached at evenly spaced times from time0 to time1 and joined by straight lines.
+class keyframe_translate : public hittable {
+    public:
+        keyframe_translate(hittable *p, const vec3 *offsets, int n, float t0, float t1)
+            : ptr(p), keys(offsets, offsets + n), time0(t0), time1(t1) {}
+        virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+            vec3 at = offset(r.time());
+            if (!ptr->hit(ray(r.origin() - at, r.direction(), r.time()), t_min, t_max, rec))
+                return false;
+            rec.p += at;
+            rec.p_error += FLT_EPSILON * max_abs(rec.p);
+            return true;
+        }
+        virtual bool bounding_box(float t0, float t1, aabb& box) const;
+        virtual bool occluded(const ray& r, float t_min, float t_max) const {
+            vec3 at = offset(r.time());
+            return ptr->occluded(ray(r.origin() - at, r.direction(), r.time()), t_min, t_max);
+        }
+        vec3 offset(float time) const;
+        hittable *ptr;
+        std::vector<vec3> keys;
+        float time0, time1;
+};
+
+vec3 keyframe_translate::offset(float time) const {
+    int n = int(keys.size());
+    float f = time1 > time0 ? (time - time0) / (time1 - time0) * (n - 1) : 0;
+    if (!(f > 0)) f = 0;
+    if (f > n - 1) f = float(n - 1);
+    int i = int(f);
+    if (i > n - 2) i = n - 2;
+    if (i < 0)
+        return keys[0];
+    float s = f - i;
+    return keys[i] + s*(keys[i+1] - keys[i]);
+}
+
+// The path is straight between keys, so its bounds over [t0,t1] are those at either end and at
+// the keys in between.
+bool keyframe_translate::bounding_box(float t0, float t1, aabb& box) const {
+    aabb b;
+    if (!ptr->bounding_box(t0, t1, b))
+        return false;
+    vec3 lo = offset(t0), hi = lo;
+    vec3 end = offset(t1);
+    int n = int(keys.size());
+    for (int a = 0; a < 3; a++) {
+        lo[a] = ffmin(lo[a], end[a]);
+        hi[a] = ffmax(hi[a], end[a]);
+    }
+    for (int i = 0; i < n; i++) {
+        float t = n > 1 ? time0 + (time1 - time0) * i / (n - 1) : time0;
+        if (t <= t0 || t >= t1)
+            continue;
+        for (int a = 0; a < 3; a++) {
+            lo[a] = ffmin(lo[a], keys[i][a]);
+            hi[a] = ffmax(hi[a], keys[i][a]);
+        }
+    }
+    box = aabb(b.min() + lo, b.max() + hi);
+    return true;
+}
+
+class rotate_y : public hittable {
+    public:
+        rotate_y(hittable *p, float angle);
+        virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+        virtual bool occluded(const ray& r, float t_min, float t_max) const;
+        virtual bool bounding_box(float t0, float t1, aabb& box) const {
+            box = bbox; return hasbox;}
+        virtual int hit_packet(const ray_packet& p, int active, float t_min, float *t_max,
+                               hit_record *rec) const;
+        hittable *ptr;
+        float sin_theta;
+        float cos_theta;
+        bool hasbox;
+        aabb bbox;
+};
+
+rotate_y::rotate_y(hittable *p, float angle) : ptr(p) {
+    float radians = (M_PI / 180.) * angle;
+    sin_theta = sin(radians);
+    cos_theta = cos(radians);
+    hasbox = ptr->bounding_box(0, 1, bbox);
+    vec3 min(FLT_MAX, FLT_MAX, FLT_MAX);
+    vec3 max(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    for (int i = 0; i < 2; i++) {
+        for (int j = 0; j < 2; j++) {
+            for (int k = 0; k < 2; k++) {
+                float x = i*bbox.max().x() + (1-i)*bbox.min().x();
+                float y = j*bbox.max().y() + (1-j)*bbox.min().y();
+                float z = k*bbox.max().z() + (1-k)*bbox.min().z();
+                float newx = cos_theta*x + sin_theta*z;
+                float newz = -sin_theta*x + cos_theta*z;
+                vec3 tester(newx, y, newz);
+                for ( int c = 0; c < 3; c++ )
+                {
+                    if ( tester[c] > max[c] )
+                        max[c] = tester[c];
+                    if ( tester[c] < min[c] )
+                        min[c] = tester[c];
+                }
+            }
+        }
+    }
+    bbox = aabb(min, max);
+}
+
+bool rotate_y::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+    vec3 origin = r.origin();
+    vec3 direction = r.direction();
+    origin[0] = cos_theta*r.origin()[0] - sin_theta*r.origin()[2];
+    origin[2] =  sin_theta*r.origin()[0] + cos_theta*r.origin()[2];
+    direction[0] = cos_theta*r.direction()[0] - sin_theta*r.direction()[2];
+    direction[2] = sin_theta*r.direction()[0] + cos_theta*r.direction()[2];
+    ray rotated_r(origin, direction, r.time());
+    if (ptr->hit(rotated_r, t_min, t_max, rec)) {
+        vec3 p = rec.p;
+        vec3 normal = rec.normal;
+        p[0] = cos_theta*rec.p[0] + sin_theta*rec.p[2];
+        p[2] = -sin_theta*rec.p[0] + cos_theta*rec.p[2];
+        normal[0] = cos_theta*rec.normal[0] + sin_theta*rec.normal[2];
+        normal[2] = -sin_theta*rec.normal[0] + cos_theta*rec.normal[2];
+        // Each new coordinate adds two old ones, each scaled by at most 1.
+        rec.p = p;
+        rec.p_error = 2 * rec.p_error + point_error(max_abs(p));
+        rec.normal = normal;
+        return true;
+    }
+    else
+        return false;
+}
+
+int rotate_y::hit_packet(const ray_packet& p, int active, float t_min, float *t_max,
+                         hit_record *rec) const {
+    ray_packet rotated_p = p;
+    for (int k = 0; k < p.count; k++) {
+        rotated_p.origin[0][k] = cos_theta*p.origin[0][k] - sin_theta*p.origin[2][k];
+        rotated_p.origin[2][k] = sin_theta*p.origin[0][k] + cos_theta*p.origin[2][k];
+        rotated_p.direction[0][k] = cos_theta*p.direction[0][k] - sin_theta*p.direction[2][k];
+        rotated_p.direction[2][k] = sin_theta*p.direction[0][k] + cos_theta*p.direction[2][k];
+    }
+    int hits = ptr->hit_packet(rotated_p, active, t_min, t_max, rec);
+    for (int k = 0; k < p.count; k++) {
+        if (!(hits & (1 << k)))
+            continue;
+        vec3 point = rec[k].p;
+        vec3 normal = rec[k].normal;
+        point[0] = cos_theta*rec[k].p[0] + sin_theta*rec[k].p[2];
+        point[2] = -sin_theta*rec[k].p[0] + cos_theta*rec[k].p[2];
+        normal[0] = cos_theta*rec[k].normal[0] + sin_theta*rec[k].normal[2];
+        normal[2] = -sin_theta*rec[k].normal[0] + cos_theta*rec[k].normal[2];
+        rec[k].p = point;
+        rec[k].p_error = 2 * rec[k].p_error + point_error(max_abs(point));
+        rec[k].normal = normal;
+    }
+    return hits;
+}
+
+bool rotate_y::occluded(const ray& r, float t_min, float t_max) const {
+    vec3 origin = r.origin();
+    vec3 direction = r.direction();
+    origin[0] = cos_theta*r.origin()[0] - sin_theta*r.origin()[2];
+    origin[2] =  sin_theta*r.origin()[0] + cos_theta*r.origin()[2];
+    direction[0] = cos_theta*r.direction()[0] - sin_theta*r.direction()[2];
+    direction[2] = sin_theta*r.direction()[0] + cos_theta*r.direction()[2];
+    return ptr->occluded(ray(origin, direction, r.time()), t_min, t_max);
+}
+
+#endif
+
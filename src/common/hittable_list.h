@@ -21,8 +21,12 @@ class hittable_list: public hittable  {
         hittable_list(hittable **l, int n) {list = l; list_size = n; }
         virtual bool hit(const ray& r, float tmin, float tmax, hit_record& rec) const;
         virtual bool bounding_box(float t0, float t1, aabb& box) const;
+        virtual bool occluded(const ray& r, float t_min, float t_max) const;
+        virtual bool intersect(const ray& r, float t_min, float t_max, hit_record& rec) const;
         virtual float  pdf_value(const vec3& o, const vec3& v) const;
         virtual vec3 random(const vec3& o) const;
+        virtual int hit_packet(const ray_packet& p, int active, float t_min, float *t_max,
+                               hit_record *rec) const;
 
         hittable **list;
         int list_size;
@@ -51,7 +55,7 @@ bool hittable_list::bounding_box(float t0, float t1, aabb& box) const {
     else
         box = temp_box;
     for (int i = 1; i < list_size; i++) {
-        if(list[0]->bounding_box(t0, t1, temp_box)) {
+        if(list[i]->bounding_box(t0, t1, temp_box)) {
             box = surrounding_box(box, temp_box);
         }
         else
@@ -61,11 +65,18 @@ bool hittable_list::bounding_box(float t0, float t1, aabb& box) const {
 }
 
 bool hittable_list::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+    if (!intersect(r, t_min, t_max, rec))
+        return false;
+    finalize_hit(r, rec);
+    return true;
+}
+
+bool hittable_list::intersect(const ray& r, float t_min, float t_max, hit_record& rec) const {
         hit_record temp_rec;
         bool hit_anything = false;
         double closest_so_far = t_max;
         for (int i = 0; i < list_size; i++) {
-            if (list[i]->hit(r, t_min, closest_so_far, temp_rec)) {
+            if (list[i]->intersect(r, t_min, closest_so_far, temp_rec)) {
                 hit_anything = true;
                 closest_so_far = temp_rec.t;
                 rec = temp_rec;
@@ -74,5 +85,21 @@ bool hittable_list::hit(const ray& r, float t_min, float t_max, hit_record& rec)
         return hit_anything;
 }
 
-#endif
+int hittable_list::hit_packet(const ray_packet& p, int active, float t_min, float *t_max,
+                              hit_record *rec) const {
+    // Each object only reports hits closer than the t_max left by the objects before it, so rec
+    // ends up holding the closest hit of every ray.
+    int hits = 0;
+    for (int i = 0; i < list_size; i++)
+        hits |= list[i]->hit_packet(p, active, t_min, t_max, rec);
+    return hits;
+}
 
+bool hittable_list::occluded(const ray& r, float t_min, float t_max) const {
+    for (int i = 0; i < list_size; i++)
+        if (list[i]->occluded(r, t_min, t_max))
+            return true;
+    return false;
+}
+
+#endif
@@ -0,0 +1,233 @@
+#ifndef INSTANCEH
+#define INSTANCEH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include "hittable.h"
+
+#include <float.h>
+#include <math.h>
+
+
+// An affine map, p -> L p + d, stored as the rows of the 3x4 matrix [L | d].
+class affine_transform {
+    public:
+        affine_transform() {
+            for (int i = 0; i < 3; i++)
+                for (int j = 0; j < 4; j++)
+                    m[i][j] = i == j ? 1.0f : 0.0f;
+        }
+
+        static affine_transform translation(const vec3& d);
+        static affine_transform rotation_y(float degrees);
+        static affine_transform rotation(const vec3& axis, float degrees);
+        static affine_transform scaling(float s);
+
+        // The transform that applies b first and then this one.
+        affine_transform operator*(const affine_transform& b) const;
+        affine_transform inverse() const;
+
+        vec3 point(const vec3& p) const {
+            return vec3(m[0][0]*p[0] + m[0][1]*p[1] + m[0][2]*p[2] + m[0][3],
+                        m[1][0]*p[0] + m[1][1]*p[1] + m[1][2]*p[2] + m[1][3],
+                        m[2][0]*p[0] + m[2][1]*p[1] + m[2][2]*p[2] + m[2][3]);
+        }
+        vec3 vector(const vec3& v) const {
+            return vec3(m[0][0]*v[0] + m[0][1]*v[1] + m[0][2]*v[2],
+                        m[1][0]*v[0] + m[1][1]*v[1] + m[1][2]*v[2],
+                        m[2][0]*v[0] + m[2][1]*v[1] + m[2][2]*v[2]);
+        }
+        // L^T v. Normals go to world space by the transpose of the world-to-object map.
+        vec3 transposed_vector(const vec3& v) const {
+            return vec3(m[0][0]*v[0] + m[1][0]*v[1] + m[2][0]*v[2],
+                        m[0][1]*v[0] + m[1][1]*v[1] + m[2][1]*v[2],
+                        m[0][2]*v[0] + m[1][2]*v[1] + m[2][2]*v[2]);
+        }
+        // A bound on the rounding error in point(p), for a p whose coordinates are each off by
+        // up to p_error: that error carried through L, and the rounding of point()'s own sums.
+        float point_error(const vec3& p, float p_error) const {
+            float e = 0;
+            for (int i = 0; i < 3; i++) {
+                float gain = fabsf(m[i][0]) + fabsf(m[i][1]) + fabsf(m[i][2]);
+                float size = fabsf(m[i][0]*p[0]) + fabsf(m[i][1]*p[1]) + fabsf(m[i][2]*p[2])
+                             + fabsf(m[i][3]);
+                e = fmaxf(e, gain * p_error + ::point_error(size));
+            }
+            return e;
+        }
+
+        float m[3][4];
+};
+
+affine_transform affine_transform::translation(const vec3& d) {
+    affine_transform t;
+    for (int i = 0; i < 3; i++)
+        t.m[i][3] = d[i];
+    return t;
+}
+
+// The same rotation as rotate_y: positive angles turn +x towards -z.
+affine_transform affine_transform::rotation_y(float degrees) {
+    float radians = (M_PI / 180.) * degrees;
+    affine_transform t;
+    t.m[0][0] = cos(radians);  t.m[0][2] = sin(radians);
+    t.m[2][0] = -sin(radians); t.m[2][2] = cos(radians);
+    return t;
+}
+
+affine_transform affine_transform::rotation(const vec3& axis, float degrees) {
+    vec3 a = unit_vector(axis);
+    float radians = (M_PI / 180.) * degrees;
+    float c = cos(radians), s = sin(radians);
+    affine_transform t;
+    for (int i = 0; i < 3; i++)
+        for (int j = 0; j < 3; j++)
+            t.m[i][j] = (1 - c)*a[i]*a[j] + (i == j ? c : 0.0f);
+    t.m[0][1] -= s*a[2]; t.m[1][0] += s*a[2];
+    t.m[0][2] += s*a[1]; t.m[2][0] -= s*a[1];
+    t.m[1][2] -= s*a[0]; t.m[2][1] += s*a[0];
+    return t;
+}
+
+affine_transform affine_transform::scaling(float s) {
+    affine_transform t;
+    for (int i = 0; i < 3; i++)
+        t.m[i][i] = s;
+    return t;
+}
+
+affine_transform affine_transform::operator*(const affine_transform& b) const {
+    affine_transform t;
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 4; j++) {
+            t.m[i][j] = m[i][0]*b.m[0][j] + m[i][1]*b.m[1][j] + m[i][2]*b.m[2][j];
+            if (j == 3)
+                t.m[i][j] += m[i][3];
+        }
+    }
+    return t;
+}
+
+affine_transform affine_transform::inverse() const {
+    // The linear part is inverted by cofactors; the translation then undoes L d.
+    float det = m[0][0]*(m[1][1]*m[2][2] - m[1][2]*m[2][1])
+              - m[0][1]*(m[1][0]*m[2][2] - m[1][2]*m[2][0])
+              + m[0][2]*(m[1][0]*m[2][1] - m[1][1]*m[2][0]);
+    float inv_det = 1.0f / det;
+    affine_transform t;
+    t.m[0][0] = (m[1][1]*m[2][2] - m[1][2]*m[2][1]) * inv_det;
+    t.m[0][1] = (m[0][2]*m[2][1] - m[0][1]*m[2][2]) * inv_det;
+    t.m[0][2] = (m[0][1]*m[1][2] - m[0][2]*m[1][1]) * inv_det;
+    t.m[1][0] = (m[1][2]*m[2][0] - m[1][0]*m[2][2]) * inv_det;
+    t.m[1][1] = (m[0][0]*m[2][2] - m[0][2]*m[2][0]) * inv_det;
+    t.m[1][2] = (m[0][2]*m[1][0] - m[0][0]*m[1][2]) * inv_det;
+    t.m[2][0] = (m[1][0]*m[2][1] - m[1][1]*m[2][0]) * inv_det;
+    t.m[2][1] = (m[0][1]*m[2][0] - m[0][0]*m[2][1]) * inv_det;
+    t.m[2][2] = (m[0][0]*m[1][1] - m[0][1]*m[1][0]) * inv_det;
+    vec3 d = t.vector(vec3(m[0][3], m[1][3], m[2][3]));
+    for (int i = 0; i < 3; i++)
+        t.m[i][3] = -d[i];
+    return t;
+}
+
+
+// A placed copy of a shared object, typically a BVH over one model's primitives (the bottom
+// level). Any number of instances can point at the same object, and a BVH over the instances
+// (the top level) finds which copies a ray reaches. Rays are moved into the object's space with
+// one matrix, so a copy costs one object and no geometry however it is placed.
+class instance : public hittable {
+    public:
+        instance(hittable *p, const affine_transform& object_to_world);
+        virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+        virtual bool bounding_box(float t0, float t1, aabb& box) const {
+            box = bbox; return hasbox;}
+        virtual float pdf_value(const vec3& o, const vec3& v) const {
+            return ptr->pdf_value(to_object.point(o), to_object.vector(v));
+        }
+        virtual vec3 random(const vec3& o) const {
+            return to_world.vector(ptr->random(to_object.point(o)));
+        }
+        virtual int hit_packet(const ray_packet& p, int active, float t_min, float *t_max,
+                               hit_record *rec) const;
+        virtual bool hit_interval(const ray& r, float& t_enter, float& t_exit) const {
+            ray object_r(to_object.point(r.origin()), to_object.vector(r.direction()), r.time());
+            return ptr->hit_interval(object_r, t_enter, t_exit);
+        }
+        virtual bool occluded(const ray& r, float t_min, float t_max) const {
+            ray object_r(to_object.point(r.origin()), to_object.vector(r.direction()), r.time());
+            return ptr->occluded(object_r, t_min, t_max);
+        }
+        hittable *ptr;
+        affine_transform to_world;
+        affine_transform to_object;
+        bool hasbox;
+        aabb bbox;
+};
+
+instance::instance(hittable *p, const affine_transform& object_to_world)
+    : ptr(p), to_world(object_to_world), to_object(object_to_world.inverse()) {
+    aabb object_box;
+    hasbox = ptr->bounding_box(0, 1, object_box);
+    vec3 min(FLT_MAX, FLT_MAX, FLT_MAX);
+    vec3 max(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    for (int i = 0; i < 8; i++) {
+        vec3 corner(i & 1 ? object_box.max().x() : object_box.min().x(),
+                    i & 2 ? object_box.max().y() : object_box.min().y(),
+                    i & 4 ? object_box.max().z() : object_box.min().z());
+        vec3 tester = to_world.point(corner);
+        for (int c = 0; c < 3; c++) {
+            min[c] = ffmin(min[c], tester[c]);
+            max[c] = ffmax(max[c], tester[c]);
+        }
+    }
+    bbox = aabb(min, max);
+}
+
+// The object-space direction is not normalized, so a hit's t is the same in both spaces.
+bool instance::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+    ray object_r(to_object.point(r.origin()), to_object.vector(r.direction()), r.time());
+    if (ptr->hit(object_r, t_min, t_max, rec)) {
+        rec.p_error = to_world.point_error(rec.p, rec.p_error);
+        rec.p = to_world.point(rec.p);
+        rec.normal = unit_vector(to_object.transposed_vector(rec.normal));
+        return true;
+    }
+    else
+        return false;
+}
+
+int instance::hit_packet(const ray_packet& p, int active, float t_min, float *t_max,
+                         hit_record *rec) const {
+    ray_packet object_p;
+    object_p.count = p.count;
+    const float (*m)[4] = to_object.m;
+    for (int i = 0; i < 3; i++) {
+        for (int k = 0; k < ray_packet_size; k++) {
+            object_p.origin[i][k] = m[i][0]*p.origin[0][k] + m[i][1]*p.origin[1][k]
+                                  + m[i][2]*p.origin[2][k] + m[i][3];
+            object_p.direction[i][k] = m[i][0]*p.direction[0][k] + m[i][1]*p.direction[1][k]
+                                     + m[i][2]*p.direction[2][k];
+        }
+    }
+    for (int k = 0; k < ray_packet_size; k++)
+        object_p.time[k] = p.time[k];
+    int hits = ptr->hit_packet(object_p, active, t_min, t_max, rec);
+    for (int k = 0; k < p.count; k++) {
+        if (hits & (1 << k)) {
+            rec[k].p_error = to_world.point_error(rec[k].p, rec[k].p_error);
+            rec[k].p = to_world.point(rec[k].p);
+            rec[k].normal = unit_vector(to_object.transposed_vector(rec[k].normal));
+        }
+    }
+    return hits;
+}
+
+#endif
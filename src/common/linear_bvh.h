@@ -0,0 +1,309 @@
+#ifndef LINEARBVHH
+#define LINEARBVHH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include "hittable.h"
+#include "render_stats.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+
+// A flattened BVH node. Nodes are stored in depth-first order, so the first child of an interior
+// node is always the next node in the array and only the second child needs an explicit index.
+struct linear_bvh_node {
+    float bmin[3];
+    float bmax[3];
+    int32_t offset;   // leaf: first primitive, interior: index of the second child
+    uint16_t count;   // number of primitives in a leaf, 0 for interior nodes
+    uint8_t axis;     // split axis of an interior node
+    uint8_t pad;
+};
+
+static_assert(sizeof(linear_bvh_node) == 32, "linear_bvh_node should be 32 bytes");
+
+// Entries in the traversal stacks of hit() and occluded(). A median split over n primitives is at
+// most log2(n)+1 levels deep, so this covers anything built here that fits in memory; an adopted
+// tree has to be checked against it (see linear_bvh_adoptable()).
+const int linear_bvh_stack_size = 64;
+
+
+// The nodes use indices, not pointers, so a tree written to a file can be read back anywhere: see
+// primitive_order() and the constructor that adopts a prebuilt tree.
+class linear_bvh : public hittable {
+    public:
+        linear_bvh() : nodes(0), node_count(0) {}
+        linear_bvh(hittable **l, int n, float time0, float time1, int max_leaf_size = 2);
+        // Adopts a tree built earlier over the same primitives l: tree_nodes are used where they
+        // are, with no copy, so they must outlive the tree, and order gives, for each primitive
+        // the leaves list, its index in l.
+        linear_bvh(hittable **l, const linear_bvh_node *tree_nodes, int tree_node_count,
+                   const uint32_t *order, int order_count);
+        virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+        virtual bool bounding_box(float t0, float t1, aabb& box) const;
+        virtual bool occluded(const ray& r, float t_min, float t_max) const;
+        virtual bool intersect(const ray& r, float t_min, float t_max, hit_record& rec) const;
+
+        // For each of prims, its index in l, the list the tree was built over.
+        std::vector<uint32_t> primitive_order(hittable **l, int n) const;
+
+        const linear_bvh_node *nodes;
+        int node_count;
+        std::vector<hittable*> prims;
+
+    private:
+        linear_bvh(const linear_bvh&);
+        linear_bvh& operator=(const linear_bvh&);
+
+        struct build_prim {
+            aabb box;
+            vec3 centroid;
+            hittable *ptr;
+        };
+
+        int build(std::vector<build_prim>& info, int begin, int end, int max_leaf_size);
+
+        std::vector<linear_bvh_node> storage;   // the nodes of a tree built here
+};
+
+// Whether a tree read from outside, as from a cache, can be adopted over the n primitives l:
+// every child, leaf and order index is in range, no path is deeper than the traversal stacks, and
+// every node's bounds hold what is under it over [time0,time1]. A tree whose primitives have
+// changed shape since it was built fails the last, rather than clipping them.
+bool linear_bvh_adoptable(hittable **l, int n, const linear_bvh_node *nodes, int node_count,
+                          const uint32_t *order, int order_count, float time0, float time1) {
+    if (order_count != n || node_count < (n > 0 ? 1 : 0) || node_count > 2*n)
+        return false;
+    for (int i = 0; i < order_count; i++)
+        if (order[i] >= uint32_t(n))
+            return false;
+    // Children come after their parents, so one pass in order sees every node's depth before its
+    // children need it.
+    std::vector<int> depth(node_count, 0);
+    for (int i = 0; i < node_count; i++) {
+        const linear_bvh_node& node = nodes[i];
+        if (depth[i] >= linear_bvh_stack_size)
+            return false;
+        aabb box;
+        if (node.count > 0) {
+            if (node.offset < 0 || int64_t(node.offset) + node.count > order_count)
+                return false;
+            for (int k = node.offset; k < node.offset + node.count; k++) {
+                if (!l[order[k]]->bounding_box(time0, time1, box))
+                    return false;
+                for (int a = 0; a < 3; a++)
+                    if (box.min()[a] < node.bmin[a] || box.max()[a] > node.bmax[a])
+                        return false;
+            }
+            continue;
+        }
+        if (node.axis > 2 || node.offset <= i+1 || node.offset >= node_count)
+            return false;
+        const int children[2] = { i+1, node.offset };
+        for (int c = 0; c < 2; c++) {
+            const linear_bvh_node& child = nodes[children[c]];
+            for (int a = 0; a < 3; a++)
+                if (child.bmin[a] < node.bmin[a] || child.bmax[a] > node.bmax[a])
+                    return false;
+            depth[children[c]] = std::max(depth[children[c]], depth[i] + 1);
+        }
+    }
+    return true;
+}
+
+
+linear_bvh::linear_bvh(hittable **l, int n, float time0, float time1, int max_leaf_size) {
+    trace_zone zone("linear bvh build", "primitives", n);
+    if (max_leaf_size < 1) max_leaf_size = 1;
+    if (max_leaf_size > 0xffff) max_leaf_size = 0xffff;
+
+    // Bounds are looked up once per primitive, not once per comparison while sorting.
+    std::vector<build_prim> info(n);
+    for (int i = 0; i < n; i++) {
+        if (!l[i]->bounding_box(time0, time1, info[i].box))
+            std::cerr << "no bounding box in linear_bvh constructor\n";
+        info[i].centroid = 0.5*(info[i].box.min() + info[i].box.max());
+        info[i].ptr = l[i];
+    }
+
+    prims.reserve(n);
+    storage.reserve(n > 0 ? 2*n - 1 : 0);
+    if (n > 0)
+        build(info, 0, n, max_leaf_size);
+    nodes = storage.empty() ? 0 : &storage[0];
+    node_count = int(storage.size());
+}
+
+linear_bvh::linear_bvh(hittable **l, const linear_bvh_node *tree_nodes, int tree_node_count,
+                       const uint32_t *order, int order_count)
+    : nodes(tree_nodes), node_count(tree_node_count), prims(order_count) {
+    for (int i = 0; i < order_count; i++)
+        prims[i] = l[order[i]];
+}
+
+std::vector<uint32_t> linear_bvh::primitive_order(hittable **l, int n) const {
+    std::unordered_map<const hittable*, uint32_t> index;
+    for (int i = n-1; i >= 0; i--)
+        index[l[i]] = uint32_t(i);
+    std::vector<uint32_t> order(prims.size());
+    for (size_t i = 0; i < prims.size(); i++)
+        order[i] = index[prims[i]];
+    return order;
+}
+
+int linear_bvh::build(std::vector<build_prim>& info, int begin, int end, int max_leaf_size) {
+    aabb bounds = info[begin].box;
+    vec3 cmin = info[begin].centroid;
+    vec3 cmax = info[begin].centroid;
+    for (int i = begin+1; i < end; i++) {
+        bounds = surrounding_box(bounds, info[i].box);
+        for (int a = 0; a < 3; a++) {
+            cmin[a] = ffmin(cmin[a], info[i].centroid[a]);
+            cmax[a] = ffmax(cmax[a], info[i].centroid[a]);
+        }
+    }
+
+    int index = int(storage.size());
+    storage.push_back(linear_bvh_node());
+    linear_bvh_node node;
+    for (int a = 0; a < 3; a++) {
+        node.bmin[a] = bounds.min()[a];
+        node.bmax[a] = bounds.max()[a];
+    }
+    node.pad = 0;
+
+    int n = end - begin;
+    int axis = aabb(cmin, cmax).longest_axis();
+    // Primitives with coincident centroids cannot be separated by a split, so they share a leaf
+    // (unless there are more of them than a leaf can count).
+    if (n <= max_leaf_size || (cmax[axis] - cmin[axis] <= 0 && n <= 0xffff)) {
+        node.offset = int32_t(prims.size());
+        node.count = uint16_t(n);
+        node.axis = 0;
+        for (int i = begin; i < end; i++)
+            prims.push_back(info[i].ptr);
+        storage[index] = node;
+        return index;
+    }
+
+    int mid = begin + n/2;
+    std::nth_element(info.begin() + begin, info.begin() + mid, info.begin() + end,
+                     [axis](const build_prim& a, const build_prim& b) {
+                         return a.centroid[axis] < b.centroid[axis];
+                     });
+    build(info, begin, mid, max_leaf_size);
+    node.offset = build(info, mid, end, max_leaf_size);
+    node.count = 0;
+    node.axis = uint8_t(axis);
+    storage[index] = node;
+    return index;
+}
+
+bool linear_bvh::bounding_box(float t0, float t1, aabb& b) const {
+    if (node_count == 0)
+        return false;
+    const linear_bvh_node& root = nodes[0];
+    b = aabb(vec3(root.bmin[0], root.bmin[1], root.bmin[2]),
+             vec3(root.bmax[0], root.bmax[1], root.bmax[2]));
+    return true;
+}
+
+bool linear_bvh::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+    if (!intersect(r, t_min, t_max, rec))
+        return false;
+    finalize_hit(r, rec);
+    return true;
+}
+
+bool linear_bvh::intersect(const ray& r, float t_min, float t_max, hit_record& rec) const {
+    if (node_count == 0)
+        return false;
+
+    int stack[linear_bvh_stack_size];
+    int stack_size = 0;
+    int current = 0;
+    bool hit_anything = false;
+    for (;;) {
+        const linear_bvh_node& node = nodes[current];
+        RT_COUNT(node_visits, 1);
+        if (slab_hit(node.bmin, node.bmax, r, t_min, t_max)) {
+            if (node.count > 0) {
+                RT_COUNT(primitive_tests, node.count);
+                // Each hit narrows t_max, so later primitives and nodes only report closer hits.
+                for (int i = 0; i < node.count; i++) {
+                    if (prims[node.offset + i]->intersect(r, t_min, t_max, rec)) {
+                        hit_anything = true;
+                        t_max = rec.t;
+                    }
+                }
+                if (stack_size == 0)
+                    break;
+                current = stack[--stack_size];
+            }
+            else if (r.sign(node.axis)) {
+                stack[stack_size++] = current + 1;
+                current = node.offset;
+            }
+            else {
+                stack[stack_size++] = node.offset;
+                current = current + 1;
+            }
+        }
+        else {
+            if (stack_size == 0)
+                break;
+            current = stack[--stack_size];
+        }
+    }
+    return hit_anything;
+}
+
+// The same walk as hit(), but any hit will do, so it returns at the first one and never needs
+// to visit the nearer child first.
+bool linear_bvh::occluded(const ray& r, float t_min, float t_max) const {
+    if (node_count == 0)
+        return false;
+
+    int stack[linear_bvh_stack_size];
+    int stack_size = 0;
+    int current = 0;
+    for (;;) {
+        const linear_bvh_node& node = nodes[current];
+        RT_COUNT(node_visits, 1);
+        if (slab_hit(node.bmin, node.bmax, r, t_min, t_max)) {
+            if (node.count > 0) {
+                RT_COUNT(primitive_tests, node.count);
+                for (int i = 0; i < node.count; i++)
+                    if (prims[node.offset + i]->occluded(r, t_min, t_max))
+                        return true;
+                if (stack_size == 0)
+                    break;
+                current = stack[--stack_size];
+            }
+            else {
+                stack[stack_size++] = node.offset;
+                current = current + 1;
+            }
+        }
+        else {
+            if (stack_size == 0)
+                break;
+            current = stack[--stack_size];
+        }
+    }
+    return false;
+}
+
+#endif
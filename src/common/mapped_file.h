@@ -0,0 +1,96 @@
+#ifndef MAPPEDFILEH
+#define MAPPEDFILEH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include <fstream>
+#include <stddef.h>
+#include <vector>
+#ifndef _MSC_VER
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+// A read-only view of a whole file. Where the platform allows, the file is memory-mapped and its
+// pages are read in as they are touched; otherwise it is read into memory in one go.
+class mapped_file {
+    public:
+        mapped_file() : bytes(0), length(0), mapped(false) {}
+        ~mapped_file() { close(); }
+
+        bool open(const char *path);
+        void close();
+
+        const char *data() const { return bytes; }
+        size_t size() const { return length; }
+
+    private:
+        mapped_file(const mapped_file&);
+        mapped_file& operator=(const mapped_file&);
+
+        const char *bytes;
+        size_t length;
+        bool mapped;
+        std::vector<char> buffer;
+};
+
+
+bool mapped_file::open(const char *path) {
+    close();
+#ifndef _MSC_VER
+    int fd = ::open(path, O_RDONLY);
+    if (fd >= 0) {
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void *p = mmap(0, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) {
+                // Loaders read front to back.
+                madvise(p, size_t(st.st_size), MADV_SEQUENTIAL);
+                ::close(fd);
+                bytes = static_cast<const char*>(p);
+                length = size_t(st.st_size);
+                mapped = true;
+                return true;
+            }
+        }
+        ::close(fd);
+    }
+#endif
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        return false;
+    in.seekg(0, std::ios::end);
+    std::streamoff n = in.tellg();
+    in.seekg(0, std::ios::beg);
+    buffer.resize(size_t(n) + 1);
+    in.read(&buffer[0], n);
+    if (!in)
+        return false;
+    bytes = &buffer[0];
+    length = size_t(n);
+    return true;
+}
+
+void mapped_file::close() {
+#ifndef _MSC_VER
+    if (mapped)
+        munmap(const_cast<char*>(bytes), length);
+#endif
+    std::vector<char>().swap(buffer);
+    bytes = 0;
+    length = 0;
+    mapped = false;
+}
+
+#endif
@@ -0,0 +1,454 @@
+#ifndef MESHIOH
+#define MESHIOH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include "mapped_file.h"
+
+#include <ctype.h>
+#include <iostream>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+// An indexed triangle mesh as flat arrays, which is how triangle_mesh keeps it too: three floats
+// per vertex position (and normal, if there are any), two per texture coordinate, and three
+// vertex indices per triangle.
+struct mesh_data {
+    size_t vertex_count() const { return positions.size() / 3; }
+    size_t triangle_count() const { return indices.size() / 3; }
+
+    std::vector<float> positions;
+    std::vector<float> normals;     // empty, or one per vertex
+    std::vector<float> texcoords;   // empty, or one per vertex
+    std::vector<uint32_t> indices;
+};
+
+
+// Reads a file front to back, a token at a time, without copying it line by line. The file need
+// not end in a newline (or anything else) for the last token to be read.
+class mesh_reader {
+    public:
+        mesh_reader(const char *begin, const char *end) : p(begin), end(end) {}
+
+        bool at_end() const { return p >= end; }
+
+        void skip_spaces() {
+            while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+                p++;
+        }
+        void skip_line() {
+            while (p < end && *p != '\n')
+                p++;
+            if (p < end)
+                p++;
+        }
+        bool at_line_end() {
+            skip_spaces();
+            return p >= end || *p == '\n' || *p == '#';
+        }
+
+        // The next whitespace-separated token on the current line.
+        std::string token() {
+            skip_spaces();
+            const char *start = p;
+            while (p < end && !isspace((unsigned char)*p))
+                p++;
+            return std::string(start, p);
+        }
+
+        bool number(double& value) {
+            skip_spaces();
+            char buf[64];
+            size_t n = 0;
+            while (p < end && n+1 < sizeof(buf) && !isspace((unsigned char)*p) && *p != '/')
+                buf[n++] = *p++;
+            buf[n] = 0;
+            char *stop;
+            value = strtod(buf, &stop);
+            return n > 0 && *stop == 0;
+        }
+
+        // Reads an integer within the current token, stopping at '/'. Returns false if there is
+        // none, as in the empty texture index of "f 1//1".
+        bool integer(long& value) {
+            const char *start = p;
+            bool negative = p < end && *p == '-';
+            if (negative)
+                p++;
+            long v = 0;
+            while (p < end && *p >= '0' && *p <= '9')
+                v = 10*v + (*p++ - '0');
+            value = negative ? -v : v;
+            return p > start + (negative ? 1 : 0);
+        }
+
+        char peek() const { return p < end ? *p : 0; }
+        void advance() { p++; }
+        const char *position() const { return p; }
+        void seek(const char *q) { p = q; }
+
+    private:
+        const char *p;
+        const char *end;
+};
+
+
+struct obj_corner {
+    long v, t, n;
+    bool operator==(const obj_corner& o) const { return v == o.v && t == o.t && n == o.n; }
+};
+
+struct obj_corner_hash {
+    size_t operator()(const obj_corner& c) const {
+        uint64_t h = uint64_t(c.v) * 0x9e3779b97f4a7c15ULL;
+        h ^= uint64_t(c.t) + 0x7f4a7c159e3779b9ULL + (h << 6) + (h >> 2);
+        h ^= uint64_t(c.n) + 0x94d049bb133111ebULL + (h << 6) + (h >> 2);
+        return size_t(h);
+    }
+};
+
+
+// Wavefront OBJ: v, vt and vn lines and polygonal f lines, triangulated as fans. Faces that only
+// use positions share the position array; otherwise each distinct v/vt/vn triple becomes one
+// vertex.
+bool load_obj(const char *path, mesh_data& mesh) {
+    mapped_file file;
+    if (!file.open(path)) {
+        std::cerr << "could not open " << path << "\n";
+        return false;
+    }
+    mesh_reader in(file.data(), file.data() + file.size());
+    std::vector<float> pos, tex, nrm;
+    std::vector<long> corners;   // (v, vt, vn) per triangle corner, 0-based, -1 when absent
+    bool separate_attributes = false;
+    std::vector<long> face;
+    int line = 1;
+    for (; !in.at_end(); in.skip_line(), line++) {
+        if (in.at_line_end())
+            continue;
+        std::string kind = in.token();
+        if (kind == "v" || kind == "vn" || kind == "vt") {
+            std::vector<float>& out = kind == "v" ? pos : (kind == "vn" ? nrm : tex);
+            int n = kind == "vt" ? 2 : 3;
+            for (int k = 0; k < n; k++) {
+                double value;
+                if (!in.number(value)) {
+                    std::cerr << path << ":" << line << ": bad " << kind << " line\n";
+                    return false;
+                }
+                out.push_back(float(value));
+            }
+        }
+        else if (kind == "f") {
+            face.clear();
+            while (!in.at_line_end()) {
+                long index[3] = { 0, 0, 0 };
+                long counts[3] = { long(pos.size()/3), long(tex.size()/2), long(nrm.size()/3) };
+                for (int k = 0; k < 3; k++) {
+                    long value;
+                    if (in.integer(value))
+                        index[k] = value < 0 ? counts[k] + value + 1 : value;
+                    if (in.peek() != '/')
+                        break;
+                    in.advance();
+                }
+                for (int k = 0; k < 3; k++) {
+                    if (index[k] > counts[k] || (k == 0 && index[k] <= 0)) {
+                        std::cerr << path << ":" << line << ": bad face index\n";
+                        return false;
+                    }
+                    face.push_back(index[k] - 1);
+                }
+                separate_attributes |= index[1] > 0 || index[2] > 0;
+                if (!isspace((unsigned char)in.peek()) && !in.at_end()) {
+                    std::cerr << path << ":" << line << ": bad face\n";
+                    return false;
+                }
+            }
+            for (size_t k = 2; k < face.size()/3; k++) {
+                corners.insert(corners.end(), face.begin(), face.begin() + 3);
+                corners.insert(corners.end(), face.begin() + 3*(k-1), face.begin() + 3*k);
+                corners.insert(corners.end(), face.begin() + 3*k, face.begin() + 3*k + 3);
+            }
+        }
+        // Groups, objects, materials and smoothing groups don't change the geometry.
+    }
+
+    mesh = mesh_data();
+    if (!separate_attributes) {
+        mesh.positions.swap(pos);
+        mesh.indices.reserve(corners.size()/3);
+        for (size_t c = 0; c < corners.size(); c += 3)
+            mesh.indices.push_back(uint32_t(corners[c]));
+        return true;
+    }
+
+    bool has_tex = false, has_nrm = false;
+    for (size_t c = 0; c < corners.size(); c += 3) {
+        has_tex |= corners[c+1] >= 0;
+        has_nrm |= corners[c+2] >= 0;
+    }
+    typedef std::unordered_map<obj_corner, uint32_t, obj_corner_hash> corner_map;
+    corner_map vertex_ids;
+    for (size_t c = 0; c < corners.size(); c += 3) {
+        obj_corner key = { corners[c], corners[c+1], corners[c+2] };
+        corner_map::iterator it = vertex_ids.find(key);
+        if (it != vertex_ids.end()) {
+            mesh.indices.push_back(it->second);
+            continue;
+        }
+        uint32_t id = uint32_t(mesh.vertex_count());
+        vertex_ids[key] = id;
+        mesh.indices.push_back(id);
+        mesh.positions.insert(mesh.positions.end(), &pos[3*corners[c]], &pos[3*corners[c]+3]);
+        if (has_tex) {
+            for (int k = 0; k < 2; k++)
+                mesh.texcoords.push_back(corners[c+1] >= 0 ? tex[2*corners[c+1] + k] : 0.0f);
+        }
+        if (has_nrm) {
+            for (int k = 0; k < 3; k++)
+                mesh.normals.push_back(corners[c+2] >= 0 ? nrm[3*corners[c+2] + k] : 0.0f);
+        }
+    }
+    return true;
+}
+
+
+// A PLY property: its name, its type's size in bytes, and for lists, the size of the count.
+struct ply_property {
+    std::string name;
+    int type;
+    bool is_float;
+    bool is_signed;
+    int count_type;   // 0 unless this is a list
+};
+
+struct ply_element {
+    std::string name;
+    size_t count;
+    std::vector<ply_property> properties;
+};
+
+inline bool ply_type(const std::string& name, int& size, bool& is_float, bool& is_signed) {
+    static const struct { const char *name; int size; bool is_float; bool is_signed; } types[] = {
+        { "char", 1, false, true },   { "int8", 1, false, true },
+        { "uchar", 1, false, false }, { "uint8", 1, false, false },
+        { "short", 2, false, true },  { "int16", 2, false, true },
+        { "ushort", 2, false, false },{ "uint16", 2, false, false },
+        { "int", 4, false, true },    { "int32", 4, false, true },
+        { "uint", 4, false, false },  { "uint32", 4, false, false },
+        { "float", 4, true, true },   { "float32", 4, true, true },
+        { "double", 8, true, true },  { "float64", 8, true, true },
+    };
+    for (size_t i = 0; i < sizeof(types)/sizeof(types[0]); i++) {
+        if (name == types[i].name) {
+            size = types[i].size;
+            is_float = types[i].is_float;
+            is_signed = types[i].is_signed;
+            return true;
+        }
+    }
+    return false;
+}
+
+// One binary value, in the file's byte order.
+inline double ply_binary_value(const char *p, int size, bool is_float, bool is_signed,
+                               bool big_endian) {
+    unsigned char b[8];
+    for (int k = 0; k < size; k++)
+        b[k] = (unsigned char)p[big_endian ? size-1-k : k];
+    uint64_t bits = 0;
+    for (int k = size; k-- > 0;)
+        bits = (bits << 8) | b[k];
+    if (is_float) {
+        if (size == 4) {
+            uint32_t u = uint32_t(bits);
+            float f;
+            memcpy(&f, &u, 4);
+            return f;
+        }
+        double d;
+        memcpy(&d, &bits, 8);
+        return d;
+    }
+    if (is_signed && size < 8 && (bits >> (8*size - 1)))
+        return double(int64_t(bits | (~uint64_t(0) << (8*size))));
+    return double(bits);
+}
+
+// Stanford PLY, ASCII or binary in either byte order: the vertex element's x, y, z and optional
+// nx, ny, nz and u, v (or s, t), and the face element's vertex_indices list, triangulated as fans.
+bool load_ply(const char *path, mesh_data& mesh) {
+    mapped_file file;
+    if (!file.open(path)) {
+        std::cerr << "could not open " << path << "\n";
+        return false;
+    }
+    mesh_reader in(file.data(), file.data() + file.size());
+    if (in.token() != "ply") {
+        std::cerr << path << ": not a PLY file\n";
+        return false;
+    }
+    std::string format;
+    std::vector<ply_element> elements;
+    for (in.skip_line(); !in.at_end(); in.skip_line()) {
+        std::string kind = in.token();
+        if (kind == "format") {
+            format = in.token();
+        }
+        else if (kind == "element") {
+            ply_element e;
+            e.name = in.token();
+            double count;
+            in.number(count);
+            e.count = size_t(count);
+            elements.push_back(e);
+        }
+        else if (kind == "property" && !elements.empty()) {
+            ply_property prop;
+            std::string type = in.token();
+            int count_size = 0;
+            bool count_float, count_signed;
+            if (type == "list") {
+                if (!ply_type(in.token(), count_size, count_float, count_signed) || count_float) {
+                    std::cerr << path << ": bad list count type\n";
+                    return false;
+                }
+                type = in.token();
+            }
+            if (!ply_type(type, prop.type, prop.is_float, prop.is_signed)) {
+                std::cerr << path << ": unknown property type " << type << "\n";
+                return false;
+            }
+            prop.count_type = count_size;
+            prop.name = in.token();
+            elements.back().properties.push_back(prop);
+        }
+        else if (kind == "end_header") {
+            in.skip_line();
+            break;
+        }
+    }
+    bool ascii = format == "ascii";
+    bool big_endian = format == "binary_big_endian";
+    if (!ascii && !big_endian && format != "binary_little_endian") {
+        std::cerr << path << ": unknown PLY format " << format << "\n";
+        return false;
+    }
+
+    mesh = mesh_data();
+    const char *end = file.data() + file.size();
+    for (size_t e = 0; e < elements.size(); e++) {
+        const ply_element& el = elements[e];
+        bool is_vertex = el.name == "vertex";
+        bool is_face = el.name == "face";
+        // Where each property of interest goes: 0-2 position, 3-5 normal, 6-7 texcoord,
+        // 8 the face's index list, -1 skipped.
+        std::vector<int> slot(el.properties.size(), -1);
+        bool has_normals = false, has_texcoords = false;
+        for (size_t k = 0; k < el.properties.size(); k++) {
+            static const char *names[] = { "x", "y", "z", "nx", "ny", "nz", "u", "v" };
+            const std::string& name = el.properties[k].name;
+            for (int s = 0; is_vertex && s < 8; s++)
+                if (name == names[s])
+                    slot[k] = s;
+            if (is_vertex && (name == "s" || name == "texture_u")) slot[k] = 6;
+            if (is_vertex && (name == "t" || name == "texture_v")) slot[k] = 7;
+            if (is_face && (name == "vertex_indices" || name == "vertex_index"))
+                slot[k] = 8;
+            has_normals |= slot[k] >= 3 && slot[k] <= 5;
+            has_texcoords |= slot[k] >= 6 && slot[k] <= 7;
+        }
+        if (is_vertex) {
+            mesh.positions.resize(3*el.count);
+            if (has_normals) mesh.normals.resize(3*el.count);
+            if (has_texcoords) mesh.texcoords.resize(2*el.count);
+        }
+        std::vector<uint32_t> polygon;
+        for (size_t i = 0; i < el.count; i++) {
+            polygon.clear();
+            for (size_t k = 0; k < el.properties.size(); k++) {
+                const ply_property& prop = el.properties[k];
+                size_t n = 1;
+                bool ok = true;
+                double value = 0;
+                if (prop.count_type) {
+                    if (ascii)
+                        ok = in.number(value);
+                    else if (in.position() + prop.count_type <= end) {
+                        value = ply_binary_value(in.position(), prop.count_type, false, false,
+                                                 big_endian);
+                        in.seek(in.position() + prop.count_type);
+                    }
+                    else
+                        ok = false;
+                    n = size_t(value);
+                }
+                for (size_t j = 0; ok && j < n; j++) {
+                    if (ascii)
+                        ok = in.number(value);
+                    else if (in.position() + prop.type <= end) {
+                        value = ply_binary_value(in.position(), prop.type, prop.is_float,
+                                                 prop.is_signed, big_endian);
+                        in.seek(in.position() + prop.type);
+                    }
+                    else
+                        ok = false;
+                    if (slot[k] == 8)
+                        polygon.push_back(uint32_t(value));
+                    else if (slot[k] >= 0 && slot[k] < 3)
+                        mesh.positions[3*i + slot[k]] = float(value);
+                    else if (slot[k] >= 3 && slot[k] < 6)
+                        mesh.normals[3*i + slot[k] - 3] = float(value);
+                    else if (slot[k] >= 6)
+                        mesh.texcoords[2*i + slot[k] - 6] = float(value);
+                }
+                if (!ok) {
+                    std::cerr << path << ": " << el.name << " " << i << " is cut short\n";
+                    return false;
+                }
+            }
+            if (ascii)
+                in.skip_line();
+            for (size_t k = 2; k < polygon.size(); k++) {
+                mesh.indices.push_back(polygon[0]);
+                mesh.indices.push_back(polygon[k-1]);
+                mesh.indices.push_back(polygon[k]);
+            }
+        }
+    }
+    for (size_t i = 0; i < mesh.indices.size(); i++) {
+        if (mesh.indices[i] >= mesh.vertex_count()) {
+            std::cerr << path << ": face index out of range\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+
+// Loads an .obj or .ply file.
+bool load_mesh(const char *path, mesh_data& mesh) {
+    const char *dot = strrchr(path, '.');
+    if (dot && !strcmp(dot, ".obj"))
+        return load_obj(path, mesh);
+    if (dot && !strcmp(dot, ".ply"))
+        return load_ply(path, mesh);
+    std::cerr << "unsupported mesh format: " << path << "\n";
+    return false;
+}
+
+#endif
@@ -20,6 +20,9 @@ class moving_sphere: public hittable  {
         moving_sphere(vec3 cen0, vec3 cen1, float t0, float t1, float r, material *m) : center0(cen0), center1(cen1), time0(t0),time1(t1), radius(r), mat_ptr(m)  {};
         virtual bool hit(const ray& r, float tmin, float tmax, hit_record& rec) const;
         virtual bool bounding_box(float t0, float t1, aabb& box) const;
+        virtual bool occluded(const ray& r, float t_min, float t_max) const;
+        virtual bool intersect(const ray& r, float t_min, float t_max, hit_record& rec) const;
+        virtual void finalize(const ray& r, hit_record& rec) const;
         vec3 center(float time) const;
         vec3 center0, center1;
         float time0, time1;
@@ -40,9 +43,8 @@ bool moving_sphere::bounding_box(float t0, float t1, aabb& box) const {
 }
 
 
-
 // replace "center" with "center(r.time())"
-bool moving_sphere::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+bool moving_sphere::intersect(const ray& r, float t_min, float t_max, hit_record& rec) const {
     vec3 oc = r.origin() - center(r.time());
     float a = dot(r.direction(), r.direction());
     float b = dot(oc, r.direction());
@@ -52,23 +54,48 @@ bool moving_sphere::hit(const ray& r, float t_min, float t_max, hit_record& rec)
         float temp = (-b - sqrt(discriminant))/a;
         if (temp < t_max && temp > t_min) {
             rec.t = temp;
-            rec.p = r.point_at_parameter(rec.t);
-            rec.normal = (rec.p - center(r.time())) / radius;
-            rec.mat_ptr = mat_ptr;
+            rec.prim = this;
             return true;
         }
         temp = (-b + sqrt(discriminant))/a;
         if (temp < t_max && temp > t_min) {
             rec.t = temp;
-            rec.p = r.point_at_parameter(rec.t);
-            rec.normal = (rec.p - center(r.time())) / radius;
-            rec.mat_ptr = mat_ptr;
+            rec.prim = this;
             return true;
         }
     }
     return false;
 }
 
+void moving_sphere::finalize(const ray& r, hit_record& rec) const {
+    vec3 c = center(r.time());
+    rec.p = r.point_at_parameter(rec.t);
+    rec.p_error = reproject_to_sphere(rec.p, c, radius);
+    rec.normal = (rec.p - c) / radius;
+    rec.mat_ptr = mat_ptr;
+}
 
-#endif
+bool moving_sphere::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+    if (!intersect(r, t_min, t_max, rec))
+        return false;
+    finalize(r, rec);
+    return true;
+}
+
+bool moving_sphere::occluded(const ray& r, float t_min, float t_max) const {
+    vec3 oc = r.origin() - center(r.time());
+    float a = dot(r.direction(), r.direction());
+    float b = dot(oc, r.direction());
+    float c = dot(oc, oc) - radius*radius;
+    float discriminant = b*b - a*c;
+    if (discriminant <= 0)
+        return false;
+    float temp = (-b - sqrt(discriminant))/a;
+    if (temp < t_max && temp > t_min)
+        return true;
+    temp = (-b + sqrt(discriminant))/a;
+    return temp < t_max && temp > t_min;
+}
 
+
+#endif
@@ -0,0 +1,157 @@
+#ifndef NUMAH
+#define NUMAH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include "hittable.h"
+
+#include <stdio.h>
+#include <thread>
+#include <vector>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+
+// The CPUs of each NUMA node, as Linux lists them under /sys/devices/system/node. Elsewhere, or
+// where that cannot be read, all of the hardware threads make up one node.
+struct numa_topology {
+    int nodes() const { return int(node_cpus.size()); }
+
+    // The CPU and node for worker thread w. Workers are spread round the nodes, so any number of
+    // them loads every socket evenly, and then round each node's CPUs.
+    int worker_cpu(int w, int& node) const {
+        node = w % nodes();
+        const std::vector<int>& cpus = node_cpus[node];
+        return cpus[(w / nodes()) % cpus.size()];
+    }
+
+    std::vector<std::vector<int> > node_cpus;
+};
+
+// Reads a list such as "0-3,8-11" into cpus.
+inline bool parse_cpu_list(const char *s, std::vector<int>& cpus) {
+    for (;;) {
+        int first, last, used;
+        if (sscanf(s, "%d%n", &first, &used) != 1)
+            return false;
+        s += used;
+        last = first;
+        if (*s == '-') {
+            if (sscanf(s + 1, "%d%n", &last, &used) != 1)
+                return false;
+            s += used + 1;
+        }
+        for (int c = first; c <= last; c++)
+            cpus.push_back(c);
+        if (*s != ',')
+            return !cpus.empty();
+        s++;
+    }
+}
+
+inline numa_topology numa_detect() {
+    numa_topology t;
+#ifdef __linux__
+    // Node numbers can have gaps, so a missing node does not end the search straight away.
+    for (int node = 0, missing = 0; missing < 64; node++) {
+        char path[64], line[4096];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        FILE *f = fopen(path, "r");
+        if (!f) {
+            missing++;
+            continue;
+        }
+        std::vector<int> cpus;
+        if (fgets(line, sizeof(line), f) && parse_cpu_list(line, cpus))
+            t.node_cpus.push_back(cpus);
+        fclose(f);
+    }
+#endif
+    if (t.node_cpus.empty()) {
+        unsigned int n = std::thread::hardware_concurrency();
+        t.node_cpus.resize(1);
+        for (unsigned int c = 0; c < (n > 0 ? n : 1); c++)
+            t.node_cpus[0].push_back(int(c));
+    }
+    return t;
+}
+
+// Which node the calling thread was pinned to by numa_pin_thread(); 0 for threads never pinned.
+inline int& numa_current_node() {
+    static thread_local int node = 0;
+    return node;
+}
+
+// Keeps the calling thread on cpu, and records its node. Threads it starts afterwards inherit the
+// CPU. Returns false, leaving the thread free to move, where that is not supported.
+inline bool numa_pin_thread(int cpu, int node) {
+    numa_current_node() = node;
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    (void)cpu;
+    return false;
+#endif
+}
+
+
+// A read-only part of a scene, such as the world or its lights, built once per NUMA node by a
+// thread pinned there, so that under the kernel's first-touch policy each copy's BVH nodes,
+// shapes, materials and procedural textures sit in that node's memory. Each query goes to the copy
+// for the calling thread's node; hits carry that copy's materials, so shading stays local too.
+// Image texels are not copied: they live in image_texture_cache(), which every node shares.
+class numa_replicated : public hittable {
+    public:
+        numa_replicated(hittable **copies, int n) : copies(copies), n(n) {}
+
+        virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+            return local()->hit(r, t_min, t_max, rec);
+        }
+        virtual bool bounding_box(float t0, float t1, aabb& box) const {
+            return local()->bounding_box(t0, t1, box);
+        }
+        virtual float pdf_value(const vec3& o, const vec3& v) const {
+            return local()->pdf_value(o, v);
+        }
+        virtual vec3 random(const vec3& o) const { return local()->random(o); }
+        virtual bool sample_surface(hit_record& rec, float& area) const {
+            return local()->sample_surface(rec, area);
+        }
+        virtual int hit_packet(const ray_packet& p, int active, float t_min, float *t_max,
+                               hit_record *rec) const {
+            return local()->hit_packet(p, active, t_min, t_max, rec);
+        }
+        virtual bool hit_interval(const ray& r, float& t_enter, float& t_exit) const {
+            return local()->hit_interval(r, t_enter, t_exit);
+        }
+        virtual bool occluded(const ray& r, float t_min, float t_max) const {
+            return local()->occluded(r, t_min, t_max);
+        }
+        virtual bool intersect(const ray& r, float t_min, float t_max, hit_record& rec) const {
+            return local()->intersect(r, t_min, t_max, rec);
+        }
+
+    private:
+        const hittable *local() const {
+            int node = numa_current_node();
+            return copies[node < n ? node : 0];
+        }
+
+        hittable **copies;
+        int n;
+};
+
+#endif
@@ -0,0 +1,496 @@
+#ifndef PAGEDMESHH
+#define PAGEDMESHH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include "hittable.h"
+#include "linear_bvh.h"
+#include "mesh_io.h"
+#include "render_stats.h"
+#include "triangle_mesh.h"
+
+#include <algorithm>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+
+// A triangle mesh kept mostly on disk. The mesh is cut into chunks of nearby triangles, each a
+// triangle_mesh with its own tree, and the chunks are written to a backing file; only the top of
+// the tree, down to the chunks' bounds, stays in memory. Rays page chunks in as they reach them,
+// and once the resident chunks pass the budget the ones used least recently are pushed out.
+// Rays traced one at a time page in whatever chunk they reach next, which thrashes once the
+// rays are incoherent and the budget is well under the mesh; hit_batch() instead runs each chunk
+// against all of the batch's rays that enter it, so a chunk is read at most once a batch.
+//
+// Rays may come from any number of threads. A chunk one thread is still tracing stays alive when
+// another pushes it out, so memory can run over the budget by about a chunk a thread.
+class paged_mesh : public hittable {
+    public:
+        // Takes over the mesh's arrays, and frees them once the chunks are written out.
+        paged_mesh(mesh_data&& m, material *mat, size_t max_resident_bytes = size_t(64) << 20,
+                   int chunk_triangles = 4096);
+        ~paged_mesh();
+
+        // The most recently used chunk always stays, however small the budget.
+        void set_budget(size_t max_resident_bytes);
+
+        virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+        virtual bool bounding_box(float t0, float t1, aabb& box) const;
+        virtual int hit_packet(const ray_packet& p, int active, float t_min, float *t_max,
+                               hit_record *rec) const;
+        // hit() for n rays at once, narrowing t_max[k] and filling in rec[k] for every ray k
+        // that hits. Returns how many hit, and sets hits[k] for each.
+        int hit_batch(const ray *rays, int n, float t_min, float *t_max, hit_record *rec,
+                      bool *hits) const;
+        virtual bool occluded(const ray& r, float t_min, float t_max) const;
+        virtual bool intersect(const ray& r, float t_min, float t_max, hit_record& rec) const;
+        virtual void finalize(const ray& r, hit_record& rec) const;
+
+        size_t triangle_count() const { return triangles; }
+        size_t chunk_count() const { return chunks.size(); }
+        size_t resident_bytes() const;
+        size_t chunks_read() const;
+
+        material *mat_ptr;
+
+    private:
+        paged_mesh(const paged_mesh&);
+        paged_mesh& operator=(const paged_mesh&);
+
+        typedef std::shared_ptr<const triangle_mesh> chunk_ptr;
+
+        // Where a chunk sits in the backing store, and how big its arrays are.
+        struct chunk_info {
+            size_t offset;
+            size_t bytes;
+            uint32_t vertices, triangles, nodes;
+            bool normals, texcoords;
+        };
+        struct resident_chunk {
+            int chunk;
+            chunk_ptr mesh;
+        };
+
+        int build(const mesh_data& m, std::vector<uint32_t>& tris, std::vector<float>& centroids,
+                  int begin, int end, int chunk_triangles);
+        void write_chunk(const mesh_data& m, const uint32_t *tris, int count,
+                         linear_bvh_node& node);
+        chunk_ptr page(int chunk) const;
+        int chunk_of(int prim_id) const;
+        // Walks the top tree over the chunks r enters; see the definition.
+        template <typename F> bool visit(const ray& r, float t_min, float t_max, F f) const;
+
+        std::vector<linear_bvh_node> nodes;   // leaves hold one chunk each
+        std::vector<chunk_info> chunks;
+        std::vector<uint32_t> first_triangle;   // each chunk's first prim_id
+        size_t triangles;
+        FILE *backing;
+        // Used instead of the backing file when no temporary file can be made.
+        std::vector<char> in_memory;
+
+        mutable std::mutex lock;
+        size_t budget;
+        // Chunks in the order they were last used, most recent first.
+        mutable std::list<resident_chunk> lru;
+        mutable std::unordered_map<int, std::list<resident_chunk>::iterator> resident;
+        mutable size_t resident_total;
+        mutable size_t reads;
+};
+
+
+paged_mesh::paged_mesh(mesh_data&& m, material *mat, size_t max_resident_bytes,
+                       int chunk_triangles)
+    : mat_ptr(mat), triangles(m.triangle_count()), backing(tmpfile()), budget(max_resident_bytes),
+      resident_total(0), reads(0) {
+    mesh_data source(std::move(m));
+    if (chunk_triangles < 1) chunk_triangles = 1;
+    std::vector<uint32_t> tris(triangles);
+    std::vector<float> centroids(3*triangles);
+    for (size_t t = 0; t < triangles; t++) {
+        tris[t] = uint32_t(t);
+        for (int a = 0; a < 3; a++) {
+            float sum = 0;
+            for (int c = 0; c < 3; c++)
+                sum += source.positions[3*source.indices[3*t + c] + a];
+            centroids[3*t + a] = sum / 3;
+        }
+    }
+    if (triangles > 0)
+        build(source, tris, centroids, 0, int(triangles), chunk_triangles);
+    if (backing)
+        fflush(backing);
+}
+
+paged_mesh::~paged_mesh() {
+    if (backing)
+        fclose(backing);
+}
+
+// Splits at the median along the widest spread of centroids until the pieces are small enough
+// to be chunks, so each chunk is a compact cluster and the top tree is balanced. The chunks are
+// written out in the tree's order, and the nodes' bounds come from the chunks' own trees.
+int paged_mesh::build(const mesh_data& m, std::vector<uint32_t>& tris,
+                      std::vector<float>& centroids, int begin, int end, int chunk_triangles) {
+    int index = int(nodes.size());
+    nodes.push_back(linear_bvh_node());
+    int n = end - begin;
+    if (n <= chunk_triangles) {
+        linear_bvh_node leaf;
+        write_chunk(m, &tris[begin], n, leaf);
+        leaf.offset = int32_t(chunks.size()) - 1;
+        leaf.count = 1;
+        leaf.axis = 0;
+        leaf.pad = 0;
+        nodes[index] = leaf;
+        return index;
+    }
+    float cmin[3], cmax[3];
+    for (int a = 0; a < 3; a++)
+        cmin[a] = cmax[a] = centroids[3*tris[begin] + a];
+    for (int i = begin+1; i < end; i++) {
+        for (int a = 0; a < 3; a++) {
+            cmin[a] = ffmin(cmin[a], centroids[3*tris[i] + a]);
+            cmax[a] = ffmax(cmax[a], centroids[3*tris[i] + a]);
+        }
+    }
+    int axis = 0;
+    for (int a = 1; a < 3; a++)
+        if (cmax[a] - cmin[a] > cmax[axis] - cmin[axis])
+            axis = a;
+    int mid = begin + n/2;
+    const float *c = &centroids[0];
+    std::nth_element(tris.begin() + begin, tris.begin() + mid, tris.begin() + end,
+                     [c, axis](uint32_t a, uint32_t b) { return c[3*a + axis] < c[3*b + axis]; });
+    build(m, tris, centroids, begin, mid, chunk_triangles);
+    int second = build(m, tris, centroids, mid, end, chunk_triangles);
+    linear_bvh_node& node = nodes[index];
+    const linear_bvh_node& left = nodes[index + 1];
+    const linear_bvh_node& right = nodes[second];
+    for (int a = 0; a < 3; a++) {
+        node.bmin[a] = ffmin(left.bmin[a], right.bmin[a]);
+        node.bmax[a] = ffmax(left.bmax[a], right.bmax[a]);
+    }
+    node.offset = second;
+    node.count = 0;
+    node.axis = uint8_t(axis);
+    node.pad = 0;
+    return index;
+}
+
+// The chunk keeps only the vertices its triangles use, renumbered, and is built into a
+// triangle_mesh once here so that paging it in later is only a read.
+void paged_mesh::write_chunk(const mesh_data& m, const uint32_t *tris, int count,
+                             linear_bvh_node& node) {
+    mesh_data local;
+    std::unordered_map<uint32_t, uint32_t> renumbered;
+    bool normals = !m.normals.empty(), texcoords = !m.texcoords.empty();
+    for (int t = 0; t < count; t++) {
+        for (int c = 0; c < 3; c++) {
+            uint32_t v = m.indices[3*tris[t] + c];
+            std::pair<std::unordered_map<uint32_t, uint32_t>::iterator, bool> found =
+                renumbered.insert(std::make_pair(v, uint32_t(local.vertex_count())));
+            if (found.second) {
+                local.positions.insert(local.positions.end(), &m.positions[3*v], &m.positions[3*v+3]);
+                if (normals)
+                    local.normals.insert(local.normals.end(), &m.normals[3*v], &m.normals[3*v+3]);
+                if (texcoords)
+                    local.texcoords.insert(local.texcoords.end(), &m.texcoords[2*v],
+                                           &m.texcoords[2*v+2]);
+            }
+            local.indices.push_back(found.first->second);
+        }
+    }
+    triangle_mesh built(std::move(local), mat_ptr);
+    const mesh_data& b = built.mesh;
+    for (int a = 0; a < 3; a++) {
+        node.bmin[a] = built.nodes[0].bmin[a];
+        node.bmax[a] = built.nodes[0].bmax[a];
+    }
+
+    chunk_info info;
+    info.offset = chunks.empty() ? 0 : chunks.back().offset + chunks.back().bytes;
+    info.vertices = uint32_t(b.vertex_count());
+    info.triangles = uint32_t(b.triangle_count());
+    info.nodes = uint32_t(built.nodes.size());
+    info.normals = normals;
+    info.texcoords = texcoords;
+    const void *parts[5] = { b.positions.data(), b.normals.data(), b.texcoords.data(),
+                             b.indices.data(), built.nodes.data() };
+    size_t sizes[5] = { b.positions.size()*sizeof(float), b.normals.size()*sizeof(float),
+                        b.texcoords.size()*sizeof(float), b.indices.size()*sizeof(uint32_t),
+                        built.nodes.size()*sizeof(linear_bvh_node) };
+    info.bytes = 0;
+    for (int k = 0; k < 5; k++) {
+        if (backing)
+            fwrite(parts[k], 1, sizes[k], backing);
+        else
+            in_memory.insert(in_memory.end(), (const char*)parts[k],
+                             (const char*)parts[k] + sizes[k]);
+        info.bytes += sizes[k];
+    }
+    first_triangle.push_back(chunks.empty() ? 0 : first_triangle.back() + chunks.back().triangles);
+    chunks.push_back(info);
+}
+
+void paged_mesh::set_budget(size_t max_resident_bytes) {
+    std::lock_guard<std::mutex> guard(lock);
+    budget = max_resident_bytes;
+    while (resident_total > budget && lru.size() > 1) {
+        resident_total -= chunks[lru.back().chunk].bytes;
+        resident.erase(lru.back().chunk);
+        lru.pop_back();
+    }
+}
+
+size_t paged_mesh::resident_bytes() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return resident_total;
+}
+
+size_t paged_mesh::chunks_read() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return reads;
+}
+
+// A chunk that cannot be read back comes in empty, and nothing hits it.
+paged_mesh::chunk_ptr paged_mesh::page(int chunk) const {
+    std::lock_guard<std::mutex> guard(lock);
+    std::unordered_map<int, std::list<resident_chunk>::iterator>::iterator found =
+        resident.find(chunk);
+    if (found != resident.end()) {
+        lru.splice(lru.begin(), lru, found->second);
+        return found->second->mesh;
+    }
+
+    const chunk_info& info = chunks[chunk];
+    mesh_data m;
+    std::vector<linear_bvh_node> tree(info.nodes);
+    m.positions.resize(3*size_t(info.vertices));
+    m.normals.resize(info.normals ? 3*size_t(info.vertices) : 0);
+    m.texcoords.resize(info.texcoords ? 2*size_t(info.vertices) : 0);
+    m.indices.resize(3*size_t(info.triangles));
+    void *parts[5] = { m.positions.data(), m.normals.data(), m.texcoords.data(),
+                       m.indices.data(), tree.data() };
+    size_t sizes[5] = { m.positions.size()*sizeof(float), m.normals.size()*sizeof(float),
+                        m.texcoords.size()*sizeof(float), m.indices.size()*sizeof(uint32_t),
+                        tree.size()*sizeof(linear_bvh_node) };
+    bool ok = true;
+    if (backing)
+        ok = fseek(backing, long(info.offset), SEEK_SET) == 0;
+    size_t at = info.offset;
+    for (int k = 0; k < 5 && ok; k++) {
+        if (backing)
+            ok = fread(parts[k], 1, sizes[k], backing) == sizes[k];
+        else
+            memcpy(parts[k], &in_memory[at], sizes[k]);
+        at += sizes[k];
+    }
+    if (!ok) {
+        m = mesh_data();
+        tree.clear();
+    }
+    chunk_ptr mesh = std::make_shared<const triangle_mesh>(std::move(m), std::move(tree), mat_ptr);
+    resident_chunk entry = { chunk, mesh };
+    lru.push_front(entry);
+    resident[chunk] = lru.begin();
+    resident_total += info.bytes;
+    reads++;
+    while (resident_total > budget && lru.size() > 1) {
+        resident_total -= chunks[lru.back().chunk].bytes;
+        resident.erase(lru.back().chunk);
+        lru.pop_back();
+    }
+    return mesh;
+}
+
+int paged_mesh::chunk_of(int prim_id) const {
+    return int(std::upper_bound(first_triangle.begin(), first_triangle.end(), uint32_t(prim_id))
+               - first_triangle.begin()) - 1;
+}
+
+// Calls f(chunk, t_max) for each chunk r enters, nearest side first; f returns the new t_max,
+// or a negative number to stop, which makes visit() return false.
+template <typename F>
+bool paged_mesh::visit(const ray& r, float t_min, float t_max, F f) const {
+    if (nodes.empty())
+        return true;
+    int stack[64];
+    int stack_size = 0;
+    int current = 0;
+    for (;;) {
+        const linear_bvh_node& node = nodes[current];
+        RT_COUNT(node_visits, 1);
+        if (slab_hit(node.bmin, node.bmax, r, t_min, t_max)) {
+            if (node.count > 0) {
+                t_max = f(node.offset, t_max);
+                if (t_max < 0)
+                    return false;
+                if (stack_size == 0)
+                    break;
+                current = stack[--stack_size];
+            }
+            else if (r.sign(node.axis)) {
+                stack[stack_size++] = current + 1;
+                current = node.offset;
+            }
+            else {
+                stack[stack_size++] = node.offset;
+                current = current + 1;
+            }
+        }
+        else {
+            if (stack_size == 0)
+                break;
+            current = stack[--stack_size];
+        }
+    }
+    return true;
+}
+
+bool paged_mesh::bounding_box(float t0, float t1, aabb& b) const {
+    if (nodes.empty())
+        return false;
+    const linear_bvh_node& root = nodes[0];
+    b = aabb(vec3(root.bmin[0], root.bmin[1], root.bmin[2]),
+             vec3(root.bmax[0], root.bmax[1], root.bmax[2]));
+    return true;
+}
+
+bool paged_mesh::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+    if (!intersect(r, t_min, t_max, rec))
+        return false;
+    finalize(r, rec);
+    return true;
+}
+
+bool paged_mesh::intersect(const ray& r, float t_min, float t_max, hit_record& rec) const {
+    bool hit_anything = false;
+    visit(r, t_min, t_max, [&](int chunk, float t_far) {
+        hit_record h;
+        if (page(chunk)->intersect(r, t_min, t_far, h)) {
+            hit_anything = true;
+            rec.t = h.t;
+            rec.prim = this;
+            rec.prim_id = int(first_triangle[chunk]) + h.prim_id;
+            return h.t;
+        }
+        return t_far;
+    });
+    return hit_anything;
+}
+
+bool paged_mesh::occluded(const ray& r, float t_min, float t_max) const {
+    return !visit(r, t_min, t_max, [&](int chunk, float t_far) {
+        return page(chunk)->occluded(r, t_min, t_far) ? -1.0f : t_far;
+    });
+}
+
+// The chunk's own finalize() works with its own triangle numbers.
+void paged_mesh::finalize(const ray& r, hit_record& rec) const {
+    int id = rec.prim_id;
+    int chunk = chunk_of(id);
+    rec.prim_id = id - int(first_triangle[chunk]);
+    page(chunk)->finalize(r, rec);
+    rec.prim = this;
+    rec.prim_id = id;
+}
+
+// First every ray lists the chunks it enters; then each chunk is paged in once and run against
+// all of its rays. The rays' t_max still narrows as they go, chunk by chunk.
+int paged_mesh::hit_batch(const ray *rays, int n, float t_min, float *t_max, hit_record *rec,
+                          bool *hits) const {
+    static thread_local std::vector<std::pair<int, int> > visits;
+    static thread_local std::vector<int> hit_chunk;
+    visits.clear();
+    hit_chunk.assign(n, -1);
+    for (int k = 0; k < n; k++) {
+        visit(rays[k], t_min, t_max[k], [k](int chunk, float t_far) {
+            visits.push_back(std::make_pair(chunk, k));
+            return t_far;
+        });
+    }
+    std::sort(visits.begin(), visits.end());
+
+    for (size_t v = 0; v < visits.size();) {
+        int chunk = visits[v].first;
+        chunk_ptr mesh = page(chunk);
+        for (; v < visits.size() && visits[v].first == chunk; v++) {
+            int k = visits[v].second;
+            hit_record h;
+            if (mesh->intersect(rays[k], t_min, t_max[k], h)) {
+                t_max[k] = h.t;
+                rec[k] = h;
+                rec[k].prim = this;
+                rec[k].prim_id = int(first_triangle[chunk]) + h.prim_id;
+                hit_chunk[k] = chunk;
+            }
+        }
+    }
+    // Finishing the hits chunk by chunk reads each again at most once.
+    visits.clear();
+    for (int k = 0; k < n; k++) {
+        hits[k] = hit_chunk[k] >= 0;
+        if (hits[k])
+            visits.push_back(std::make_pair(hit_chunk[k], k));
+    }
+    std::sort(visits.begin(), visits.end());
+    for (size_t v = 0; v < visits.size();) {
+        int chunk = visits[v].first;
+        chunk_ptr mesh = page(chunk);
+        for (; v < visits.size() && visits[v].first == chunk; v++) {
+            int k = visits[v].second;
+            rec[k].prim_id -= int(first_triangle[chunk]);
+            mesh->finalize(rays[k], rec[k]);
+            rec[k].prim_id += int(first_triangle[chunk]);
+        }
+    }
+    return int(visits.size());
+}
+
+int paged_mesh::hit_packet(const ray_packet& p, int active, float t_min, float *t_max,
+                           hit_record *rec) const {
+    ray rays[ray_packet_size];
+    float t[ray_packet_size];
+    hit_record found[ray_packet_size];
+    bool hit[ray_packet_size];
+    int index[ray_packet_size];
+    int n = 0;
+    for (int k = 0; k < p.count; k++) {
+        if (active & (1 << k)) {
+            index[n] = k;
+            rays[n] = p.get(k);
+            t[n++] = t_max[k];
+        }
+    }
+    // Only the first n lanes are filled, and hit_batch() is handed just those.
+    if (n == 0)
+        return 0;
+    hit_batch(rays, n, t_min, t, found, hit);
+    int hits = 0;
+    for (int j = 0; j < n; j++) {
+        if (hit[j]) {
+            t_max[index[j]] = t[j];
+            rec[index[j]] = found[j];
+            hits |= 1 << index[j];
+        }
+    }
+    return hits;
+}
+
+#endif
@@ -0,0 +1,295 @@
+#ifndef PERLINH
+#define PERLINH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include "random.h"
+#include "vec3.h"
+
+#include <math.h>
+#include <vector>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define PERLIN_SSE
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define PERLIN_NEON
+#endif
+
+
+// Octaves are evaluated perlin_lanes at a time, one per SIMD lane. Each lane does the same
+// arithmetic in the same order as a single noise() call, so turb gives the same values it did when
+// it called noise() once per octave.
+const int perlin_lanes = 4;
+
+#if defined(PERLIN_SSE)
+typedef __m128 perlin_float;
+inline perlin_float perlin_load(const float *p) { return _mm_loadu_ps(p); }
+inline perlin_float perlin_set(float a, float b, float c, float d) { return _mm_setr_ps(a, b, c, d); }
+inline perlin_float perlin_splat(float f) { return _mm_set1_ps(f); }
+inline perlin_float perlin_add(perlin_float a, perlin_float b) { return _mm_add_ps(a, b); }
+inline perlin_float perlin_sub(perlin_float a, perlin_float b) { return _mm_sub_ps(a, b); }
+inline perlin_float perlin_mul(perlin_float a, perlin_float b) { return _mm_mul_ps(a, b); }
+inline void perlin_store(float *p, perlin_float a) { _mm_storeu_ps(p, a); }
+#elif defined(PERLIN_NEON)
+typedef float32x4_t perlin_float;
+inline perlin_float perlin_load(const float *p) { return vld1q_f32(p); }
+inline perlin_float perlin_set(float a, float b, float c, float d) {
+    float v[4] = { a, b, c, d };
+    return vld1q_f32(v);
+}
+inline perlin_float perlin_splat(float f) { return vdupq_n_f32(f); }
+inline perlin_float perlin_add(perlin_float a, perlin_float b) { return vaddq_f32(a, b); }
+inline perlin_float perlin_sub(perlin_float a, perlin_float b) { return vsubq_f32(a, b); }
+inline perlin_float perlin_mul(perlin_float a, perlin_float b) { return vmulq_f32(a, b); }
+inline void perlin_store(float *p, perlin_float a) { vst1q_f32(p, a); }
+#else
+struct perlin_float { float v[4]; };
+inline perlin_float perlin_load(const float *p) { perlin_float r; for (int i = 0; i < 4; i++) r.v[i] = p[i]; return r; }
+inline perlin_float perlin_set(float a, float b, float c, float d) { perlin_float r = {{ a, b, c, d }}; return r; }
+inline perlin_float perlin_splat(float f) { perlin_float r; for (int i = 0; i < 4; i++) r.v[i] = f; return r; }
+inline perlin_float perlin_add(perlin_float a, perlin_float b) { for (int i = 0; i < 4; i++) a.v[i] += b.v[i]; return a; }
+inline perlin_float perlin_sub(perlin_float a, perlin_float b) { for (int i = 0; i < 4; i++) a.v[i] -= b.v[i]; return a; }
+inline perlin_float perlin_mul(perlin_float a, perlin_float b) { for (int i = 0; i < 4; i++) a.v[i] *= b.v[i]; return a; }
+inline void perlin_store(float *p, perlin_float a) { for (int i = 0; i < 4; i++) p[i] = a.v[i]; }
+#endif
+
+// The lattice tables packed for lookups: gradients as structure-of-arrays, and permutations as
+// bytes, 3.75 KB in all.
+struct perlin_tables {
+    float grad[3][256];
+    unsigned char perm[3][256];
+};
+
+class perlin {
+    public:
+        float noise(const vec3& p) const {
+            float r[perlin_lanes];
+            octaves(p, 1, 1, r);
+            return r[0];
+        }
+        float turb(const vec3& p, int depth=7) const {
+            float accum = 0;
+            float weight = 1.0;
+            float scale = 1.0;
+            for (int first = 0; first < depth; first += perlin_lanes) {
+                int n = depth - first < perlin_lanes ? depth - first : perlin_lanes;
+                float r[perlin_lanes];
+                octaves(p, scale, n, r);
+                for (int i = 0; i < n; i++) {
+                    accum += weight*r[i];
+                    weight *= 0.5;
+                    scale *= 2;
+                }
+            }
+            return fabs(accum);
+        }
+        // r[i] = noise(p * scale * 2^i) for the first n <= perlin_lanes lanes.
+        void octaves(const vec3& p, float scale, int n, float *r) const;
+
+        static vec3 *ranvec;
+        static int *perm_x;
+        static int *perm_y;
+        static int *perm_z;
+        static perlin_tables tables;
+};
+
+static vec3* perlin_generate() {
+    vec3 *p = new vec3[256];
+    for (int i = 0; i < 256; ++i) {
+        double x_random = 2*random_double() - 1;
+        double y_random = 2*random_double() - 1;
+        double z_random = 2*random_double() - 1;
+        p[i] = unit_vector(vec3(x_random, y_random, z_random));
+    }
+    return p;
+}
+
+void permute(int *p, int n) {
+    for (int i = n-1; i > 0; i--) {
+        int target = int(random_double()*(i+1));
+        int tmp = p[i];
+        p[i] = p[target];
+        p[target] = tmp;
+    }
+    return;
+}
+
+static int* perlin_generate_perm() {
+    int * p = new int[256];
+    for (int i = 0; i < 256; i++)
+        p[i] = i;
+    permute(p, 256);
+    return p;
+}
+
+vec3 *perlin::ranvec = perlin_generate();
+int *perlin::perm_x = perlin_generate_perm();
+int *perlin::perm_y = perlin_generate_perm();
+int *perlin::perm_z = perlin_generate_perm();
+
+perlin_tables perlin_pack_tables() {
+    perlin_tables t;
+    for (int i = 0; i < 256; i++) {
+        for (int a = 0; a < 3; a++)
+            t.grad[a][i] = perlin::ranvec[i][a];
+        t.perm[0][i] = (unsigned char)(perlin::perm_x[i]);
+        t.perm[1][i] = (unsigned char)(perlin::perm_y[i]);
+        t.perm[2][i] = (unsigned char)(perlin::perm_z[i]);
+    }
+    return t;
+}
+
+perlin_tables perlin::tables = perlin_pack_tables();
+
+// The lattice cell x is in along one axis: x's fraction within it, and the permutation entries of
+// its two ends.
+inline void perlin_axis(float x, const unsigned char *perm, float& f, int h[2]) {
+    // floor() without the library call; x is well inside int's range.
+    int i = int(x);
+    if (x < i)
+        i--;
+    f = x - i;
+    h[0] = perm[i & 255];
+    h[1] = perm[(i+1) & 255];
+}
+
+// Lane l of octaves(): the fractions for p * scale, and the gradient index at each corner.
+inline void perlin_cell(const vec3& p, float scale, int l, float f[3][perlin_lanes],
+                        int g[8][perlin_lanes]) {
+    const perlin_tables& t = perlin::tables;
+    int h[3][2];
+    perlin_axis(p[0] * scale, t.perm[0], f[0][l], h[0]);
+    perlin_axis(p[1] * scale, t.perm[1], f[1][l], h[1]);
+    perlin_axis(p[2] * scale, t.perm[2], f[2][l], h[2]);
+    g[0][l] = h[0][0] ^ h[1][0] ^ h[2][0];
+    g[1][l] = h[0][0] ^ h[1][0] ^ h[2][1];
+    g[2][l] = h[0][0] ^ h[1][1] ^ h[2][0];
+    g[3][l] = h[0][0] ^ h[1][1] ^ h[2][1];
+    g[4][l] = h[0][1] ^ h[1][0] ^ h[2][0];
+    g[5][l] = h[0][1] ^ h[1][0] ^ h[2][1];
+    g[6][l] = h[0][1] ^ h[1][1] ^ h[2][0];
+    g[7][l] = h[0][1] ^ h[1][1] ^ h[2][1];
+}
+
+// One corner's contribution in each lane: its blend weight times the dot product of its gradient,
+// gradient k[lane], with the offset (x,y,z) from the corner.
+inline perlin_float perlin_corner(const int *k, perlin_float wx, perlin_float wy, perlin_float wz,
+                                  perlin_float x, perlin_float y, perlin_float z) {
+    const perlin_tables& t = perlin::tables;
+    perlin_float gx = perlin_set(t.grad[0][k[0]], t.grad[0][k[1]], t.grad[0][k[2]], t.grad[0][k[3]]);
+    perlin_float gy = perlin_set(t.grad[1][k[0]], t.grad[1][k[1]], t.grad[1][k[2]], t.grad[1][k[3]]);
+    perlin_float gz = perlin_set(t.grad[2][k[0]], t.grad[2][k[1]], t.grad[2][k[2]], t.grad[2][k[3]]);
+    perlin_float dot = perlin_add(perlin_add(perlin_mul(gx, x), perlin_mul(gy, y)), perlin_mul(gz, z));
+    return perlin_mul(perlin_mul(perlin_mul(wx, wy), wz), dot);
+}
+
+void perlin::octaves(const vec3& p, float scale, int n, float *r) const {
+    // Found per lane: the fractional position in the cell, and which gradient sits at each of its
+    // corners, corner c being (c>>2, (c>>1)&1, c&1). Lanes past n repeat the last octave.
+    float f[3][perlin_lanes];
+    int g[8][perlin_lanes];
+    float s1 = n > 1 ? 2*scale : scale, s2 = n > 2 ? 2*s1 : s1, s3 = n > 3 ? 2*s2 : s2;
+    perlin_cell(p, scale, 0, f, g);
+    perlin_cell(p, s1, 1, f, g);
+    perlin_cell(p, s2, 2, f, g);
+    perlin_cell(p, s3, 3, f, g);
+
+    // Hermite-smoothed trilinear blend of the corner gradients' dot products. The lanes are
+    // assembled in registers: storing them one by one and loading them as a vector would stall on
+    // store forwarding.
+    perlin_float one = perlin_splat(1), two = perlin_splat(2), three = perlin_splat(3);
+    perlin_float u = perlin_set(f[0][0], f[0][1], f[0][2], f[0][3]);
+    perlin_float v = perlin_set(f[1][0], f[1][1], f[1][2], f[1][3]);
+    perlin_float w = perlin_set(f[2][0], f[2][1], f[2][2], f[2][3]);
+    perlin_float uu = perlin_mul(perlin_mul(u, u), perlin_sub(three, perlin_mul(two, u)));
+    perlin_float vv = perlin_mul(perlin_mul(v, v), perlin_sub(three, perlin_mul(two, v)));
+    perlin_float ww = perlin_mul(perlin_mul(w, w), perlin_sub(three, perlin_mul(two, w)));
+    perlin_float u1 = perlin_sub(u, one), v1 = perlin_sub(v, one), w1 = perlin_sub(w, one);
+    perlin_float nu = perlin_sub(one, uu), nv = perlin_sub(one, vv), nw = perlin_sub(one, ww);
+    perlin_float accum = perlin_splat(0);
+    accum = perlin_add(accum, perlin_corner(g[0], nu, nv, nw, u, v, w));
+    accum = perlin_add(accum, perlin_corner(g[1], nu, nv, ww, u, v, w1));
+    accum = perlin_add(accum, perlin_corner(g[2], nu, vv, nw, u, v1, w));
+    accum = perlin_add(accum, perlin_corner(g[3], nu, vv, ww, u, v1, w1));
+    accum = perlin_add(accum, perlin_corner(g[4], uu, nv, nw, u1, v, w));
+    accum = perlin_add(accum, perlin_corner(g[5], uu, nv, ww, u1, v, w1));
+    accum = perlin_add(accum, perlin_corner(g[6], uu, vv, nw, u1, v1, w));
+    accum = perlin_add(accum, perlin_corner(g[7], uu, vv, ww, u1, v1, w1));
+    float all[perlin_lanes];
+    perlin_store(all, accum);
+    for (int l = 0; l < n; l++)
+        r[l] = all[l];
+}
+
+
+// turb baked on an n x n x n grid over a box in noise space and interpolated between grid points,
+// for textures on static objects: one lookup costs eight loads instead of seven octaves. Detail
+// finer than the grid spacing is lost, and the grid takes 4n^3 bytes.
+class perlin_volume {
+    public:
+        perlin_volume() : n(0) {}
+        void bake(const perlin& noise, const vec3& lo, const vec3& hi, int n);
+        // False, leaving value alone, outside the box or before anything is baked.
+        bool lookup(const vec3& p, float& value) const;
+        size_t bytes() const { return values.size() * sizeof(float); }
+
+        vec3 min, max;
+        vec3 inv_spacing;
+        int n;
+        std::vector<float> values;
+};
+
+void perlin_volume::bake(const perlin& noise, const vec3& lo, const vec3& hi, int size) {
+    n = size < 2 ? 2 : size;
+    min = lo;
+    max = hi;
+    vec3 spacing = (hi - lo) / float(n-1);
+    for (int a = 0; a < 3; a++)
+        inv_spacing[a] = spacing[a] > 0 ? 1 / spacing[a] : 0;
+    values.resize(size_t(n)*n*n);
+    for (int z = 0; z < n; z++)
+        for (int y = 0; y < n; y++)
+            for (int x = 0; x < n; x++)
+                values[(size_t(z)*n + y)*n + x] =
+                    noise.turb(lo + vec3(x*spacing[0], y*spacing[1], z*spacing[2]));
+}
+
+bool perlin_volume::lookup(const vec3& p, float& value) const {
+    if (n == 0)
+        return false;
+    int cell[3];
+    float f[3];
+    for (int a = 0; a < 3; a++) {
+        if (p[a] < min[a] || p[a] > max[a])
+            return false;
+        float x = (p[a] - min[a]) * inv_spacing[a];
+        int i = int(x);
+        if (i > n-2) i = n-2;
+        cell[a] = i;
+        f[a] = x - i;
+    }
+    const float *v = &values[(size_t(cell[2])*n + cell[1])*n + cell[0]];
+    size_t dy = n, dz = size_t(n)*n;
+    float c00 = v[0]     + f[0]*(v[1]     - v[0]);
+    float c10 = v[dy]    + f[0]*(v[dy+1]  - v[dy]);
+    float c01 = v[dz]    + f[0]*(v[dz+1]  - v[dz]);
+    float c11 = v[dz+dy] + f[0]*(v[dz+dy+1] - v[dz+dy]);
+    float c0 = c00 + f[1]*(c10 - c00);
+    float c1 = c01 + f[1]*(c11 - c01);
+    value = c0 + f[2]*(c1 - c0);
+    return true;
+}
+
+
+#endif
+
@@ -0,0 +1,155 @@
+#ifndef RANDOMH
+#define RANDOMH
+
+#include "sampler.h"
+
+#include <stdint.h>
+
+
+// PCG32 (O'Neill, "PCG: A Family of Simple Fast Space-Efficient Statistically Good Algorithms for
+// Random Number Generation"): 64 bits of state, a selectable stream, and a handful of integer ops
+// per number.
+class pcg32 {
+    public:
+        pcg32() { seed(0x853c49e6748fea9bULL, 0xda3e39cb94b95bdbULL); }
+        void seed(uint64_t initstate, uint64_t initseq) {
+            state = 0;
+            inc = (initseq << 1) | 1;
+            next();
+            state += initstate;
+            next();
+        }
+        uint32_t next() {
+            uint64_t old = state;
+            state = old * 6364136223846793005ULL + inc;
+            uint32_t xorshifted = uint32_t(((old >> 18) ^ old) >> 27);
+            uint32_t rot = uint32_t(old >> 59);
+            return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+        }
+
+        uint64_t state;
+        uint64_t inc;
+};
+
+inline uint64_t random_hash(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+
+// Every thread draws from its own generator, so render threads never contend on shared state.
+// While a sample is being traced the state also knows which pixel, sample and dimension it is on,
+// so random_double() can take the number from a sample pattern instead of the generator.
+struct random_state {
+    random_state() : seed_hash(0), sample_key(0), pixel(0), pixel_seed(0), sample(0),
+                     dimension(0), dimension_end(0) {}
+    pcg32 generator;
+    uint64_t seed_hash;
+    uint64_t sample_key;
+    uint32_t pixel;
+    uint32_t pixel_seed;
+    uint32_t sample;
+    int dimension;       // next pattern dimension
+    int dimension_end;   // end of the dimensions the pattern covers for this bounce
+};
+
+inline random_state& thread_random_state() {
+    static thread_local random_state rs;
+    return rs;
+}
+
+// The sample pattern shared by every thread. Set it before rendering starts.
+struct random_pattern_config {
+    sample_pattern pattern;
+    uint32_t samples_per_pixel;
+    uint32_t image_width;
+};
+
+inline random_pattern_config& random_pattern() {
+    static random_pattern_config config = { pattern_random, 1, 1 };
+    return config;
+}
+
+inline void random_set_pattern(sample_pattern pattern, uint32_t samples_per_pixel,
+                               uint32_t image_width) {
+    random_pattern_config& config = random_pattern();
+    config.pattern = pattern;
+    config.samples_per_pixel = samples_per_pixel > 0 ? samples_per_pixel : 1;
+    config.image_width = image_width > 0 ? image_width : 1;
+}
+
+// Each bounce owns this many consecutive dimensions of the pattern; a bounce that draws more,
+// or one past the dimensions the pattern covers, goes on with the generator.
+const int random_bounce_dimensions = 8;
+
+inline void random_seed(uint64_t seed, uint64_t stream) {
+    random_state& rs = thread_random_state();
+    rs.generator.seed(random_hash(seed), stream);
+    rs.dimension = rs.dimension_end = 0;
+}
+
+inline void random_begin_dimensions(random_state& rs, uint64_t bounce) {
+    rs.dimension = 0;
+    rs.dimension_end = 0;
+    if (random_pattern().pattern != pattern_random
+            && bounce < uint64_t(sample_pattern_dimensions / random_bounce_dimensions)) {
+        rs.dimension = int(bounce) * random_bounce_dimensions;
+        rs.dimension_end = rs.dimension + random_bounce_dimensions;
+    }
+}
+
+// Renderers key the stream on (pixel, sample, bounce) rather than on the thread, so a sample sees
+// the same random numbers however the image is split across threads. Bounce 0 is the camera; the
+// integrator moves to bounce d+1 before scattering at depth d.
+inline void random_begin_sample(uint64_t seed, uint64_t pixel, uint64_t sample) {
+    random_state& rs = thread_random_state();
+    rs.seed_hash = random_hash(seed);
+    rs.pixel = uint32_t(pixel);
+    rs.pixel_seed = uint32_t(random_hash(rs.seed_hash ^ pixel));
+    rs.sample = uint32_t(sample);
+    rs.sample_key = random_hash(random_hash(rs.seed_hash ^ pixel) ^ sample);
+    rs.generator.seed(rs.sample_key, 0);
+    random_begin_dimensions(rs, 0);
+}
+
+inline void random_begin_bounce(uint64_t bounce) {
+    random_state& rs = thread_random_state();
+    rs.generator.seed(rs.sample_key, bounce);
+    random_begin_dimensions(rs, bounce);
+}
+
+// Wavefront renderers interleave many samples on one thread. They keep each path's sample id and
+// switch back to it before drawing that path's random numbers for a bounce. The id packs the pixel
+// and sample index; the image seed is the one the thread last began a sample with.
+inline uint64_t random_sample_key() {
+    random_state& rs = thread_random_state();
+    return (uint64_t(rs.pixel) << 32) | rs.sample;
+}
+
+inline void random_resume_sample(uint64_t sample_key, uint64_t bounce) {
+    random_state& rs = thread_random_state();
+    rs.pixel = uint32_t(sample_key >> 32);
+    rs.pixel_seed = uint32_t(random_hash(rs.seed_hash ^ rs.pixel));
+    rs.sample = uint32_t(sample_key);
+    rs.sample_key = random_hash(random_hash(rs.seed_hash ^ rs.pixel) ^ rs.sample);
+    rs.generator.seed(rs.sample_key, bounce);
+    random_begin_dimensions(rs, bounce);
+}
+
+inline double random_double() {
+    random_state& rs = thread_random_state();
+    if (rs.dimension < rs.dimension_end) {
+        const random_pattern_config& config = random_pattern();
+        return sample_pattern_value(config.pattern, rs.pixel % config.image_width,
+                                    rs.pixel / config.image_width, rs.pixel_seed,
+                                    uint32_t(rs.seed_hash), rs.sample, config.samples_per_pixel,
+                                    rs.dimension++);
+    }
+    return rs.generator.next() / 4294967296.0;
+}
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef RAYH
+#define RAYH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include <cfloat>
+
+#include "vec3.h"
+
+
+class ray
+{
+    public:
+        ray() {}
+        ray(const vec3& a, const vec3& b, float ti = 0.0) { A = a; B = b; _time = ti; set_inverse(); }
+        const vec3& origin() const       { return A; }
+        const vec3& direction() const    { return B; }
+        float time() const    { return _time; }
+        vec3 point_at_parameter(float t) const { return A + t*B; }
+        // 1/direction, and for each axis whether the direction is negative, worked out once here
+        // for every box the ray is tested against.
+        const vec3& inv_direction() const { return inv_B; }
+        int sign(int a) const { return _sign[a]; }
+
+        vec3 A;
+        vec3 B;
+        float _time;
+        vec3 inv_B;
+        int _sign[3];
+
+    private:
+        void set_inverse() {
+            for (int a = 0; a < 3; a++) {
+                inv_B[a] = 1 / B[a];
+                _sign[a] = inv_B[a] < 0;
+            }
+        }
+};
+
+
+// Up to ray_packet_size coherent rays, stored as structure-of-arrays so that primitives can test
+// all of them with the same arithmetic. Bit k of a packet mask refers to ray k. Lanes past count
+// are padded with copies of the last ray, and their t_max with -FLT_MAX so that no t is inside
+// their interval, so loops can always run over the full width.
+const int ray_packet_size = 8;
+
+struct ray_packet {
+    void set(int k, const ray& r) {
+        for (int a = 0; a < 3; a++) {
+            origin[a][k] = r.origin()[a];
+            direction[a][k] = r.direction()[a];
+        }
+        time[k] = r.time();
+    }
+    void pad(float *t_max) {
+        for (int k = count; k < ray_packet_size; k++) {
+            set(k, get(count-1));
+            t_max[k] = -FLT_MAX;
+        }
+    }
+    ray get(int k) const {
+        return ray(vec3(origin[0][k], origin[1][k], origin[2][k]),
+                   vec3(direction[0][k], direction[1][k], direction[2][k]), time[k]);
+    }
+
+    float origin[3][ray_packet_size];
+    float direction[3][ray_packet_size];
+    float time[ray_packet_size];
+    int count;
+};
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef RAYOFFSETH
+#define RAYOFFSETH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include "fast_math.h"
+#include "vec3.h"
+
+#include <float.h>
+#include <math.h>
+#include <stdint.h>
+
+
+// Bounds on the rounding error in hit points, and where rays leaving them start. Both hittable.h
+// and In One Weekend's own build spawn_ray() on these.
+
+// The largest of v's coordinates, ignoring sign.
+inline float max_abs(const vec3& v) {
+    return fmaxf(fabsf(v[0]), fmaxf(fabsf(v[1]), fabsf(v[2])));
+}
+
+// A bound on the rounding error in a point worked out, in a few float operations, from numbers
+// no larger than magnitude; shapes use it for hit_record::p_error.
+inline float point_error(float magnitude) {
+    return 4 * FLT_EPSILON * magnitude;
+}
+
+// Moves a hit point p back onto the sphere about center, from wherever the rounding in the ray's
+// arithmetic left it, and returns the bound on its error there. Off the sphere, p's error across
+// it would grow with the ray's length; on it, it depends only on the sphere's size and place.
+inline float reproject_to_sphere(vec3& p, const vec3& center, float radius) {
+    vec3 v = p - center;
+    p = center + v * (fabsf(radius) / v.length());
+    return point_error(max_abs(center) + fabsf(radius));
+}
+
+// The floats next above and below x.
+inline float next_float_up(float x) {
+    if (x == INFINITY)
+        return x;
+    uint32_t b = fast_bits(x == 0 ? 0.0f : x);
+    return fast_from_bits(x >= 0 ? b + 1 : b - 1);
+}
+
+inline float next_float_down(float x) {
+    if (x == -INFINITY)
+        return x;
+    uint32_t b = fast_bits(x == 0 ? -0.0f : x);
+    return fast_from_bits(x <= 0 ? b + 1 : b - 1);
+}
+
+// Where a ray leaving a surface at p in direction dir should start so that it cannot hit that
+// surface again, after Pharr, Jakob and Humphreys' Physically Based Rendering, section 3.9: p
+// moved along the normal n, to the side dir is on, by the distance p_error allows along n, and
+// then to the next float on, so that rounding the sum cannot bring it back. The offset is the
+// rounding error the shape worked out rather than a fixed distance, which is too small for big
+// scenes and too big for small ones, so rays that start this way need no t_min above 0.
+inline vec3 offset_ray_origin(const vec3& p, float p_error, const vec3& n, const vec3& dir) {
+    // Points at the origin itself have no error; they still move off it, by more than a denormal.
+    const float min_offset = 1e-30f;
+    float d = fmaxf(p_error * (fabsf(n[0]) + fabsf(n[1]) + fabsf(n[2])), min_offset);
+    vec3 m = dot(n, dir) < 0 ? -n : n;
+    vec3 o = p + d * m;
+    for (int a = 0; a < 3; a++) {
+        if (m[a] > 0)
+            o[a] = next_float_up(o[a]);
+        else if (m[a] < 0)
+            o[a] = next_float_down(o[a]);
+    }
+    return o;
+}
+
+
+#endif
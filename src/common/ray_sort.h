@@ -0,0 +1,82 @@
+#ifndef RAYSORTH
+#define RAYSORTH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include "hittable.h"
+
+#include <algorithm>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+
+// Reordering rays so that neighbours in a batch start close together and head the same way, after
+// Pharr et al.'s and Aila and Laine's coherent ray sorting. Rays that agree on the signs of their
+// direction take the same near child first at every BVH node, and rays from nearby origins visit
+// the same nodes, so traced in this order they keep the top of the tree and the shapes they share
+// in cache, and packets of them stay full deeper down.
+
+// Bits of each axis of an origin's position in its Morton code; with the octant's three bits on
+// top, a key fills 63 bits.
+const int ray_sort_bits = 20;
+
+// x's low 21 bits, moved to every third bit.
+inline uint64_t spread_bits3(uint32_t x) {
+    uint64_t d = x & 0x1fffff;
+    d = (d | d << 32) & 0x1f00000000ffffULL;
+    d = (d | d << 16) & 0x1f0000ff0000ffULL;
+    d = (d | d << 8) & 0x100f00f00f00f00fULL;
+    d = (d | d << 4) & 0x10c30c30c30c30c3ULL;
+    d = (d | d << 2) & 0x1249249249249249ULL;
+    return d;
+}
+
+// Where the cell at x, y, z comes on the three-dimensional Morton curve.
+inline uint64_t morton_index3(uint32_t x, uint32_t y, uint32_t z) {
+    return spread_bits3(x) | spread_bits3(y) << 1 | spread_bits3(z) << 2;
+}
+
+// r's place in the sorted order: the octant of its direction, then its origin's place on a Morton
+// curve through bounds. Origins outside bounds count as on its nearest face.
+inline uint64_t ray_sort_key(const ray& r, const aabb& bounds) {
+    const uint32_t cells = (1u << ray_sort_bits) - 1;
+    uint32_t q[3];
+    for (int a = 0; a < 3; a++) {
+        float extent = bounds.max()[a] - bounds.min()[a];
+        float f = extent > 0 ? (r.origin()[a] - bounds.min()[a]) / extent : 0;
+        f = f > 0 ? (f < 1 ? f : 1) : 0;
+        q[a] = uint32_t(f * cells);
+    }
+    uint64_t octant = r.sign(0) | r.sign(1) << 1 | r.sign(2) << 2;
+    return octant << (3 * ray_sort_bits) | morton_index3(q[0], q[1], q[2]);
+}
+
+// Sorts the indices in each run of batch entries of order, batch 0 meaning all of them, by the
+// keys of the rays ray_of(index) gives. Equal keys go in index order, so the result depends only
+// on the rays. keys is scratch space.
+template <typename F>
+void sort_ray_batches(std::vector<int>& order, int batch, const aabb& bounds, F ray_of,
+                      std::vector<std::pair<uint64_t, int> >& keys) {
+    size_t n = order.size();
+    size_t step = batch > 0 ? size_t(batch) : n;
+    keys.resize(n);
+    for (size_t i = 0; i < n; i++)
+        keys[i] = std::make_pair(ray_sort_key(ray_of(order[i]), bounds), order[i]);
+    for (size_t begin = 0; begin < n; begin += step) {
+        size_t end = n - begin < step ? n : begin + step;
+        std::sort(keys.begin() + begin, keys.begin() + end);
+    }
+    for (size_t i = 0; i < n; i++)
+        order[i] = keys[i].second;
+}
+
+#endif
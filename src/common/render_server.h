@@ -0,0 +1,264 @@
+#ifndef RENDERSERVERH
+#define RENDERSERVERH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include "framebuffer.h"
+
+#include <functional>
+#include <sstream>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+
+// A renderer that stays up between frames: the scene, its BVHs, textures and noise tables are built
+// once, and each request only pays for the samples it asks for. Requests are lines of text,
+//
+//     render nx=320 ny=240 ns=16 seed=7 lookfrom=13,2,3 lookat=0,0,0 vfov=20 format=png
+//
+// where every field is optional and falls back to the server's own settings and the scene's
+// camera. The answer to each is a line "ok <format> <bytes>" followed by that many bytes of image,
+// or a line "error <message>". "quit" ends the session; so does the end of the input. A request
+// that comes to more pixels or samples than the server's render_limits allow, or a line longer
+// than they allow, is answered with an error rather than rendered or read into memory.
+
+// Fields of the view a request may set, as bits of render_request::view_fields.
+const int render_view_lookfrom = 1;
+const int render_view_lookat = 2;
+const int render_view_vfov = 4;
+const int render_view_aperture = 8;
+const int render_view_focus = 16;
+
+struct render_request {
+    int nx, ny, ns;
+    uint32_t seed;
+    image_format format;
+    float lookfrom[3];
+    float lookat[3];
+    float vfov, aperture, focus_dist;
+    int view_fields;
+};
+
+// The largest request a server takes on: each of nx, ny and ns, the pixels nx*ny, the samples
+// nx*ny*ns, and the bytes of a request line.
+struct render_limits {
+    int max_nx, max_ny, max_ns;
+    long long max_pixels, max_samples;
+    size_t max_line;
+};
+
+const render_limits render_default_limits = { 4096, 4096, 4096, 4096LL*4096, 1LL << 30, 4096 };
+
+// Returns false, with a message in error, if req asks for more than limits allow.
+bool check_render_limits(const render_request& req, const render_limits& limits,
+                         std::string& error) {
+    const char *names[5] = { "nx", "ny", "ns", "nx*ny", "nx*ny*ns" };
+    long long pixels = (long long)req.nx * req.ny;
+    long long values[5] = { req.nx, req.ny, req.ns, pixels, pixels * req.ns };
+    long long maxima[5] = { limits.max_nx, limits.max_ny, limits.max_ns, limits.max_pixels,
+                            limits.max_samples };
+    for (int k = 0; k < 5; k++) {
+        if (values[k] > maxima[k]) {
+            error = std::string(names[k]) + "=" + std::to_string(values[k])
+                  + " is over the limit of " + std::to_string(maxima[k]);
+            return false;
+        }
+    }
+    return true;
+}
+
+inline const char *image_format_name(image_format f) {
+    switch (f) {
+        case image_p6: return "ppm";
+        case image_png: return "png";
+        case image_pfm: return "pfm";
+        case image_exr: return "exr";
+        default: return "unknown";
+    }
+}
+
+inline bool parse_float3(const char *s, float v[3]) {
+    char end;
+    return sscanf(s, "%f,%f,%f%c", &v[0], &v[1], &v[2], &end) == 3;
+}
+
+// Reads the fields after "render" on a request line into req, which holds the defaults. Returns
+// false, with a message in error, for a field it does not know or cannot read, or if the request,
+// defaults and all, comes to more than limits allow.
+bool parse_render_request(const char *line, render_request& req, const render_limits& limits,
+                          std::string& error) {
+    std::istringstream in(line);
+    std::string field;
+    while (in >> field) {
+        size_t eq = field.find('=');
+        std::string key = field.substr(0, eq);
+        const char *value = eq == std::string::npos ? "" : field.c_str() + eq + 1;
+        char end;
+        bool ok = eq != std::string::npos;
+        if (key == "nx") ok = ok && sscanf(value, "%d%c", &req.nx, &end) == 1 && req.nx > 0;
+        else if (key == "ny") ok = ok && sscanf(value, "%d%c", &req.ny, &end) == 1 && req.ny > 0;
+        else if (key == "ns") ok = ok && sscanf(value, "%d%c", &req.ns, &end) == 1 && req.ns > 0;
+        else if (key == "seed") ok = ok && sscanf(value, "%u%c", &req.seed, &end) == 1;
+        else if (key == "lookfrom") {
+            ok = ok && parse_float3(value, req.lookfrom);
+            req.view_fields |= render_view_lookfrom;
+        }
+        else if (key == "lookat") {
+            ok = ok && parse_float3(value, req.lookat);
+            req.view_fields |= render_view_lookat;
+        }
+        else if (key == "vfov") {
+            ok = ok && sscanf(value, "%f%c", &req.vfov, &end) == 1;
+            req.view_fields |= render_view_vfov;
+        }
+        else if (key == "aperture") {
+            ok = ok && sscanf(value, "%f%c", &req.aperture, &end) == 1;
+            req.view_fields |= render_view_aperture;
+        }
+        else if (key == "focus") {
+            ok = ok && sscanf(value, "%f%c", &req.focus_dist, &end) == 1;
+            req.view_fields |= render_view_focus;
+        }
+        else if (key == "format") {
+            req.format = image_format_for_path((std::string(".") + value).c_str());
+            ok = ok && req.format != image_unknown;
+        }
+        else
+            ok = false;
+        if (!ok) {
+            error = "bad field " + field;
+            return false;
+        }
+    }
+    return check_render_limits(req, limits, error);
+}
+
+
+// Renders a request into a framebuffer of req.nx by req.ny, or returns false with a message.
+typedef std::function<bool(const render_request& req, framebuffer& fb, std::string& error)>
+    render_handler;
+// Encodes fb as PNG, for servers that have an encoder; without one PNG requests are refused.
+typedef std::function<bool(const framebuffer& fb, std::string& bytes)> png_encoder;
+
+bool encode_image(const framebuffer& fb, image_format format, const png_encoder& png,
+                  std::string& bytes) {
+    if (format == image_png)
+        return png && png(fb, bytes);
+    std::ostringstream out;
+    if (format == image_p6) write_ppm_p6(out, fb);
+    else if (format == image_pfm) write_pfm(out, fb);
+    else if (format == image_exr) write_exr(out, fb);
+    else return false;
+    bytes = out.str();
+    return true;
+}
+
+// Answers requests read from in on out until "quit" or the end of in. Returns false if out
+// could no longer be written to, as when a client goes away mid-answer.
+bool serve_requests(FILE *in, FILE *out, const render_request& defaults,
+                    const render_limits& limits, const render_handler& render,
+                    const png_encoder& png) {
+    std::string line;
+    // Set when a line has more bytes than limits.max_line; the rest of it is read and dropped.
+    bool too_long = false;
+    for (int c; (c = fgetc(in)) != EOF || !line.empty(); ) {
+        if (c != '\n' && c != EOF) {
+            if (c == '\r')
+                continue;
+            if (line.size() < limits.max_line)
+                line += char(c);
+            else
+                too_long = true;
+            continue;
+        }
+        std::string command = line.substr(0, line.find(' '));
+        std::string rest = command.size() < line.size() ? line.substr(command.size()) : "";
+        line.clear();
+        std::string error, bytes;
+        render_request req = defaults;
+        if (too_long) {
+            error = "request longer than " + std::to_string(limits.max_line) + " bytes";
+            too_long = false;
+        }
+        else if (command == "quit")
+            return true;
+        else if (command.empty())
+            continue;
+        else if (command != "render")
+            error = "unknown request " + command;
+        else if (parse_render_request(rest.c_str(), req, limits, error)) {
+            framebuffer fb(req.nx, req.ny);
+            if (render(req, fb, error) && !encode_image(fb, req.format, png, bytes))
+                error = std::string("cannot encode ") + image_format_name(req.format);
+        }
+        if (error.empty())
+            fprintf(out, "ok %s %zu\n", image_format_name(req.format), bytes.size());
+        else
+            fprintf(out, "error %s\n", error.c_str());
+        fwrite(bytes.data(), 1, bytes.size(), out);
+        if (fflush(out) != 0)
+            return false;
+        if (c == EOF)
+            break;
+    }
+    return true;
+}
+
+#ifndef _WIN32
+// Listens on address:port and serves the clients that connect one after another, each for as long
+// as it keeps its connection. Only returns if the socket cannot be set up. The default address is
+// the loopback one; a server that other machines reach should sit behind something that checks
+// who is asking, since any client can make it render.
+bool serve_tcp(const char *address, int port, const render_request& defaults,
+               const render_limits& limits, const render_handler& render,
+               const png_encoder& png) {
+    // A client that hangs up mid-answer must not take the server down with it.
+    signal(SIGPIPE, SIG_IGN);
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (listener < 0)
+        return false;
+    int yes = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(uint16_t(port));
+    if (inet_pton(AF_INET, address, &addr.sin_addr) != 1
+            || bind(listener, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(listener, 8) != 0) {
+        close(listener);
+        return false;
+    }
+    for (;;) {
+        int client = accept(listener, 0, 0);
+        if (client < 0)
+            continue;
+        FILE *in = fdopen(client, "rb");
+        FILE *out = in ? fdopen(dup(client), "wb") : 0;
+        if (in && out)
+            serve_requests(in, out, defaults, limits, render, png);
+        if (out) fclose(out);
+        if (in) fclose(in);
+        else close(client);
+    }
+}
+#endif
+
+#endif
@@ -0,0 +1,173 @@
+#ifndef RENDERSTATSH
+#define RENDERSTATSH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+
+// Counters of what a render spends its time on: rays traced and how deep, BVH nodes visited and
+// primitives tested, scatters by material, NaN samples zeroed. They are compiled in only when
+// RT_STATS is defined; otherwise every RT_COUNT macro is empty and a release build pays nothing.
+#ifdef RT_STATS
+#include <mutex>
+#include <ostream>
+#include <string.h>
+
+// Bounces deeper than this share the last bin of the depth histogram.
+const int render_stats_max_depth = 64;
+// Kinds of material scatter counts are kept for; any past this share the last slot.
+const int render_stats_max_kinds = 16;
+
+struct render_stats {
+    render_stats() { memset(this, 0, sizeof(*this)); }
+    void add(const render_stats& o) {
+        rays += o.rays;
+        shadow_rays += o.shadow_rays;
+        node_visits += o.node_visits;
+        primitive_tests += o.primitive_tests;
+        nan_corrections += o.nan_corrections;
+        for (int i = 0; i < render_stats_max_kinds; i++)
+            scatters[i] += o.scatters[i];
+        for (int i = 0; i < render_stats_max_depth; i++)
+            depth[i] += o.depth[i];
+    }
+
+    long long rays;              // rays traced for the nearest hit, camera rays included
+    long long shadow_rays;       // rays traced only to see whether anything blocks them
+    long long node_visits;       // BVH nodes whose bounds a ray was tested against
+    long long primitive_tests;   // primitives a BVH handed a ray to from its leaves
+    long long nan_corrections;   // samples with a NaN channel that was zeroed
+    long long scatters[render_stats_max_kinds];   // by material kind, see render_stats_kind_name
+    long long depth[render_stats_max_depth];      // rays traced at each bounce, 0 for camera rays
+};
+
+inline std::mutex& render_stats_lock() {
+    static std::mutex m;
+    return m;
+}
+
+inline render_stats& render_stats_totals() {
+    static render_stats totals;
+    return totals;
+}
+
+// Counters are kept per thread and folded into the totals when the thread exits, so they do not
+// contend on the hot path.
+struct render_thread_stats {
+    ~render_thread_stats() { flush(); }
+    void flush() {
+        std::lock_guard<std::mutex> lock(render_stats_lock());
+        render_stats_totals().add(counts);
+        counts = render_stats();
+    }
+    render_stats counts;
+};
+
+inline render_thread_stats& render_stats_local() {
+    static thread_local render_thread_stats c;
+    return c;
+}
+
+inline const char *&render_stats_kind_name(int slot) {
+    static const char *names[render_stats_max_kinds];
+    return names[slot];
+}
+
+// The slot scatters off material kind name are counted in, assigned the first time it is asked.
+inline int render_stats_kind_slot(const char *name) {
+    std::lock_guard<std::mutex> lock(render_stats_lock());
+    int slot = 0;
+    while (slot < render_stats_max_kinds - 1 && render_stats_kind_name(slot)
+           && strcmp(render_stats_kind_name(slot), name))
+        slot++;
+    if (!render_stats_kind_name(slot))
+        render_stats_kind_name(slot) = name;
+    return slot;
+}
+
+// Flushes the calling thread and returns the totals. Worker threads flush when they exit, so call
+// this once they have been joined.
+inline const render_stats& render_stats_collect() {
+    render_stats_local().flush();
+    return render_stats_totals();
+}
+
+// The number of rays a packet's lane mask leaves active, for counting the work of packet traversal
+// per ray.
+inline int render_stats_lanes(int mask) {
+    int n = 0;
+    for (; mask; mask &= mask - 1)
+        n++;
+    return n;
+}
+
+inline int render_stats_depth_bin(int depth) {
+    return depth < render_stats_max_depth ? depth : render_stats_max_depth-1;
+}
+
+#define RT_COUNT(field, n) (render_stats_local().counts.field += (n))
+#define RT_COUNT_DEPTH(d, n) (render_stats_local().counts.depth[render_stats_depth_bin(d)] += (n))
+#define RT_COUNT_SCATTER(name) do { \
+        static const int rt_stats_slot = render_stats_kind_slot(name); \
+        render_stats_local().counts.scatters[rt_stats_slot]++; \
+    } while (0)
+
+// How many bins of the depth histogram to show: up to the last one that is not empty.
+inline int render_stats_depth_bins(const render_stats& s) {
+    int n = render_stats_max_depth;
+    while (n > 0 && s.depth[n-1] == 0)
+        n--;
+    return n;
+}
+
+// A summary for people, with rates per camera sample.
+void render_stats_print(std::ostream& out, const render_stats& s, long long camera_samples) {
+    double per = camera_samples > 0 ? 1.0 / camera_samples : 0;
+    out << "rays: " << s.rays << " (" << s.rays * per << " per camera sample)\n";
+    out << "shadow rays: " << s.shadow_rays << " (" << s.shadow_rays * per
+        << " per camera sample)\n";
+    out << "bvh: " << s.node_visits << " node visits, " << s.primitive_tests
+        << " primitive tests (" << s.node_visits * per << " and " << s.primitive_tests * per
+        << " per camera sample)\n";
+    out << "nan corrections: " << s.nan_corrections << "\n";
+    out << "scatters:";
+    for (int i = 0; i < render_stats_max_kinds && render_stats_kind_name(i); i++)
+        out << " " << render_stats_kind_name(i) << " " << s.scatters[i];
+    out << "\nrays by depth:";
+    int bins = render_stats_depth_bins(s);
+    for (int i = 0; i < bins; i++)
+        out << " " << s.depth[i];
+    out << "\n";
+}
+
+// The same counters as one JSON object, for scripts.
+void render_stats_write_json(std::ostream& out, const render_stats& s, long long camera_samples) {
+    out << "{\n  \"camera_samples\": " << camera_samples
+        << ",\n  \"rays\": " << s.rays
+        << ",\n  \"shadow_rays\": " << s.shadow_rays
+        << ",\n  \"node_visits\": " << s.node_visits
+        << ",\n  \"primitive_tests\": " << s.primitive_tests
+        << ",\n  \"nan_corrections\": " << s.nan_corrections
+        << ",\n  \"scatters\": {";
+    for (int i = 0; i < render_stats_max_kinds && render_stats_kind_name(i); i++)
+        out << (i ? ", " : "") << "\"" << render_stats_kind_name(i) << "\": " << s.scatters[i];
+    out << "},\n  \"rays_by_depth\": [";
+    int bins = render_stats_depth_bins(s);
+    for (int i = 0; i < bins; i++)
+        out << (i ? ", " : "") << s.depth[i];
+    out << "]\n}\n";
+}
+#else
+#define RT_COUNT(field, n) ((void)0)
+#define RT_COUNT_DEPTH(d, n) ((void)0)
+#define RT_COUNT_SCATTER(name) ((void)0)
+#endif
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef ROULETTEH
+#define ROULETTEH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+
+// Russian roulette: past min_depth bounces, a path whose throughput (what its next bounce's
+// radiance will be scaled by) has fallen below roulette_threshold goes on with a probability in
+// proportion to it, and is scaled up by one over that probability if it does, so the expected
+// image is unchanged. The survivors carry on at the threshold. Cutting only the dim paths spends
+// fewer rays on light that hardly shows, without the noise of cutting paths that still matter.
+const float roulette_threshold = 0.1f;
+
+// Returns the probability that a path at depth whose throughput is (r, g, b) goes on. A negative
+// min_depth turns roulette off.
+inline float roulette_survival(int depth, int min_depth, float r, float g, float b) {
+    if (min_depth < 0 || depth < min_depth)
+        return 1;
+    float m = r > g ? r : g;
+    m = m > b ? m : b;
+    return m < roulette_threshold ? m / roulette_threshold : 1;
+}
+
+#endif
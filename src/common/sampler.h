@@ -0,0 +1,247 @@
+#ifndef SAMPLERH
+#define SAMPLERH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+
+// Sample patterns random_double() can draw from. Each one maps (pixel, sample index, dimension)
+// to a number in [0,1); dimensions are used in pairs, so consecutive draws such as a lens or
+// hemisphere point are stratified together.
+enum sample_pattern {
+    pattern_random,       // independent pcg32 numbers
+    pattern_stratified,   // correlated multi-jittered pairs (Kensler 2013)
+    pattern_halton,       // Halton, with the digits Owen-scrambled per pixel
+    pattern_sobol,        // Owen-scrambled Sobol pairs, each pair shuffled (Burley 2020)
+    pattern_blue_noise,   // one Sobol sequence, rotated per pixel by a blue-noise mask
+    pattern_unknown
+};
+
+sample_pattern sample_pattern_for_name(const char *name) {
+    static const char *names[] = { "random", "stratified", "halton", "sobol", "bluenoise" };
+    for (int p = 0; p < int(pattern_unknown); p++)
+        if (!strcmp(name, names[p]))
+            return sample_pattern(p);
+    return pattern_unknown;
+}
+
+// The patterns cover this many dimensions of each sample; later ones come from pcg32.
+const int sample_pattern_dimensions = 64;
+
+
+inline float sample_unit_float(uint32_t x) {
+    return float(x >> 8) * (1.0f / 16777216.0f);
+}
+
+inline uint32_t sample_hash(uint32_t x, uint32_t seed) {
+    x ^= seed;
+    x ^= x >> 16;
+    x *= 0x7feb352dU;
+    x ^= x >> 15;
+    x *= 0x846ca68bU;
+    x ^= x >> 16;
+    return x;
+}
+
+inline uint32_t reverse_bits(uint32_t x) {
+    x = (x << 16) | (x >> 16);
+    x = ((x & 0x00ff00ffU) << 8) | ((x & 0xff00ff00U) >> 8);
+    x = ((x & 0x0f0f0f0fU) << 4) | ((x & 0xf0f0f0f0U) >> 4);
+    x = ((x & 0x33333333U) << 2) | ((x & 0xccccccccU) >> 2);
+    x = ((x & 0x55555555U) << 1) | ((x & 0xaaaaaaaaU) >> 1);
+    return x;
+}
+
+// An Owen scramble of a 32-bit fraction: each bit is flipped depending on the bits above it.
+// The Laine-Karras hash does this on the reversed bits, where "above" becomes "below".
+inline uint32_t nested_uniform_scramble(uint32_t x, uint32_t seed) {
+    x = reverse_bits(x);
+    x += seed;
+    x ^= x * 0x6c50b47cU;
+    x ^= x * 0xb82f1e52U;
+    x ^= x * 0xc7afe638U;
+    x ^= x * 0x8d22f6e6U;
+    return reverse_bits(x);
+}
+
+// The first two Sobol dimensions: van der Corput, and the dimension with direction numbers
+// v[k] = v[k-1] ^ (v[k-1] >> 1). Together they form a (0,2)-sequence.
+inline uint32_t sobol(uint32_t index, int dimension) {
+    if (dimension == 0)
+        return reverse_bits(index);
+    uint32_t y = 0;
+    for (uint32_t v = 1U << 31; index; index >>= 1, v ^= v >> 1)
+        if (index & 1)
+            y ^= v;
+    return y;
+}
+
+// Component d of sample index of the Sobol pair for this seed. The index is shuffled, and each
+// component scrambled, by hashes of the seed, so every pair of dimensions is independent of the
+// others but still stratified together.
+inline float scrambled_sobol(uint32_t index, uint32_t seed, int d) {
+    uint32_t i = nested_uniform_scramble(index, sample_hash(seed, 0x9e3779b9U));
+    uint32_t x = sobol(i, d);
+    return sample_unit_float(nested_uniform_scramble(x, sample_hash(seed, d ? 0xc2b2ae35U
+                                                                             : 0x85ebca6bU)));
+}
+
+inline uint32_t halton_base(int dimension) {
+    static const uint32_t primes[sample_pattern_dimensions] = {
+        2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53,
+        59, 61, 67, 71, 73, 79, 83, 89, 97, 101, 103, 107, 109, 113, 127, 131,
+        137, 139, 149, 151, 157, 163, 167, 173, 179, 181, 191, 193, 197, 199, 211, 223,
+        227, 229, 233, 239, 241, 251, 257, 263, 269, 271, 277, 281, 283, 293, 307, 311 };
+    return primes[dimension];
+}
+
+// Kensler, "Correlated Multi-Jittered Sampling": a hashed permutation of [0,l).
+inline uint32_t cmj_permute(uint32_t i, uint32_t l, uint32_t p) {
+    uint32_t w = l - 1;
+    w |= w >> 1;
+    w |= w >> 2;
+    w |= w >> 4;
+    w |= w >> 8;
+    w |= w >> 16;
+    do {
+        i ^= p;             i *= 0xe170893dU;
+        i ^= p >> 16;       i ^= (i & w) >> 4;
+        i ^= p >> 8;        i *= 0x0929eb3fU;
+        i ^= p >> 23;       i ^= (i & w) >> 1;
+        i *= 1 | p >> 27;   i *= 0x6935fa69U;
+        i ^= (i & w) >> 11; i *= 0x74dcb303U;
+        i ^= (i & w) >> 2;  i *= 0x9e501cc3U;
+        i ^= (i & w) >> 2;  i *= 0xc860a3dfU;
+        i &= w;
+        i ^= i >> 5;
+    } while (i >= l);
+    return (i + p) % l;
+}
+
+// The radical inverse of index in the given base, with the digits at each position shuffled by
+// their own permutation (Owen scrambling). Plain Halton's higher bases are strongly correlated with
+// each other at low sample counts, and the permutations break that up. Digits continue past the
+// last nonzero one, since a permuted zero need not be zero.
+inline float scrambled_radical_inverse(uint32_t base, uint32_t index, uint32_t seed) {
+    double inv_base = 1.0 / base;
+    double scale = inv_base;
+    double r = 0;
+    for (uint32_t digit = 0; scale > 1.0/16777216; digit++, index /= base, scale *= inv_base)
+        r += cmj_permute(index % base, base, sample_hash(seed, digit)) * scale;
+    return float(r < 1.0 ? r : 0.99999994);
+}
+
+inline float cmj_jitter(uint32_t i, uint32_t p) {
+    return sample_unit_float(sample_hash(i, p));
+}
+
+// Sample s of n: one point in each cell of an m x (n/m) grid, and in each of the n rows and n
+// columns, with the strata shuffled by p.
+inline void cmj_pair(uint32_t s, uint32_t n, uint32_t p, float& u, float& v) {
+    uint32_t m = uint32_t(sqrt(double(n)));
+    uint32_t k = (n + m - 1) / m;
+    s = cmj_permute(s, n, p * 0x51633e2dU);
+    uint32_t sx = cmj_permute(s % m, m, p * 0x68bc21ebU);
+    uint32_t sy = cmj_permute(s / m, k, p * 0x02e5be93U);
+    float jx = cmj_jitter(s, p * 0x967a889bU);
+    float jy = cmj_jitter(s, p * 0x368cc8b7U);
+    u = (sx + (sy + jx) / k) / m;
+    v = (s + jy) / n;
+    if (u >= 1.0f) u = 0.99999994f;
+    if (v >= 1.0f) v = 0.99999994f;
+}
+
+
+// A 64x64 tile of blue noise: every value (rank + 1/2)/4096 appears once, and similar values sit
+// far apart. It is made by the void-and-cluster method, placing each rank in the pixel with least
+// Gaussian energy from those already placed, and is built once, the first time it is needed.
+const int blue_noise_size = 64;
+
+inline const std::vector<float>& blue_noise_mask() {
+    struct mask_builder {
+        static std::vector<float> build() {
+            const int n = blue_noise_size;
+            std::vector<float> mask(n*n, 0.0f);
+            std::vector<double> energy(n*n, 0.0);
+            std::vector<bool> placed(n*n, false);
+            std::vector<double> kernel(n*n);
+            for (int dy = 0; dy < n; dy++) {
+                for (int dx = 0; dx < n; dx++) {
+                    int x = dx < n/2 ? dx : n - dx;
+                    int y = dy < n/2 ? dy : n - dy;
+                    kernel[dy*n + dx] = exp(-(x*x + y*y) / (2 * 1.9 * 1.9));
+                }
+            }
+            for (int rank = 0; rank < n*n; rank++) {
+                int best = -1;
+                for (int p = 0; p < n*n; p++) {
+                    // Ties, including the empty tile, go to a hashed order rather than to (0,0)
+                    // and its neighbours.
+                    if (!placed[p] && (best < 0 || energy[p] < energy[best]
+                            || (energy[p] == energy[best]
+                                && sample_hash(p, 0x2545f491U) < sample_hash(best, 0x2545f491U))))
+                        best = p;
+                }
+                placed[best] = true;
+                mask[best] = (rank + 0.5f) / float(n*n);
+                int bx = best % n, by = best / n;
+                for (int y = 0; y < n; y++)
+                    for (int x = 0; x < n; x++)
+                        energy[y*n + x] += kernel[((y - by + n) % n)*n + (x - bx + n) % n];
+            }
+            return mask;
+        }
+    };
+    static const std::vector<float> mask = mask_builder::build();
+    return mask;
+}
+
+inline float blue_noise(int x, int y) {
+    return blue_noise_mask()[(y & (blue_noise_size-1))*blue_noise_size + (x & (blue_noise_size-1))];
+}
+
+
+// Dimension d of sample `sample` (of `count`) in pixel (x,y). pixel_seed is a hash of the image
+// seed and the pixel; image_seed is the image seed alone.
+inline float sample_pattern_value(sample_pattern pattern, uint32_t x, uint32_t y,
+                                  uint32_t pixel_seed, uint32_t image_seed, uint32_t sample,
+                                  uint32_t count, int d) {
+    switch (pattern) {
+        case pattern_stratified: {
+            // Sample counts past the planned one start another, independently shuffled, set.
+            uint32_t n = count > 0 ? count : 1;
+            float u, v;
+            cmj_pair(sample % n, n, sample_hash(pixel_seed ^ (sample / n), d/2), u, v);
+            return d & 1 ? v : u;
+        }
+        case pattern_halton:
+            return scrambled_radical_inverse(halton_base(d), sample, sample_hash(pixel_seed, d));
+        case pattern_sobol:
+            return scrambled_sobol(sample, sample_hash(pixel_seed, d/2), d & 1);
+        case pattern_blue_noise: {
+            // Neighbouring pixels share a sequence but not a rotation, so their errors differ in a
+            // blue-noise pattern rather than as white noise. Each dimension reads the mask at its
+            // own offset.
+            uint32_t shift = sample_hash(image_seed ^ 0x68e31da4U, d);
+            float r = scrambled_sobol(sample, sample_hash(image_seed, d/2), d & 1)
+                    + blue_noise(x + (shift & 0xffff), y + (shift >> 16));
+            return r < 1.0f ? r : r - 1.0f;
+        }
+        default:
+            return 0;
+    }
+}
+
+#endif
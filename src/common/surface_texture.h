@@ -0,0 +1,66 @@
+#ifndef SURFTEXTH
+#define SURFTEXTH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include "texture_base.h"
+#include "texture_cache.h"
+
+
+// The cache every image_texture keeps its texels in.
+texture_cache& image_texture_cache() {
+    static texture_cache cache;
+    return cache;
+}
+
+// An image wrapped over [0,1]^2 of u,v. The texels are held in image_texture_cache() as a mip
+// pyramid, and lookups are filtered over the ray's footprint. world_height, the length in world
+// units the image's height is stretched over (pi*r on a sphere), turns a footprint into a width in
+// u,v; when it is zero the top level is always used.
+class image_texture : public texture {
+    public:
+        image_texture() {}
+        image_texture(const unsigned char *pixels, int A, int B, float world_height = 0)
+            : nx(A), ny(B), height(world_height) {
+            id = image_texture_cache().add(pixels, nx, ny);
+        }
+        // For an image the cache has reserved cache_id for, to be filled in later.
+        image_texture(int cache_id, int A, int B, float world_height)
+            : id(cache_id), nx(A), ny(B), height(world_height) {}
+        virtual vec3 value(float u, float v, const vec3& p) const { return value(u, v, p, 0); }
+        virtual vec3 value(float u, float v, const vec3& p, float footprint) const;
+        virtual void value_batch(const float *u, const float *v, const vec3 *p, vec3 *out,
+                                 int n) const;
+        int id;
+        int nx, ny;
+        float height;
+};
+
+vec3 image_texture::value(float u, float v, const vec3& p, float footprint) const {
+    float rgb[3];
+    float width = height > 0 ? footprint / height : 0;
+    image_texture_cache().trilinear(id, u, v, width, rgb);
+    return vec3(rgb[0], rgb[1], rgb[2]);
+}
+
+// Batches have no footprints, so they read the top level, as value(u, v, p) does, in one call for
+// the whole batch rather than a virtual call per point.
+void image_texture::value_batch(const float *u, const float *v, const vec3 *p, vec3 *out,
+                                int n) const {
+    texture_cache& cache = image_texture_cache();
+    for (int k = 0; k < n; k++) {
+        float rgb[3];
+        cache.trilinear(id, u[k], v[k], 0, rgb);
+        out[k] = vec3(rgb[0], rgb[1], rgb[2]);
+    }
+}
+
+#endif
@@ -0,0 +1,107 @@
+#ifndef TASKGROUPH
+#define TASKGROUPH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include "tile_scheduler.h"
+#include "trace.h"
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+// Worker threads that run tasks in the order they are given, for work such as decoding images
+// that can go on while the thread that gave it carries on with something else. A task that needs
+// another's result waits on the future run() returned for it; tasks should only wait on tasks
+// given before them, so that the oldest task can always finish. The threads start with the first
+// task, so a group that is never given one costs nothing.
+class task_group {
+    public:
+        // threads = 0 uses every hardware thread.
+        explicit task_group(int threads = 0)
+            : thread_count(threads > 0 ? threads : default_thread_count()), busy(0),
+              stopping(false) {}
+        ~task_group();
+
+        std::future<void> run(std::function<void()> task);
+        // Returns once every task given so far has finished.
+        void wait();
+
+    private:
+        task_group(const task_group&);
+        task_group& operator=(const task_group&);
+
+        void work();
+
+        int thread_count;
+        std::vector<std::thread> workers;
+        std::deque<std::packaged_task<void()> > queue;
+        int busy;
+        bool stopping;
+        std::mutex lock;
+        std::condition_variable wake, idle;
+};
+
+
+task_group::~task_group() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (size_t t = 0; t < workers.size(); t++)
+        workers[t].join();
+}
+
+std::future<void> task_group::run(std::function<void()> task) {
+    std::packaged_task<void()> job(task);
+    std::future<void> done = job.get_future();
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        queue.push_back(std::move(job));
+        if (int(workers.size()) < thread_count && size_t(busy) + queue.size() > workers.size())
+            workers.push_back(std::thread(&task_group::work, this));
+    }
+    wake.notify_one();
+    return done;
+}
+
+void task_group::wait() {
+    std::unique_lock<std::mutex> guard(lock);
+    idle.wait(guard, [this]() { return queue.empty() && busy == 0; });
+}
+
+// Workers finish the queue before they stop, so nothing given to the group is dropped.
+void task_group::work() {
+    trace_name_thread("task worker");
+    std::unique_lock<std::mutex> guard(lock);
+    for (;;) {
+        wake.wait(guard, [this]() { return stopping || !queue.empty(); });
+        if (queue.empty())
+            return;
+        std::packaged_task<void()> job = std::move(queue.front());
+        queue.pop_front();
+        busy++;
+        guard.unlock();
+        job();
+        guard.lock();
+        busy--;
+        if (queue.empty() && busy == 0)
+            idle.notify_all();
+    }
+}
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef TEXTUREBASEH
+#define TEXTUREBASEH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include "vec3.h"
+
+
+// The kinds a renderer may tag its built-in textures with, so that it can switch on the tag and
+// call them directly rather than through the vtable, as texture_value() in The Rest of Your Life
+// does. Every other texture is texture_other.
+enum texture_kind { texture_other, texture_constant, texture_checker, texture_noise };
+
+class texture  {
+    public:
+        texture() : kind(texture_other) {}
+        virtual ~texture() {}
+        virtual vec3 value(float u, float v, const vec3& p) const = 0;
+        // footprint is the width, in world units, of the ray's cone where it hit the surface.
+        // Textures that can filter over it do; the rest ignore it.
+        virtual vec3 value(float u, float v, const vec3& p, float footprint) const {
+            return value(u, v, p);
+        }
+        // out[k] = value(u[k], v[k], p[k]) for k < n, for shading stages that work through a
+        // queue of hits at once. The built-in textures work on arrays of their inputs, in loops
+        // the compiler can vectorize, and give exactly what value() would; the default calls
+        // value() for each point.
+        virtual void value_batch(const float *u, const float *v, const vec3 *p, vec3 *out,
+                                 int n) const {
+            for (int k = 0; k < n; k++)
+                out[k] = value(u[k], v[k], p[k]);
+        }
+
+        texture_kind kind;
+};
+
+#endif
@@ -0,0 +1,405 @@
+#ifndef TEXTURECACHEH
+#define TEXTURECACHEH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <math.h>
+#include <memory>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unordered_map>
+#include <vector>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+
+// RGB8 images kept as mip pyramids cut into square tiles. The tiles live in a backing file, and
+// only a bounded number of them are held in memory: a lookup pages in the tiles it touches and
+// pushes out the ones used least recently. Each tile is a contiguous block, and neighbouring
+// texels almost always share one, so filtered lookups stay within a few cache lines.
+//
+// Images are added while a scene is built; lookups may then come from any number of threads. An
+// image can also be reserved first and filled in later, from another thread: its lookups wait for
+// it, so rendering can start while images are still being decoded.
+//
+// A tile's texels never change once written, so each thread keeps a small view of the tiles it
+// used last and reads them with no lock at all; nearly every lookup is served from it. Behind the
+// views the resident tiles are split between shards by tile number, each with its own lock,
+// recency list and share of the budget, so threads that do miss their views seldom wait for each
+// other. A tile missing from its shard is read with no lock held, and the shard's lock is taken
+// again only to publish it. Tiles are shared between the shards and the views, so a tile pushed
+// out of its shard stays good for the views that still hold it. Once an image is filled, its
+// lookups read its levels without locking.
+class texture_cache {
+    public:
+        static const int tile_size = 32;
+        static const size_t tile_bytes = 3 * tile_size * tile_size;
+        static const int shard_count = 16;
+
+        explicit texture_cache(size_t max_resident_bytes = size_t(64) << 20);
+        ~texture_cache();
+
+        // Builds the pyramid for an nx x ny image whose first row is its top, and returns the
+        // id later lookups use. The pixels are copied, so the caller may free them.
+        int add(const unsigned char *rgb, int nx, int ny);
+        // An id for an image to come, and its pixels as add() takes them. Only the copy into the
+        // cache holds the lock, so several images can be filled at once. Ids must all be
+        // reserved before lookups start.
+        int reserve();
+        void fill(int id, const unsigned char *rgb, int nx, int ny);
+
+        // Never fewer than 8 tiles a shard, so the 8 one trilinear lookup can touch stay resident
+        // for the lookups next to it even if they all fall in one shard.
+        void set_budget(size_t max_resident_bytes);
+
+        // u runs left to right and v bottom to top, as image_texture has always had them;
+        // lookups outside [0,1] clamp to the edge.
+        void bilinear(int id, int level, float u, float v, float rgb[3]);
+        // Blends the two levels whose texels are closest in size to width, which is measured in
+        // units of v (image heights). A width of zero does a bilinear lookup on the top level.
+        void trilinear(int id, float u, float v, float width, float rgb[3]);
+
+        int levels(int id) { return int(filled(id).size()); }
+        size_t resident_bytes();
+        size_t tiles_read();
+        size_t lookups() const { return fetches; }
+
+    private:
+        texture_cache(const texture_cache&);
+        texture_cache& operator=(const texture_cache&);
+
+        struct level_info {
+            int nx, ny;
+            int tiles_x;
+            size_t first_tile;   // index of the level's first tile in the backing store
+        };
+        struct image_entry {
+            image_entry() : ready(false) {}
+            // Set, with release order, once levels has been written; it never changes after.
+            std::atomic<bool> ready;
+            std::vector<level_info> levels;
+        };
+        typedef std::shared_ptr<const std::vector<unsigned char> > tile_ptr;
+        struct resident_tile {
+            uint64_t key;
+            tile_ptr texels;
+        };
+        // An entry of a thread's view: tile index of the cache numbered cache_id, 0 for none.
+        struct view_entry {
+            view_entry() : cache_id(0), index(0) {}
+            uint64_t cache_id, index;
+            tile_ptr texels;
+        };
+        static const int view_size = 16;
+        struct shard {
+            shard() : budget(8), reads(0) {}
+            std::mutex lock;
+            // Tiles in the order they were last used, most recent first.
+            std::list<resident_tile> lru;
+            std::unordered_map<uint64_t, std::list<resident_tile>::iterator> resident;
+            size_t budget, reads;
+        };
+
+        static view_entry *thread_view();
+        void read_tile(size_t index, unsigned char *texels);
+        const unsigned char *tile(size_t index);
+        tile_ptr shard_tile(size_t index);
+        void texel(const level_info& l, int x, int y, float rgb[3]);
+        void lookup_level(const level_info& l, float u, float v, float rgb[3]);
+        const std::vector<level_info>& filled(int id);
+
+        // A deque, so that reserving an image never moves the others' entries.
+        std::deque<image_entry> images;
+        size_t tile_count;
+        shard shards[shard_count];
+        FILE *backing;
+        // Used instead of the backing file when no temporary file can be made.
+        std::vector<unsigned char> in_memory;
+        std::atomic<size_t> fetches;
+        // Tells this cache's tiles apart from another's in the threads' views.
+        uint64_t id;
+        // lock guards images and tile_count; file_lock guards writes to the backing store, and
+        // reads where they cannot be made without moving its position.
+        std::mutex lock, file_lock;
+        std::condition_variable image_filled;
+};
+
+
+texture_cache::texture_cache(size_t max_resident_bytes)
+    : tile_count(0), backing(tmpfile()), fetches(0) {
+    static std::atomic<uint64_t> caches(0);
+    id = ++caches;
+    set_budget(max_resident_bytes);
+}
+
+texture_cache::~texture_cache() {
+    if (backing)
+        fclose(backing);
+}
+
+void texture_cache::set_budget(size_t max_resident_bytes) {
+    size_t budget = max_resident_bytes / tile_bytes / shard_count;
+    for (int i = 0; i < shard_count; i++) {
+        shard& s = shards[i];
+        std::lock_guard<std::mutex> guard(s.lock);
+        s.budget = budget > 8 ? budget : 8;
+        while (s.resident.size() > s.budget) {
+            s.resident.erase(s.lru.back().key);
+            s.lru.pop_back();
+        }
+    }
+}
+
+size_t texture_cache::resident_bytes() {
+    size_t tiles = 0;
+    for (int i = 0; i < shard_count; i++) {
+        std::lock_guard<std::mutex> guard(shards[i].lock);
+        tiles += shards[i].resident.size();
+    }
+    return tiles * tile_bytes;
+}
+
+size_t texture_cache::tiles_read() {
+    size_t reads = 0;
+    for (int i = 0; i < shard_count; i++) {
+        std::lock_guard<std::mutex> guard(shards[i].lock);
+        reads += shards[i].reads;
+    }
+    return reads;
+}
+
+int texture_cache::add(const unsigned char *rgb, int nx, int ny) {
+    int id = reserve();
+    fill(id, rgb, nx, ny);
+    return id;
+}
+
+int texture_cache::reserve() {
+    std::lock_guard<std::mutex> guard(lock);
+    images.resize(images.size() + 1);
+    return int(images.size()) - 1;
+}
+
+void texture_cache::fill(int id, const unsigned char *rgb, int nx, int ny) {
+    // The tiles of every level are made first, numbered from 0, and moved to the end of the
+    // backing store in one go.
+    std::vector<level_info> pyramid;
+    std::vector<unsigned char> level(rgb, rgb + size_t(3)*nx*ny);
+    std::vector<unsigned char> tiles;
+    size_t count = 0;
+    for (;;) {
+        level_info l;
+        l.nx = nx;
+        l.ny = ny;
+        l.tiles_x = (nx + tile_size - 1) / tile_size;
+        l.first_tile = count;
+        int tiles_y = (ny + tile_size - 1) / tile_size;
+        tiles.resize((count + size_t(l.tiles_x) * tiles_y) * tile_bytes);
+        // Tiles are written whole; texels past the image edge repeat the last row and column.
+        for (int ty = 0; ty < tiles_y; ty++) {
+            for (int tx = 0; tx < l.tiles_x; tx++) {
+                unsigned char *block = &tiles[count * tile_bytes];
+                for (int y = 0; y < tile_size; y++) {
+                    for (int x = 0; x < tile_size; x++) {
+                        int sx = tx*tile_size + x, sy = ty*tile_size + y;
+                        if (sx > nx-1) sx = nx-1;
+                        if (sy > ny-1) sy = ny-1;
+                        memcpy(&block[3*(y*tile_size + x)], &level[3*(size_t(sy)*nx + sx)], 3);
+                    }
+                }
+                count++;
+            }
+        }
+        pyramid.push_back(l);
+        if (nx == 1 && ny == 1)
+            break;
+        // Each texel of the next level averages the (up to) four it covers.
+        int mx = nx > 1 ? nx/2 : 1, my = ny > 1 ? ny/2 : 1;
+        std::vector<unsigned char> next(size_t(3)*mx*my);
+        for (int y = 0; y < my; y++) {
+            for (int x = 0; x < mx; x++) {
+                int x0 = nx > 1 ? 2*x : 0, x1 = nx > 1 ? 2*x+1 : 0;
+                int y0 = ny > 1 ? 2*y : 0, y1 = ny > 1 ? 2*y+1 : 0;
+                for (int c = 0; c < 3; c++) {
+                    int sum = level[3*(size_t(y0)*nx + x0) + c] + level[3*(size_t(y0)*nx + x1) + c]
+                            + level[3*(size_t(y1)*nx + x0) + c] + level[3*(size_t(y1)*nx + x1) + c];
+                    next[3*(size_t(y)*mx + x) + c] = (unsigned char)((sum + 2) / 4);
+                }
+            }
+        }
+        level.swap(next);
+        nx = mx;
+        ny = my;
+    }
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        std::lock_guard<std::mutex> file_guard(file_lock);
+        for (size_t l = 0; l < pyramid.size(); l++)
+            pyramid[l].first_tile += tile_count;
+        if (backing) {
+            // Reads made with fseek may have left the file position anywhere.
+            fseek(backing, long(tile_count * tile_bytes), SEEK_SET);
+            fwrite(&tiles[0], 1, tiles.size(), backing);
+            fflush(backing);
+        }
+        else
+            in_memory.insert(in_memory.end(), tiles.begin(), tiles.end());
+        tile_count += count;
+        images[id].levels = pyramid;
+        images[id].ready.store(true, std::memory_order_release);
+    }
+    image_filled.notify_all();
+}
+
+// Image id's levels, once it has been filled.
+const std::vector<texture_cache::level_info>& texture_cache::filled(int id) {
+    image_entry& image = images[id];
+    if (!image.ready.load(std::memory_order_acquire)) {
+        std::unique_lock<std::mutex> guard(lock);
+        image_filled.wait(guard, [&image]() { return image.ready.load(); });
+    }
+    return image.levels;
+}
+
+// Reads a tile from the backing store. Where pread() is available no lock is needed, as it leaves
+// the file position alone.
+void texture_cache::read_tile(size_t index, unsigned char *texels) {
+#ifndef _WIN32
+    if (backing) {
+        if (pread(fileno(backing), texels, tile_bytes, off_t(index * tile_bytes))
+                != ssize_t(tile_bytes))
+            memset(texels, 0, tile_bytes);
+        return;
+    }
+#endif
+    std::lock_guard<std::mutex> guard(file_lock);
+    if (backing) {
+        fseek(backing, long(index * tile_bytes), SEEK_SET);
+        if (fread(texels, 1, tile_bytes, backing) != tile_bytes)
+            memset(texels, 0, tile_bytes);
+    }
+    else
+        memcpy(texels, &in_memory[index * tile_bytes], tile_bytes);
+}
+
+texture_cache::view_entry *texture_cache::thread_view() {
+    static thread_local view_entry view[view_size];
+    return view;
+}
+
+// Tile index, from the shard that holds it or else the backing store.
+texture_cache::tile_ptr texture_cache::shard_tile(size_t index) {
+    shard& s = shards[index % shard_count];
+    std::unordered_map<uint64_t, std::list<resident_tile>::iterator>::iterator found;
+    {
+        std::lock_guard<std::mutex> guard(s.lock);
+        found = s.resident.find(index);
+        if (found != s.resident.end()) {
+            s.lru.splice(s.lru.begin(), s.lru, found->second);
+            return found->second->texels;
+        }
+    }
+    std::shared_ptr<std::vector<unsigned char> > texels =
+        std::make_shared<std::vector<unsigned char> >(tile_bytes);
+    read_tile(index, &(*texels)[0]);
+    std::lock_guard<std::mutex> guard(s.lock);
+    // Another thread may have paged the same tile in meanwhile; then its copy is used.
+    found = s.resident.find(index);
+    if (found != s.resident.end()) {
+        s.lru.splice(s.lru.begin(), s.lru, found->second);
+        return found->second->texels;
+    }
+    if (s.resident.size() >= s.budget) {
+        s.resident.erase(s.lru.back().key);
+        s.lru.pop_back();
+    }
+    s.lru.push_front(resident_tile());
+    s.lru.front().key = index;
+    s.lru.front().texels = texels;
+    s.resident[index] = s.lru.begin();
+    s.reads++;
+    return texels;
+}
+
+// The pointer is good until the calling thread's next lookup.
+const unsigned char *texture_cache::tile(size_t index) {
+    view_entry& e = thread_view()[index % view_size];
+    if (e.cache_id != id || e.index != index) {
+        e.texels = shard_tile(index);
+        e.cache_id = id;
+        e.index = index;
+    }
+    return &(*e.texels)[0];
+}
+
+void texture_cache::texel(const level_info& l, int x, int y, float rgb[3]) {
+    if (x < 0) x = 0;
+    if (y < 0) y = 0;
+    if (x > l.nx-1) x = l.nx-1;
+    if (y > l.ny-1) y = l.ny-1;
+    const unsigned char *t = tile(l.first_tile + size_t(y / tile_size) * l.tiles_x + x / tile_size);
+    const unsigned char *c = t + 3*((y % tile_size)*tile_size + x % tile_size);
+    for (int i = 0; i < 3; i++)
+        rgb[i] = c[i] * (1.0f / 255.0f);
+}
+
+void texture_cache::lookup_level(const level_info& l, float u, float v, float rgb[3]) {
+    float x = u*l.nx - 0.5f;
+    float y = (1-v)*l.ny - 0.5f;
+    float fx = floorf(x), fy = floorf(y);
+    int x0 = int(fx), y0 = int(fy);
+    float wx = x - fx, wy = y - fy;
+    float c00[3], c10[3], c01[3], c11[3];
+    texel(l, x0, y0, c00);
+    texel(l, x0+1, y0, c10);
+    texel(l, x0, y0+1, c01);
+    texel(l, x0+1, y0+1, c11);
+    for (int i = 0; i < 3; i++)
+        rgb[i] = (1-wy)*((1-wx)*c00[i] + wx*c10[i]) + wy*((1-wx)*c01[i] + wx*c11[i]);
+}
+
+// Lookups are counted with relaxed order; the count is only read for -stats, after the render.
+void texture_cache::bilinear(int id, int level, float u, float v, float rgb[3]) {
+    const std::vector<level_info>& pyramid = filled(id);
+    fetches.fetch_add(1, std::memory_order_relaxed);
+    lookup_level(pyramid[level], u, v, rgb);
+}
+
+void texture_cache::trilinear(int id, float u, float v, float width, float rgb[3]) {
+    const std::vector<level_info>& pyramid = filled(id);
+    float texels = width * pyramid[0].ny;
+    float lod = texels > 1 ? log2f(texels) : 0;
+    int last = int(pyramid.size()) - 1;
+    fetches.fetch_add(1, std::memory_order_relaxed);
+    if (lod >= last) {
+        lookup_level(pyramid[last], u, v, rgb);
+        return;
+    }
+    int l0 = int(lod);
+    float w = lod - l0;
+    lookup_level(pyramid[l0], u, v, rgb);
+    if (w > 0) {
+        float next[3];
+        lookup_level(pyramid[l0+1], u, v, next);
+        for (int i = 0; i < 3; i++)
+            rgb[i] = (1-w)*rgb[i] + w*next[i];
+    }
+}
+
+#endif
@@ -0,0 +1,278 @@
+#ifndef TILESCHEDULERH
+#define TILESCHEDULERH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include "trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+
+// A tile covers the pixels [x0,x1) x [y0,y1). The index is its position in the full tile grid, and
+// does not depend on which thread renders it, so it can be used to seed per-tile state.
+struct tile {
+    int x0, y0, x1, y1;
+    int index;
+};
+
+// The order tiles are started in. Scanline goes along the rows from the top. Morton and Hilbert
+// follow those curves over the tile grid, so that tiles started one after another are near each
+// other and see much the same part of the scene. Focus starts with the tiles in the focus region
+// (the middle of the image, unless one is given) and works outwards from there.
+enum tile_order { tile_order_scanline, tile_order_morton, tile_order_hilbert, tile_order_focus };
+
+inline int default_thread_count() {
+    unsigned int n = std::thread::hardware_concurrency();
+    return n > 0 ? int(n) : 1;
+}
+
+
+// Each worker owns a queue of tiles. The owner takes work from the back of its own queue, and a
+// worker that runs dry steals from the front of another worker's queue.
+class tile_queue {
+    public:
+        void push(const tile& t) {
+            std::lock_guard<std::mutex> lock(m);
+            q.push_back(t);
+        }
+        bool pop(tile& t) {
+            std::lock_guard<std::mutex> lock(m);
+            if (q.empty())
+                return false;
+            t = q.back();
+            q.pop_back();
+            return true;
+        }
+        bool steal(tile& t) {
+            std::lock_guard<std::mutex> lock(m);
+            if (q.empty())
+                return false;
+            t = q.front();
+            q.pop_front();
+            return true;
+        }
+
+    private:
+        std::mutex m;
+        std::deque<tile> q;
+};
+
+
+class tile_scheduler {
+    public:
+        tile_scheduler(int nx, int ny, int tile_size, int num_threads,
+                       tile_order order = tile_order_scanline);
+
+        // Orders the tiles by tile_order_focus around the pixels [x0,x1) x [y0,y1): the tiles
+        // that overlap them come first, nearest their middle first, then the rest by how far
+        // they are from the region.
+        void focus(int x0, int y0, int x1, int y1);
+
+        // Calls render_tile(t) once for every tile, spread across the worker threads. Returns when
+        // all tiles are done. With a single thread the tiles are rendered on the calling thread.
+        // Each call renders every tile again, so a progressive render can run one pass per call.
+        // Returns false if cancel() stopped it before every tile was started.
+        template <typename F> bool run(F render_tile);
+
+        // Stops the run in progress, and any after it, from starting more tiles. Tiles already
+        // started are finished. It may be called from any thread, and from a signal handler.
+        void cancel() { cancelled = true; }
+        bool was_cancelled() const { return cancelled; }
+
+        // Called with the worker's number, 0 being the calling thread, as each worker of a run
+        // starts, before it renders any tile; used to pin workers to CPUs.
+        void on_worker_start(const std::function<void(int)>& f) { worker_start = f; }
+
+        int thread_count() const { return int(queues.size()); }
+        // The tiles in the order they are started.
+        const std::vector<tile>& tiles() const { return all_tiles; }
+
+    private:
+        void sort_tiles(int nx, int ny, int tile_size, tile_order order, int fx0, int fy0,
+                        int fx1, int fy1);
+        void deal();
+        template <typename F> void work(int id, F& render_tile);
+
+        std::vector<tile> all_tiles;
+        std::deque<tile_queue> queues;
+        int width, height, size;
+        tile_order ordering;
+        std::atomic<bool> cancelled;
+        std::function<void(int)> worker_start;
+};
+
+
+// Where the tile at column x and row y of a grid n tiles on a side, n a power of two, comes on
+// the Morton and Hilbert curves.
+inline uint64_t morton_index(uint32_t x, uint32_t y) {
+    uint64_t d = 0;
+    for (int b = 0; b < 32; b++)
+        d |= uint64_t((x >> b) & 1) << (2*b) | uint64_t((y >> b) & 1) << (2*b + 1);
+    return d;
+}
+
+inline uint64_t hilbert_index(uint32_t n, uint32_t x, uint32_t y) {
+    uint64_t d = 0;
+    for (uint32_t s = n / 2; s > 0; s /= 2) {
+        uint32_t rx = (x & s) > 0, ry = (y & s) > 0;
+        d += uint64_t(s) * s * ((3 * rx) ^ ry);
+        // Rotates the quadrant so that the curve within it runs the standard way.
+        if (ry == 0) {
+            if (rx == 1) {
+                x = n - 1 - x;
+                y = n - 1 - y;
+            }
+            uint32_t t = x;
+            x = y;
+            y = t;
+        }
+    }
+    return d;
+}
+
+
+tile_scheduler::tile_scheduler(int nx, int ny, int tile_size, int num_threads, tile_order order)
+    : cancelled(false) {
+    if (tile_size < 1) tile_size = 1;
+    if (num_threads < 1) num_threads = 1;
+    width = nx;
+    height = ny;
+    size = tile_size;
+
+    // Tiles are listed top row first, to match the order the image is written out.
+    int index = 0;
+    for (int y1 = ny; y1 > 0; y1 -= tile_size) {
+        for (int x0 = 0; x0 < nx; x0 += tile_size) {
+            tile t = tile();
+            t.x0 = x0;
+            t.x1 = x0 + tile_size < nx ? x0 + tile_size : nx;
+            t.y1 = y1;
+            t.y0 = y1 - tile_size > 0 ? y1 - tile_size : 0;
+            t.index = index++;
+            all_tiles.push_back(t);
+        }
+    }
+    queues.resize(num_threads);
+    sort_tiles(nx, ny, tile_size, order, nx/2, ny/2, nx/2, ny/2);
+}
+
+void tile_scheduler::focus(int x0, int y0, int x1, int y1) {
+    sort_tiles(width, height, size, tile_order_focus, x0, y0, x1, y1);
+}
+
+void tile_scheduler::sort_tiles(int nx, int ny, int tile_size, tile_order order, int fx0, int fy0,
+                                int fx1, int fy1) {
+    ordering = order;
+    // Each tile's key puts it in its place; the index, which is the scanline order, breaks ties.
+    uint32_t columns = uint32_t((nx + tile_size - 1) / tile_size);
+    uint32_t rows = uint32_t((ny + tile_size - 1) / tile_size);
+    uint32_t n = 1;
+    while (n < columns || n < rows)
+        n *= 2;
+    std::vector<std::pair<uint64_t, tile> > keyed(all_tiles.size());
+    for (size_t k = 0; k < all_tiles.size(); k++) {
+        const tile& t = all_tiles[k];
+        uint32_t column = uint32_t(t.x0 / tile_size), row = uint32_t(t.index / columns);
+        uint64_t key = uint64_t(t.index);
+        if (order == tile_order_morton)
+            key = morton_index(column, row);
+        else if (order == tile_order_hilbert)
+            key = hilbert_index(n, column, row);
+        else if (order == tile_order_focus) {
+            // Twice the distances, in pixels, from the tile's middle to the region and to the
+            // region's middle; the first counts for far more than the second.
+            int cx = t.x0 + t.x1, cy = t.y0 + t.y1;
+            long long dx = cx < 2*fx0 ? 2*fx0 - cx : cx > 2*fx1 ? cx - 2*fx1 : 0;
+            long long dy = cy < 2*fy0 ? 2*fy0 - cy : cy > 2*fy1 ? cy - 2*fy1 : 0;
+            // A tile overlapping the region counts as in it.
+            if (t.x1 > fx0 && t.x0 < fx1 && t.y1 > fy0 && t.y0 < fy1)
+                dx = dy = 0;
+            long long ex = cx - (fx0 + fx1), ey = cy - (fy0 + fy1);
+            key = uint64_t(dx*dx + dy*dy) << 32 | uint64_t(ex*ex + ey*ey);
+        }
+        keyed[k] = std::make_pair(key, t);
+    }
+    std::stable_sort(keyed.begin(), keyed.end(),
+                     [](const std::pair<uint64_t, tile>& a, const std::pair<uint64_t, tile>& b) {
+                         return a.first < b.first;
+                     });
+    for (size_t k = 0; k < keyed.size(); k++)
+        all_tiles[k] = keyed[k].second;
+}
+
+void tile_scheduler::deal() {
+    int n = int(all_tiles.size());
+    if (ordering == tile_order_focus) {
+        // Deal the tiles round, so that at any moment the workers are on the tiles that come
+        // first between them.
+        for (int i = n-1; i >= 0; i--)
+            queues[i % thread_count()].push(all_tiles[i]);
+        return;
+    }
+    // Deal each worker a contiguous run of tiles, so that neighbouring tiles (and the parts of the
+    // scene they see) tend to stay on one thread until stealing kicks in.
+    for (int w = 0; w < thread_count(); w++) {
+        int begin = int((long long)(n) * w / thread_count());
+        int end = int((long long)(n) * (w+1) / thread_count());
+        for (int i = end-1; i >= begin; i--)
+            queues[w].push(all_tiles[i]);
+    }
+}
+
+template <typename F>
+void tile_scheduler::work(int id, F& render_tile) {
+    if (worker_start)
+        worker_start(id);
+    if (id > 0)
+        trace_name_thread("tile worker " + std::to_string(id));
+    tile t = tile();
+    while (!cancelled) {
+        if (queues[id].pop(t)) {
+            trace_zone zone("tile", "index", t.index);
+            render_tile(t);
+            continue;
+        }
+        bool stole = false;
+        for (int k = 1; k < thread_count() && !stole; k++)
+            stole = queues[(id + k) % thread_count()].steal(t);
+        if (!stole)
+            return;
+        trace_zone zone("stolen tile", "index", t.index);
+        render_tile(t);
+    }
+}
+
+template <typename F>
+bool tile_scheduler::run(F render_tile) {
+    deal();
+    std::vector<std::thread> workers;
+    for (int id = 1; id < thread_count(); id++)
+        workers.push_back(std::thread([this, id, &render_tile]() { work(id, render_tile); }));
+    work(0, render_tile);
+    for (size_t i = 0; i < workers.size(); i++)
+        workers[i].join();
+    if (!cancelled)
+        return true;
+    // Tiles a cancelled run never started are dropped, so the next run deals afresh.
+    tile t = tile();
+    for (int id = 0; id < thread_count(); id++)
+        while (queues[id].pop(t)) {}
+    return false;
+}
+
+#endif
@@ -0,0 +1,199 @@
+#ifndef TRACEH
+#define TRACEH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <string>
+#include <vector>
+#if defined(RT_ITT)
+#include <ittnotify.h>
+#endif
+#if defined(RT_TRACY)
+#include <string.h>
+#include <tracy/TracyC.h>
+#endif
+
+
+// A timeline of what each thread spends its time on: scene and BVH builds, texture loads, tiles,
+// output. Each trace_zone covers the scope it is declared in. Once trace_start() is called the
+// zones are recorded, each thread into a buffer of its own, and trace_write() saves them as the
+// Chrome trace_event JSON that chrome://tracing and Perfetto (ui.perfetto.dev) open, one track per
+// thread, so gaps where workers wait on a serial step or on each other show up. Until then a zone
+// costs one relaxed load of a flag, which at these granularities is nothing.
+//
+// Building with RT_ITT defined also marks the zones as ITT tasks, which VTune shows on its
+// timeline; with RT_TRACY defined, and Tracy 0.10 or later built with TRACY_ENABLE, they are
+// Tracy zones too. Both are on whether or not trace_start() was called, and need their libraries
+// linked in.
+
+struct trace_event {
+    const char *name;       // a string literal, as are arg_name and every name passed below
+    const char *arg_name;   // 0 when the zone has no argument
+    long long arg;
+    double start_us, duration_us;
+};
+
+struct trace_thread {
+    int tid;
+    std::string name;
+    std::vector<trace_event> events;
+};
+
+struct trace_state {
+    trace_state() : on(false) {}
+    ~trace_state() {
+        for (size_t i = 0; i < threads.size(); i++)
+            delete threads[i];
+    }
+
+    std::atomic<bool> on;
+    std::chrono::steady_clock::time_point start;
+    // Buffers outlive their threads, whose events are written after they have been joined.
+    std::mutex lock;
+    std::vector<trace_thread*> threads;
+};
+
+inline trace_state& trace_global() {
+    static trace_state state;
+    return state;
+}
+
+inline bool trace_enabled() { return trace_global().on.load(std::memory_order_relaxed); }
+
+// The calling thread's buffer, made the first time it records anything.
+inline trace_thread& trace_this_thread() {
+    static thread_local trace_thread *mine = 0;
+    if (!mine) {
+        trace_state& g = trace_global();
+        std::lock_guard<std::mutex> guard(g.lock);
+        mine = new trace_thread;
+        mine->tid = int(g.threads.size()) + 1;
+        mine->name = "thread " + std::to_string(mine->tid);
+        g.threads.push_back(mine);
+    }
+    return *mine;
+}
+
+inline double trace_now_us() {
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now()
+                                                     - trace_global().start).count();
+}
+
+// Starts recording. The calling thread is named main.
+inline void trace_start() {
+    trace_state& g = trace_global();
+    g.start = std::chrono::steady_clock::now();
+    trace_this_thread().name = "main";
+    g.on = true;
+}
+
+// Names the calling thread's track in the trace, e.g. "tile worker 3". Does nothing while the
+// trace is off.
+inline void trace_name_thread(const std::string& name) {
+    if (trace_enabled())
+        trace_this_thread().name = name;
+}
+
+
+class trace_zone {
+    public:
+        explicit trace_zone(const char *zone_name, const char *arg_name = 0, long long arg = 0);
+        ~trace_zone() { end(); }
+
+        // Ends the zone before the end of its scope. Later calls do nothing.
+        void end();
+
+    private:
+        trace_zone(const trace_zone&);
+        trace_zone& operator=(const trace_zone&);
+
+        trace_event event;
+        bool open, recording;
+#if defined(RT_TRACY)
+        TracyCZoneCtx tracy_ctx;
+#endif
+};
+
+
+#if defined(RT_ITT)
+inline __itt_domain *trace_itt_domain() {
+    static __itt_domain *domain = __itt_domain_create("rtweekend");
+    return domain;
+}
+#endif
+
+inline trace_zone::trace_zone(const char *zone_name, const char *arg_name, long long arg)
+    : open(true), recording(trace_enabled()) {
+    event.name = zone_name;
+    event.arg_name = arg_name;
+    event.arg = arg;
+#if defined(RT_ITT)
+    __itt_task_begin(trace_itt_domain(), __itt_null, __itt_null,
+                     __itt_string_handle_create(zone_name));
+#endif
+#if defined(RT_TRACY)
+    uint64_t srcloc = ___tracy_alloc_srcloc_name(0, "", 0, "", 0, zone_name, strlen(zone_name),
+                                                 0);
+    tracy_ctx = ___tracy_emit_zone_begin_alloc(srcloc, 1);
+#endif
+    if (recording)
+        event.start_us = trace_now_us();
+}
+
+inline void trace_zone::end() {
+    if (!open)
+        return;
+    open = false;
+    if (recording) {
+        event.duration_us = trace_now_us() - event.start_us;
+        trace_this_thread().events.push_back(event);
+    }
+#if defined(RT_TRACY)
+    ___tracy_emit_zone_end(tracy_ctx);
+#endif
+#if defined(RT_ITT)
+    __itt_task_end(trace_itt_domain());
+#endif
+}
+
+
+// Writes every zone recorded so far to path as Chrome trace_event JSON. Call it once the threads
+// that recorded zones are done. Returns false if the file cannot be written.
+inline bool trace_write(const char *path) {
+    trace_state& g = trace_global();
+    std::ofstream out(path);
+    out << std::fixed << std::setprecision(3) << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+    std::lock_guard<std::mutex> guard(g.lock);
+    const char *comma = "\n";
+    for (size_t i = 0; i < g.threads.size(); i++) {
+        const trace_thread& t = *g.threads[i];
+        out << comma << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << t.tid
+            << ", \"args\": {\"name\": \"" << t.name << "\"}}";
+        comma = ",\n";
+        for (size_t k = 0; k < t.events.size(); k++) {
+            const trace_event& e = t.events[k];
+            out << comma << "{\"name\": \"" << e.name << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": "
+                << t.tid << ", \"ts\": " << e.start_us << ", \"dur\": " << e.duration_us;
+            if (e.arg_name)
+                out << ", \"args\": {\"" << e.arg_name << "\": " << e.arg << "}";
+            out << "}";
+        }
+    }
+    out << "\n]}\n";
+    return bool(out);
+}
+
+#endif
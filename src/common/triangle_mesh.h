@@ -0,0 +1,415 @@
+#ifndef TRIANGLEMESHH
+#define TRIANGLEMESHH
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include "hittable.h"
+#include "linear_bvh.h"
+#include "mesh_io.h"
+#include "render_stats.h"
+
+#include <algorithm>
+#include <float.h>
+#include <math.h>
+#include <utility>
+#include <vector>
+
+
+// A whole indexed mesh as one hittable. The triangles are not separate objects: the mesh keeps
+// the vertex and index arrays, and its own BVH over the triangles' bounds, with the index array
+// reordered so that each leaf's triangles are contiguous.
+class triangle_mesh : public hittable {
+    public:
+        // Takes over the mesh's arrays.
+        triangle_mesh(mesh_data&& m, material *mat, int max_leaf_size = 4);
+        // A mesh whose tree was built before, such as one read back from disk: m's index array
+        // must already be in the order the nodes expect.
+        triangle_mesh(mesh_data&& m, std::vector<linear_bvh_node>&& built, material *mat)
+            : mesh(std::move(m)), mat_ptr(mat), nodes(std::move(built)) {}
+        virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+        virtual bool bounding_box(float t0, float t1, aabb& box) const;
+        virtual bool occluded(const ray& r, float t_min, float t_max) const;
+        virtual bool intersect(const ray& r, float t_min, float t_max, hit_record& rec) const;
+        virtual void finalize(const ray& r, hit_record& rec) const;
+
+        size_t triangle_count() const { return mesh.triangle_count(); }
+
+        mesh_data mesh;
+        material *mat_ptr;
+        std::vector<linear_bvh_node> nodes;
+
+    private:
+        struct build_tri {
+            float bmin[3], bmax[3];
+            float centroid[3];
+            uint32_t tri;
+        };
+
+        int build(std::vector<build_tri>& info, int begin, int end, int depth, int max_leaf_size);
+        static void ray_shear(const vec3& d, int k[3], float shear[3]);
+        // Sets t, and the barycentric coordinates b of the hit when b is not null.
+        bool hit_triangle(const ray& r, size_t tri, const int k[3], const float shear[3],
+                          float t_min, float t_max, float& t, float *b = 0) const;
+        vec3 vertex(uint32_t i) const {
+            return vec3(mesh.positions[3*i], mesh.positions[3*i+1], mesh.positions[3*i+2]);
+        }
+};
+
+
+triangle_mesh::triangle_mesh(mesh_data&& m, material *mat, int max_leaf_size)
+    : mesh(std::move(m)), mat_ptr(mat) {
+    if (max_leaf_size < 1) max_leaf_size = 1;
+    size_t n = mesh.triangle_count();
+    std::vector<build_tri> info(n);
+    for (size_t t = 0; t < n; t++) {
+        for (int a = 0; a < 3; a++) {
+            float p0 = mesh.positions[3*mesh.indices[3*t] + a];
+            float p1 = mesh.positions[3*mesh.indices[3*t+1] + a];
+            float p2 = mesh.positions[3*mesh.indices[3*t+2] + a];
+            // Padded a little, so a triangle lying in an axis plane still has a box with volume,
+            // and rounding in the box test can't cull a ray that grazes its edge.
+            float lo = ffmin(p0, ffmin(p1, p2)), hi = ffmax(p0, ffmax(p1, p2));
+            float pad = 1e-5f*(fabs(lo) + fabs(hi)) + 1e-6f;
+            info[t].bmin[a] = lo - pad;
+            info[t].bmax[a] = hi + pad;
+            info[t].centroid[a] = 0.5f*(info[t].bmin[a] + info[t].bmax[a]);
+        }
+        info[t].tri = uint32_t(t);
+    }
+    nodes.reserve(n > 0 ? 2*n - 1 : 0);
+    if (n > 0)
+        build(info, 0, int(n), 0, max_leaf_size);
+
+    std::vector<uint32_t> ordered(mesh.indices.size());
+    for (size_t t = 0; t < n; t++)
+        for (int c = 0; c < 3; c++)
+            ordered[3*t + c] = mesh.indices[3*info[t].tri + c];
+    mesh.indices.swap(ordered);
+}
+
+int triangle_mesh::build(std::vector<build_tri>& info, int begin, int end, int depth,
+                         int max_leaf_size) {
+    linear_bvh_node node;
+    float cmin[3], cmax[3];
+    for (int a = 0; a < 3; a++) {
+        node.bmin[a] = info[begin].bmin[a];
+        node.bmax[a] = info[begin].bmax[a];
+        cmin[a] = cmax[a] = info[begin].centroid[a];
+    }
+    for (int i = begin+1; i < end; i++) {
+        for (int a = 0; a < 3; a++) {
+            node.bmin[a] = ffmin(node.bmin[a], info[i].bmin[a]);
+            node.bmax[a] = ffmax(node.bmax[a], info[i].bmax[a]);
+            cmin[a] = ffmin(cmin[a], info[i].centroid[a]);
+            cmax[a] = ffmax(cmax[a], info[i].centroid[a]);
+        }
+    }
+    node.pad = 0;
+    int index = int(nodes.size());
+    nodes.push_back(node);
+
+    int n = end - begin;
+    int axis = 0;
+    for (int a = 1; a < 3; a++)
+        if (cmax[a] - cmin[a] > cmax[axis] - cmin[axis])
+            axis = a;
+    float extent = cmax[axis] - cmin[axis];
+    if (n <= max_leaf_size || (extent <= 0 && n <= 0xffff)) {
+        nodes[index].offset = begin;
+        nodes[index].count = uint16_t(n);
+        nodes[index].axis = 0;
+        return index;
+    }
+
+    // Binned SAH: sort the centroids into buckets along the widest axis and split at the bucket
+    // boundary with the least cost. Past a safe depth the split is at the median instead, which
+    // keeps the tree within the traversal stack.
+    const int nbins = 16;
+    int mid = begin + n/2;
+    if (depth < 48 && extent > 0) {
+        int count[nbins] = { 0 };
+        float bmin[nbins][3], bmax[nbins][3];
+        for (int b = 0; b < nbins; b++)
+            for (int a = 0; a < 3; a++) {
+                bmin[b][a] = FLT_MAX;
+                bmax[b][a] = -FLT_MAX;
+            }
+        float scale = nbins / extent;
+        for (int i = begin; i < end; i++) {
+            int b = std::min(nbins-1, int((info[i].centroid[axis] - cmin[axis]) * scale));
+            count[b]++;
+            for (int a = 0; a < 3; a++) {
+                bmin[b][a] = ffmin(bmin[b][a], info[i].bmin[a]);
+                bmax[b][a] = ffmax(bmax[b][a], info[i].bmax[a]);
+            }
+        }
+        // right_area[b] and right_count[b] describe buckets b..nbins-1.
+        float right_area[nbins];
+        int right_count[nbins];
+        float lo[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, hi[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+        int total = 0;
+        for (int b = nbins-1; b > 0; b--) {
+            for (int a = 0; a < 3; a++) {
+                lo[a] = ffmin(lo[a], bmin[b][a]);
+                hi[a] = ffmax(hi[a], bmax[b][a]);
+            }
+            total += count[b];
+            right_count[b] = total;
+            right_area[b] = total ? (hi[0]-lo[0])*(hi[1]-lo[1]) + (hi[1]-lo[1])*(hi[2]-lo[2])
+                                  + (hi[2]-lo[2])*(hi[0]-lo[0]) : 0;
+        }
+        for (int a = 0; a < 3; a++) {
+            lo[a] = FLT_MAX;
+            hi[a] = -FLT_MAX;
+        }
+        total = 0;
+        float best_cost = FLT_MAX;
+        int best_split = -1;
+        for (int b = 1; b < nbins; b++) {
+            for (int a = 0; a < 3; a++) {
+                lo[a] = ffmin(lo[a], bmin[b-1][a]);
+                hi[a] = ffmax(hi[a], bmax[b-1][a]);
+            }
+            total += count[b-1];
+            if (total == 0 || right_count[b] == 0)
+                continue;
+            float left_area = (hi[0]-lo[0])*(hi[1]-lo[1]) + (hi[1]-lo[1])*(hi[2]-lo[2])
+                            + (hi[2]-lo[2])*(hi[0]-lo[0]);
+            float cost = left_area*total + right_area[b]*right_count[b];
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_split = b;
+            }
+        }
+        if (best_split > 0) {
+            float c0 = cmin[axis];
+            build_tri *split = std::partition(&info[begin], &info[begin] + n,
+                [=](const build_tri& t) {
+                    return std::min(nbins-1, int((t.centroid[axis] - c0) * scale)) < best_split;
+                });
+            mid = int(split - &info[0]);
+        }
+    }
+    if (mid == begin || mid == end || depth >= 48) {
+        mid = begin + n/2;
+        std::nth_element(info.begin() + begin, info.begin() + mid, info.begin() + end,
+                         [axis](const build_tri& a, const build_tri& b) {
+                             return a.centroid[axis] < b.centroid[axis];
+                         });
+    }
+    build(info, begin, mid, depth+1, max_leaf_size);
+    nodes[index].offset = build(info, mid, end, depth+1, max_leaf_size);
+    nodes[index].count = 0;
+    nodes[index].axis = uint8_t(axis);
+    return index;
+}
+
+bool triangle_mesh::bounding_box(float t0, float t1, aabb& b) const {
+    if (nodes.empty())
+        return false;
+    const linear_bvh_node& root = nodes[0];
+    b = aabb(vec3(root.bmin[0], root.bmin[1], root.bmin[2]),
+             vec3(root.bmax[0], root.bmax[1], root.bmax[2]));
+    return true;
+}
+
+// The shear that takes the ray direction d to +z, which is the same for every triangle.
+void triangle_mesh::ray_shear(const vec3& d, int k[3], float shear[3]) {
+    k[2] = fabs(d[0]) > fabs(d[1]) ? (fabs(d[0]) > fabs(d[2]) ? 0 : 2)
+                                   : (fabs(d[1]) > fabs(d[2]) ? 1 : 2);
+    k[0] = (k[2] + 1) % 3;
+    k[1] = (k[0] + 1) % 3;
+    if (d[k[2]] < 0)
+        std::swap(k[0], k[1]);
+    shear[0] = d[k[0]] / d[k[2]];
+    shear[1] = d[k[1]] / d[k[2]];
+    shear[2] = 1.0f / d[k[2]];
+}
+
+// Woop, Benthin and Wald, "Watertight Ray/Triangle Intersection": the triangle is moved into a
+// space where the ray runs along +z from the origin, and the hit test becomes 2D edge functions.
+// A ray through a shared edge or vertex hits at least one of the triangles, never neither.
+bool triangle_mesh::hit_triangle(const ray& r, size_t tri, const int k[3], const float shear[3],
+                                 float t_min, float t_max, float& t, float *b) const {
+    uint32_t i0 = mesh.indices[3*tri], i1 = mesh.indices[3*tri+1], i2 = mesh.indices[3*tri+2];
+    vec3 A = vertex(i0) - r.origin();
+    vec3 B = vertex(i1) - r.origin();
+    vec3 C = vertex(i2) - r.origin();
+    float ax = A[k[0]] - shear[0]*A[k[2]], ay = A[k[1]] - shear[1]*A[k[2]];
+    float bx = B[k[0]] - shear[0]*B[k[2]], by = B[k[1]] - shear[1]*B[k[2]];
+    float cx = C[k[0]] - shear[0]*C[k[2]], cy = C[k[1]] - shear[1]*C[k[2]];
+    float u = cx*by - cy*bx;
+    float v = ax*cy - ay*cx;
+    float w = bx*ay - by*ax;
+    // Exactly on an edge in float; settle it in double so the neighbouring triangle agrees.
+    if (u == 0 || v == 0 || w == 0) {
+        u = float(double(cx)*double(by) - double(cy)*double(bx));
+        v = float(double(ax)*double(cy) - double(ay)*double(cx));
+        w = float(double(bx)*double(ay) - double(by)*double(ax));
+    }
+    if ((u < 0 || v < 0 || w < 0) && (u > 0 || v > 0 || w > 0))
+        return false;
+    float det = u + v + w;
+    if (det == 0)
+        return false;
+    float s = (u*shear[2]*A[k[2]] + v*shear[2]*B[k[2]] + w*shear[2]*C[k[2]]) / det;
+    if (!(s > t_min && s < t_max))
+        return false;
+    t = s;
+    if (b) {
+        b[0] = u / det;
+        b[1] = v / det;
+        b[2] = w / det;
+    }
+    return true;
+}
+
+// Runs the one triangle's test again for its barycentric coordinates, which comes out exactly
+// as it did in the traversal.
+void triangle_mesh::finalize(const ray& r, hit_record& rec) const {
+    int k[3];
+    float shear[3];
+    ray_shear(r.direction(), k, shear);
+    size_t tri = size_t(rec.prim_id);
+    float t, b[3];
+    hit_triangle(r, tri, k, shear, -FLT_MAX, FLT_MAX, t, b);
+    uint32_t i0 = mesh.indices[3*tri], i1 = mesh.indices[3*tri+1], i2 = mesh.indices[3*tri+2];
+    float b0 = b[0], b1 = b[1], b2 = b[2];
+
+    // The point is made from the corners, as the barycentric coordinates weight them, rather
+    // than from the ray: its error then depends on the triangle's size and place, not on how
+    // far the ray came.
+    vec3 p0 = vertex(i0), p1 = vertex(i1), p2 = vertex(i2);
+    rec.p = b0*p0 + b1*p1 + b2*p2;
+    vec3 size;
+    for (int a = 0; a < 3; a++)
+        size[a] = fabsf(b0*p0[a]) + fabsf(b1*p1[a]) + fabsf(b2*p2[a]);
+    rec.p_error = point_error(max_abs(size));
+    if (!mesh.normals.empty()) {
+        vec3 n0(mesh.normals[3*i0], mesh.normals[3*i0+1], mesh.normals[3*i0+2]);
+        vec3 n1(mesh.normals[3*i1], mesh.normals[3*i1+1], mesh.normals[3*i1+2]);
+        vec3 n2(mesh.normals[3*i2], mesh.normals[3*i2+1], mesh.normals[3*i2+2]);
+        rec.normal = unit_vector(b0*n0 + b1*n1 + b2*n2);
+    }
+    else {
+        vec3 A = vertex(i0) - r.origin();
+        vec3 B = vertex(i1) - r.origin();
+        vec3 C = vertex(i2) - r.origin();
+        rec.normal = unit_vector(cross(B - A, C - A));
+    }
+    if (!mesh.texcoords.empty()) {
+        rec.u = b0*mesh.texcoords[2*i0] + b1*mesh.texcoords[2*i1] + b2*mesh.texcoords[2*i2];
+        rec.v = b0*mesh.texcoords[2*i0+1] + b1*mesh.texcoords[2*i1+1] + b2*mesh.texcoords[2*i2+1];
+    }
+    else {
+        rec.u = b1;
+        rec.v = b2;
+    }
+    rec.mat_ptr = mat_ptr;
+}
+
+bool triangle_mesh::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+    if (!intersect(r, t_min, t_max, rec))
+        return false;
+    finalize(r, rec);
+    return true;
+}
+
+bool triangle_mesh::intersect(const ray& r, float t_min, float t_max, hit_record& rec) const {
+    if (nodes.empty())
+        return false;
+
+    vec3 d = r.direction();
+    int k[3];
+    float shear[3];
+    ray_shear(d, k, shear);
+
+    int stack[64];
+    int stack_size = 0;
+    int current = 0;
+    bool hit_anything = false;
+    for (;;) {
+        const linear_bvh_node& node = nodes[current];
+        RT_COUNT(node_visits, 1);
+        if (slab_hit(node.bmin, node.bmax, r, t_min, t_max)) {
+            if (node.count > 0) {
+                RT_COUNT(primitive_tests, node.count);
+                for (int i = 0; i < node.count; i++) {
+                    if (hit_triangle(r, node.offset + i, k, shear, t_min, t_max, rec.t)) {
+                        hit_anything = true;
+                        t_max = rec.t;
+                        rec.prim = this;
+                        rec.prim_id = node.offset + i;
+                    }
+                }
+                if (stack_size == 0)
+                    break;
+                current = stack[--stack_size];
+            }
+            else if (r.sign(node.axis)) {
+                stack[stack_size++] = current + 1;
+                current = node.offset;
+            }
+            else {
+                stack[stack_size++] = node.offset;
+                current = current + 1;
+            }
+        }
+        else {
+            if (stack_size == 0)
+                break;
+            current = stack[--stack_size];
+        }
+    }
+    return hit_anything;
+}
+
+bool triangle_mesh::occluded(const ray& r, float t_min, float t_max) const {
+    if (nodes.empty())
+        return false;
+
+    vec3 d = r.direction();
+    int k[3];
+    float shear[3];
+    ray_shear(d, k, shear);
+    float t;
+
+    int stack[64];
+    int stack_size = 0;
+    int current = 0;
+    for (;;) {
+        const linear_bvh_node& node = nodes[current];
+        RT_COUNT(node_visits, 1);
+        if (slab_hit(node.bmin, node.bmax, r, t_min, t_max)) {
+            if (node.count > 0) {
+                RT_COUNT(primitive_tests, node.count);
+                for (int i = 0; i < node.count; i++)
+                    if (hit_triangle(r, node.offset + i, k, shear, t_min, t_max, t))
+                        return true;
+                if (stack_size == 0)
+                    break;
+                current = stack[--stack_size];
+            }
+            else {
+                stack[stack_size++] = node.offset;
+                current = current + 1;
+            }
+        }
+        else {
+            if (stack_size == 0)
+                break;
+            current = stack[--stack_size];
+        }
+    }
+    return false;
+}
+
+#endif
@@ -0,0 +1,315 @@
+#ifndef VEC3H
+#define VEC3H
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+#include <iostream>
+#include <math.h>
+#include <stdlib.h>
+
+// Building with RT_SIMD_VEC3 defined keeps each vec3 in one 16-byte SSE or NEON register, with a
+// fourth, unused lane. The arithmetic, dot and cross then take a few vector instructions instead
+// of three scalar ones each, and give the same results bit for bit: every lane does the operation
+// the scalar code would, and dot adds its products in the same order. Adding RT_FAST_RSQRT makes
+// unit_vector() and make_unit_vector() use the hardware reciprocal square root estimate, refined
+// by one Newton step, in place of a square root and a division; that is accurate to about 1e-7
+// but no longer matches the scalar build exactly. Files and mapped caches never hold vec3s, so
+// both layouts read the same data.
+#if defined(RT_SIMD_VEC3)
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define VEC3_SSE
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define VEC3_NEON
+#endif
+#endif
+
+
+#if defined(VEC3_SSE) || defined(VEC3_NEON)
+
+#if defined(VEC3_SSE)
+typedef __m128 vec3_lanes;
+inline vec3_lanes vec3_make(float a, float b, float c) { return _mm_setr_ps(a, b, c, 0); }
+inline vec3_lanes vec3_splat(float t) { return _mm_set1_ps(t); }
+inline vec3_lanes vec3_add(vec3_lanes a, vec3_lanes b) { return _mm_add_ps(a, b); }
+inline vec3_lanes vec3_sub(vec3_lanes a, vec3_lanes b) { return _mm_sub_ps(a, b); }
+inline vec3_lanes vec3_mul(vec3_lanes a, vec3_lanes b) { return _mm_mul_ps(a, b); }
+inline vec3_lanes vec3_div(vec3_lanes a, vec3_lanes b) { return _mm_div_ps(a, b); }
+inline vec3_lanes vec3_neg(vec3_lanes a) { return _mm_xor_ps(a, _mm_set1_ps(-0.0f)); }
+// Lanes (y, z, x) and (z, x, y), for cross().
+inline vec3_lanes vec3_yzx(vec3_lanes a) { return _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1)); }
+inline vec3_lanes vec3_zxy(vec3_lanes a) { return _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 1, 0, 2)); }
+// (x + y) + z of the lanes of a, as the scalar dot adds them.
+inline float vec3_sum(vec3_lanes a) {
+    __m128 y = _mm_shuffle_ps(a, a, _MM_SHUFFLE(1, 1, 1, 1));
+    __m128 z = _mm_movehl_ps(a, a);
+    return _mm_cvtss_f32(_mm_add_ss(_mm_add_ss(a, y), z));
+}
+// An estimate of 1/sqrt(x) to 12 bits, refined by one Newton step to about 23.
+inline float vec3_rsqrt(float x) {
+    __m128 v = _mm_set_ss(x);
+    __m128 r = _mm_rsqrt_ss(v);
+    __m128 rr = _mm_mul_ss(r, r);
+    return _mm_cvtss_f32(_mm_mul_ss(_mm_mul_ss(_mm_set_ss(0.5f), r),
+                                    _mm_sub_ss(_mm_set_ss(3.0f), _mm_mul_ss(v, rr))));
+}
+#else
+typedef float32x4_t vec3_lanes;
+inline vec3_lanes vec3_make(float a, float b, float c) {
+    float v[4] = { a, b, c, 0 };
+    return vld1q_f32(v);
+}
+inline vec3_lanes vec3_splat(float t) { return vdupq_n_f32(t); }
+inline vec3_lanes vec3_add(vec3_lanes a, vec3_lanes b) { return vaddq_f32(a, b); }
+inline vec3_lanes vec3_sub(vec3_lanes a, vec3_lanes b) { return vsubq_f32(a, b); }
+inline vec3_lanes vec3_mul(vec3_lanes a, vec3_lanes b) { return vmulq_f32(a, b); }
+inline vec3_lanes vec3_div(vec3_lanes a, vec3_lanes b) {
+#if defined(__aarch64__) || defined(_M_ARM64)
+    return vdivq_f32(a, b);
+#else
+    float x[4], y[4];
+    vst1q_f32(x, a);
+    vst1q_f32(y, b);
+    return vec3_make(x[0]/y[0], x[1]/y[1], x[2]/y[2]);
+#endif
+}
+inline vec3_lanes vec3_neg(vec3_lanes a) { return vnegq_f32(a); }
+inline vec3_lanes vec3_yzx(vec3_lanes a) {
+    float32x4_t r = vextq_f32(a, a, 1);            // y z w x
+    return vsetq_lane_f32(vgetq_lane_f32(a, 3), vsetq_lane_f32(vgetq_lane_f32(a, 0), r, 2), 3);
+}
+inline vec3_lanes vec3_zxy(vec3_lanes a) {
+    float32x4_t r = vextq_f32(a, a, 2);            // z w x y
+    return vsetq_lane_f32(vgetq_lane_f32(a, 3),
+                          vsetq_lane_f32(vgetq_lane_f32(a, 1),
+                                         vsetq_lane_f32(vgetq_lane_f32(a, 0), r, 1), 2), 3);
+}
+inline float vec3_sum(vec3_lanes a) {
+    return (vgetq_lane_f32(a, 0) + vgetq_lane_f32(a, 1)) + vgetq_lane_f32(a, 2);
+}
+inline float vec3_rsqrt(float x) {
+    float32x2_t v = vdup_n_f32(x);
+    float32x2_t r = vrsqrte_f32(v);
+    r = vmul_f32(r, vrsqrts_f32(vmul_f32(v, r), r));
+    return vget_lane_f32(r, 0);
+}
+#endif
+
+class vec3 {
+    public:
+        vec3() {}
+        vec3(float e0, float e1, float e2) : m(vec3_make(e0, e1, e2)) {}
+        explicit vec3(vec3_lanes v) : m(v) {}
+        inline float x() const { return e[0]; }
+        inline float y() const { return e[1]; }
+        inline float z() const { return e[2]; }
+        inline float r() const { return e[0]; }
+        inline float g() const { return e[1]; }
+        inline float b() const { return e[2]; }
+
+        inline const vec3& operator+() const { return *this; }
+        inline vec3 operator-() const { return vec3(vec3_neg(m)); }
+        inline float operator[](int i) const { return e[i]; }
+        inline float& operator[](int i) { return e[i]; }
+
+        inline vec3& operator+=(const vec3 &v2) { m = vec3_add(m, v2.m); return *this; }
+        inline vec3& operator-=(const vec3 &v2) { m = vec3_sub(m, v2.m); return *this; }
+        inline vec3& operator*=(const vec3 &v2) { m = vec3_mul(m, v2.m); return *this; }
+        inline vec3& operator/=(const vec3 &v2) { m = vec3_div(m, v2.m); return *this; }
+        inline vec3& operator*=(const float t) { m = vec3_mul(m, vec3_splat(t)); return *this; }
+        inline vec3& operator/=(const float t) {
+            m = vec3_mul(m, vec3_splat(1.0f/t));
+            return *this;
+        }
+
+        inline float length() const { return sqrt(squared_length()); }
+        inline float squared_length() const { return vec3_sum(vec3_mul(m, m)); }
+        inline void make_unit_vector();
+
+        union {
+            float e[4];
+            vec3_lanes m;
+        };
+};
+
+inline vec3 operator+(const vec3 &v1, const vec3 &v2) { return vec3(vec3_add(v1.m, v2.m)); }
+inline vec3 operator-(const vec3 &v1, const vec3 &v2) { return vec3(vec3_sub(v1.m, v2.m)); }
+inline vec3 operator*(const vec3 &v1, const vec3 &v2) { return vec3(vec3_mul(v1.m, v2.m)); }
+inline vec3 operator/(const vec3 &v1, const vec3 &v2) { return vec3(vec3_div(v1.m, v2.m)); }
+inline vec3 operator*(float t, const vec3 &v) { return vec3(vec3_mul(vec3_splat(t), v.m)); }
+inline vec3 operator/(vec3 v, float t) { return vec3(vec3_div(v.m, vec3_splat(t))); }
+inline vec3 operator*(const vec3 &v, float t) { return vec3(vec3_mul(vec3_splat(t), v.m)); }
+
+inline float dot(const vec3 &v1, const vec3 &v2) { return vec3_sum(vec3_mul(v1.m, v2.m)); }
+
+inline vec3 cross(const vec3 &v1, const vec3 &v2) {
+    return vec3(vec3_sub(vec3_mul(vec3_yzx(v1.m), vec3_zxy(v2.m)),
+                         vec3_mul(vec3_zxy(v1.m), vec3_yzx(v2.m))));
+}
+
+inline void vec3::make_unit_vector() {
+#if defined(RT_FAST_RSQRT)
+    m = vec3_mul(m, vec3_splat(vec3_rsqrt(squared_length())));
+#else
+    m = vec3_mul(m, vec3_splat(1.0 / sqrt(squared_length())));
+#endif
+}
+
+inline vec3 unit_vector(vec3 v) {
+#if defined(RT_FAST_RSQRT)
+    return vec3(vec3_mul(v.m, vec3_splat(vec3_rsqrt(v.squared_length()))));
+#else
+    return v / v.length();
+#endif
+}
+
+#else
+
+class vec3 {
+    public:
+        vec3() {}
+        vec3(float e0, float e1, float e2) { e[0] = e0; e[1] = e1; e[2] = e2; }
+        inline float x() const { return e[0]; }
+        inline float y() const { return e[1]; }
+        inline float z() const { return e[2]; }
+        inline float r() const { return e[0]; }
+        inline float g() const { return e[1]; }
+        inline float b() const { return e[2]; }
+
+        inline const vec3& operator+() const { return *this; }
+        inline vec3 operator-() const { return vec3(-e[0], -e[1], -e[2]); }
+        inline float operator[](int i) const { return e[i]; }
+        inline float& operator[](int i) { return e[i]; }
+
+        inline vec3& operator+=(const vec3 &v2);
+        inline vec3& operator-=(const vec3 &v2);
+        inline vec3& operator*=(const vec3 &v2);
+        inline vec3& operator/=(const vec3 &v2);
+        inline vec3& operator*=(const float t);
+        inline vec3& operator/=(const float t);
+
+        inline float length() const { return sqrt(e[0]*e[0] + e[1]*e[1] + e[2]*e[2]); }
+        inline float squared_length() const { return e[0]*e[0] + e[1]*e[1] + e[2]*e[2]; }
+        inline void make_unit_vector();
+
+        float e[3];
+};
+
+
+inline void vec3::make_unit_vector() {
+    float k = 1.0 / sqrt(e[0]*e[0] + e[1]*e[1] + e[2]*e[2]);
+    e[0] *= k; e[1] *= k; e[2] *= k;
+}
+
+inline vec3 operator+(const vec3 &v1, const vec3 &v2) {
+    return vec3(v1.e[0] + v2.e[0], v1.e[1] + v2.e[1], v1.e[2] + v2.e[2]);
+}
+
+inline vec3 operator-(const vec3 &v1, const vec3 &v2) {
+    return vec3(v1.e[0] - v2.e[0], v1.e[1] - v2.e[1], v1.e[2] - v2.e[2]);
+}
+
+inline vec3 operator*(const vec3 &v1, const vec3 &v2) {
+    return vec3(v1.e[0] * v2.e[0], v1.e[1] * v2.e[1], v1.e[2] * v2.e[2]);
+}
+
+inline vec3 operator/(const vec3 &v1, const vec3 &v2) {
+    return vec3(v1.e[0] / v2.e[0], v1.e[1] / v2.e[1], v1.e[2] / v2.e[2]);
+}
+
+inline vec3 operator*(float t, const vec3 &v) {
+    return vec3(t*v.e[0], t*v.e[1], t*v.e[2]);
+}
+
+inline vec3 operator/(vec3 v, float t) {
+    return vec3(v.e[0]/t, v.e[1]/t, v.e[2]/t);
+}
+
+inline vec3 operator*(const vec3 &v, float t) {
+    return vec3(t*v.e[0], t*v.e[1], t*v.e[2]);
+}
+
+inline float dot(const vec3 &v1, const vec3 &v2) {
+    return v1.e[0] * v2.e[0]
+         + v1.e[1] * v2.e[1]
+         + v1.e[2] * v2.e[2];
+}
+
+inline vec3 cross(const vec3 &v1, const vec3 &v2) {
+    return vec3(v1.e[1] * v2.e[2] - v1.e[2] * v2.e[1],
+                v1.e[2] * v2.e[0] - v1.e[0] * v2.e[2],
+                v1.e[0] * v2.e[1] - v1.e[1] * v2.e[0]);
+}
+
+inline vec3& vec3::operator+=(const vec3 &v){
+    e[0] += v.e[0];
+    e[1] += v.e[1];
+    e[2] += v.e[2];
+    return *this;
+}
+
+inline vec3& vec3::operator*=(const vec3 &v){
+    e[0] *= v.e[0];
+    e[1] *= v.e[1];
+    e[2] *= v.e[2];
+    return *this;
+}
+
+inline vec3& vec3::operator/=(const vec3 &v){
+    e[0] /= v.e[0];
+    e[1] /= v.e[1];
+    e[2] /= v.e[2];
+    return *this;
+}
+
+inline vec3& vec3::operator-=(const vec3& v) {
+    e[0] -= v.e[0];
+    e[1] -= v.e[1];
+    e[2] -= v.e[2];
+    return *this;
+}
+
+inline vec3& vec3::operator*=(const float t) {
+    e[0] *= t;
+    e[1] *= t;
+    e[2] *= t;
+    return *this;
+}
+
+inline vec3& vec3::operator/=(const float t) {
+    float k = 1.0f/t;
+
+    e[0] *= k;
+    e[1] *= k;
+    e[2] *= k;
+    return *this;
+}
+
+inline vec3 unit_vector(vec3 v) {
+    return v / v.length();
+}
+
+#endif
+
+
+inline std::istream& operator>>(std::istream &is, vec3 &t) {
+    is >> t.e[0] >> t.e[1] >> t.e[2];
+    return is;
+}
+
+inline std::ostream& operator<<(std::ostream &os, const vec3 &t) {
+    os << t.e[0] << " " << t.e[1] << " " << t.e[2];
+    return os;
+}
+
+
+#endif